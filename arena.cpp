@@ -0,0 +1,205 @@
+#include "arena.h"
+#include <cstring>
+#include <functional>
+#include <new>
+
+using namespace std;
+
+namespace {
+
+// Finalizer from splitmix64: spreads sequential keys over the whole table
+uint64_t mix(uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+} // namespace
+
+// StringArena class methods implementation
+string_view StringArena::store(string_view text) {
+    if (text.empty()) {
+        return string_view();
+    }
+    if (text.size() > CHUNK_BYTES) {
+        // Oversized strings get a chunk of their own, slotted in before the open one
+        chunks.emplace_back(new char[text.size()]);
+        char* out = chunks.back().get();
+        memcpy(out, text.data(), text.size());
+        if (chunks.size() > 1) std::swap(chunks[chunks.size() - 1], chunks[chunks.size() - 2]);
+        totalBytes += text.size();
+        usedBytes += text.size();
+        return string_view(out, text.size());
+    }
+    if (text.size() > CHUNK_BYTES - chunkUsed) {
+        chunks.emplace_back(new char[CHUNK_BYTES]);
+        totalBytes += CHUNK_BYTES;
+        chunkUsed = 0;
+    }
+    char* out = chunks.back().get() + chunkUsed;
+    memcpy(out, text.data(), text.size());
+    chunkUsed += text.size();
+    usedBytes += text.size();
+    return string_view(out, text.size());
+}
+
+string_view StringArena::intern(string_view text) {
+    if (text.empty()) {
+        return string_view();
+    }
+    if ((internedCount + 1) * 4 > interned.size() * 3) {
+        growInterned();
+    }
+    size_t mask = interned.size() - 1;
+    for (size_t i = hash<string_view>()(text) & mask;; i = (i + 1) & mask) {
+        if (interned[i].data() == nullptr) {
+            interned[i] = store(text);
+            ++internedCount;
+            return interned[i];
+        }
+        if (interned[i] == text) {
+            return interned[i];
+        }
+    }
+}
+
+void StringArena::growInterned() {
+    vector<string_view> old(max<size_t>(64, interned.size() * 2));
+    old.swap(interned);
+    size_t mask = interned.size() - 1;
+    for (string_view text : old) {
+        if (text.data() == nullptr) continue;
+        size_t i = hash<string_view>()(text) & mask;
+        while (interned[i].data() != nullptr) i = (i + 1) & mask;
+        interned[i] = text;
+    }
+}
+
+void StringArena::clear() {
+    chunks.clear();
+    chunkUsed = CHUNK_BYTES;
+    totalBytes = 0;
+    usedBytes = 0;
+    interned.clear();
+    internedCount = 0;
+}
+
+void StringArena::swap(StringArena& other) {
+    chunks.swap(other.chunks);
+    std::swap(chunkUsed, other.chunkUsed);
+    std::swap(totalBytes, other.totalBytes);
+    std::swap(usedBytes, other.usedBytes);
+    interned.swap(other.interned);
+    std::swap(internedCount, other.internedCount);
+}
+
+size_t StringArena::bytes() const { return totalBytes; }
+size_t StringArena::used() const { return usedBytes; }
+
+// FlatIndex class methods implementation
+size_t FlatIndex::home(uint64_t key) const {
+    return mix(key) & (table.size() - 1);
+}
+
+size_t FlatIndex::find(uint64_t key) const {
+    if (table.empty()) {
+        return npos;
+    }
+    size_t mask = table.size() - 1;
+    for (size_t i = home(key);; i = (i + 1) & mask) {
+        if (table[i].key == key) return table[i].value;
+        if (table[i].key == EMPTY) return npos;
+    }
+}
+
+void FlatIndex::insert(uint64_t key, size_t value) {
+    if ((count + 1) * 8 > table.size() * 7) {
+        rehash(max<size_t>(16, table.size() * 2));
+    }
+    size_t mask = table.size() - 1;
+    for (size_t i = home(key);; i = (i + 1) & mask) {
+        if (table[i].key == EMPTY) {
+            table[i] = Entry{key, value};
+            ++count;
+            return;
+        }
+        if (table[i].key == key) {
+            table[i].value = value;
+            return;
+        }
+    }
+}
+
+bool FlatIndex::erase(uint64_t key) {
+    if (table.empty()) {
+        return false;
+    }
+    size_t mask = table.size() - 1;
+    size_t i = home(key);
+    while (table[i].key != key) {
+        if (table[i].key == EMPTY) return false;
+        i = (i + 1) & mask;
+    }
+    // Pull back every later entry of the run that may sit in the hole
+    for (size_t j = (i + 1) & mask; table[j].key != EMPTY; j = (j + 1) & mask) {
+        size_t want = home(table[j].key);
+        bool movable = i <= j ? (want <= i || want > j) : (want <= i && want > j);
+        if (movable) {
+            table[i] = table[j];
+            i = j;
+        }
+    }
+    table[i].key = EMPTY;
+    --count;
+    return true;
+}
+
+void FlatIndex::reserve(size_t wanted) {
+    size_t capacity = 16;
+    while (capacity * 7 < wanted * 8) capacity *= 2;
+    if (capacity > table.size()) {
+        rehash(capacity);
+    }
+}
+
+void FlatIndex::rehash(size_t capacity) {
+    vector<Entry> old(capacity, Entry{EMPTY, 0});
+    old.swap(table);
+    count = 0;
+    for (const Entry& entry : old) {
+        if (entry.key != EMPTY) insert(entry.key, entry.value);
+    }
+}
+
+// NodePool class methods implementation
+void* NodePool::allocate(size_t size) {
+    size_t rounded = (size + alignof(max_align_t) - 1) / alignof(max_align_t) * alignof(max_align_t);
+    if (blockSize == 0) {
+        blockSize = rounded;
+    }
+    if (rounded != blockSize) {
+        return ::operator new(size);
+    }
+    if (freeList) {
+        void* block = freeList;
+        freeList = *static_cast<void**>(block);
+        return block;
+    }
+    if (slabUsed == BLOCKS_PER_SLAB) {
+        slabs.emplace_back(new char[blockSize * BLOCKS_PER_SLAB]);
+        slabUsed = 0;
+    }
+    return slabs.back().get() + blockSize * slabUsed++;
+}
+
+void NodePool::deallocate(void* block, size_t size) {
+    size_t rounded = (size + alignof(max_align_t) - 1) / alignof(max_align_t) * alignof(max_align_t);
+    if (rounded != blockSize) {
+        ::operator delete(block);
+        return;
+    }
+    *static_cast<void**>(block) = freeList;
+    freeList = block;
+}
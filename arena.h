@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Append-only storage for the strings of stored accounts. Bytes are carved
+// out of 64 KiB chunks that never move, so a string_view into the arena
+// stays valid until clear(). intern() returns the existing copy of a string
+// stored before through intern(); store() always appends.
+class StringArena {
+public:
+    static const size_t CHUNK_BYTES = 64 * 1024;
+
+    StringArena() = default;
+    StringArena(const StringArena&) = delete;
+    StringArena& operator=(const StringArena&) = delete;
+
+    string_view store(string_view text);
+    string_view intern(string_view text);
+    void clear();
+    void swap(StringArena& other);
+
+    size_t bytes() const; // Held in chunks, used or not
+    size_t used() const;  // Handed out
+
+private:
+    vector<unique_ptr<char[]>> chunks;
+    size_t chunkUsed = CHUNK_BYTES; // Bytes used in the last chunk
+    size_t totalBytes = 0;
+    size_t usedBytes = 0;
+    // Open-addressing set of interned strings; an empty view marks a free slot
+    vector<string_view> interned;
+    size_t internedCount = 0;
+
+    void growInterned();
+};
+
+// Open-addressing hash index from a 64-bit key to a slot, with no allocation
+// per entry. Linear probing; erase shifts the following run back instead of
+// leaving tombstones.
+class FlatIndex {
+public:
+    static const size_t npos = static_cast<size_t>(-1);
+
+    size_t find(uint64_t key) const; // npos if absent
+    void insert(uint64_t key, size_t value); // Inserts or overwrites
+    bool erase(uint64_t key);
+    void reserve(size_t count);
+    size_t size() const { return count; }
+    size_t bytes() const { return table.capacity() * sizeof(Entry); }
+
+    template <typename Fn>
+    void forEach(Fn fn) const { // fn(key, value), in table order
+        for (const Entry& entry : table) {
+            if (entry.key != EMPTY) fn(entry.key, static_cast<size_t>(entry.value));
+        }
+    }
+
+private:
+    static const uint64_t EMPTY = UINT64_MAX; // Never a key: account numbers and phones are far smaller
+
+    struct Entry {
+        uint64_t key;
+        uint64_t value;
+    };
+    vector<Entry> table;
+    size_t count = 0;
+
+    size_t home(uint64_t key) const;
+    void rehash(size_t capacity);
+};
+
+// Fixed-size blocks carved from slabs with a free list, for node-based
+// containers that would otherwise allocate once per element. The block size
+// is fixed by the first allocation; any other size goes to operator new.
+class NodePool {
+public:
+    NodePool() = default;
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    void* allocate(size_t size);
+    void deallocate(void* block, size_t size);
+
+private:
+    static const size_t BLOCKS_PER_SLAB = 1024;
+
+    size_t blockSize = 0;
+    vector<unique_ptr<char[]>> slabs;
+    size_t slabUsed = BLOCKS_PER_SLAB;
+    void* freeList = nullptr;
+};
+
+// Standard allocator over a NodePool, for std::set and friends
+template <typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    explicit PoolAllocator(NodePool* pool) : pool(pool) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) : pool(other.pool) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(pool->allocate(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) { pool->deallocate(p, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const { return pool == other.pool; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const { return pool != other.pool; }
+
+private:
+    template <typename U>
+    friend class PoolAllocator;
+    NodePool* pool;
+};
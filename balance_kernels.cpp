@@ -0,0 +1,219 @@
+#include "balance_kernels.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BANK_HAVE_X86 1
+#endif
+
+using namespace std;
+
+namespace {
+
+const int64_t PPM = 1000000;
+
+// Balance and rate bounds for which the AVX2 lanes are exact: balance < 2^32
+// and ppm < 2^20 keep balance * ppm below 2^52, where int64 <-> double is exact.
+const int64_t SIMD_MAX_BALANCE = int64_t(1) << 32;
+const int64_t SIMD_MAX_PPM = int64_t(1) << 20;
+
+inline int64_t* raw(Money* balances) { return reinterpret_cast<int64_t*>(balances); }
+
+void interestScalar(int64_t* b, size_t begin, size_t end, int64_t ppm, RoundingMode mode, int64_t& affected, int64_t& total) {
+    for (size_t i = begin; i < end; ++i) {
+        if (b[i] <= 0) continue;
+        int64_t interest = Money::scaleRounded(b[i], ppm, PPM, mode);
+        if (interest > 0) {
+            b[i] += interest;
+            ++affected;
+            total += interest;
+        }
+    }
+}
+
+void serviceChargeScalar(int64_t* b, const unsigned char* live, size_t begin, size_t end, int64_t charge, int64_t& affected, int64_t& skipped) {
+    for (size_t i = begin; i < end; ++i) {
+        if (!live[i]) continue;
+        if (b[i] >= charge) {
+            b[i] -= charge;
+            ++affected;
+        } else {
+            ++skipped;
+        }
+    }
+}
+
+#ifdef BANK_HAVE_X86
+
+// Exact conversions for 0 <= x < 2^52 via the 2^52 exponent trick
+__attribute__((target("avx2"))) inline __m256d u52ToDouble(__m256i x) {
+    const __m256i magic = _mm256_set1_epi64x(0x4330000000000000LL);
+    return _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(x, magic)), _mm256_castsi256_pd(magic));
+}
+
+__attribute__((target("avx2"))) inline __m256i doubleToU52(__m256d x) {
+    const __m256d magic = _mm256_set1_pd(4503599627370496.0); // 2^52
+    return _mm256_xor_si256(_mm256_castpd_si256(_mm256_add_pd(x, magic)), _mm256_castpd_si256(magic));
+}
+
+__attribute__((target("avx2")))
+void interestAvx2(int64_t* b, size_t count, int64_t ppm, RoundingMode mode, int64_t& affected, int64_t& total) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i maxBalance = _mm256_set1_epi64x(SIMD_MAX_BALANCE - 1);
+    const __m256i rate = _mm256_set1_epi64x(ppm);
+    const __m256d denom = _mm256_set1_pd(double(PPM));
+    const __m256d half = _mm256_set1_pd(double(PPM) / 2);
+    const __m256d one = _mm256_set1_pd(1.0);
+    __m256i sum = zero;
+    __m256i hits = zero;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i bal = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        // Lanes above the exact range send the whole block to the scalar path
+        if (!_mm256_testz_si256(_mm256_cmpgt_epi64(bal, maxBalance), _mm256_cmpgt_epi64(bal, maxBalance))) {
+            int64_t a = 0, t = 0;
+            interestScalar(b, i, i + 4, ppm, mode, a, t);
+            affected += a;
+            total += t;
+            continue;
+        }
+        __m256i positive = _mm256_cmpgt_epi64(bal, zero);
+        __m256i safe = _mm256_and_si256(bal, positive); // Negative lanes earn nothing
+
+        // product = balance * ppm, exact in 64 bits since both fit in 32
+        __m256d p = u52ToDouble(_mm256_mul_epu32(safe, rate));
+        __m256d q = _mm256_floor_pd(_mm256_div_pd(p, denom));
+        __m256d r = _mm256_sub_pd(p, _mm256_mul_pd(q, denom));
+        // Correct a quotient that the division rounded across an integer
+        __m256d under = _mm256_cmp_pd(r, _mm256_setzero_pd(), _CMP_LT_OQ);
+        q = _mm256_sub_pd(q, _mm256_and_pd(under, one));
+        r = _mm256_add_pd(r, _mm256_and_pd(under, denom));
+        __m256d over = _mm256_cmp_pd(r, denom, _CMP_GE_OQ);
+        q = _mm256_add_pd(q, _mm256_and_pd(over, one));
+        r = _mm256_sub_pd(r, _mm256_and_pd(over, denom));
+
+        __m256d roundUp;
+        switch (mode) {
+            case RoundingMode::Down:
+                roundUp = _mm256_setzero_pd();
+                break;
+            case RoundingMode::Up:
+                roundUp = _mm256_cmp_pd(r, _mm256_setzero_pd(), _CMP_GT_OQ);
+                break;
+            case RoundingMode::HalfUp:
+                roundUp = _mm256_cmp_pd(r, half, _CMP_GE_OQ);
+                break;
+            default: {
+                __m256d oddQ = _mm256_cmp_pd(_mm256_sub_pd(q, _mm256_mul_pd(_mm256_floor_pd(_mm256_mul_pd(q, _mm256_set1_pd(0.5))), _mm256_set1_pd(2.0))), one, _CMP_EQ_OQ);
+                roundUp = _mm256_or_pd(_mm256_cmp_pd(r, half, _CMP_GT_OQ),
+                                       _mm256_and_pd(_mm256_cmp_pd(r, half, _CMP_EQ_OQ), oddQ));
+                break;
+            }
+        }
+        q = _mm256_add_pd(q, _mm256_and_pd(roundUp, one));
+
+        __m256i interest = doubleToU52(q);
+        __m256i credited = _mm256_cmpgt_epi64(interest, zero);
+        interest = _mm256_and_si256(interest, credited);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(b + i), _mm256_add_epi64(bal, interest));
+        sum = _mm256_add_epi64(sum, interest);
+        hits = _mm256_sub_epi64(hits, credited); // credited lanes are -1
+    }
+
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), sum);
+    total += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), hits);
+    affected += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    interestScalar(b, i, count, ppm, mode, affected, total);
+}
+
+__attribute__((target("avx2")))
+void serviceChargeAvx2(int64_t* b, const unsigned char* live, size_t count, int64_t charge, int64_t& affected, int64_t& skipped) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i chargeMinusOne = _mm256_set1_epi64x(charge - 1);
+    const __m256i chargeVec = _mm256_set1_epi64x(charge);
+    __m256i hits = zero;
+    __m256i misses = zero;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int32_t liveBytes;
+        memcpy(&liveBytes, live + i, sizeof(liveBytes));
+        __m256i alive = _mm256_cmpgt_epi64(_mm256_cvtepu8_epi64(_mm_cvtsi32_si128(liveBytes)), zero);
+        __m256i bal = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i covers = _mm256_cmpgt_epi64(bal, chargeMinusOne); // bal >= charge
+        __m256i take = _mm256_and_si256(alive, covers);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(b + i), _mm256_sub_epi64(bal, _mm256_and_si256(take, chargeVec)));
+        hits = _mm256_sub_epi64(hits, take);
+        misses = _mm256_sub_epi64(misses, _mm256_andnot_si256(covers, alive));
+    }
+
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), hits);
+    affected += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), misses);
+    skipped += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    serviceChargeScalar(b, live, i, count, charge, affected, skipped);
+}
+
+#endif // BANK_HAVE_X86
+
+} // namespace
+
+KernelIsa bestKernelIsa() {
+#ifdef BANK_HAVE_X86
+    static const KernelIsa best = __builtin_cpu_supports("avx2") ? KernelIsa::Avx2 : KernelIsa::Scalar;
+    return best;
+#else
+    return KernelIsa::Scalar;
+#endif
+}
+
+const char* kernelIsaName(KernelIsa isa) {
+    return isa == KernelIsa::Avx2 ? "avx2" : "scalar";
+}
+
+BulkRunSummary interestKernel(Money* balances, size_t count, Rate rate, RoundingMode mode, KernelIsa isa) {
+    BulkRunSummary summary;
+    summary.accountsScanned = count;
+    int64_t ppm = rate.partsPerMillion();
+    int64_t affected = 0, total = 0;
+    if (ppm <= 0) {
+        return summary; // Nothing positive to credit
+    }
+#ifdef BANK_HAVE_X86
+    if (isa == KernelIsa::Avx2 && ppm < SIMD_MAX_PPM) {
+        interestAvx2(raw(balances), count, ppm, mode, affected, total);
+    } else
+#endif
+    {
+        interestScalar(raw(balances), 0, count, ppm, mode, affected, total);
+    }
+    summary.accountsAffected = static_cast<size_t>(affected);
+    summary.total = Money::fromMinor(total);
+    return summary;
+}
+
+BulkRunSummary serviceChargeKernel(Money* balances, const unsigned char* live, size_t count, Money charge, KernelIsa isa) {
+    BulkRunSummary summary;
+    summary.accountsScanned = count;
+    int64_t affected = 0, skipped = 0;
+#ifdef BANK_HAVE_X86
+    if (isa == KernelIsa::Avx2) {
+        serviceChargeAvx2(raw(balances), live, count, charge.minorUnits(), affected, skipped);
+    } else
+#endif
+    {
+        serviceChargeScalar(raw(balances), live, 0, count, charge.minorUnits(), affected, skipped);
+    }
+    summary.accountsAffected = static_cast<size_t>(affected);
+    summary.accountsSkipped = static_cast<size_t>(skipped);
+    summary.total = charge * affected;
+    return summary;
+}
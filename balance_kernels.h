@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include "money.h"
+
+// Result of a bulk pass over the balance column, returned instead of
+// printing one line per account.
+struct BulkRunSummary {
+    size_t accountsScanned = 0;
+    size_t accountsAffected = 0; // Credited with interest / charged
+    size_t accountsSkipped = 0;  // Service charge not taken: insufficient funds
+    Money total;                 // Interest credited / charges collected
+};
+
+enum class KernelIsa { Scalar, Avx2 };
+
+// Widest instruction set the running CPU supports
+KernelIsa bestKernelIsa();
+const char* kernelIsaName(KernelIsa isa);
+
+// Credit balance * rate (rounded with `mode`) to every positive balance.
+// Tombstoned slots must hold a zero balance; they are then left untouched.
+BulkRunSummary interestKernel(Money* balances, size_t count, Rate rate, RoundingMode mode, KernelIsa isa = bestKernelIsa());
+
+// Take `charge` from every live slot whose balance covers it.
+BulkRunSummary serviceChargeKernel(Money* balances, const unsigned char* live, size_t count, Money charge, KernelIsa isa = bestKernelIsa());
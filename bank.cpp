@@ -0,0 +1,1388 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iterator>
+#include <utility>
+#include "metrics.h"
+#include "project.h"
+
+using namespace std;
+
+const char* txResultMessage(TxResult result) {
+    switch (result) {
+        case TxResult::Ok:                return "OK";
+        case TxResult::InvalidAmount:     return "Amount must be positive.";
+        case TxResult::AccountNotFound:   return "Account not found.";
+        case TxResult::InsufficientFunds: return "Insufficient funds.";
+        case TxResult::InvalidPhone:      return "Invalid phone number. It must be exactly 10 digits.";
+        case TxResult::DuplicatePhone:    return "An account with this mobile number already exists.";
+        case TxResult::WeakPassword:      return "Password must contain at least one uppercase letter and one special character.";
+        case TxResult::AuthFailed:        return "Invalid account number or password.";
+        case TxResult::TooManyAttempts:   return "Too many failed attempts. Try again later.";
+        case TxResult::VelocityLimit:     return "Refused: the account's transaction limits would be exceeded.";
+        case TxResult::InvalidName:       return "Name is too long (at most 256 characters).";
+        case TxResult::InvalidPasswordHash: return "Password hash is too long to store.";
+    }
+    return "Unknown result.";
+}
+
+// Development key for card numbers and PIN values; deployments set their own
+static const char* const DEVELOPMENT_CARD_SECRET = "banking-system development card secret";
+
+// Bank class methods implementation
+Bank::Bank() : nextAccountNumber(1000), cards(DEVELOPMENT_CARD_SECRET) {}
+
+Bank::AllStripes::AllStripes(const Bank& bank) : bank(bank) {
+    for (Stripe& stripe : bank.stripes) stripe.lock.lock();
+}
+
+Bank::AllStripes::~AllStripes() {
+    for (size_t i = LOCK_STRIPES; i-- > 0;) bank.stripes[i].lock.unlock();
+}
+
+Bank::RangeStripes::RangeStripes(const Bank& bank, int first, int end) : bank(bank) {
+    if (static_cast<int64_t>(end) - first >= static_cast<int64_t>(LOCK_STRIPES)) {
+        held.set();
+    } else {
+        for (int number = first; number < end; ++number) held.set(bank.stripeOf(number));
+    }
+    for (size_t i = 0; i < LOCK_STRIPES; ++i) {
+        if (held[i]) bank.stripes[i].lock.lock();
+    }
+}
+
+Bank::RangeStripes::RangeStripes(const Bank& bank, const bitset<LOCK_STRIPES>& held) : bank(bank), held(held) {
+    for (size_t i = 0; i < LOCK_STRIPES; ++i) {
+        if (held[i]) bank.stripes[i].lock.lock();
+    }
+}
+
+Bank::RangeStripes::~RangeStripes() {
+    for (size_t i = LOCK_STRIPES; i-- > 0;) {
+        if (held[i]) bank.stripes[i].lock.unlock();
+    }
+}
+
+Bank::ReadView::ReadView(const Bank& bank) : bank(bank) {
+    AllStripes all(bank);
+    epoch = bank.writeEpoch++;
+    {
+        lock_guard<mutex> guard(bank.viewsLock);
+        bank.viewEpochs.insert(epoch);
+    }
+    bank.openViews.fetch_add(1, memory_order_relaxed); // Writers see it through their stripe
+    // Every change is journaled under its stripes, so these match the cut exactly
+    if (bank.journal) {
+        cutLsn = bank.journal->lastLsn();
+        cutOffset = bank.journal->endOffset();
+    }
+}
+
+// Drops the before-images no open view needs: those older than the oldest
+// open view, or all of them once none is left. writeEpoch is read first so
+// a view cut meanwhile keeps the images taken after it.
+Bank::ReadView::~ReadView() {
+    uint64_t keepAfter;
+    {
+        lock_guard<mutex> stripe(bank.stripes[0].lock);
+        keepAfter = bank.writeEpoch;
+    }
+    {
+        lock_guard<mutex> guard(bank.viewsLock);
+        bank.viewEpochs.erase(bank.viewEpochs.find(epoch));
+        if (!bank.viewEpochs.empty()) keepAfter = min(keepAfter, *bank.viewEpochs.begin());
+    }
+    bank.openViews.fetch_sub(1, memory_order_relaxed);
+    for (Stripe& stripe : bank.stripes) {
+        lock_guard<mutex> guard(stripe.lock);
+        auto& images = stripe.beforeImages;
+        images.erase(remove_if(images.begin(), images.end(), [keepAfter](const BeforeImage& image) { return image.epoch <= keepAfter; }),
+                     images.end());
+    }
+}
+
+// The balance before the first change made after the cut, if there was one
+Money Bank::ReadView::balance(size_t slot) const {
+    Stripe& stripe = bank.stripes[bank.stripeOf(bank.accounts.record(slot).accountNumber)];
+    lock_guard<mutex> guard(stripe.lock);
+    if (bank.accounts.version(slot) > epoch) {
+        for (const BeforeImage& image : stripe.beforeImages) {
+            if (image.slot == slot && image.epoch > epoch) return image.balance;
+        }
+    }
+    return bank.accounts.balance(slot);
+}
+
+// One image per balance and epoch is enough: later changes in the same
+// epoch come after every open view's cut
+void Bank::preserveSlow(size_t slot) {
+    uint64_t& version = accounts.version(slot);
+    if (version < writeEpoch) {
+        stripes[stripeOf(accounts.record(slot).accountNumber)].beforeImages.push_back(BeforeImage{slot, writeEpoch, accounts.balance(slot)});
+        version = writeEpoch;
+    }
+}
+
+void Bank::preserveAll() {
+    if (openViews.load(memory_order_relaxed) != 0) accounts.forEachSlot([this](size_t slot) { preserveSlow(slot); });
+}
+
+size_t Bank::stripeOf(int accountNumber) const {
+    return static_cast<unsigned>(accountNumber) % LOCK_STRIPES;
+}
+
+int Bank::generateNewAccountNumber() {
+    int accountNumber = nextAccountNumber;
+    nextAccountNumber += numberStride;
+    return accountNumber;
+}
+
+void Bank::setNumbering(int first, int stride) {
+    unique_lock<shared_mutex> structure(structureLock);
+    if (!accounts.empty() || stride < 1) {
+        throw logic_error("Account numbering can only be set on an empty bank.");
+    }
+    nextAccountNumber = first;
+    numberStride = stride;
+}
+
+void Bank::setCardSecret(const string& secret) {
+    unique_lock<shared_mutex> structure(structureLock);
+    if (!accounts.empty()) {
+        throw logic_error("The card secret can only be set on an empty bank.");
+    }
+    cards = CardKeys(secret);
+}
+
+static int64_t nowMicros() {
+    return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Also stamps the record, so history has a time even without a journal
+uint64_t Bank::log(JournalRecord& record) {
+    record.timestamp = nowMicros();
+    return journal ? journal->append(record) : 0;
+}
+
+void Bank::commit(uint64_t lsn) {
+    if (journal && lsn) journal->waitDurable(lsn);
+}
+
+static JournalRecord openRecord(int accountNumber, const string& name, const string& phone, const string& passwordHash, Money balance,
+                                bool hasATM, int atmCardNumber, int atmPin) {
+    JournalRecord record;
+    record.op = JournalOp::Open;
+    record.account = accountNumber;
+    record.amount = balance.minorUnits();
+    record.name = name;
+    record.phone = phone;
+    record.passwordHash = passwordHash;
+    record.hasATM = hasATM;
+    record.atmCardNumber = atmCardNumber;
+    record.atmPin = atmPin;
+    return record;
+}
+
+static JournalRecord balanceRecord(JournalOp op, int accountNumber, int64_t amount) {
+    JournalRecord record;
+    record.op = op;
+    record.account = accountNumber;
+    record.amount = amount;
+    return record;
+}
+
+bool Bank::isValidPhone(const string& phone) {
+    return phone.length() == 10 && all_of(phone.begin(), phone.end(), ::isdigit);
+}
+
+bool Bank::isStrongPassword(const string& password) {
+    bool hasUpper = false, hasSpecial = false;
+    for (char ch : password) {
+        if (isupper(static_cast<unsigned char>(ch))) hasUpper = true;
+        if (!isalnum(static_cast<unsigned char>(ch))) hasSpecial = true;
+    }
+    return hasUpper && hasSpecial;
+}
+
+bool Bank::isValidName(const string& name) {
+    return name.size() <= MAX_NAME_BYTES;
+}
+
+// Strings a journal record cannot carry are refused before anything changes
+static void checkStored(const string& passwordHash) {
+    if (passwordHash.size() > MAX_JOURNAL_STRING) {
+        throw invalid_argument("Password hash too long to journal.");
+    }
+}
+
+TxResult Bank::open(const string& name, const string& phone, const string& password, bool withATM, int& accountNumber,
+                    string* atmPin) {
+    if (!isValidPhone(phone)) {
+        return refused(MetricOp::Open, TxResult::InvalidPhone);
+    }
+    if (!isStrongPassword(password)) {
+        return refused(MetricOp::Open, TxResult::WeakPassword);
+    }
+    if (!isValidName(name)) {
+        return refused(MetricOp::Open, TxResult::InvalidName);
+    }
+    PasswordCost cost;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        cost = passwordCost;
+    }
+    // Hashed before taking the lock: it is deliberately slow
+    return openHashed(name, phone, hashPassword(password, cost), withATM, accountNumber, Commit::Wait, atmPin);
+}
+
+TxResult Bank::openHashed(const string& name, const string& phone, const string& passwordHash, bool withATM, int& accountNumber,
+                          Commit mode, string* atmPin) {
+    OpTimer timer(MetricOp::Open);
+    // Everything insert() and the journal would choke on is refused before a number is drawn
+    if (!isValidPhone(phone)) {
+        return timer.done(TxResult::InvalidPhone);
+    }
+    if (!isValidName(name)) {
+        return timer.done(TxResult::InvalidName);
+    }
+    if (passwordHash.size() > MAX_JOURNAL_STRING) {
+        return timer.done(TxResult::InvalidPasswordHash);
+    }
+    string pin = withATM ? CardKeys::randomPin() : string();
+
+    uint64_t lsn;
+    {
+        unique_lock<shared_mutex> structure(structureLock);
+        if (accounts.containsPhone(phone)) {
+            return timer.done(TxResult::DuplicatePhone);
+        }
+        accountNumber = generateNewAccountNumber();
+        int atmCardNumber = 0;
+        int pinValue = 0;
+        if (withATM) {
+            // Unique by construction; a clash means the secret changed under a live book
+            atmCardNumber = cards.cardNumber(accountNumber);
+            if (accounts.containsCard(atmCardNumber)) {
+                throw logic_error("Card " + to_string(atmCardNumber) + " is already issued; was the card secret changed?");
+            }
+            pinValue = cards.pinValue(atmCardNumber, pin);
+        }
+        size_t slot = accounts.insert(accountNumber, name, phone, passwordHash, Money(), withATM, atmCardNumber, pinValue);
+        JournalRecord record = openRecord(accountNumber, name, phone, passwordHash, Money(), withATM, atmCardNumber, pinValue);
+        lsn = log(record);
+        remember(slot, HistoryKind::Open, 0, record);
+    }
+    if (mode == Commit::Wait) {
+        commit(lsn);
+    }
+    if (atmPin) *atmPin = pin;
+    return timer.done(TxResult::Ok);
+}
+
+TxResult Bank::close(int accountNumber, Commit mode) {
+    OpTimer timer(MetricOp::Close);
+    uint64_t lsn;
+    {
+        unique_lock<shared_mutex> structure(structureLock);
+        size_t slot = accounts.slotOf(accountNumber);
+        if (slot == AccountStore::npos) {
+            return timer.done(TxResult::AccountNotFound);
+        }
+        history.release(accounts.history(slot));
+        accounts.erase(accountNumber);
+        stripes[stripeOf(accountNumber)].velocity.erase(accountNumber);
+        stripes[stripeOf(accountNumber)].pinAttempts.reset(accountNumber);
+        JournalRecord record = balanceRecord(JournalOp::Close, accountNumber, 0);
+        lsn = log(record);
+    }
+    sessions.erase(accountNumber);
+    attempts.reset(accountNumber);
+    if (mode == Commit::Wait) {
+        commit(lsn);
+    }
+    return timer.done(TxResult::Ok);
+}
+
+TxResult Bank::authenticate(int accountNumber, const string& password) const {
+    OpTimer timer(MetricOp::Authenticate);
+    string stored;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        size_t slot = accounts.slotOf(accountNumber);
+        if (slot == AccountStore::npos) {
+            return timer.done(TxResult::AuthFailed);
+        }
+        stored = string(accounts.record(slot).passwordHash); // Never changes after open
+    }
+    int64_t now = nowMicros();
+    if (sessions.contains(accountNumber, stored, password, now)) {
+        return timer.done(TxResult::Ok);
+    }
+    if (!attempts.acquire(accountNumber, now)) {
+        return timer.done(TxResult::TooManyAttempts);
+    }
+    if (!passwordMatches(password, stored)) {
+        return timer.done(TxResult::AuthFailed);
+    }
+    attempts.reset(accountNumber);
+    sessions.insert(accountNumber, stored, password, now);
+    return timer.done(TxResult::Ok);
+}
+
+void Bank::setPasswordCost(PasswordCost cost) {
+    unique_lock<shared_mutex> structure(structureLock);
+    passwordCost = cost;
+}
+
+TxResult Bank::deposit(int accountNumber, Money amount, Money* newBalance, Commit mode) {
+    OpTimer timer(MetricOp::Deposit);
+    if (!amount.isPositive()) {
+        return timer.done(TxResult::InvalidAmount);
+    }
+    uint64_t lsn;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        size_t slot = accounts.slotOf(accountNumber);
+        if (slot == AccountStore::npos) {
+            return timer.done(TxResult::AccountNotFound);
+        }
+        accounts.prefetch(slot);
+        lock_guard<mutex> stripe(stripes[stripeOf(accountNumber)].lock);
+        Money credited;
+        if (!accounts.balance(slot).checkedAdd(amount, credited)) {
+            return timer.done(TxResult::InvalidAmount); // The balance would overflow
+        }
+        preserve(slot);
+        accounts.balance(slot) = credited;
+        if (newBalance) *newBalance = credited;
+        JournalRecord record = balanceRecord(JournalOp::Deposit, accountNumber, amount.minorUnits());
+        lsn = log(record);
+        remember(slot, HistoryKind::Deposit, 0, record);
+    }
+    if (mode == Commit::Wait) {
+        commit(lsn);
+    }
+    return timer.done(TxResult::Ok);
+}
+
+TxResult Bank::withdraw(int accountNumber, Money amount, Money* newBalance, Commit mode) {
+    OpTimer timer(MetricOp::Withdraw);
+    if (!amount.isPositive()) {
+        return timer.done(TxResult::InvalidAmount);
+    }
+    uint64_t lsn;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        size_t slot = accounts.slotOf(accountNumber);
+        if (slot == AccountStore::npos) {
+            return timer.done(TxResult::AccountNotFound);
+        }
+        accounts.prefetch(slot);
+        lock_guard<mutex> stripe(stripes[stripeOf(accountNumber)].lock);
+        TxResult result = withdrawSlot(slot, accountNumber, amount, newBalance, lsn);
+        if (result != TxResult::Ok) {
+            return timer.done(result);
+        }
+    }
+    if (mode == Commit::Wait) {
+        commit(lsn);
+    }
+    return timer.done(TxResult::Ok);
+}
+
+TxResult Bank::withdrawSlot(size_t slot, int accountNumber, Money amount, Money* newBalance, uint64_t& lsn) {
+    Money& balance = accounts.balance(slot);
+    if (amount > balance) {
+        return TxResult::InsufficientFunds;
+    }
+    if (checkVelocity(accountNumber, VelocityWithdraw, amount) != TxResult::Ok) {
+        return TxResult::VelocityLimit;
+    }
+    preserve(slot);
+    balance -= amount;
+    if (newBalance) *newBalance = balance;
+    JournalRecord record = balanceRecord(JournalOp::Withdraw, accountNumber, amount.minorUnits());
+    lsn = log(record);
+    remember(slot, HistoryKind::Withdrawal, 0, record);
+    recordVelocity(accountNumber, VelocityWithdraw, amount, record.timestamp);
+    return TxResult::Ok;
+}
+
+size_t Bank::cardSlot(int cardNumber, const string& pin, bool& pinMatches) const {
+    size_t slot = accounts.slotOfCard(cardNumber);
+    // The PIN value is fixed at open, so it is checked before the stripe is taken
+    pinMatches = slot != AccountStore::npos && cards.pinMatches(cardNumber, pin, accounts.record(slot).atmPin);
+    return slot;
+}
+
+TxResult Bank::settlePin(int accountNumber, bool pinMatches) const {
+    AttemptLimiter& tries = stripes[stripeOf(accountNumber)].pinAttempts;
+    int64_t now = nowMicros();
+    if (tries.exhausted(accountNumber, now)) {
+        return TxResult::TooManyAttempts; // Even with the right PIN
+    }
+    if (!pinMatches) {
+        return tries.acquire(accountNumber, now) ? TxResult::AuthFailed : TxResult::TooManyAttempts;
+    }
+    tries.reset(accountNumber);
+    return TxResult::Ok;
+}
+
+TxResult Bank::authorizeCard(int cardNumber, const string& pin, int& accountNumber) const {
+    OpTimer timer(MetricOp::CardAuthorize);
+    shared_lock<shared_mutex> structure(structureLock);
+    bool pinMatches;
+    size_t slot = cardSlot(cardNumber, pin, pinMatches);
+    if (slot == AccountStore::npos) {
+        return timer.done(TxResult::AuthFailed);
+    }
+    int holder = accounts.record(slot).accountNumber;
+    lock_guard<mutex> stripe(stripes[stripeOf(holder)].lock);
+    TxResult result = settlePin(holder, pinMatches);
+    if (result == TxResult::Ok) {
+        accountNumber = holder;
+    }
+    return timer.done(result);
+}
+
+TxResult Bank::cardWithdraw(int cardNumber, const string& pin, Money amount, Money* newBalance, Commit mode) {
+    OpTimer timer(MetricOp::CardWithdraw);
+    if (!amount.isPositive()) {
+        return timer.done(TxResult::InvalidAmount);
+    }
+    uint64_t lsn;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        bool pinMatches;
+        size_t slot = cardSlot(cardNumber, pin, pinMatches);
+        if (slot == AccountStore::npos) {
+            return timer.done(TxResult::AuthFailed);
+        }
+        accounts.prefetch(slot);
+        int accountNumber = accounts.record(slot).accountNumber;
+        lock_guard<mutex> stripe(stripes[stripeOf(accountNumber)].lock);
+        TxResult result = settlePin(accountNumber, pinMatches);
+        if (result == TxResult::Ok) {
+            result = withdrawSlot(slot, accountNumber, amount, newBalance, lsn);
+        }
+        if (result != TxResult::Ok) {
+            return timer.done(result);
+        }
+    }
+    if (mode == Commit::Wait) {
+        commit(lsn);
+    }
+    return timer.done(TxResult::Ok);
+}
+
+TxResult Bank::transfer(int fromAccountNumber, int toAccountNumber, Money amount, Commit mode) {
+    OpTimer timer(MetricOp::Transfer);
+    if (!amount.isPositive()) {
+        return timer.done(TxResult::InvalidAmount);
+    }
+    uint64_t lsn;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        size_t from = accounts.slotOf(fromAccountNumber);
+        size_t to = accounts.slotOf(toAccountNumber);
+        if (from == AccountStore::npos || to == AccountStore::npos) {
+            return timer.done(TxResult::AccountNotFound);
+        }
+
+        accounts.prefetch(from);
+        accounts.prefetch(to);
+        size_t first = stripeOf(fromAccountNumber);
+        size_t second = stripeOf(toAccountNumber);
+        if (first > second) swap(first, second);
+        lock_guard<mutex> firstLock(stripes[first].lock);
+        unique_lock<mutex> secondLock;
+        if (second != first) {
+            secondLock = unique_lock<mutex>(stripes[second].lock);
+        }
+
+        if (accounts.balance(from) < amount) {
+            return timer.done(TxResult::InsufficientFunds);
+        }
+        Money credited;
+        if (from != to && !accounts.balance(to).checkedAdd(amount, credited)) {
+            return timer.done(TxResult::InvalidAmount); // The recipient's balance would overflow
+        }
+        if (checkVelocity(fromAccountNumber, VelocityTransfer, amount) != TxResult::Ok) {
+            return timer.done(TxResult::VelocityLimit);
+        }
+        preserve(from);
+        preserve(to);
+        accounts.balance(from) -= amount;
+        accounts.balance(to) += amount;
+        JournalRecord record = balanceRecord(JournalOp::Transfer, fromAccountNumber, amount.minorUnits());
+        record.counterparty = toAccountNumber;
+        lsn = log(record);
+        remember(from, HistoryKind::TransferOut, toAccountNumber, record);
+        remember(to, HistoryKind::TransferIn, fromAccountNumber, record);
+        recordVelocity(fromAccountNumber, VelocityTransfer, amount, record.timestamp);
+    }
+    if (mode == Commit::Wait) {
+        commit(lsn);
+    }
+    return timer.done(TxResult::Ok);
+}
+
+TxResult Bank::debitLeg(int accountNumber, int counterparty, Money amount, uint64_t reference, Commit mode) {
+    return applyLeg(JournalOp::TransferDebit, accountNumber, counterparty, amount, reference, mode);
+}
+
+TxResult Bank::creditLeg(int accountNumber, int counterparty, Money amount, uint64_t reference, Commit mode) {
+    return applyLeg(JournalOp::TransferCredit, accountNumber, counterparty, amount, reference, mode);
+}
+
+TxResult Bank::applyLeg(JournalOp op, int accountNumber, int counterparty, Money amount, uint64_t reference, Commit mode) {
+    OpTimer timer(MetricOp::TransferLeg);
+    if (!amount.isPositive()) {
+        return timer.done(TxResult::InvalidAmount);
+    }
+    bool debit = op == JournalOp::TransferDebit;
+    uint64_t lsn;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        size_t slot = accounts.slotOf(accountNumber);
+        if (slot == AccountStore::npos) {
+            return timer.done(TxResult::AccountNotFound);
+        }
+        accounts.prefetch(slot);
+        lock_guard<mutex> stripe(stripes[stripeOf(accountNumber)].lock);
+        Money& balance = accounts.balance(slot);
+        if (debit && amount > balance) {
+            return timer.done(TxResult::InsufficientFunds);
+        }
+        Money credited;
+        if (!debit && !balance.checkedAdd(amount, credited)) {
+            return timer.done(TxResult::InvalidAmount); // The balance would overflow
+        }
+        if (debit && checkVelocity(accountNumber, VelocityTransfer, amount) != TxResult::Ok) {
+            return timer.done(TxResult::VelocityLimit);
+        }
+        preserve(slot);
+        balance += debit ? -amount : amount;
+        JournalRecord record = balanceRecord(op, accountNumber, amount.minorUnits());
+        record.counterparty = counterparty;
+        record.reference = reference;
+        lsn = log(record);
+        remember(slot, debit ? HistoryKind::TransferOut : HistoryKind::TransferIn, counterparty, record);
+        if (debit) recordVelocity(accountNumber, VelocityTransfer, amount, record.timestamp);
+    }
+    if (mode == Commit::Wait) {
+        commit(lsn);
+    }
+    return timer.done(TxResult::Ok);
+}
+
+TxResult Bank::post(const string& idempotencyKey, const vector<Posting>& legs, Commit mode, bool* duplicate) {
+    OpTimer timer(MetricOp::Post);
+    if (duplicate) *duplicate = false;
+    if (legs.size() < 2 || legs.size() > MAX_POSTING_LEGS) {
+        return timer.done(TxResult::InvalidAmount);
+    }
+    // Net the legs per account, in account-number order: one lookup, one
+    // funds check and one history entry per account however many legs it has
+    vector<pair<int64_t, int64_t>> changes;
+    changes.reserve(legs.size());
+    int64_t sum = 0;
+    for (const Posting& leg : legs) {
+        if (leg.amount.isZero() || __builtin_add_overflow(sum, leg.amount.minorUnits(), &sum)) {
+            return timer.done(TxResult::InvalidAmount);
+        }
+        changes.emplace_back(leg.account, leg.amount.minorUnits());
+    }
+    if (sum != 0) {
+        return timer.done(TxResult::InvalidAmount);
+    }
+    sort(changes.begin(), changes.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    size_t merged = 0;
+    for (size_t i = 0; i < changes.size(); ++i) {
+        if (merged > 0 && changes[merged - 1].first == changes[i].first) {
+            if (__builtin_add_overflow(changes[merged - 1].second, changes[i].second, &changes[merged - 1].second)) {
+                return timer.done(TxResult::InvalidAmount);
+            }
+        } else {
+            changes[merged++] = changes[i];
+        }
+    }
+    changes.resize(merged);
+    changes.erase(remove_if(changes.begin(), changes.end(), [](const auto& change) { return change.second == 0; }), changes.end());
+    if (changes.empty()) {
+        return timer.done(TxResult::InvalidAmount); // Nothing moves
+    }
+
+    uint64_t key = idempotencyKey.empty() ? 0 : idempotencyHash(idempotencyKey);
+    uint64_t lsn = 0;
+    if (key && !postedKeys.claim(key, lsn)) {
+        if (duplicate) *duplicate = true;
+        if (mode == Commit::Wait) {
+            commit(lsn); // The first attempt may not be durable yet
+        }
+        return timer.done(TxResult::Ok);
+    }
+    TxResult result = TxResult::Ok;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        vector<size_t> slots(changes.size());
+        bitset<LOCK_STRIPES> needed;
+        for (size_t i = 0; i < changes.size() && result == TxResult::Ok; ++i) {
+            slots[i] = accounts.slotOf(static_cast<int>(changes[i].first));
+            if (slots[i] == AccountStore::npos) {
+                result = TxResult::AccountNotFound;
+            } else {
+                accounts.prefetch(slots[i]);
+                needed.set(stripeOf(static_cast<int>(changes[i].first)));
+            }
+        }
+        if (result == TxResult::Ok) {
+            RangeStripes held(*this, needed);
+            for (size_t i = 0; i < changes.size(); ++i) {
+                int64_t after;
+                if (__builtin_add_overflow(accounts.balance(slots[i]).minorUnits(), changes[i].second, &after)) {
+                    result = TxResult::InvalidAmount; // A credit would overflow the balance
+                    break;
+                }
+                if (after < 0) {
+                    result = TxResult::InsufficientFunds;
+                    break;
+                }
+            }
+            for (size_t i = 0; i < changes.size() && result == TxResult::Ok; ++i) {
+                if (changes[i].second < 0) {
+                    result = checkVelocity(static_cast<int>(changes[i].first), VelocityPost, Money::fromMinor(-changes[i].second));
+                }
+            }
+            if (result == TxResult::Ok) {
+                JournalRecord record;
+                record.op = JournalOp::Post;
+                record.account = static_cast<int32_t>(changes.front().first);
+                record.reference = key;
+                record.entries = changes;
+                for (size_t i = 0; i < changes.size(); ++i) {
+                    preserve(slots[i]);
+                    accounts.balance(slots[i]) += Money::fromMinor(changes[i].second);
+                }
+                lsn = log(record);
+                // A two-account batch reads like a transfer in history
+                for (size_t i = 0; i < changes.size(); ++i) {
+                    int counterparty = changes.size() == 2 ? static_cast<int>(changes[1 - i].first) : 0;
+                    remember(slots[i], changes[i].second < 0 ? HistoryKind::TransferOut : HistoryKind::TransferIn, counterparty, record);
+                    if (changes[i].second < 0) {
+                        recordVelocity(static_cast<int>(changes[i].first), VelocityPost, Money::fromMinor(-changes[i].second), record.timestamp);
+                    }
+                }
+                // Still under the stripes, so a snapshot cut after the record also has the key
+                if (key) postedKeys.release(key, true, lsn);
+            }
+        }
+    }
+    if (key && result != TxResult::Ok) {
+        postedKeys.release(key, false, 0);
+    }
+    if (result == TxResult::Ok && mode == Commit::Wait) {
+        commit(lsn);
+    }
+    return timer.done(result);
+}
+
+TxResult Bank::balance(int accountNumber, Money& balance) const {
+    OpTimer timer(MetricOp::Balance);
+    shared_lock<shared_mutex> structure(structureLock);
+    size_t slot = accounts.slotOf(accountNumber);
+    if (slot == AccountStore::npos) {
+        return timer.done(TxResult::AccountNotFound);
+    }
+    lock_guard<mutex> stripe(stripes[stripeOf(accountNumber)].lock);
+    balance = accounts.balance(slot);
+    return timer.done(TxResult::Ok);
+}
+
+TxResult Bank::getAccount(int accountNumber, Account& account) const {
+    shared_lock<shared_mutex> structure(structureLock);
+    size_t slot = accounts.slotOf(accountNumber);
+    if (slot == AccountStore::npos) {
+        return TxResult::AccountNotFound;
+    }
+    lock_guard<mutex> stripe(stripes[stripeOf(accountNumber)].lock);
+    account = accounts.get(slot);
+    return TxResult::Ok;
+}
+
+TxResult Bank::applyInterest(Rate rate, RoundingMode rounding, BulkRunSummary& summary) {
+    OpTimer timer(MetricOp::ApplyInterest);
+    if (rate.partsPerMillion() < 0) {
+        return timer.done(TxResult::InvalidAmount);
+    }
+    uint64_t lsn;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        AllStripes all(*this);
+        preserveAll();
+        summary = accounts.applyInterest(rate, rounding);
+        JournalRecord record = balanceRecord(JournalOp::Interest, 0, rate.partsPerMillion());
+        record.rounding = static_cast<uint8_t>(rounding);
+        lsn = log(record);
+        rememberBulk(HistoryKind::Interest, record);
+    }
+    commit(lsn);
+    return timer.done(TxResult::Ok);
+}
+
+TxResult Bank::applyServiceCharge(Money charge, BulkRunSummary& summary) {
+    OpTimer timer(MetricOp::ApplyServiceCharge);
+    if (!charge.isPositive()) {
+        return timer.done(TxResult::InvalidAmount);
+    }
+    uint64_t lsn;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        AllStripes all(*this);
+        preserveAll();
+        summary = accounts.applyServiceCharge(charge);
+        JournalRecord record = balanceRecord(JournalOp::ServiceCharge, 0, charge.minorUnits());
+        lsn = log(record);
+        rememberBulk(HistoryKind::ServiceCharge, record);
+    }
+    commit(lsn);
+    return timer.done(TxResult::Ok);
+}
+
+static size_t jobChunks(const JobProgress& job) {
+    int64_t numbers = static_cast<int64_t>(job.endAccount) - job.firstAccount;
+    return numbers > 0 ? static_cast<size_t>((numbers + job.span - 1) / job.span) : 0;
+}
+
+TxResult Bank::startJob(const JobSpec& spec, uint64_t& jobId) {
+    if (!spec.valid()) {
+        return TxResult::InvalidAmount;
+    }
+    uint64_t lsn;
+    {
+        shared_lock<shared_mutex> structure(structureLock); // Numbers only change under the exclusive lock
+        JobProgress job;
+        job.spec = spec;
+        job.endAccount = nextAccountNumber;
+        job.firstAccount = nextAccountNumber;
+        accounts.forEachSlot([&](size_t slot) { job.firstAccount = min(job.firstAccount, accounts.record(slot).accountNumber); });
+        job.span = static_cast<int>(spec.chunkAccounts) * numberStride;
+        job.chunkState.assign(jobChunks(job), JobProgress::Pending);
+
+        JournalRecord record;
+        record.op = JournalOp::JobStart;
+        record.account = job.firstAccount;
+        record.counterparty = job.endAccount;
+        record.amount = job.span;
+        record.rounding = static_cast<uint8_t>(spec.rounding);
+        record.jobKind = static_cast<uint8_t>(spec.kind);
+        for (const RateTier& tier : spec.tiers) record.entries.emplace_back(tier.minimum.minorUnits(), tier.value);
+        lock_guard<mutex> guard(jobsLock);
+        job.id = jobId = record.reference = nextJobId++;
+        lsn = log(record);
+        jobs.emplace(jobId, move(job));
+    }
+    commit(lsn);
+    return TxResult::Ok;
+}
+
+BulkRunSummary Bank::runJobChunk(uint64_t jobId, size_t chunk) {
+    OpTimer timer(MetricOp::JobChunk);
+    BulkRunSummary summary;
+    JobSpec spec;
+    int first, end;
+    {
+        lock_guard<mutex> guard(jobsLock);
+        auto it = jobs.find(jobId);
+        if (it == jobs.end() || chunk >= it->second.chunks()) {
+            throw logic_error("Unknown bulk job chunk " + to_string(jobId) + "/" + to_string(chunk));
+        }
+        JobProgress& job = it->second;
+        if (job.chunkState[chunk] != JobProgress::Pending) {
+            timer.done(TxResult::Ok);
+            return summary; // Done, or being run by another caller
+        }
+        job.chunkState[chunk] = JobProgress::Running;
+        spec = job.spec;
+        first = job.firstAccount + static_cast<int>(chunk) * job.span;
+        end = static_cast<int>(min<int64_t>(static_cast<int64_t>(first) + job.span, job.endAccount));
+    }
+    uint64_t lsn;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        RangeStripes held(*this, first, end);
+        JournalRecord record;
+        record.op = JournalOp::JobChunk;
+        record.reference = jobId;
+        record.amount = static_cast<int64_t>(chunk);
+        record.jobKind = static_cast<uint8_t>(spec.kind);
+        vector<size_t> changed;
+        for (int number = first; number < end; number += numberStride) {
+            size_t slot = accounts.slotOf(number);
+            if (slot == AccountStore::npos) continue; // Closed since the job started
+            ++summary.accountsScanned;
+            Money& balance = accounts.balance(slot);
+            int64_t change = spec.changeFor(balance);
+            if (change == 0) {
+                const RateTier* tier = spec.tierFor(balance);
+                if (spec.kind == JobKind::ServiceCharge && tier && tier->value > 0) ++summary.accountsSkipped;
+                continue;
+            }
+            preserve(slot);
+            balance += Money::fromMinor(change);
+            summary.total += Money::fromMinor(change < 0 ? -change : change);
+            ++summary.accountsAffected;
+            record.entries.emplace_back(number, change);
+            changed.push_back(slot);
+        }
+        lsn = log(record);
+        HistoryKind kind = spec.kind == JobKind::Interest ? HistoryKind::Interest : HistoryKind::ServiceCharge;
+        for (size_t slot : changed) remember(slot, kind, 0, record);
+
+        lock_guard<mutex> guard(jobsLock);
+        JobProgress& job = jobs.at(jobId);
+        job.chunkState[chunk] = JobProgress::Done;
+        job.summary.accountsScanned += summary.accountsScanned;
+        job.summary.accountsAffected += summary.accountsAffected;
+        job.summary.accountsSkipped += summary.accountsSkipped;
+        job.summary.total += summary.total;
+    }
+    commit(lsn);
+    timer.done(TxResult::Ok);
+    return summary;
+}
+
+BulkRunSummary Bank::endJob(uint64_t jobId) {
+    BulkRunSummary summary;
+    uint64_t lsn;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        lock_guard<mutex> guard(jobsLock);
+        auto it = jobs.find(jobId);
+        if (it == jobs.end()) {
+            throw logic_error("Unknown bulk job " + to_string(jobId));
+        }
+        if (it->second.chunksDone() != it->second.chunks()) {
+            throw logic_error("Bulk job " + to_string(jobId) + " still has chunks to run");
+        }
+        summary = it->second.summary;
+        JournalRecord record;
+        record.op = JournalOp::JobEnd;
+        record.reference = jobId;
+        lsn = log(record);
+        jobs.erase(it);
+    }
+    commit(lsn);
+    return summary;
+}
+
+bool Bank::jobProgress(uint64_t jobId, JobProgress& progress) const {
+    lock_guard<mutex> guard(jobsLock);
+    auto it = jobs.find(jobId);
+    if (it == jobs.end()) {
+        return false;
+    }
+    progress = it->second;
+    return true;
+}
+
+vector<uint64_t> Bank::unfinishedJobs() const {
+    lock_guard<mutex> guard(jobsLock);
+    vector<uint64_t> ids;
+    for (const auto& job : jobs) ids.push_back(job.first);
+    return ids;
+}
+
+int Bank::addAccount(const string& name, const string& phone, const string& passwordHash, Money balance) {
+    if (!isValidName(name)) {
+        throw invalid_argument(txResultMessage(TxResult::InvalidName));
+    }
+    checkStored(passwordHash);
+    int accountNumber;
+    uint64_t lsn;
+    {
+        unique_lock<shared_mutex> structure(structureLock);
+        if (accounts.containsPhone(phone)) {
+            throw invalid_argument("An account with this mobile number already exists.");
+        }
+        accountNumber = generateNewAccountNumber();
+        size_t slot = accounts.insert(accountNumber, name, phone, passwordHash, balance);
+        JournalRecord record = openRecord(accountNumber, name, phone, passwordHash, balance, false, 0, 0);
+        lsn = log(record);
+        remember(slot, HistoryKind::Open, 0, record);
+    }
+    commit(lsn);
+    return accountNumber;
+}
+
+size_t Bank::recover(Journal& journal, const string& snapshotPath) {
+    size_t replayed;
+    {
+        unique_lock<shared_mutex> structure(structureLock);
+        if (!accounts.empty()) {
+            throw logic_error("Journal recovery needs an empty bank.");
+        }
+        uint64_t snapshotLsn = 0, snapshotOffset = 0;
+        if (!snapshotPath.empty() && SnapshotView::exists(snapshotPath)) {
+            SnapshotView snapshot(snapshotPath);
+            nextAccountNumber = snapshot.header().nextAccountNumber;
+            snapshotLsn = snapshot.header().journalLsn;
+            snapshotOffset = snapshot.header().journalOffset;
+            // History from before the snapshot is only in the journal
+            uint64_t spilledBefore = snapshotLsn ? snapshotLsn + 1 : 0;
+            accounts.reserve(snapshot.size());
+            for (size_t i = 0; i < snapshot.size(); ++i) {
+                const SnapshotRecord& r = snapshot.record(i);
+                size_t slot = accounts.insert(r.accountNumber, snapshot.name(r), snapshot.phone(r), snapshot.passwordHash(r),
+                                              Money::fromMinor(r.balance), r.hasATM != 0, r.atmCardNumber, r.atmPin);
+                history.resume(accounts.history(slot), Money::fromMinor(r.balance), spilledBefore);
+            }
+            for (size_t i = 0; i < snapshot.keyCount(); ++i) postedKeys.remember(snapshot.key(i), snapshotLsn);
+        }
+        replayed = journal.replay([this](const JournalRecord& record) { applyRecord(record); }, snapshotOffset, snapshotLsn);
+    }
+    attachJournal(&journal);
+    return replayed;
+}
+
+// Copies the book through a read view, so transactions go on while it is
+// written; the view's journal position is where replay picks up.
+size_t Bank::saveSnapshot(const string& path) const {
+    SnapshotWriter writer;
+    uint64_t lsn, offset;
+    int next;
+    Journal* attached;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        ReadView view(*this);
+        {
+            // A job that started after the cut is replayed whole; one still
+            // open now may have started before it
+            lock_guard<mutex> guard(jobsLock);
+            if (!jobs.empty()) {
+                throw runtime_error("A bulk job is unfinished; resume it before taking a snapshot.");
+            }
+        }
+        accounts.forEachSlot([&](size_t slot) { writer.add(accounts.record(slot), view.balance(slot)); });
+        next = nextAccountNumber;
+        // Keys of batches after the cut come back with their journal records
+        writer.setKeys(postedKeys.applied());
+        lsn = view.lsn();
+        offset = view.offset();
+        attached = journal;
+    }
+    if (attached) attached->sync(); // The snapshot must not get ahead of what is durable
+    writer.write(path, lsn, offset, next);
+    return writer.size();
+}
+
+void Bank::takeReplayedLegs(vector<TransferLeg>& legs) {
+    unique_lock<shared_mutex> structure(structureLock);
+    legs.swap(replayedLegs);
+    vector<TransferLeg>().swap(replayedLegs);
+}
+
+void Bank::setVelocityRules(VelocityRules rules) {
+    lock_guard<mutex> guard(rulesLock);
+    ruleSets.emplace_back(new VelocityRules(move(rules)));
+    const VelocityRules* next = ruleSets.back().get();
+    const VelocityRules* previous = velocityRules.load(memory_order_relaxed);
+    // Windows the previous rules did not keep hold stale counts; start them empty
+    uint16_t stale = next->windows() & ~(previous ? previous->windows() : 0);
+    shared_lock<shared_mutex> structure(structureLock);
+    AllStripes all(*this);
+    if (stale) {
+        for (Stripe& stripe : stripes) stripe.velocity.resetWindows(stale);
+    }
+    velocityRules.store(next, memory_order_release);
+}
+
+void Bank::loadVelocityRules(const string& path) {
+    setVelocityRules(VelocityRules::load(path));
+}
+
+vector<pair<string, uint64_t>> Bank::velocityBlocks() const {
+    vector<pair<string, uint64_t>> blocks;
+    const VelocityRules* rules = velocityRules.load(memory_order_acquire);
+    for (size_t i = 0; rules && i < rules->size(); ++i) blocks.emplace_back(rules->name(i), rules->blocked(i));
+    return blocks;
+}
+
+// Whole seconds are all the windows need, and time() is far cheaper than a
+// precise clock read
+TxResult Bank::checkVelocitySlow(const VelocityRules& rules, int accountNumber, VelocityKind kind, Money amount) {
+    VelocityCounters none; // Rules that read no window need no entry
+    VelocityCounters& counters = rules.windows() != 0 ? stripes[stripeOf(accountNumber)].velocity.at(accountNumber) : none;
+    return rules.check(counters, kind, amount.minorUnits(), time(nullptr)) < 0 ? TxResult::Ok : TxResult::VelocityLimit;
+}
+
+void Bank::recordVelocitySlow(const VelocityRules& rules, int accountNumber, VelocityKind kind, Money amount, int64_t timestamp) {
+    rules.record(stripes[stripeOf(accountNumber)].velocity.at(accountNumber), kind, amount.minorUnits(), timestamp / 1000000);
+}
+
+void Bank::syncJournal() {
+    Journal* attached;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        attached = journal;
+    }
+    if (attached) attached->sync();
+}
+
+void Bank::attachJournal(Journal* journal) {
+    unique_lock<shared_mutex> structure(structureLock);
+    this->journal = journal;
+}
+
+// Re-apply one journaled change. Only successful operations were journaled,
+// so a record that no longer applies means the journal does not match.
+// Caller holds structureLock exclusively.
+void Bank::applyRecord(const JournalRecord& record) {
+    auto slotFor = [this](int accountNumber) {
+        size_t slot = accounts.slotOf(accountNumber);
+        if (slot == AccountStore::npos) {
+            throw runtime_error("Journal replay: unknown account " + to_string(accountNumber));
+        }
+        return slot;
+    };
+    // Outflows count toward velocity limits as of when they were made
+    auto outflow = [&](int accountNumber, VelocityKind kind, Money amount) {
+        recordVelocity(accountNumber, kind, amount, record.timestamp);
+    };
+    Money amount = Money::fromMinor(record.amount);
+    switch (record.op) {
+        case JournalOp::Open: {
+            size_t slot = accounts.insert(record.account, record.name, record.phone, record.passwordHash, amount, record.hasATM,
+                                          record.atmCardNumber, record.atmPin);
+            nextAccountNumber = max(nextAccountNumber, record.account + numberStride);
+            remember(slot, HistoryKind::Open, 0, record);
+            break;
+        }
+        case JournalOp::Close:
+            history.release(accounts.history(slotFor(record.account)));
+            accounts.erase(record.account);
+            stripes[stripeOf(record.account)].velocity.erase(record.account);
+            break;
+        case JournalOp::Deposit: {
+            size_t slot = slotFor(record.account);
+            accounts.balance(slot) += amount;
+            remember(slot, HistoryKind::Deposit, 0, record);
+            break;
+        }
+        case JournalOp::Withdraw: {
+            size_t slot = slotFor(record.account);
+            accounts.balance(slot) -= amount;
+            remember(slot, HistoryKind::Withdrawal, 0, record);
+            outflow(record.account, VelocityWithdraw, amount);
+            break;
+        }
+        case JournalOp::Transfer: {
+            size_t from = slotFor(record.account);
+            size_t to = slotFor(record.counterparty);
+            accounts.balance(from) -= amount;
+            accounts.balance(to) += amount;
+            remember(from, HistoryKind::TransferOut, record.counterparty, record);
+            remember(to, HistoryKind::TransferIn, record.account, record);
+            outflow(record.account, VelocityTransfer, amount);
+            break;
+        }
+        case JournalOp::TransferDebit:
+        case JournalOp::TransferCredit: {
+            bool debit = record.op == JournalOp::TransferDebit;
+            size_t slot = slotFor(record.account);
+            accounts.balance(slot) += debit ? -amount : amount;
+            remember(slot, debit ? HistoryKind::TransferOut : HistoryKind::TransferIn, record.counterparty, record);
+            replayedLegs.push_back(TransferLeg{record.reference, debit, record.account, record.counterparty, amount});
+            if (debit) outflow(record.account, VelocityTransfer, amount);
+            break;
+        }
+        case JournalOp::Interest:
+            accounts.applyInterest(Rate::fromPpm(record.amount), static_cast<RoundingMode>(record.rounding));
+            rememberBulk(HistoryKind::Interest, record);
+            break;
+        case JournalOp::ServiceCharge:
+            accounts.applyServiceCharge(amount);
+            rememberBulk(HistoryKind::ServiceCharge, record);
+            break;
+        case JournalOp::JobStart:
+        case JournalOp::JobChunk:
+        case JournalOp::JobEnd:
+            replayJobRecord(record);
+            break;
+        case JournalOp::Post: {
+            for (size_t i = 0; i < record.entries.size(); ++i) {
+                const auto& change = record.entries[i];
+                size_t slot = slotFor(static_cast<int>(change.first));
+                accounts.balance(slot) += Money::fromMinor(change.second);
+                int counterparty = record.entries.size() == 2 ? static_cast<int>(record.entries[1 - i].first) : 0;
+                remember(slot, change.second < 0 ? HistoryKind::TransferOut : HistoryKind::TransferIn, counterparty, record);
+                if (change.second < 0) outflow(static_cast<int>(change.first), VelocityPost, Money::fromMinor(-change.second));
+            }
+            if (record.reference) postedKeys.remember(record.reference, record.lsn);
+            break;
+        }
+    }
+}
+
+// Rebuilds the progress of jobs that have not ended, so a JobRunner can
+// resume them; a chunk's recorded changes are applied as they were made.
+void Bank::replayJobRecord(const JournalRecord& record) {
+    if (record.op == JournalOp::JobStart) {
+        JobProgress job;
+        job.id = record.reference;
+        job.spec.kind = static_cast<JobKind>(record.jobKind);
+        job.spec.rounding = static_cast<RoundingMode>(record.rounding);
+        for (const auto& tier : record.entries) job.spec.tiers.push_back(RateTier{Money::fromMinor(tier.first), tier.second});
+        job.firstAccount = record.account;
+        job.endAccount = record.counterparty;
+        job.span = static_cast<int>(record.amount);
+        job.spec.chunkAccounts = static_cast<size_t>(job.span / numberStride);
+        job.chunkState.assign(jobChunks(job), JobProgress::Pending);
+        nextJobId = max(nextJobId, job.id + 1);
+        jobs[job.id] = move(job);
+    } else if (record.op == JournalOp::JobChunk) {
+        HistoryKind kind = static_cast<JobKind>(record.jobKind) == JobKind::Interest ? HistoryKind::Interest : HistoryKind::ServiceCharge;
+        BulkRunSummary summary;
+        for (const auto& entry : record.entries) {
+            size_t slot = accounts.slotOf(static_cast<int>(entry.first));
+            if (slot == AccountStore::npos) {
+                throw runtime_error("Journal replay: unknown account " + to_string(entry.first));
+            }
+            accounts.balance(slot) += Money::fromMinor(entry.second);
+            remember(slot, kind, 0, record);
+            ++summary.accountsAffected;
+            summary.total += Money::fromMinor(entry.second < 0 ? -entry.second : entry.second);
+        }
+        auto it = jobs.find(record.reference);
+        if (it != jobs.end() && static_cast<size_t>(record.amount) < it->second.chunks()) {
+            it->second.chunkState[record.amount] = JobProgress::Done;
+            it->second.summary.accountsAffected += summary.accountsAffected;
+            it->second.summary.total += summary.total;
+        }
+    } else {
+        jobs.erase(record.reference);
+    }
+}
+
+void Bank::remember(size_t slot, HistoryKind kind, int counterparty, const JournalRecord& record) {
+    history.record(accounts.history(slot), kind, counterparty, accounts.balance(slot), record.timestamp, record.lsn);
+}
+
+// A history header always holds the balance after its newest entry, so the
+// accounts a kernel changed are exactly those whose balance now differs.
+// Caller holds every stripe.
+void Bank::rememberBulk(HistoryKind kind, const JournalRecord& record) {
+    accounts.forEachHistory([&](Money balance, HistoryLog& log) {
+        if (balance.minorUnits() != log.balance) {
+            history.record(log, kind, 0, balance, record.timestamp, record.lsn);
+        }
+    });
+}
+
+// Replays the account's own records; bulk passes are recomputed from its
+// running balance exactly as the kernels apply them.
+void Bank::journalHistory(int accountNumber, uint64_t beforeLsn, vector<HistoryEntry>& entries) const {
+    Journal* attached;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        attached = journal;
+    }
+    if (!attached || beforeLsn <= 1) {
+        return;
+    }
+    if (attached->durableLsn() + 1 < beforeLsn) {
+        attached->sync(); // The records may still be in the group-commit buffer
+    }
+    bool opened = false;
+    int64_t balance = 0;
+    auto add = [&](const JournalRecord& record, HistoryKind kind, int counterparty, int64_t amount) {
+        if (!opened) return; // Opened before journaling began: no base balance
+        balance += amount;
+        HistoryEntry entry;
+        entry.timestamp = record.timestamp;
+        entry.lsn = record.lsn;
+        entry.kind = kind;
+        entry.counterparty = counterparty;
+        entry.amount = Money::fromMinor(amount);
+        entry.balance = Money::fromMinor(balance);
+        entries.push_back(entry);
+    };
+    attached->read([&](const JournalRecord& record) {
+        if (record.lsn >= beforeLsn) {
+            return false;
+        }
+        switch (record.op) {
+            case JournalOp::Open:
+                if (record.account == accountNumber) {
+                    opened = true;
+                    add(record, HistoryKind::Open, 0, record.amount);
+                }
+                break;
+            case JournalOp::Deposit:
+                if (record.account == accountNumber) add(record, HistoryKind::Deposit, 0, record.amount);
+                break;
+            case JournalOp::Withdraw:
+                if (record.account == accountNumber) add(record, HistoryKind::Withdrawal, 0, -record.amount);
+                break;
+            case JournalOp::Transfer:
+                if (record.account == accountNumber) add(record, HistoryKind::TransferOut, record.counterparty, -record.amount);
+                if (record.counterparty == accountNumber) add(record, HistoryKind::TransferIn, record.account, record.amount);
+                break;
+            case JournalOp::TransferDebit:
+                if (record.account == accountNumber) add(record, HistoryKind::TransferOut, record.counterparty, -record.amount);
+                break;
+            case JournalOp::TransferCredit:
+                if (record.account == accountNumber) add(record, HistoryKind::TransferIn, record.counterparty, record.amount);
+                break;
+            case JournalOp::Interest:
+                if (opened && balance > 0) {
+                    int64_t interest = Money::scaleRounded(balance, record.amount, 1000000, static_cast<RoundingMode>(record.rounding));
+                    if (interest > 0) add(record, HistoryKind::Interest, 0, interest);
+                }
+                break;
+            case JournalOp::ServiceCharge:
+                if (opened && balance >= record.amount) add(record, HistoryKind::ServiceCharge, 0, -record.amount);
+                break;
+            case JournalOp::JobChunk:
+                for (const auto& entry : record.entries) {
+                    if (entry.first != accountNumber) continue;
+                    add(record, static_cast<JobKind>(record.jobKind) == JobKind::Interest ? HistoryKind::Interest : HistoryKind::ServiceCharge,
+                        0, entry.second);
+                }
+                break;
+            case JournalOp::Post:
+                for (size_t i = 0; i < record.entries.size(); ++i) {
+                    const auto& change = record.entries[i];
+                    if (change.first != accountNumber) continue;
+                    int counterparty = record.entries.size() == 2 ? static_cast<int>(record.entries[1 - i].first) : 0;
+                    add(record, change.second < 0 ? HistoryKind::TransferOut : HistoryKind::TransferIn, counterparty, change.second);
+                }
+                break;
+            case JournalOp::Close:
+            case JournalOp::JobStart:
+            case JournalOp::JobEnd:
+                break;
+        }
+        return true;
+    });
+}
+
+TxResult Bank::recentHistory(int accountNumber, size_t count, vector<HistoryEntry>& entries) const {
+    entries.clear();
+    uint64_t spilledBefore;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        size_t slot = accounts.slotOf(accountNumber);
+        if (slot == AccountStore::npos) {
+            return TxResult::AccountNotFound;
+        }
+        lock_guard<mutex> stripe(stripes[stripeOf(accountNumber)].lock);
+        history.collect(accounts.history(slot), entries);
+        spilledBefore = accounts.history(slot).spilledBeforeLsn;
+    }
+    if (entries.size() < count && spilledBefore) {
+        vector<HistoryEntry> older;
+        journalHistory(accountNumber, spilledBefore, older);
+        size_t keep = min(older.size(), count - entries.size());
+        entries.insert(entries.begin(), older.end() - keep, older.end());
+    }
+    if (entries.size() > count) {
+        entries.erase(entries.begin(), entries.end() - count);
+    }
+    return TxResult::Ok;
+}
+
+TxResult Bank::historyBetween(int accountNumber, int64_t from, int64_t to, vector<HistoryEntry>& entries) const {
+    entries.clear();
+    vector<HistoryEntry> recent;
+    uint64_t spilledBefore;
+    {
+        shared_lock<shared_mutex> structure(structureLock);
+        size_t slot = accounts.slotOf(accountNumber);
+        if (slot == AccountStore::npos) {
+            return TxResult::AccountNotFound;
+        }
+        lock_guard<mutex> stripe(stripes[stripeOf(accountNumber)].lock);
+        history.collect(accounts.history(slot), recent);
+        spilledBefore = accounts.history(slot).spilledBeforeLsn;
+    }
+    auto inRange = [from, to](const HistoryEntry& entry) { return entry.timestamp >= from && entry.timestamp < to; };
+    // Go to the journal only if the range starts before what memory still holds
+    if (spilledBefore && (recent.empty() || recent.front().timestamp >= from)) {
+        vector<HistoryEntry> older;
+        journalHistory(accountNumber, spilledBefore, older);
+        copy_if(older.begin(), older.end(), back_inserter(entries), inRange);
+    }
+    copy_if(recent.begin(), recent.end(), back_inserter(entries), inRange);
+    return TxResult::Ok;
+}
+
+void Bank::setHistoryLimit(size_t bytesPerAccount) {
+    history.setLimit(bytesPerAccount);
+}
+
+void Bank::setHistoryCapacity(size_t bytes) {
+    history.setCapacity(bytes);
+}
+
+size_t Bank::historyBytes() const {
+    return history.segmentsInUse() * sizeof(HistorySegment);
+}
+
+bool Bank::phoneExists(const string& phone) const {
+    shared_lock<shared_mutex> structure(structureLock);
+    return accounts.containsPhone(phone);
+}
+
+size_t Bank::accountCount() const {
+    shared_lock<shared_mutex> structure(structureLock);
+    return accounts.size();
+}
+
+AccountPage Bank::accountsByNamePrefix(const string& prefix, size_t pageSize, const PageCursor& after) const {
+    AccountPage page;
+    shared_lock<shared_mutex> structure(structureLock);
+    accounts.forEachNamePrefix(AccountStore::foldName(prefix), after.name, after.accountNumber,
+                               [&](size_t slot) {
+        if (page.accounts.size() == pageSize) {
+            page.hasMore = true;
+            return false;
+        }
+        // Only the rows returned need their balance, so lock them one at a time
+        const AccountRow& record = accounts.record(slot);
+        lock_guard<mutex> stripe(stripes[stripeOf(record.accountNumber)].lock);
+        page.accounts.push_back(accounts.get(slot));
+        page.next.name = string(record.foldedName);
+        page.next.accountNumber = record.accountNumber;
+        return true;
+    });
+    return page;
+}
+
+AccountPage Bank::accountsWithBalanceOver(Money minimum, size_t pageSize, const PageCursor& after) const {
+    AccountPage page;
+    shared_lock<shared_mutex> structure(structureLock);
+    ReadView view(*this);
+    accounts.forEachSlotAfter(after.accountNumber, [&](size_t slot) {
+        Money balance = view.balance(slot);
+        if (!(balance > minimum)) return true;
+        if (page.accounts.size() == pageSize) {
+            page.hasMore = true;
+            return false;
+        }
+        page.accounts.push_back(accounts.get(slot, balance));
+        page.next.accountNumber = page.accounts.back().getAccountNumber();
+        return true;
+    });
+    return page;
+}
+
+Money Bank::totalBalance() const {
+    shared_lock<shared_mutex> structure(structureLock);
+    ReadView view(*this);
+    Money total;
+    accounts.forEachSlot([&](size_t slot) { total += view.balance(slot); });
+    return total;
+}
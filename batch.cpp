@@ -0,0 +1,303 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+// Waves smaller than this run on the calling thread; a fan-out costs more
+const size_t MIN_PARALLEL_ROWS = 512;
+
+struct Row {
+    const char* text;   // Points into the mapped input
+    uint32_t length;
+    uint32_t wave;
+    uint64_t line;
+    int32_t from;
+    int32_t to;
+    int64_t amount;
+    BatchStatus status;
+};
+
+// Fixed set of threads running parallel-for loops; the caller takes a share too
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned threads) {
+        for (unsigned i = 1; i < threads; ++i) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        start.notify_all();
+        for (thread& w : workers) w.join();
+    }
+
+    // Calls fn(begin, end) over [0, count) split evenly across all threads
+    void run(size_t count, const function<void(size_t, size_t)>& fn) {
+        size_t parts = workers.size() + 1;
+        if (parts == 1 || count < MIN_PARALLEL_ROWS) {
+            fn(0, count);
+            return;
+        }
+        {
+            lock_guard<mutex> guard(lock);
+            task = &fn;
+            taskCount = count;
+            pending = workers.size();
+            ++generation;
+        }
+        start.notify_all();
+        fn(0, count / parts);
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [this] { return pending == 0; });
+        task = nullptr;
+    }
+
+private:
+    vector<thread> workers;
+    mutex lock;
+    condition_variable start;
+    condition_variable finished;
+    const function<void(size_t, size_t)>* task = nullptr;
+    size_t taskCount = 0;
+    size_t pending = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void workerLoop(unsigned index) {
+        uint64_t seen = 0;
+        for (;;) {
+            const function<void(size_t, size_t)>* fn;
+            size_t count;
+            {
+                unique_lock<mutex> guard(lock);
+                start.wait(guard, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                fn = task;
+                count = taskCount;
+            }
+            size_t parts = workers.size() + 1;
+            (*fn)(count * index / parts, count * (index + 1) / parts);
+            {
+                lock_guard<mutex> guard(lock);
+                --pending;
+            }
+            finished.notify_one();
+        }
+    }
+};
+
+bool parseInt(const char*& p, const char* end, int32_t& out) {
+    bool negative = (p < end && *p == '-');
+    if (negative) ++p;
+    int64_t value = 0;
+    const char* digits = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p++ - '0');
+        if (value > INT32_MAX) return false;
+    }
+    if (p == digits) return false;
+    out = static_cast<int32_t>(negative ? -value : value);
+    return true;
+}
+
+// "from,to,amount" in place; no copies of the line are made
+void parseRow(Row& row) {
+    const char* p = row.text;
+    const char* end = row.text + row.length;
+    if (!parseInt(p, end, row.from) || p == end || *p++ != ',' ||
+        !parseInt(p, end, row.to) || p == end || *p++ != ',' ||
+        !parseScaledDecimal(p, static_cast<size_t>(end - p), 2, row.amount)) {
+        row.status = BatchStatus::ParseError;
+        return;
+    }
+    row.status = row.amount > 0 ? BatchStatus::Ok : BatchStatus::InvalidAmount;
+}
+
+BatchStatus toBatchStatus(TxResult result) {
+    switch (result) {
+        case TxResult::Ok:                return BatchStatus::Ok;
+        case TxResult::InvalidAmount:     return BatchStatus::InvalidAmount;
+        case TxResult::InsufficientFunds: return BatchStatus::InsufficientFunds;
+        case TxResult::VelocityLimit:     return BatchStatus::VelocityLimit;
+        default:                          return BatchStatus::AccountNotFound;
+    }
+}
+
+void appendRow(string& out, const Row& row) {
+    out += to_string(row.line);
+    out += ',';
+    out.append(row.text, row.length);
+    out += ',';
+    out += batchStatusName(row.status);
+    out += '\n';
+}
+
+// Read-only mapping of the input file
+class MappedFile {
+public:
+    explicit MappedFile(const string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("Cannot open batch file " + path + ": " + strerror(errno));
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw runtime_error("Cannot stat batch file " + path + ": " + strerror(errno));
+        }
+        length = static_cast<size_t>(st.st_size);
+        if (length > 0) {
+            void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                throw runtime_error("Cannot map batch file " + path + ": " + strerror(errno));
+            }
+            data = static_cast<const char*>(mapped);
+            ::madvise(const_cast<char*>(data), length, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+    }
+    ~MappedFile() {
+        if (data) ::munmap(const_cast<char*>(data), length);
+    }
+    const char* data = nullptr;
+    size_t length = 0;
+};
+
+} // namespace
+
+const char* batchStatusName(BatchStatus status) {
+    switch (status) {
+        case BatchStatus::Ok:                return "OK";
+        case BatchStatus::ParseError:        return "PARSE_ERROR";
+        case BatchStatus::InvalidAmount:     return "INVALID_AMOUNT";
+        case BatchStatus::AccountNotFound:   return "ACCOUNT_NOT_FOUND";
+        case BatchStatus::InsufficientFunds: return "INSUFFICIENT_FUNDS";
+        case BatchStatus::VelocityLimit:     return "VELOCITY_LIMIT";
+    }
+    return "UNKNOWN";
+}
+
+// BatchProcessor class methods implementation
+BatchProcessor::BatchProcessor(Bank& bank, unsigned threads, size_t windowRows)
+    : bank(bank), threads(threads ? threads : max(1u, thread::hardware_concurrency())), windowRows(max<size_t>(windowRows, 1)) {}
+
+BatchSummary BatchProcessor::run(const string& inputPath, const string& resultPath) {
+    auto started = chrono::steady_clock::now();
+    MappedFile input(inputPath);
+    FILE* results = fopen(resultPath.c_str(), "w");
+    if (!results) {
+        throw runtime_error("Cannot create result file " + resultPath + ": " + strerror(errno));
+    }
+
+    BatchSummary summary;
+    WorkerPool pool(threads);
+    vector<Row> rows;
+    vector<uint32_t> order;        // Row indices grouped by wave
+    vector<size_t> waveStart;
+    unordered_map<int32_t, uint32_t> lastWave;
+    string out;
+
+    const char* p = input.data;
+    const char* end = input.data + input.length;
+    uint64_t line = 0;
+    while (p < end) {
+        // Cut the next window of whole lines
+        rows.clear();
+        while (p < end && rows.size() < windowRows) {
+            const char* eol = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)));
+            if (!eol) eol = end;
+            const char* text = p;
+            size_t length = static_cast<size_t>(eol - p);
+            p = eol + (eol < end ? 1 : 0);
+            ++line;
+            if (length && text[length - 1] == '\r') --length;
+            if (length == 0 || text[0] == '#') continue;
+            Row row;
+            row.text = text;
+            row.length = static_cast<uint32_t>(length);
+            row.line = line;
+            row.wave = 0;
+            rows.push_back(row);
+        }
+
+        pool.run(rows.size(), [&rows](size_t begin, size_t stop) {
+            for (size_t i = begin; i < stop; ++i) parseRow(rows[i]);
+        });
+
+        // Wave of a row = one past the latest wave touching either account
+        lastWave.clear();
+        uint32_t waves = 0;
+        for (Row& row : rows) {
+            if (row.status != BatchStatus::Ok) continue;
+            uint32_t& a = lastWave[row.from];
+            uint32_t& b = lastWave[row.to];
+            row.wave = max(a, b) + 1;
+            a = b = row.wave;
+            waves = max(waves, row.wave);
+        }
+        waveStart.assign(waves + 2, 0);
+        for (const Row& row : rows) {
+            if (row.wave) ++waveStart[row.wave + 1];
+        }
+        for (size_t w = 1; w < waveStart.size(); ++w) waveStart[w] += waveStart[w - 1];
+        order.resize(waveStart.back());
+        {
+            vector<size_t> cursor(waveStart.begin(), waveStart.end());
+            for (size_t i = 0; i < rows.size(); ++i) {
+                if (rows[i].wave) order[cursor[rows[i].wave]++] = static_cast<uint32_t>(i);
+            }
+        }
+
+        for (uint32_t w = 1; w <= waves; ++w) {
+            size_t first = waveStart[w];
+            pool.run(waveStart[w + 1] - first, [&, first](size_t begin, size_t stop) {
+                for (size_t k = begin; k < stop; ++k) {
+                    Row& row = rows[order[first + k]];
+                    row.status = toBatchStatus(bank.transfer(row.from, row.to, Money::fromMinor(row.amount), Commit::Defer));
+                }
+            });
+        }
+        summary.waves += waves;
+
+        // Report the window only once it is durable
+        bank.syncJournal();
+        out.clear();
+        for (const Row& row : rows) {
+            appendRow(out, row);
+            ++summary.rows;
+            if (row.status == BatchStatus::Ok) ++summary.applied;
+            else if (row.status == BatchStatus::ParseError) ++summary.parseErrors;
+            else ++summary.rejected;
+        }
+        if (fwrite(out.data(), 1, out.size(), results) != out.size()) {
+            fclose(results);
+            throw runtime_error("Cannot write result file " + resultPath + ".");
+        }
+    }
+
+    fclose(results);
+    summary.seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    return summary;
+}
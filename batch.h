@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "project.h"
+
+using namespace std;
+
+// Per-row outcome written to the result file
+enum class BatchStatus : uint8_t {
+    Ok,
+    ParseError,
+    InvalidAmount,
+    AccountNotFound,
+    InsufficientFunds,
+    VelocityLimit
+};
+
+const char* batchStatusName(BatchStatus status);
+
+struct BatchSummary {
+    size_t rows = 0;
+    size_t applied = 0;
+    size_t parseErrors = 0;
+    size_t rejected = 0; // Parsed but refused: amount, unknown account, funds, limits
+    size_t waves = 0;    // Conflict-free groups the rows were applied in
+    double seconds = 0;
+};
+
+// Streaming ingestion of settlement files of transfers.
+//
+// Input is one transfer per line, "from,to,amount" (amount in major units
+// with up to two decimals); blank lines and lines starting with '#' are
+// skipped. The file is mapped and cut into windows of whole lines. Each
+// window is parsed in place, in parallel, then applied in conflict-free waves:
+// a row goes in the wave after the last one touching either of its accounts,
+// so rows in one wave share no account and can run on any thread while every
+// account still sees its transfers in file order. The outcome is therefore
+// identical to applying the file serially.
+//
+// The result file gets one "line,from,to,amount,STATUS" row per input row,
+// written only after the journal has made the batch durable.
+class BatchProcessor {
+public:
+    explicit BatchProcessor(Bank& bank, unsigned threads = 0, size_t windowRows = 1 << 16);
+
+    BatchSummary run(const string& inputPath, const string& resultPath);
+
+private:
+    Bank& bank;
+    unsigned threads;
+    size_t windowRows;
+};
@@ -0,0 +1,141 @@
+// Heap allocations per account: counts every operator new while the book is
+// built, while a third of it is deleted (and compacted), with a journal
+// attached, and while Account values are moved around; then checks that the
+// string arena shrinks once most rows are gone. Exits non-zero if the book
+// comes out wrong.
+//
+//   cmake --build build --target bench_alloc
+//   ./bench_alloc [accounts] [directory]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#include "project.h"
+
+using namespace std;
+
+namespace {
+
+atomic<size_t> allocations{0};
+atomic<size_t> allocatedBytes{0};
+
+// Allocations and bytes requested since construction
+struct Counter {
+    size_t count = allocations;
+    size_t bytes = allocatedBytes;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    void report(const char* what, size_t per) const {
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        printf("%-34s %7.2f allocs %9.1f bytes %8.0f ns  per account\n", what, double(allocations - count) / per,
+               double(allocatedBytes - bytes) / per, seconds * 1e9 / per);
+    }
+};
+
+// A mix of short names, which fit the string's inline buffer, and long ones
+string nameFor(size_t i) {
+    static const char* const FIRST[] = {"Asha", "Bartholomew", "Chen", "Dev", "Evangelina", "Farah"};
+    static const char* const LAST[] = {"Rao", "Vandenberghe", "Iyer", "Montgomery-Smith", "Nair"};
+    return string(FIRST[i % 6]) + " " + LAST[(i / 6) % 5];
+}
+
+} // namespace
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    allocatedBytes.fetch_add(size, memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    try {
+        return operator new(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+void* operator new[](size_t size, const nothrow_t& tag) noexcept { return operator new(size, tag); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? stoul(argv[1]) : 200000;
+    string dir = argc > 2 ? argv[2] : "/tmp";
+    bool ok = true;
+
+    // Realistic stored values, made up front so hashing is not counted
+    vector<string> names, phones, hashes;
+    for (size_t i = 0; i < count; ++i) {
+        names.push_back(nameFor(i));
+        phones.push_back(to_string(4000000000ULL + i));
+    }
+    for (int i = 0; i < 16; ++i) hashes.push_back(hashPassword("Secret@" + to_string(i), PasswordCost{4, 8, 1}));
+
+    vector<int> numbers;
+    numbers.reserve(count);
+    {
+        Bank bank;
+        Counter counter;
+        for (size_t i = 0; i < count; ++i) numbers.push_back(bank.addAccount(names[i], phones[i], hashes[i % 16], Money::fromMajor(10)));
+        counter.report("create, no journal:", count);
+
+        Counter churn;
+        for (size_t i = 0; i < count; i += 3) bank.close(numbers[i]);
+        churn.report("delete a third + compaction:", (count + 2) / 3);
+        ok &= bank.accountCount() == count - (count + 2) / 3;
+        ok &= bank.totalBalance() == Money::fromMajor(10) * static_cast<int64_t>(bank.accountCount());
+
+        Account account;
+        ok &= bank.getAccount(numbers[1], account) == TxResult::Ok && account.getName() == names[1] && account.getPhone() == phones[1];
+    }
+    {
+        string path = dir + "/bench_alloc.journal";
+        remove(path.c_str());
+        Journal journal(path, Journal::Durability::Async);
+        Bank bank;
+        bank.recover(journal);
+        Counter counter;
+        for (size_t i = 0; i < count; ++i) bank.addAccount(names[i], phones[i], hashes[i % 16], Money::fromMajor(10));
+        counter.report("create, async journal:", count);
+        remove(path.c_str());
+    }
+    {
+        // Straight on the store: erased rows' strings are dropped when a compaction pass ends
+        AccountStore store;
+        for (size_t i = 0; i < count; ++i) store.insert(static_cast<int>(i + 1), names[i], phones[i], hashes[i % 16], Money());
+        size_t full = store.arenaBytes();
+        for (size_t i = 0; i < count; ++i) {
+            if (i % 3 != 0) store.erase(static_cast<int>(i + 1));
+        }
+        store.compact();
+        printf("arena after deleting two thirds:   %zu -> %zu KiB\n", full / 1024, store.arenaBytes() / 1024);
+        ok &= store.arenaBytes() < full;
+        for (size_t i = 0; i < count; i += 3) {
+            size_t slot = store.slotOfPhone(phones[i]);
+            ok &= slot != AccountStore::npos && store.record(slot).name == names[i] && store.record(slot).passwordHash == hashes[i % 16];
+        }
+        size_t matches = 0;
+        store.forEachNamePrefix(AccountStore::foldName(names[3]), "", 0, [&](size_t) { return ++matches, true; });
+        ok &= matches != 0 && !store.containsPhone("40000000x0") && !store.containsPhone("400");
+    }
+    {
+        vector<Account> accounts;
+        for (size_t i = 0; i < 1000; ++i) accounts.emplace_back(static_cast<int>(i), names[i], phones[i], hashes[i % 16]);
+        vector<Account> moved;
+        moved.reserve(accounts.size());
+        Counter counter;
+        for (Account& account : accounts) moved.push_back(move(account));
+        counter.report("move an Account:", accounts.size());
+        ok &= moved[7].getName() == names[7];
+    }
+
+    printf("%s\n", ok ? "Book intact." : "ALLOCATION RUN FAILED");
+    return ok ? 0 : 1;
+}
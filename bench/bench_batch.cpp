@@ -0,0 +1,58 @@
+// Batch ingestion throughput: generate a book and a settlement file, run it
+// through BatchProcessor at several thread counts, and check the final total.
+//
+//   cmake --build build --target bench_batch
+//   ./bench_batch [accounts] [rows] [directory]
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include "batch.h"
+#include "project.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+    size_t accounts = argc > 1 ? stoul(argv[1]) : 100000;
+    size_t rows = argc > 2 ? stoul(argv[2]) : 2000000;
+    string dir = argc > 3 ? argv[3] : "/tmp";
+    string inputPath = dir + "/bench_batch.csv";
+    string resultPath = dir + "/bench_batch.result";
+    string journalPath = dir + "/bench_batch.journal";
+
+    {
+        mt19937_64 rng(42);
+        ofstream input(inputPath);
+        input << "# from,to,amount\n";
+        for (size_t i = 0; i < rows; ++i) {
+            int from = 1000 + static_cast<int>(rng() % accounts);
+            int to = 1000 + static_cast<int>(rng() % accounts);
+            input << from << ',' << to << ',' << (rng() % 500) << '.' << (rng() % 90 + 10) << '\n';
+        }
+    }
+
+    bool ok = true;
+    for (unsigned threads : {1u, 2u, 4u, 8u, 16u}) {
+        remove(journalPath.c_str());
+        Journal journal(journalPath);
+        Bank bank;
+        for (size_t i = 0; i < accounts; ++i) {
+            bank.addAccount("Cust " + to_string(i), to_string(1000000000ULL + i), "Pw@" + to_string(i), Money::fromMinor(100000));
+        }
+        bank.attachJournal(&journal);
+        Money before = bank.totalBalance();
+
+        BatchSummary summary = BatchProcessor(bank, threads).run(inputPath, resultPath);
+        bool conserved = bank.totalBalance() == before;
+        ok = ok && conserved && summary.rows == rows;
+        printf("%2u threads: %8.0f rows/s  (%zu applied, %zu rejected, %zu waves, %.2f s)%s\n", threads,
+               summary.rows / summary.seconds, summary.applied, summary.rejected, summary.waves, summary.seconds,
+               conserved ? "" : "  TOTAL NOT CONSERVED");
+    }
+
+    remove(inputPath.c_str());
+    remove(resultPath.c_str());
+    remove(journalPath.c_str());
+    return ok ? 0 : 1;
+}
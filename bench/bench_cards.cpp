@@ -0,0 +1,217 @@
+// ATM cards: card numbers, PIN checks and card withdrawals.
+//
+// Part 1 checks that card numbers are a bijection of account numbers into
+// the ten-digit card range (every one unique and mapped back to its
+// account) and that another secret gives other numbers. Part 2 checks the
+// Bank: PINs drawn at open authorize their card and nothing else, wrong
+// PINs lock a card after PIN_TRIES even for the right PIN, card withdrawals
+// move the balance like withdraw(), and a journal replay brings back the
+// cards, their PIN values and legacy rows with a plain PIN. Part 3 times
+// card authorizations and card withdrawals from several threads against
+// withdraw() by account number. Exits non-zero on failure.
+//
+//   cmake --build build --target bench_cards
+//   ./bench_cards [accounts] [operations per thread] [threads] [directory]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "project.h"
+
+using namespace std;
+
+namespace {
+
+struct Card {
+    int account;
+    int number;
+    string pin;
+};
+
+// Open `count` accounts with a card each, keeping the PINs handed out
+vector<Card> openCards(Bank& bank, size_t count, Money balance, uint64_t firstPhone = 5000000000) {
+    vector<Card> cards;
+    cards.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        Card card;
+        bank.openHashed("Card " + to_string(i), to_string(firstPhone + i), "Pw@1", true, card.account, Commit::Wait, &card.pin);
+        bank.deposit(card.account, balance);
+        Account account;
+        bank.getAccount(card.account, account);
+        card.number = account.getAtmCardNumber();
+        cards.push_back(card);
+    }
+    return cards;
+}
+
+string wrongPin(const string& pin) {
+    string wrong = pin;
+    wrong[0] = wrong[0] == '9' ? '0' : char(wrong[0] + 1);
+    return wrong;
+}
+
+// Calls per second over `threads` threads, each making `operations` calls of `call(thread, i)`
+template <typename Call>
+double rate(unsigned threads, size_t operations, Call call) {
+    vector<thread> workers;
+    auto start = chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            for (size_t i = 0; i < operations; ++i) call(t, i);
+        });
+    }
+    for (thread& worker : workers) worker.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return threads * operations / seconds;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t accountCount = argc > 1 ? stoul(argv[1]) : 100000;
+    size_t operations = argc > 2 ? stoul(argv[2]) : 1000000;
+    unsigned threads = argc > 3 ? stoul(argv[3]) : thread::hardware_concurrency();
+    string dir = argc > 4 ? argv[4] : "/tmp";
+    if (threads == 0) threads = 1;
+    bool ok = true;
+
+    // Part 1: card numbers
+    {
+        CardKeys keys("bench secret");
+        CardKeys other("another secret");
+        const int first = 1000, count = 1000000;
+        vector<int> numbers;
+        numbers.reserve(count);
+        bool bijection = true;
+        size_t differ = 0;
+        auto start = chrono::steady_clock::now();
+        for (int account = first; account < first + count; ++account) numbers.push_back(keys.cardNumber(account));
+        double perCard = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / count;
+        for (int i = 0; i < count; ++i) {
+            bijection &= numbers[i] >= CARD_NUMBER_BASE && keys.accountNumber(numbers[i]) == first + i;
+            differ += other.cardNumber(first + i) != numbers[i];
+        }
+        bijection &= keys.cardNumber(0) != keys.cardNumber(1) && keys.accountNumber(CARD_NUMBER_SPACE - 1) == -1;
+        bijection &= keys.cardNumber(static_cast<int>(CARD_NUMBER_SPACE - 1)) >= CARD_NUMBER_BASE;
+        sort(numbers.begin(), numbers.end());
+        bijection &= adjacent_find(numbers.begin(), numbers.end()) == numbers.end();
+        bijection &= differ > count - 10;
+        bool pins = CardKeys::isValidPin("0042") && !CardKeys::isValidPin("123") && !CardKeys::isValidPin("12a4");
+        pins &= keys.pinMatches(numbers[0], "1234", 1234) && !keys.pinMatches(numbers[0], "4321", 1234); // Legacy plain PIN
+        pins &= keys.pinValue(numbers[0], "1234") < 0 && keys.pinMatches(numbers[0], "1234", keys.pinValue(numbers[0], "1234"));
+        pins &= !keys.pinMatches(numbers[1], "1234", keys.pinValue(numbers[0], "1234"));
+        ok &= bijection && pins;
+        printf("card numbers: %d issued in %.0f ns each, %s; PIN values %s\n", count, perCard,
+               bijection ? "unique and reversible" : "WRONG", pins ? "ok" : "WRONG");
+    }
+
+    // Part 2: the Bank
+    {
+        string journalPath = dir + "/bank_cards_" + to_string(getpid()) + ".journal";
+        remove(journalPath.c_str());
+        Money opening = Money::fromMajor(1000);
+        const int LEGACY_ACCOUNT = 500, LEGACY_CARD = 54321;
+        bool bank2 = true;
+        vector<Card> cards;
+        {
+            Journal journal(journalPath, Journal::Durability::Async);
+            // A row from before card issuing: five-digit card, plain PIN
+            JournalRecord legacy;
+            legacy.op = JournalOp::Open;
+            legacy.account = LEGACY_ACCOUNT;
+            legacy.name = "Legacy";
+            legacy.phone = "5999999999";
+            legacy.passwordHash = "Pw@1";
+            legacy.amount = opening.minorUnits();
+            legacy.hasATM = true;
+            legacy.atmCardNumber = LEGACY_CARD;
+            legacy.atmPin = 1234;
+            journal.append(legacy);
+
+            Bank bank;
+            bank.attachJournal(&journal);
+            cards = openCards(bank, 4, opening);
+            int holder = 0;
+            bank2 &= bank.authorizeCard(cards[0].number, cards[0].pin, holder) == TxResult::Ok && holder == cards[0].account;
+            bank2 &= bank.authorizeCard(cards[1].number, cards[0].pin, holder) == TxResult::AuthFailed;
+            bank2 &= bank.authorizeCard(CARD_NUMBER_BASE + 7, "1234", holder) == TxResult::AuthFailed;
+            bank2 &= bank.authorizeCard(cards[0].number, "12x4", holder) == TxResult::AuthFailed;
+
+            // A right PIN clears earlier misses; PIN_TRIES misses in a row lock the card
+            string wrong = wrongPin(cards[1].pin);
+            bank2 &= bank.authorizeCard(cards[1].number, cards[1].pin, holder) == TxResult::Ok;
+            for (unsigned i = 0; i < Bank::PIN_TRIES; ++i) {
+                bank2 &= bank.cardWithdraw(cards[1].number, wrong, Money::fromMajor(1)) == TxResult::AuthFailed;
+            }
+            bank2 &= bank.authorizeCard(cards[1].number, wrong, holder) == TxResult::TooManyAttempts;
+            bank2 &= bank.cardWithdraw(cards[1].number, cards[1].pin, Money::fromMajor(1)) == TxResult::TooManyAttempts;
+            bank2 &= bank.authorizeCard(cards[2].number, cards[2].pin, holder) == TxResult::Ok; // Others unaffected
+
+            Money balance;
+            bank2 &= bank.cardWithdraw(cards[2].number, cards[2].pin, Money::fromMajor(300), &balance) == TxResult::Ok &&
+                     balance == opening - Money::fromMajor(300);
+            bank2 &= bank.cardWithdraw(cards[2].number, cards[2].pin, Money::fromMajor(701)) == TxResult::InsufficientFunds;
+            bank2 &= bank.cardWithdraw(cards[2].number, cards[2].pin, Money()) == TxResult::InvalidAmount;
+            bank2 &= bank.cardWithdraw(cards[3].number, cards[3].pin, Money::fromMajor(1)) == TxResult::Ok;
+            bank2 &= bank.close(cards[3].account) == TxResult::Ok;
+            bank.syncJournal();
+        }
+        {
+            Journal journal(journalPath);
+            Bank bank;
+            bank.recover(journal);
+            int holder = 0;
+            Money balance;
+            bank2 &= bank.authorizeCard(cards[0].number, cards[0].pin, holder) == TxResult::Ok && holder == cards[0].account;
+            bank2 &= bank.balance(cards[2].account, balance) == TxResult::Ok && balance == opening - Money::fromMajor(300);
+            bank2 &= bank.authorizeCard(cards[3].number, cards[3].pin, holder) == TxResult::AuthFailed; // Closed
+            bank2 &= bank.cardWithdraw(LEGACY_CARD, "1234", Money::fromMajor(1), &balance) == TxResult::Ok &&
+                     balance == opening - Money::fromMajor(1);
+            bank2 &= bank.authorizeCard(LEGACY_CARD, "4321", holder) == TxResult::AuthFailed;
+            // New accounts keep getting new cards after recovery
+            vector<Card> more = openCards(bank, 1, opening, 5100000000);
+            bank2 &= more[0].account > cards[3].account && bank.authorizeCard(more[0].number, more[0].pin, holder) == TxResult::Ok;
+        }
+        remove(journalPath.c_str());
+        ok &= bank2;
+        printf("bank: %s\n", bank2 ? "PINs, lockout, card withdrawals and recovery ok" : "WRONG");
+    }
+
+    // Part 3: throughput
+    {
+        Bank bank;
+        vector<Card> cards = openCards(bank, accountCount, Money::fromMajor(1000000));
+        vector<vector<uint32_t>> picks(threads, vector<uint32_t>(operations));
+        for (unsigned t = 0; t < threads; ++t) {
+            mt19937 random(t + 1);
+            for (uint32_t& pick : picks[t]) pick = random() % cards.size();
+        }
+        Money amount = Money::fromMinor(1);
+        size_t failures = 0;
+        vector<size_t> failed(threads);
+        double authorizations = rate(threads, operations, [&](unsigned t, size_t i) {
+            const Card& card = cards[picks[t][i]];
+            int holder;
+            failed[t] += bank.authorizeCard(card.number, card.pin, holder) != TxResult::Ok;
+        });
+        double cardWithdrawals = rate(threads, operations, [&](unsigned t, size_t i) {
+            const Card& card = cards[picks[t][i]];
+            failed[t] += bank.cardWithdraw(card.number, card.pin, amount) != TxResult::Ok;
+        });
+        double withdrawals = rate(threads, operations, [&](unsigned t, size_t i) {
+            failed[t] += bank.withdraw(cards[picks[t][i]].account, amount) != TxResult::Ok;
+        });
+        for (size_t f : failed) failures += f;
+        ok &= failures == 0;
+        printf("%zu cards, %u threads, %zu operations each\n", accountCount, threads, operations);
+        printf("card authorizations: %.0f/s\n", authorizations);
+        printf("card withdrawals:    %.0f/s\n", cardWithdrawals);
+        printf("withdrawals:         %.0f/s (by account number, for comparison)\n", withdrawals);
+        if (failures) printf("%zu calls failed: WRONG\n", failures);
+    }
+    return ok ? 0 : 1;
+}
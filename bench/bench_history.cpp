@@ -0,0 +1,179 @@
+// Transaction history: memory per account, query latency from memory and
+// from the journal, and a consistency check of the statements it returns
+// (running balances chain, match the live balance, survive a replay), also
+// with the pool full.
+//
+//   cmake --build build --target bench_history
+//   ./bench_history [accounts] [operations] [directory]
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include "project.h"
+
+using namespace std;
+
+namespace {
+
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+bool sameEntries(const vector<HistoryEntry>& a, const vector<HistoryEntry>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].timestamp != b[i].timestamp || a[i].lsn != b[i].lsn || a[i].kind != b[i].kind ||
+            a[i].counterparty != b[i].counterparty || a[i].amount != b[i].amount || a[i].balance != b[i].balance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Full statement: opens the account, balances chain, ends at the live balance
+bool consistent(const Bank& bank, int accountNumber) {
+    vector<HistoryEntry> entries;
+    Money live;
+    bank.recentHistory(accountNumber, SIZE_MAX, entries);
+    bank.balance(accountNumber, live);
+    if (entries.empty() || entries.front().kind != HistoryKind::Open) return false;
+    for (size_t i = 1; i < entries.size(); ++i) {
+        if (entries[i].balance != entries[i - 1].balance + entries[i].amount || entries[i].lsn < entries[i - 1].lsn) return false;
+    }
+    return entries.back().balance == live;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t accounts = argc > 1 ? stoul(argv[1]) : 100000;
+    size_t operations = argc > 2 ? stoul(argv[2]) : 4000000;
+    string dir = argc > 3 ? argv[3] : "/tmp";
+    string journalPath = dir + "/bench_history.journal";
+    remove(journalPath.c_str());
+
+    bool ok = true;
+    vector<int> sample;
+    vector<vector<HistoryEntry>> before;
+    {
+        Journal journal(journalPath, Journal::Durability::Async);
+        Bank bank;
+        bank.recover(journal);
+        for (size_t i = 0; i < accounts; ++i) {
+            bank.addAccount("Cust " + to_string(i), to_string(1000000000ULL + i), "Pw@" + to_string(i), Money::fromMajor(1000));
+        }
+
+        mt19937_64 rng(7);
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < operations; ++i) {
+            int account = 1000 + static_cast<int>(rng() % accounts);
+            Money amount = Money::fromMinor(static_cast<int64_t>(rng() % 5000) + 1);
+            switch (rng() % 3) {
+                case 0: bank.deposit(account, amount); break;
+                case 1: bank.withdraw(account, amount); break;
+                default: bank.transfer(account, 1000 + static_cast<int>(rng() % accounts), amount); break;
+            }
+            if (i % (operations / 4 + 1) == 0) {
+                BulkRunSummary summary;
+                bank.applyInterest(Rate::fromPpm(1500), RoundingMode::HalfEven, summary);
+            }
+        }
+        double seconds = secondsSince(start);
+        printf("%zu operations in %.2f s (%.0f ops/s, history recorded inline)\n", operations, seconds, operations / seconds);
+        printf("History limit %zu B/account, pool %.1f MiB = %.0f B/account\n", HistoryPool::DEFAULT_BYTES_PER_ACCOUNT,
+               bank.historyBytes() / 1048576.0, double(bank.historyBytes()) / accounts);
+
+        vector<HistoryEntry> entries;
+        size_t queries = 100000, returned = 0;
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < queries; ++i) {
+            bank.recentHistory(1000 + static_cast<int>(rng() % accounts), 20, entries);
+            returned += entries.size();
+        }
+        seconds = secondsSince(start);
+        printf("Last 20 from memory:    %.2f us/query (%.1f entries avg)\n", seconds * 1e6 / queries, double(returned) / queries);
+
+        // Small limit so the full statement has to go back to the journal
+        bank.setHistoryLimit(64);
+        for (int i = 0; i < 20; ++i) bank.deposit(1000, Money::fromMinor(1));
+        start = chrono::steady_clock::now();
+        bank.recentHistory(1000, SIZE_MAX, entries);
+        printf("Full statement from journal: %.1f ms (%zu entries)\n", secondsSince(start) * 1e3, entries.size());
+
+        for (int i = 0; i < 200; ++i) sample.push_back(1000 + static_cast<int>(rng() % accounts));
+        for (int account : sample) {
+            if (!consistent(bank, account)) {
+                printf("Inconsistent history for account %d\n", account);
+                ok = false;
+            }
+            // A time range must agree with filtering the full statement
+            bank.recentHistory(account, SIZE_MAX, entries);
+            int64_t from = entries[entries.size() / 3].timestamp, to = entries[entries.size() * 2 / 3].timestamp;
+            vector<HistoryEntry> range, expected;
+            bank.historyBetween(account, from, to, range);
+            for (const HistoryEntry& e : entries) {
+                if (e.timestamp >= from && e.timestamp < to) expected.push_back(e);
+            }
+            if (!sameEntries(range, expected)) {
+                printf("Range query mismatch for account %d\n", account);
+                ok = false;
+            }
+            vector<HistoryEntry> recent;
+            bank.recentHistory(account, 40, recent);
+            before.push_back(recent);
+        }
+    }
+
+    // Replay rebuilds the same history, timestamps included
+    {
+        Journal journal(journalPath);
+        Bank bank;
+        auto start = chrono::steady_clock::now();
+        bank.recover(journal);
+        printf("Replay with history:    %.2f s\n", secondsSince(start));
+        for (size_t i = 0; i < sample.size(); ++i) {
+            vector<HistoryEntry> recent;
+            bank.recentHistory(sample[i], 40, recent);
+            if (!sameEntries(recent, before[i])) {
+                printf("History of account %d differs after replay\n", sample[i]);
+                ok = false;
+            }
+        }
+    }
+
+    // A full pool never fails a commit: accounts keep recycling their own
+    // segments, and ones with none keep their history in the journal
+    {
+        remove(journalPath.c_str());
+        Journal journal(journalPath, Journal::Durability::Async);
+        Bank bank;
+        bank.recover(journal);
+        bank.setHistoryCapacity(64 * 1024); // One slab of 1024 segments
+        const int FULL_ACCOUNTS = 3000;
+        vector<int> numbers(FULL_ACCOUNTS);
+        bool committed = true;
+        for (int i = 0; i < FULL_ACCOUNTS; ++i) {
+            committed &= bank.openHashed("Full " + to_string(i), to_string(2000000000ULL + i), "Pw@1", false, numbers[i]) == TxResult::Ok;
+        }
+        mt19937_64 rng(9);
+        for (int i = 0; i < 10000; ++i) {
+            int account = numbers[rng() % FULL_ACCOUNTS];
+            Money amount = Money::fromMinor(static_cast<int64_t>(rng() % 5000) + 1);
+            committed &= bank.deposit(account, amount * 2) == TxResult::Ok;
+            committed &= bank.transfer(account, numbers[rng() % FULL_ACCOUNTS], amount) == TxResult::Ok;
+            committed &= bank.withdraw(account, amount) == TxResult::Ok;
+        }
+        bool statements = bank.historyBytes() <= 64 * 1024;
+        for (int i = 0; i < FULL_ACCOUNTS; i += 97) statements &= consistent(bank, numbers[i]);
+        if (!committed) printf("A change failed once the history pool was full\n");
+        if (!statements) printf("History wrong once the history pool was full\n");
+        printf("Full pool (%.0f KiB for %d accounts): %s\n", bank.historyBytes() / 1024.0, FULL_ACCOUNTS,
+               committed && statements ? "changes commit, statements complete" : "WRONG");
+        ok &= committed && statements;
+    }
+
+    remove(journalPath.c_str());
+    printf("%s\n", ok ? "History consistent." : "HISTORY CHECK FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+// Secondary index check and cost: builds a book, deletes a share of it so
+// compaction moves slots around, then compares every paged name-prefix and
+// balance query against a brute-force filter of forEachAccount, checks that
+// paging by account number resumes at the right slot while compaction runs,
+// and times the paged queries, first and deep pages, against a full dump.
+// Exits non-zero on any mismatch.
+//
+//   cmake --build build --target bench_index
+//   ./bench_index [accounts]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include "project.h"
+
+using namespace std;
+
+namespace {
+
+const char* const FIRST[] = {"Asha", "Arjun", "Bela", "Chen", "Dev", "Elena", "Farah", "Gopal", "Hana", "Ivan", "Jaya", "Kiran"};
+const char* const LAST[] = {"Shah", "Smith", "Sen", "Rao", "Iyer", "Kapoor", "Mehta", "Nair", "Patel", "Quinn"};
+
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Every row of a query, fetched page by page
+template <typename Query>
+vector<int> allPages(Query query, size_t pageSize) {
+    vector<int> numbers;
+    PageCursor cursor;
+    for (;;) {
+        AccountPage page = query(pageSize, cursor);
+        for (const Account& account : page.accounts) numbers.push_back(account.getAccountNumber());
+        if (!page.hasMore) return numbers;
+        cursor = page.next;
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? stoul(argv[1]) : 200000;
+    Bank bank;
+    mt19937_64 rng(11);
+    vector<int> numbers;
+    for (size_t i = 0; i < count; ++i) {
+        string name = string(FIRST[rng() % 12]) + " " + LAST[rng() % 10] + " " + to_string(rng() % 1000);
+        numbers.push_back(bank.addAccount(name, to_string(8000000000ULL + i), "Pw@1", Money::fromMinor(static_cast<int64_t>(rng() % 1000000))));
+    }
+    // Delete a third so tombstones trigger compaction and slots move
+    for (size_t i = 0; i < count; i += 3) bank.close(numbers[i]);
+    bool ok = true;
+    ok &= !bank.phoneExists(to_string(8000000000ULL)) && bank.phoneExists(to_string(8000000001ULL));
+
+    vector<Account> everyone;
+    bank.forEachAccount([&everyone](const Account& account) { everyone.push_back(account); });
+
+    for (const string prefix : {"a", "ARJ", "chen s", "Elena Smith 4", "kiran", "zz", ""}) {
+        string folded = AccountStore::foldName(prefix);
+        vector<pair<string, int>> expected;
+        for (const Account& account : everyone) {
+            string name = AccountStore::foldName(account.getName());
+            if (name.compare(0, folded.size(), folded) == 0) expected.emplace_back(name, account.getAccountNumber());
+        }
+        sort(expected.begin(), expected.end());
+        vector<int> got = allPages([&](size_t n, const PageCursor& c) { return bank.accountsByNamePrefix(prefix, n, c); }, 37);
+        bool same = got.size() == expected.size();
+        for (size_t i = 0; same && i < got.size(); ++i) same = got[i] == expected[i].second;
+        if (!same) printf("Name prefix \"%s\": %zu rows, expected %zu\n", prefix.c_str(), got.size(), expected.size());
+        ok &= same;
+    }
+
+    for (int64_t minimum : {0, 500000, 999000, 1000000}) {
+        vector<int> expected;
+        for (const Account& account : everyone) {
+            if (account.getBalance() > Money::fromMinor(minimum)) expected.push_back(account.getAccountNumber());
+        }
+        vector<int> got = allPages([&](size_t n, const PageCursor& c) { return bank.accountsWithBalanceOver(Money::fromMinor(minimum), n, c); }, 50);
+        if (got != expected) printf("Balance over %lld: %zu rows, expected %zu\n", static_cast<long long>(minimum), got.size(), expected.size());
+        ok &= got == expected;
+    }
+
+    // Paging resumes from a binary search over the slots; check it against
+    // the expected account after every erase, so some checks land in the
+    // middle of a compaction pass
+    {
+        AccountStore store;
+        vector<int> alive;
+        int next = 1000;
+        for (; next < 3000; ++next) {
+            store.insert(next, "Slot", to_string(7000000000ULL + next), "Pw@1", Money());
+            alive.push_back(next);
+        }
+        bool resumes = true;
+        for (int round = 0; round < 1500 && resumes; ++round) {
+            size_t victim = rng() % alive.size();
+            store.erase(alive[victim]);
+            alive.erase(alive.begin() + victim);
+            if (round % 5 == 0) {
+                store.insert(next, "Slot", to_string(7000000000ULL + next), "Pw@1", Money());
+                alive.push_back(next++);
+            }
+            int after = 999 + static_cast<int>(rng() % (next - 998));
+            int first = -1;
+            store.forEachSlotAfter(after, [&](size_t slot) {
+                first = store.record(slot).accountNumber;
+                return false;
+            });
+            auto expected = upper_bound(alive.begin(), alive.end(), after);
+            resumes = first == (expected == alive.end() ? -1 : *expected);
+        }
+        if (!resumes) printf("Paging resumed at the wrong account\n");
+        ok &= resumes;
+    }
+
+    const size_t queries = 20000;
+    auto start = chrono::steady_clock::now();
+    size_t rows = 0;
+    for (size_t i = 0; i < queries; ++i) {
+        string prefix = AccountStore::foldName(string(FIRST[rng() % 12]) + " " + LAST[rng() % 10]);
+        rows += bank.accountsByNamePrefix(prefix, 20).accounts.size();
+    }
+    printf("Name prefix, first page of 20: %.2f us/query (%.1f rows)\n", secondsSince(start) * 1e6 / queries, double(rows) / queries);
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < 1000; ++i) bank.accountsWithBalanceOver(Money::fromMinor(990000 + static_cast<int64_t>(rng() % 10000)), 20);
+    printf("Balance over, first page of 20: %.1f us/query\n", secondsSince(start) * 1e6 / 1000);
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < 1000; ++i) {
+        PageCursor deep;
+        deep.accountNumber = everyone[everyone.size() - 1 - rng() % (everyone.size() / 10 + 1)].getAccountNumber();
+        bank.accountsWithBalanceOver(Money(), 20, deep);
+    }
+    printf("Balance over, a page of 20 in the last tenth: %.1f us/query\n", secondsSince(start) * 1e6 / 1000);
+    start = chrono::steady_clock::now();
+    size_t dumped = 0;
+    bank.forEachAccount([&dumped](const Account&) { ++dumped; });
+    printf("Full dump of %zu accounts (no printing): %.1f us\n", dumped, secondsSince(start) * 1e6);
+
+    printf("%s\n", ok ? "Index queries match." : "INDEX CHECK FAILED");
+    return ok ? 0 : 1;
+}
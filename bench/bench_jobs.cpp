@@ -0,0 +1,192 @@
+// Bulk jobs: cost, live traffic during a job, and crash resume.
+//
+// Part 1 runs tiered interest over the book as a chunked job while other
+// threads keep depositing, and counts the deposits that complete during it
+// against those during a whole-book applyInterest pass; money must balance after.
+// Part 2 forks a child that runs a tiered service-charge job against a Sync
+// journal and SIGKILLs it partway, recovers, resumes the job and checks that
+// every account was charged exactly once. Exits non-zero on failure.
+//
+//   cmake --build build --target bench_jobs
+//   ./bench_jobs [accounts] [threads] [journal directory]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "project.h"
+
+using namespace std;
+
+namespace {
+
+Money seedBalance(size_t i) {
+    return Money::fromMinor(static_cast<int64_t>(i * 7919 % 2000000)); // 0 to 19999.99
+}
+
+vector<int> seed(Bank& bank, size_t accounts) {
+    vector<int> numbers;
+    for (size_t i = 0; i < accounts; ++i) {
+        numbers.push_back(bank.addAccount("Job " + to_string(i), to_string(8000000000ULL + i), "Pw@1", seedBalance(i)));
+    }
+    return numbers;
+}
+
+struct LiveResult {
+    size_t deposits = 0;       // Completed while `bulk` ran
+    size_t allDeposits = 0;
+    double bulkMillis = 0;
+};
+
+// Deposit one cent at a time from `threads` threads around a run of `bulk`
+template <typename Fn>
+LiveResult depositDuring(Bank& bank, const vector<int>& numbers, unsigned threads, Fn bulk) {
+    atomic<bool> running{true};
+    atomic<bool> inBulk{false};
+    atomic<size_t> deposits{0};
+    atomic<size_t> allDeposits{0};
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            for (size_t i = t; running; i += 13) {
+                bank.deposit(numbers[i % numbers.size()], Money::fromMinor(1));
+                if (inBulk) deposits++;
+                allDeposits++;
+            }
+        });
+    }
+    this_thread::sleep_for(chrono::milliseconds(20));
+    auto start = chrono::steady_clock::now();
+    inBulk = true;
+    bulk();
+    inBulk = false;
+    LiveResult result;
+    result.bulkMillis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    result.deposits = deposits;
+    running = false;
+    for (thread& w : workers) w.join();
+    result.allDeposits = allDeposits;
+    return result;
+}
+
+struct Shared {
+    atomic<size_t> chunksDone;
+    atomic<size_t> chunks;
+};
+
+[[noreturn]] void runChild(const string& path, const JobSpec& spec, unsigned threads, size_t killAfter, Shared* shared) {
+    Journal journal(path, Journal::Durability::Sync);
+    Bank bank;
+    bank.recover(journal);
+    JobRunner runner(bank, threads);
+    runner.onProgress([&](size_t done, size_t chunks) {
+        shared->chunks = chunks;
+        shared->chunksDone = done;
+        if (done >= killAfter) this_thread::sleep_for(chrono::seconds(10)); // Hold here until killed
+    });
+    BulkRunSummary summary;
+    runner.run(spec, summary);
+    _exit(0);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t accounts = argc > 1 ? stoul(argv[1]) : 200000;
+    unsigned threads = argc > 2 ? stoul(argv[2]) : 4;
+    string dir = argc > 3 ? argv[3] : "/tmp";
+    bool ok = true;
+
+    // Part 1: live deposits during a tiered interest job
+    JobSpec interest = JobSpec::parse(JobKind::Interest, "0:1,1000:2,10000:3");
+    {
+        Bank bank;
+        vector<int> numbers = seed(bank, accounts);
+        Money before = bank.totalBalance();
+        BulkRunSummary pass, job;
+        LiveResult duringPass = depositDuring(bank, numbers, threads, [&] { bank.applyInterest(Rate::fromPpm(10000), RoundingMode::HalfEven, pass); });
+        LiveResult duringJob = depositDuring(bank, numbers, threads, [&] { JobRunner(bank, threads).run(interest, job); });
+        printf("%zu accounts: whole-book pass %.1f ms with %zu deposits completed meanwhile\n", accounts, duringPass.bulkMillis,
+               duringPass.deposits);
+        printf("tiered job on %u threads: %.1f ms, %zu credited, %zu deposits completed meanwhile\n", threads, duringJob.bulkMillis,
+               job.accountsAffected, duringJob.deposits);
+
+        Money expected = before + Money::fromMinor(static_cast<int64_t>(duringPass.allDeposits + duringJob.allDeposits)) + pass.total + job.total;
+        if (bank.totalBalance() != expected || job.accountsScanned != accounts || !bank.unfinishedJobs().empty()) {
+            printf("Balances do not add up after the job\n");
+            ok = false;
+        }
+    }
+
+    // Part 2: kill a service-charge job partway and resume it
+    JobSpec charge = JobSpec::parse(JobKind::ServiceCharge, "0:5,50:2.50,5000:0");
+    charge.chunkAccounts = 64;
+    size_t crashAccounts = min<size_t>(accounts, 50000);
+    string path = dir + "/bank_jobs_" + to_string(getpid()) + ".journal";
+    remove(path.c_str());
+    {
+        Journal journal(path, Journal::Durability::Async);
+        Bank bank;
+        bank.attachJournal(&journal);
+        seed(bank, crashAccounts);
+    }
+    Shared* shared = static_cast<Shared*>(mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    new (shared) Shared{{0}, {0}};
+    size_t chunks = (crashAccounts + charge.chunkAccounts - 1) / charge.chunkAccounts;
+    pid_t child = fork();
+    if (child == 0) runChild(path, charge, threads, chunks / 3, shared);
+    while (shared->chunksDone < chunks / 3) this_thread::sleep_for(chrono::microseconds(200));
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+
+    {
+        Journal journal(path);
+        Bank bank;
+        bank.recover(journal);
+        JobProgress progress;
+        vector<uint64_t> unfinished = bank.unfinishedJobs();
+        if (unfinished.size() != 1 || !bank.jobProgress(unfinished[0], progress)) {
+            printf("Recovery did not find the interrupted job\n");
+            return 1;
+        }
+        size_t doneBefore = progress.chunksDone();
+        vector<BulkRunSummary> resumed = JobRunner(bank, threads).resume();
+        printf("killed after %zu of %zu chunks reported; %zu were journaled; resumed the other %zu\n", shared->chunksDone.load(),
+               progress.chunks(), doneBefore, progress.chunks() - doneBefore);
+
+        size_t wrong = 0;
+        size_t charged = 0;
+        for (size_t i = 0; i < crashAccounts; ++i) {
+            Money balance;
+            bank.balance(1000 + static_cast<int>(i), balance);
+            int64_t change = charge.changeFor(seedBalance(i));
+            charged += change != 0;
+            wrong += balance != seedBalance(i) + Money::fromMinor(change);
+        }
+        vector<HistoryEntry> history;
+        bank.recentHistory(1000 + 1, 10, history); // 79.19: charged 2.50 once
+        size_t charges = count_if(history.begin(), history.end(), [](const HistoryEntry& e) { return e.kind == HistoryKind::ServiceCharge; });
+        if (wrong || resumed.size() != 1 || resumed[0].accountsAffected != charged || charges != 1 || !bank.unfinishedJobs().empty() ||
+            doneBefore == 0 || doneBefore == progress.chunks()) {
+            printf("%zu accounts charged wrongly after resume\n", wrong);
+            ok = false;
+        }
+    }
+    {
+        // The end of the job is journaled too: a second recovery has nothing to resume
+        Journal journal(path);
+        Bank bank;
+        bank.recover(journal);
+        ok &= bank.unfinishedJobs().empty();
+    }
+    remove(path.c_str());
+
+    printf("%s\n", ok ? "Jobs consistent." : "JOBS CHECK FAILED");
+    return ok ? 0 : 1;
+}
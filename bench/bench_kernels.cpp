@@ -0,0 +1,78 @@
+// Month-end bulk pass benchmark: per-object Account path vs the balance
+// column kernels (scalar and AVX2).
+//
+//   cmake --build build --target bench_kernels
+//   ./bench_kernels [accounts]
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "project.h"
+
+using namespace std;
+
+namespace {
+
+template <typename Fn>
+double timeMs(Fn fn) {
+    auto start = chrono::steady_clock::now();
+    fn();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void report(const string& label, double ms, size_t accounts) {
+    cout << "  " << label << ": " << ms << " ms (" << (accounts / ms / 1000.0) << " M accounts/s)\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? stoul(argv[1]) : 1000000;
+    const Rate rate = Rate::parsePercent("1.25");
+    const Money charge = Money::parse("2.50");
+
+    mt19937_64 rng(42);
+    vector<Money> seed(count);
+    for (Money& m : seed) m = Money::fromMinor(static_cast<int64_t>(rng() % 5000000));
+
+    // Per-object path: the loop AccountManager used to run, one deposit/withdraw per Account
+    vector<Account> objects;
+    objects.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        objects.emplace_back(static_cast<int>(i), "Customer Name", "9876543210", "Secret@1", seed[i]);
+    }
+    double objectInterest = timeMs([&] {
+        for (Account& a : objects) {
+            Money interest = a.getBalance().applyRate(rate);
+            if (interest.isPositive()) a.deposit(interest);
+        }
+    });
+    double objectCharge = timeMs([&] {
+        for (Account& a : objects) {
+            try {
+                a.withdraw(charge);
+            } catch (const runtime_error&) {
+            }
+        }
+    });
+
+    cout << "Accounts: " << count << "\n";
+    cout << "Interest run\n";
+    report("per-object", objectInterest, count);
+    for (KernelIsa isa : {KernelIsa::Scalar, bestKernelIsa()}) {
+        vector<Money> column = seed;
+        double ms = timeMs([&] { interestKernel(column.data(), column.size(), rate, RoundingMode::HalfEven, isa); });
+        report(string("kernel/") + kernelIsaName(isa), ms, count);
+    }
+
+    cout << "Service charge run\n";
+    report("per-object", objectCharge, count);
+    vector<unsigned char> live(count, 1);
+    for (KernelIsa isa : {KernelIsa::Scalar, bestKernelIsa()}) {
+        vector<Money> column = seed;
+        double ms = timeMs([&] { serviceChargeKernel(column.data(), live.data(), column.size(), charge, isa); });
+        report(string("kernel/") + kernelIsaName(isa), ms, count);
+    }
+    return 0;
+}
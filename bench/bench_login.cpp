@@ -0,0 +1,92 @@
+// Login cost: scrypt verifications per second at several cost settings, the
+// cached path a returning client takes, and the attempt limiter cutting off
+// a password-guessing burst. Also checks the scrypt test vectors from
+// RFC 7914. Exits non-zero if any check fails.
+//
+//   cmake --build build --target bench_login
+//   ./bench_login [highest logN]
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include "project.h"
+
+using namespace std;
+
+namespace {
+
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+string hex(const uint8_t* data, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    string out;
+    for (size_t i = 0; i < length; ++i) {
+        out += digits[data[i] >> 4];
+        out += digits[data[i] & 15];
+    }
+    return out;
+}
+
+bool matchesVector(const string& password, const string& salt, PasswordCost cost, const string& expected) {
+    uint8_t out[64];
+    scrypt(password, reinterpret_cast<const uint8_t*>(salt.data()), salt.size(), cost, out, sizeof(out));
+    return hex(out, sizeof(out)) == expected;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int highest = argc > 1 ? stoi(argv[1]) : 16;
+    bool ok = true;
+
+    ok &= matchesVector("", "", {4, 1, 1},
+                       "77d6576238657b203b19ca42c18a0497f16b4844e3074ae8dfdffa3fede21442fcd0069ded0948f8326a753a0fc81f17e8d3e0fb2e0d3628cf35e20c38d18906");
+    ok &= matchesVector("password", "NaCl", {10, 8, 16},
+                       "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b3731622eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640");
+    printf("RFC 7914 vectors: %s\n", ok ? "ok" : "MISMATCH");
+
+    for (int logN = 10; logN <= highest; logN += 2) {
+        PasswordCost cost;
+        cost.logN = static_cast<uint8_t>(logN);
+        string stored = hashPassword("Secret@1", cost);
+        size_t rounds = logN <= 12 ? 50 : 5;
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < rounds; ++i) ok &= passwordMatches("Secret@1", stored);
+        double seconds = secondsSince(start);
+        ok &= !passwordMatches("Secret@2", stored);
+        printf("logN=%2d (%4d MiB): %7.1f ms/verify, %7.1f logins/s per core\n", logN, (128 * 8 << logN) >> 20,
+               seconds * 1e3 / rounds, rounds / seconds);
+    }
+
+    // A returning client: the first login pays for the hash, the rest hit the cache
+    Bank bank;
+    int account = bank.addAccount("Login", "9000000000", hashPassword("Secret@1"), Money::fromMajor(10));
+    auto start = chrono::steady_clock::now();
+    ok &= bank.authenticate(account, "Secret@1") == TxResult::Ok;
+    printf("First login:  %.1f ms\n", secondsSince(start) * 1e3);
+    const size_t cached = 1000000;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < cached; ++i) ok &= bank.authenticate(account, "Secret@1") == TxResult::Ok;
+    double seconds = secondsSince(start);
+    printf("Cached login: %.2f us (%.0f logins/s)\n", seconds * 1e6 / cached, cached / seconds);
+
+    // A wrong password never matches the cache and is limited after the burst
+    int other = bank.addAccount("Target", "9000000001", hashPassword("Secret@1", {10, 8, 1}), Money::fromMajor(10));
+    size_t refused = 0, failed = 0;
+    for (int i = 0; i < 20; ++i) {
+        TxResult result = bank.authenticate(other, "Guess@" + to_string(i));
+        if (result == TxResult::TooManyAttempts) ++refused;
+        else if (result == TxResult::AuthFailed) ++failed;
+    }
+    printf("Guessing burst: %zu rejected by hash, %zu refused by limiter\n", failed, refused);
+    ok &= failed == 5 && refused == 15;
+    ok &= bank.authenticate(other, "Secret@1") == TxResult::TooManyAttempts;
+
+    // Legacy plaintext rows still log in
+    int legacy = bank.addAccount("Legacy", "9000000002", "Plain@1", Money::fromMajor(10));
+    ok &= bank.authenticate(legacy, "Plain@1") == TxResult::Ok && bank.authenticate(legacy, "plain@1") == TxResult::AuthFailed;
+
+    printf("%s\n", ok ? "Login checks passed." : "LOGIN CHECK FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+// Instrumentation cost and correctness: ns per deposit on one thread and on
+// several, the merged per-thread counts against what was done, the share of
+// calls timed, histogram bucket bounds, and the Prometheus dump. Build it a second time with
+// -DBANK_NO_METRICS (every source file) to get the uninstrumented cost.
+// Exits non-zero on failure.
+//
+//   cmake --build build --target bench_metrics
+//   ./bench_metrics [operations per thread] [threads]
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "metrics.h"
+
+using namespace std;
+
+namespace {
+
+// Deposits spread over `numbers` from `threads` threads; returns ns per deposit
+double depositRun(Bank& bank, const vector<int>& numbers, unsigned threads, size_t perThread) {
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            for (size_t i = 0; i < perThread; ++i) bank.deposit(numbers[(i * 7 + t) % numbers.size()], Money::fromMinor(1));
+        });
+    }
+    for (thread& w : workers) w.join();
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / (perThread * threads);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t perThread = argc > 1 ? stoul(argv[1]) : 1000000;
+    unsigned threads = argc > 2 ? stoul(argv[2]) : 4;
+    bool ok = true;
+
+    Bank bank;
+    vector<int> numbers;
+    for (int i = 0; i < 1000; ++i) numbers.push_back(bank.addAccount("Metered " + to_string(i), to_string(7000000000ULL + i), "Pw@1", Money()));
+
+    Metrics::reset();
+    double single = depositRun(bank, numbers, 1, perThread);
+    double shared = depositRun(bank, numbers, threads, perThread / threads);
+    printf("metrics %s: %.1f ns/deposit on 1 thread, %.1f ns/deposit on %u threads\n", Metrics::enabled() ? "on" : "compiled out",
+           single, shared, threads);
+
+    // Failures the admin asks about
+    Money balance;
+    bank.balance(numbers[0], balance);
+    size_t refusals = 0;
+    for (int i = 0; i < 10; ++i) refusals += bank.withdraw(numbers[0], balance + Money::fromMajor(1)) == TxResult::InsufficientFunds;
+    size_t failedLogins = 0;
+    for (int i = 0; i < 3; ++i) failedLogins += bank.authenticate(numbers[1], "Wrong@1") == TxResult::AuthFailed;
+
+    if (Metrics::enabled()) {
+        MetricsSnapshot snapshot = Metrics::collect();
+        size_t deposits = perThread + perThread / threads * threads;
+        ok &= snapshot.count(MetricOp::Deposit, TxResult::Ok) == deposits;
+        // Timed: the first call of each thread and every DEFAULT_SAMPLE_EVERY-th after it
+        uint64_t timed = snapshot.latency[static_cast<size_t>(MetricOp::Deposit)].total;
+        ok &= timed * Metrics::DEFAULT_SAMPLE_EVERY >= deposits && timed <= deposits / Metrics::DEFAULT_SAMPLE_EVERY + threads + 1;
+        ok &= snapshot.count(MetricOp::Withdraw, TxResult::InsufficientFunds) == refusals;
+        ok &= snapshot.count(MetricOp::Authenticate, TxResult::AuthFailed) == failedLogins;
+        if (!ok) printf("Merged counts do not match the calls made\n");
+
+        const LatencyHistogram& h = snapshot.latency[static_cast<size_t>(MetricOp::Deposit)];
+        printf("deposit p50 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n", (unsigned long long)h.percentile(0.5),
+               (unsigned long long)h.percentile(0.99), (unsigned long long)h.percentile(0.999), (unsigned long long)h.maxNanos);
+
+        string text = Metrics::prometheus();
+        bool exported = text.find("bank_operations_total{op=\"deposit\",result=\"ok\"} " + to_string(deposits) + "\n") != string::npos &&
+                        text.find("bank_operation_duration_seconds_count{op=\"deposit\"} " + to_string(timed) + "\n") != string::npos &&
+                        text.find("bank_operations_total{op=\"authenticate\",result=\"auth_failed\"} 3\n") != string::npos;
+        if (!exported) {
+            printf("Prometheus dump is missing series\n");
+            ok = false;
+        }
+    }
+
+    // Every value lies inside its bucket, and buckets are at most 1/16 wide
+    mt19937_64 rng(1);
+    for (int i = 0; i < 1000000; ++i) {
+        uint64_t value = rng() >> (rng() % 64);
+        if (value >= (uint64_t(1) << 40)) value >>= 24;
+        size_t bucket = LatencyHistogram::bucketOf(value);
+        uint64_t low = LatencyHistogram::lowerBound(bucket), high = LatencyHistogram::upperBound(bucket);
+        if (value < low || value > high || (high - low) * 16 > low) {
+            printf("Value %llu misplaced in bucket %zu\n", (unsigned long long)value, bucket);
+            ok = false;
+            break;
+        }
+    }
+
+    printf("%s\n", ok ? "Metrics consistent." : "METRICS CHECK FAILED");
+    return ok ? 0 : 1;
+}
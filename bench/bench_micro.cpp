@@ -0,0 +1,207 @@
+// Engine microbenchmarks on Google Benchmark: account lookup, create,
+// delete, deposit, transfer, interest (whole-book pass and chunked job) and
+// snapshot serialization, over synthetic books of 10K and 1M accounts.
+// No journal is attached, so these time the engine alone; bench_mixed and
+// crash_recovery cover the journal.
+//
+// Built by CMake when Google Benchmark is installed (target bench_micro).
+//   ./bench_micro --benchmark_format=json --benchmark_out=micro.json
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+#include "book_generator.h"
+#include "project.h"
+
+using namespace std;
+
+namespace {
+
+const int FIRST_ACCOUNT = 1000;
+
+// Books are shared across benchmarks of the same size; building 1M accounts
+// takes longer than most of what is measured on them
+Bank& sharedBook(size_t accounts) {
+    static mutex lock; // Threaded benchmarks ask from every thread at once
+    static map<size_t, unique_ptr<Bank>> books;
+    lock_guard<mutex> guard(lock);
+    unique_ptr<Bank>& book = books[accounts];
+    if (!book) {
+        book.reset(new Bank());
+        BookSpec spec;
+        spec.accounts = accounts;
+        generateBook(*book, spec);
+    }
+    return *book;
+}
+
+// xorshift64: cheap enough not to show up next to the call measured
+struct Picker {
+    uint64_t state;
+    size_t accounts;
+    Picker(size_t accounts, uint64_t seed) : state(seed * 0x9e3779b97f4a7c15ULL | 1), accounts(accounts) {}
+    int next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return FIRST_ACCOUNT + static_cast<int>(state % accounts);
+    }
+};
+
+string tempPath(const char* what) {
+    return "/tmp/bank_micro_" + to_string(getpid()) + "_" + what;
+}
+
+void BM_Lookup(benchmark::State& state) {
+    size_t accounts = state.range(0);
+    Bank& bank = sharedBook(accounts);
+    Picker pick(accounts, state.thread_index() + 1);
+    for (auto _ : state) {
+        Money balance;
+        benchmark::DoNotOptimize(bank.balance(pick.next(), balance));
+        benchmark::DoNotOptimize(balance);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_PhoneLookup(benchmark::State& state) {
+    size_t accounts = state.range(0);
+    Bank& bank = sharedBook(accounts);
+    Picker pick(accounts, 7);
+    BookSpec spec;
+    vector<string> phones;
+    for (size_t i = 0; i < 4096; ++i) phones.push_back(generatedAccount(spec, pick.next() - FIRST_ACCOUNT).phone);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(bank.phoneExists(phones[i++ & 4095]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_Create(benchmark::State& state) {
+    Bank bank;
+    string hash = hashPassword("Create@1", PasswordCost{4, 1, 1});
+    uint64_t phone = 3000000000ULL;
+    for (auto _ : state) {
+        int number;
+        benchmark::DoNotOptimize(bank.openHashed("Created Account", to_string(phone++), hash, false, number));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_Delete(benchmark::State& state) {
+    size_t accounts = state.range(0);
+    unique_ptr<Bank> bank;
+    int next = 0, end = 0;
+    for (auto _ : state) {
+        if (next == end) {
+            state.PauseTiming();
+            bank.reset(new Bank());
+            BookSpec spec;
+            spec.accounts = accounts;
+            generateBook(*bank, spec);
+            next = FIRST_ACCOUNT;
+            end = FIRST_ACCOUNT + static_cast<int>(accounts);
+            state.ResumeTiming();
+        }
+        benchmark::DoNotOptimize(bank->close(next++));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_Deposit(benchmark::State& state) {
+    size_t accounts = state.range(0);
+    Bank& bank = sharedBook(accounts);
+    Picker pick(accounts, state.thread_index() + 1);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(bank.deposit(pick.next(), Money::fromMinor(1)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_Transfer(benchmark::State& state) {
+    size_t accounts = state.range(0);
+    Bank& bank = sharedBook(accounts);
+    Picker pick(accounts, state.thread_index() + 1);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(bank.transfer(pick.next(), pick.next(), Money::fromMinor(1)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_InterestPass(benchmark::State& state) {
+    size_t accounts = state.range(0);
+    Bank& bank = sharedBook(accounts);
+    for (auto _ : state) {
+        BulkRunSummary summary;
+        bank.applyInterest(Rate::fromPpm(10), RoundingMode::HalfEven, summary); // Small, so repeated passes cannot overflow
+        benchmark::DoNotOptimize(summary.total);
+    }
+    state.SetItemsProcessed(state.iterations() * accounts);
+}
+
+void BM_InterestJob(benchmark::State& state) {
+    size_t accounts = state.range(0);
+    Bank& bank = sharedBook(accounts);
+    JobSpec spec = JobSpec::interest(Rate::fromPpm(10), RoundingMode::HalfEven);
+    for (auto _ : state) {
+        BulkRunSummary summary;
+        JobRunner(bank, 1).run(spec, summary);
+        benchmark::DoNotOptimize(summary.total);
+    }
+    state.SetItemsProcessed(state.iterations() * accounts);
+}
+
+void BM_SnapshotSave(benchmark::State& state) {
+    size_t accounts = state.range(0);
+    Bank& bank = sharedBook(accounts);
+    string path = tempPath("save.snapshot");
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(bank.saveSnapshot(path));
+    }
+    remove(path.c_str());
+    state.SetItemsProcessed(state.iterations() * accounts);
+}
+
+void BM_SnapshotLoad(benchmark::State& state) {
+    size_t accounts = state.range(0);
+    string path = tempPath("load.snapshot");
+    string journalPath = tempPath("load.journal");
+    BookSpec spec;
+    spec.accounts = accounts;
+    writeBookSnapshot(spec, path);
+    for (auto _ : state) {
+        state.PauseTiming();
+        remove(journalPath.c_str());
+        {
+            Journal journal(journalPath, Journal::Durability::Async);
+            unique_ptr<Bank> bank(new Bank());
+            state.ResumeTiming();
+            bank->recover(journal, path);
+            state.PauseTiming();
+        }
+        state.ResumeTiming();
+    }
+    remove(path.c_str());
+    remove(journalPath.c_str());
+    state.SetItemsProcessed(state.iterations() * accounts);
+}
+
+} // namespace
+
+BENCHMARK(BM_Lookup)->Arg(10000)->Arg(1000000)->ThreadRange(1, 4);
+BENCHMARK(BM_PhoneLookup)->Arg(10000)->Arg(1000000);
+BENCHMARK(BM_Create);
+BENCHMARK(BM_Delete)->Arg(10000)->Arg(1000000);
+BENCHMARK(BM_Deposit)->Arg(10000)->Arg(1000000)->ThreadRange(1, 4);
+BENCHMARK(BM_Transfer)->Arg(10000)->Arg(1000000)->ThreadRange(1, 4);
+BENCHMARK(BM_InterestPass)->Arg(10000)->Arg(1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_InterestJob)->Arg(10000)->Arg(1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SnapshotSave)->Arg(10000)->Arg(1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_SnapshotLoad)->Arg(10000)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,216 @@
+// Mixed-workload load test: worker threads run a weighted mix of balance
+// reads, deposits, withdrawals, transfers, three-leg batch postings and
+// paged name reports against a synthetic book for a fixed time. Every call
+// is timed; the report gives throughput and p50/p90/p99/p99.9/max latency
+// per operation as JSON, for tracking regressions across builds. Money only
+// moves apart from deposits and withdrawals, so the final total must equal
+// the seeded one plus their net; exits non-zero if it does not.
+//
+//   Built by CMake (target bench_mixed), or:
+//   cmake --build build --target bench_mixed
+//   ./bench_mixed [threads] [seconds] [accounts] [mix] [none|async|sync] [directory] [json path]
+// The mix is weights by operation, e.g. balance:40,deposit:15,withdraw:10,transfer:25,post:5,report:5.
+// Without a JSON path the JSON goes to stdout and the summary to stderr.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "book_generator.h"
+#include "metrics.h"
+#include "project.h"
+
+using namespace std;
+
+namespace {
+
+enum Op { Balance, Deposit, Withdraw, Transfer, Post, Report, OPS };
+const char* const OP_LABELS[OPS] = {"balance", "deposit", "withdraw", "transfer", "post", "report"};
+const int FIRST_ACCOUNT = 1000;
+
+struct WorkerStats {
+    LatencyHistogram latency[OPS];
+    uint64_t ok[OPS] = {};
+    uint64_t failed[OPS] = {};
+    int64_t netDeposits = 0; // Minor units deposited less withdrawn
+};
+
+vector<unsigned> parseMix(const string& text) {
+    vector<unsigned> weights(OPS, 0);
+    stringstream in(text);
+    string item;
+    while (getline(in, item, ',')) {
+        size_t colon = item.find(':');
+        string name = item.substr(0, colon);
+        size_t op = 0;
+        while (op < OPS && name != OP_LABELS[op]) ++op;
+        if (op == OPS || colon == string::npos) {
+            throw invalid_argument("Unknown mix entry: " + item);
+        }
+        weights[op] = stoul(item.substr(colon + 1));
+    }
+    return weights;
+}
+
+void record(LatencyHistogram& histogram, uint64_t nanos) {
+    ++histogram.counts[LatencyHistogram::bucketOf(nanos)];
+    ++histogram.total;
+    histogram.sumNanos += nanos;
+    histogram.maxNanos = max(histogram.maxNanos, nanos);
+}
+
+void work(Bank& bank, size_t accounts, const vector<unsigned>& mix, unsigned id, atomic<bool>& running, WorkerStats& stats) {
+    vector<Op> table; // One entry per unit of weight
+    for (size_t op = 0; op < OPS; ++op) table.insert(table.end(), mix[op], static_cast<Op>(op));
+    uint64_t state = (id + 1) * 0x9e3779b97f4a7c15ULL;
+    auto next = [&state] {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+    auto account = [&] { return FIRST_ACCOUNT + static_cast<int>(next() % accounts); };
+    const char* const prefixes[] = {"A", "Ra", "Sa", "Vi", "Neha", "Ka"};
+    uint64_t posted = 0;
+
+    while (running.load(memory_order_relaxed)) {
+        Op op = table[next() % table.size()];
+        Money amount = Money::fromMinor(1 + static_cast<int64_t>(next() % 10000));
+        auto start = chrono::steady_clock::now();
+        bool ok = true;
+        switch (op) {
+            case Balance: {
+                Money balance;
+                ok = bank.balance(account(), balance) == TxResult::Ok;
+                break;
+            }
+            case Deposit:
+                ok = bank.deposit(account(), amount) == TxResult::Ok;
+                if (ok) stats.netDeposits += amount.minorUnits();
+                break;
+            case Withdraw:
+                ok = bank.withdraw(account(), amount) == TxResult::Ok;
+                if (ok) stats.netDeposits -= amount.minorUnits();
+                break;
+            case Transfer:
+                ok = bank.transfer(account(), account(), amount) == TxResult::Ok;
+                break;
+            case Post: {
+                // A split payment; account() may repeat, which post() nets
+                vector<Posting> legs{Posting{account(), -amount * 2}, Posting{account(), amount}, Posting{account(), amount}};
+                string key = "mixed-" + to_string(id) + "-" + to_string(posted++);
+                ok = bank.post(key, legs) == TxResult::Ok;
+                break;
+            }
+            case Report:
+                ok = !bank.accountsByNamePrefix(prefixes[next() % 6], 20).accounts.empty();
+                break;
+            case OPS:
+                break;
+        }
+        uint64_t nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        record(stats.latency[op], nanos);
+        ++(ok ? stats.ok : stats.failed)[op];
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    unsigned threads = argc > 1 ? stoul(argv[1]) : 4;
+    double seconds = argc > 2 ? stod(argv[2]) : 5.0;
+    size_t accounts = argc > 3 ? stoul(argv[3]) : 100000;
+    string mixText = argc > 4 ? argv[4] : "balance:40,deposit:15,withdraw:10,transfer:25,post:5,report:5";
+    string durability = argc > 5 ? argv[5] : "none";
+    string dir = argc > 6 ? argv[6] : "/tmp";
+    string jsonPath = argc > 7 ? argv[7] : "";
+    vector<unsigned> mix = parseMix(mixText);
+
+    string journalPath = dir + "/bank_mixed_" + to_string(getpid()) + ".journal";
+    unique_ptr<Journal> journal;
+    if (durability != "none") {
+        remove(journalPath.c_str());
+        journal.reset(new Journal(journalPath, durability == "sync" ? Journal::Durability::Sync : Journal::Durability::Async));
+    }
+    Bank bank;
+    BookSpec spec;
+    spec.accounts = accounts;
+    auto buildStart = chrono::steady_clock::now();
+    generateBook(bank, spec);
+    double buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - buildStart).count();
+    if (journal) bank.attachJournal(journal.get());
+    const Money seeded = bank.totalBalance();
+
+    vector<WorkerStats> stats(threads);
+    atomic<bool> running{true};
+    vector<thread> workers;
+    auto start = chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] { work(bank, accounts, mix, t, running, stats[t]); });
+    }
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    running = false;
+    for (thread& w : workers) w.join();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    LatencyHistogram latency[OPS];
+    uint64_t ok[OPS] = {}, failed[OPS] = {};
+    int64_t net = 0;
+    for (const WorkerStats& s : stats) {
+        for (size_t op = 0; op < OPS; ++op) {
+            latency[op].merge(s.latency[op]);
+            ok[op] += s.ok[op];
+            failed[op] += s.failed[op];
+        }
+        net += s.netDeposits;
+    }
+    Money total = bank.totalBalance();
+    bool conserved = total == seeded + Money::fromMinor(net);
+
+    LatencyHistogram all;
+    for (size_t op = 0; op < OPS; ++op) all.merge(latency[op]);
+    ostringstream json;
+    json << "{\n  \"benchmark\": \"mixed\",\n";
+    json << "  \"config\": {\"threads\": " << threads << ", \"seconds\": " << seconds << ", \"accounts\": " << accounts
+         << ", \"mix\": \"" << mixText << "\", \"journal\": \"" << durability << "\", \"metrics\": " << (Metrics::enabled() ? "true" : "false")
+         << ", \"hardware_threads\": " << thread::hardware_concurrency() << "},\n";
+    json << "  \"book_build_seconds\": " << buildSeconds << ",\n";
+    json << "  \"elapsed_seconds\": " << elapsed << ",\n";
+    json << "  \"total_ops\": " << all.total << ",\n";
+    json << "  \"throughput_ops_per_sec\": " << static_cast<uint64_t>(all.total / elapsed) << ",\n";
+    json << "  \"conserved\": " << (conserved ? "true" : "false") << ",\n";
+    json << "  \"ops\": {";
+    bool first = true;
+    for (size_t op = 0; op <= OPS; ++op) {
+        const LatencyHistogram& h = op == OPS ? all : latency[op];
+        if (op < OPS && mix[op] == 0) continue;
+        json << (first ? "\n" : ",\n") << "    \"" << (op == OPS ? "all" : OP_LABELS[op]) << "\": {\"count\": " << h.total;
+        if (op < OPS) json << ", \"ok\": " << ok[op] << ", \"failed\": " << failed[op];
+        json << ", \"ops_per_sec\": " << static_cast<uint64_t>(h.total / elapsed)
+             << ", \"mean_ns\": " << (h.total ? h.sumNanos / h.total : 0) << ", \"p50_ns\": " << h.percentile(0.50)
+             << ", \"p90_ns\": " << h.percentile(0.90) << ", \"p99_ns\": " << h.percentile(0.99) << ", \"p999_ns\": " << h.percentile(0.999)
+             << ", \"max_ns\": " << h.maxNanos << "}";
+        first = false;
+    }
+    json << "\n  }\n}\n";
+
+    if (jsonPath.empty()) {
+        cout << json.str();
+    } else {
+        ofstream(jsonPath) << json.str();
+    }
+    fprintf(stderr, "%u threads, %zu accounts, journal %s: %.0f ops/s, p99 %.1f us, p99.9 %.1f us\n", threads, accounts,
+            durability.c_str(), all.total / elapsed, all.percentile(0.99) / 1000.0, all.percentile(0.999) / 1000.0);
+    if (!conserved) {
+        fprintf(stderr, "Total is %s, expected %s\n", total.toString().c_str(), (seeded + Money::fromMinor(net)).toString().c_str());
+    }
+    journal.reset();
+    if (durability != "none") remove(journalPath.c_str());
+    return conserved && all.total > 0 ? 0 : 1;
+}
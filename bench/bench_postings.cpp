@@ -0,0 +1,198 @@
+// Batched postings with idempotency keys.
+//
+// Part 1 runs payroll batches (one employer debit, many salary credits) and
+// split payments from several threads, posting every batch twice and some
+// from two threads at once: each key must apply exactly once and money must
+// balance. Part 2 compares a payroll batch with the same legs as separate
+// transfers. Part 3 pushes far more keys than the window holds and checks
+// that memory stays bounded and recent keys are still caught. Part 4
+// recovers from the journal alone and from a snapshot plus the journal;
+// retried keys must still be recognised. Exits non-zero on failure.
+//
+//   cmake --build build --target bench_postings
+//   ./bench_postings [threads] [employees] [batches per thread] [directory]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "project.h"
+
+using namespace std;
+
+namespace {
+
+const Money SALARY = Money::fromMinor(123456);
+
+vector<int> seed(Bank& bank, size_t count, Money balance, uint64_t phoneBase) {
+    vector<int> numbers;
+    for (size_t i = 0; i < count; ++i) {
+        numbers.push_back(bank.addAccount("Post " + to_string(i), to_string(phoneBase + i), "Pw@1", balance));
+    }
+    return numbers;
+}
+
+vector<Posting> payroll(int employer, const vector<int>& employees) {
+    vector<Posting> legs{Posting{employer, -SALARY * static_cast<int64_t>(employees.size())}};
+    for (int employee : employees) legs.push_back(Posting{employee, SALARY});
+    return legs;
+}
+
+// Payer pays 10.00, split 5.00 / 3.00 / 2.00
+vector<Posting> split(int payer, int a, int b, int c) {
+    return {Posting{payer, -Money::fromMajor(10)}, Posting{a, Money::fromMajor(5)}, Posting{b, Money::fromMajor(3)},
+            Posting{c, Money::fromMajor(2)}};
+}
+
+double seconds(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    unsigned threads = argc > 1 ? stoul(argv[1]) : 4;
+    size_t employeeCount = argc > 2 ? stoul(argv[2]) : 200;
+    size_t batches = argc > 3 ? stoul(argv[3]) : 200;
+    string dir = argc > 4 ? argv[4] : "/tmp";
+    bool ok = true;
+
+    // Part 1: every batch twice, and the shared keys from two threads at once
+    {
+        Bank bank;
+        vector<int> employers = seed(bank, threads, Money::fromMajor(100000000), 6000000000ULL);
+        vector<int> employees = seed(bank, employeeCount, Money(), 6100000000ULL);
+        const Money seeded = bank.totalBalance();
+        atomic<size_t> applied{0}, duplicates{0}, failed{0};
+        vector<thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                for (size_t i = 0; i < batches; ++i) {
+                    // Payroll keys are per thread; split keys are shared, so pairs of threads race on them
+                    bool isPayroll = i % 2 == 0;
+                    string key = isPayroll ? "payroll-" + to_string(t) + "-" + to_string(i) : "split-" + to_string(t / 2) + "-" + to_string(i);
+                    int payer = employers[isPayroll ? t : t / 2 * 2];
+                    vector<Posting> legs = isPayroll ? payroll(payer, employees)
+                                                     : split(payer, employees[i % employeeCount], employees[(i + 1) % employeeCount],
+                                                             employees[(i + 2) % employeeCount]);
+                    for (int attempt = 0; attempt < 2; ++attempt) {
+                        bool duplicate = false;
+                        if (bank.post(key, legs, Commit::Wait, &duplicate) != TxResult::Ok) {
+                            ++failed;
+                        } else {
+                            ++(duplicate ? duplicates : applied);
+                        }
+                    }
+                }
+            });
+        }
+        for (thread& w : workers) w.join();
+
+        // Distinct keys: a payroll per thread per even batch, a split per thread pair per odd one
+        size_t payrolls = threads * ((batches + 1) / 2);
+        size_t splits = (threads + 1) / 2 * (batches / 2);
+        Money paid;
+        for (int employee : employees) {
+            Money balance;
+            bank.balance(employee, balance);
+            paid += balance;
+        }
+        Money expectedPaid = SALARY * static_cast<int64_t>(payrolls * employeeCount) + Money::fromMajor(10) * static_cast<int64_t>(splits);
+        printf("%zu batches applied once each, %zu retries recognised, %zu failed\n", applied.load(), duplicates.load(), failed.load());
+        ok &= applied == payrolls + splits && failed == 0 && paid == expectedPaid && bank.totalBalance() == seeded;
+        if (!ok) printf("Batches applied wrongly: employees hold %s, expected %s\n", paid.toString().c_str(), expectedPaid.toString().c_str());
+
+        // Unbalanced and overdrawn batches change nothing and release their key
+        ok &= bank.post("bad", {Posting{employees[0], Money::fromMajor(1)}, Posting{employees[1], Money::fromMajor(1)}}) == TxResult::InvalidAmount;
+        ok &= bank.post("poor", {Posting{employees[0], -paid}, Posting{employees[1], paid}}) == TxResult::InsufficientFunds;
+        ok &= bank.post("gone", {Posting{employers[0], -SALARY}, Posting{99999999, SALARY}}) == TxResult::AccountNotFound;
+        ok &= bank.totalBalance() == seeded;
+    }
+
+    // Part 2: one payroll batch against the same legs as separate transfers
+    {
+        Bank bank;
+        int employer = seed(bank, 1, Money::fromMajor(1000000000), 6200000000ULL)[0];
+        vector<int> employees = seed(bank, employeeCount, Money(), 6300000000ULL);
+        size_t rounds = 200;
+        auto start = chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; ++r) {
+            for (int employee : employees) bank.transfer(employer, employee, SALARY, Commit::Defer);
+        }
+        double separate = seconds(start);
+        vector<Posting> legs = payroll(employer, employees);
+        start = chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; ++r) bank.post("run-" + to_string(r), legs, Commit::Defer);
+        double batched = seconds(start);
+        printf("payroll of %zu: %.1f us as transfers, %.1f us as one batch (%.1fx)\n", employeeCount, separate / rounds * 1e6,
+               batched / rounds * 1e6, separate / batched);
+        Money last;
+        bank.balance(employees.back(), last);
+        ok &= last == SALARY * static_cast<int64_t>(2 * rounds);
+    }
+
+    // Part 3: the key window stays bounded however many keys go through it
+    {
+        const size_t capacity = 1 << 14;
+        IdempotencyKeys keys(capacity);
+        size_t total = capacity * 16;
+        size_t peak = 0;
+        uint64_t lsn;
+        for (size_t i = 0; i < total; ++i) {
+            uint64_t key = idempotencyHash("window-" + to_string(i));
+            if (keys.claim(key, lsn)) keys.release(key, true, i);
+            peak = max(peak, keys.bytes());
+        }
+        size_t caught = 0;
+        for (size_t i = total - capacity / 2; i < total; ++i) caught += !keys.claim(idempotencyHash("window-" + to_string(i)), lsn);
+        printf("%zu keys through a window of %zu: %zu held, peak %zu KiB; newest %zu all caught: %s; %.1f%% of claims settled by a filter\n",
+               total, capacity, keys.size(), peak / 1024, capacity / 2, caught == capacity / 2 ? "yes" : "no",
+               100.0 * keys.filteredLookups() / total);
+        ok &= caught == capacity / 2 && keys.size() <= capacity && keys.filteredLookups() > total * 9 / 10;
+    }
+
+    // Part 4: keys come back from the journal, and from a snapshot plus the journal
+    {
+        string journalPath = dir + "/bank_postings_" + to_string(getpid()) + ".journal";
+        string snapshotPath = dir + "/bank_postings_" + to_string(getpid()) + ".snapshot";
+        remove(journalPath.c_str());
+        remove(snapshotPath.c_str());
+        size_t keyCount = 1000;
+        Money expected;
+        {
+            Journal journal(journalPath, Journal::Durability::Async);
+            Bank bank;
+            bank.attachJournal(&journal);
+            vector<int> numbers = seed(bank, 4, Money::fromMajor(1000000), 6400000000ULL);
+            for (size_t i = 0; i < keyCount; ++i) {
+                if (i == keyCount / 2) bank.saveSnapshot(snapshotPath);
+                bank.post("order-" + to_string(i), split(numbers[0], numbers[1], numbers[2], numbers[3]), Commit::Defer);
+            }
+            bank.syncJournal();
+            bank.balance(numbers[0], expected);
+        }
+        for (int withSnapshot = 0; withSnapshot < 2; ++withSnapshot) {
+            Journal journal(journalPath);
+            Bank bank;
+            size_t replayed = bank.recover(journal, withSnapshot ? snapshotPath : "");
+            size_t reapplied = 0;
+            for (size_t i = 0; i < keyCount; ++i) {
+                bool duplicate = false;
+                bank.post("order-" + to_string(i), split(1000, 1001, 1002, 1003), Commit::Wait, &duplicate);
+                reapplied += !duplicate;
+            }
+            Money payer;
+            bank.balance(1000, payer);
+            printf("recovered %s (%zu records replayed): %zu of %zu retried keys applied again\n",
+                   withSnapshot ? "from snapshot + journal" : "from the journal", replayed, reapplied, keyCount);
+            ok &= reapplied == 0 && payer == expected;
+        }
+        remove(journalPath.c_str());
+        remove(snapshotPath.c_str());
+    }
+
+    printf("%s\n", ok ? "Postings consistent." : "POSTINGS CHECK FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,369 @@
+// Server mode over loopback: runs a BankServer in-process and drives it from
+// client threads, each with one connection keeping a window of pipelined
+// requests in flight. Reports p50/p99/p999 latency of deposit, withdraw and
+// transfer, checks that the book balances against the replies, that
+// malformed or unauthorised requests are refused, and that a card opened
+// over the wire can withdraw with the PIN its Open reply carried, and that
+// credits that would overflow a balance are refused. Exits non-zero on
+// failure.
+//
+//   cmake --build build --target bench_server
+//   ./bench_server [connections] [pipeline depth] [requests per connection] [event loops] [sync|async] [directory]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "server.h"
+
+using namespace std;
+
+namespace {
+
+const int ACCOUNTS_PER_CONNECTION = 32;
+const Money SEED_BALANCE = Money::fromMajor(1000);
+const char* const PASSWORD = "Load@123";
+
+// Blocking client end of one connection; frames requests and reads replies
+class Client {
+public:
+    explicit Client(uint16_t port) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            throw runtime_error("Cannot connect to the server");
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    ~Client() { close(fd); }
+
+    // Requests are built into `pending` and go out together on send()
+    void login(uint32_t tag, int account, const string& password) {
+        size_t start = begin(WireOp::Login, tag);
+        put(account, 4);
+        put(password.size(), 2);
+        pending.append(password);
+        end(start);
+    }
+    void money(WireOp op, uint32_t tag, int account, int64_t amount) {
+        size_t start = begin(op, tag);
+        put(account, 4);
+        put(amount, 8);
+        end(start);
+    }
+    void transfer(uint32_t tag, int from, int to, int64_t amount) {
+        size_t start = begin(WireOp::Transfer, tag);
+        put(from, 4);
+        put(to, 4);
+        put(amount, 8);
+        end(start);
+    }
+    void open(uint32_t tag, bool withATM, const string& name, const string& phone, const string& password) {
+        size_t start = begin(WireOp::Open, tag);
+        put(withATM, 1);
+        for (const string* text : {&name, &phone, &password}) {
+            put(text->size(), 2);
+            pending.append(*text);
+        }
+        end(start);
+    }
+    void cardWithdraw(uint32_t tag, int card, const string& pin, int64_t amount) {
+        size_t start = begin(WireOp::CardWithdraw, tag);
+        put(card, 4);
+        put(pin.size(), 2);
+        pending.append(pin);
+        put(amount, 8);
+        end(start);
+    }
+    void raw(const string& bytes) { pending.append(bytes); }
+    void send() {
+        for (size_t sent = 0; sent < pending.size();) {
+            ssize_t n = ::send(fd, pending.data() + sent, pending.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) throw runtime_error("Send failed");
+            sent += n;
+        }
+        pending.clear();
+    }
+
+    struct Reply {
+        uint32_t tag;
+        uint8_t status;
+        int64_t value;
+        int card = 0; // Open with a card only
+        string pin;
+    };
+    // Next reply, reading more from the socket only when none is buffered
+    bool next(Reply& reply, bool block = true) {
+        while (in.size() - at < 4 || in.size() - at < 4 + get(in.data() + at, 4)) {
+            if (!block) return false;
+            in.erase(0, at);
+            at = 0;
+            char chunk[64 * 1024];
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n <= 0) throw runtime_error("Server closed the connection");
+            in.append(chunk, n);
+            block = true;
+        }
+        const char* p = in.data() + at;
+        reply.tag = static_cast<uint32_t>(get(p + 4, 4));
+        reply.status = static_cast<uint8_t>(p[8]);
+        reply.value = static_cast<int64_t>(get(p + 9, 8));
+        size_t length = get(p, 4);
+        if (length > 13) {
+            reply.card = static_cast<int>(get(p + 17, 4));
+            reply.pin.assign(p + 23, get(p + 21, 2));
+        }
+        at += 4 + length;
+        return true;
+    }
+
+private:
+    int fd;
+    string pending;
+    string in;
+    size_t at = 0;
+
+    void put(uint64_t value, size_t bytes) {
+        for (size_t i = 0; i < bytes; ++i) pending.push_back(static_cast<char>(value >> (8 * i)));
+    }
+    static uint64_t get(const char* p, size_t bytes) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < bytes; ++i) value |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+        return value;
+    }
+    size_t begin(WireOp op, uint32_t tag) {
+        size_t start = pending.size();
+        put(0, 4); // Length, patched by end()
+        put(static_cast<uint8_t>(op), 1);
+        put(tag, 4);
+        return start;
+    }
+    void end(size_t start) {
+        uint32_t length = static_cast<uint32_t>(pending.size() - start - 4);
+        for (size_t i = 0; i < 4; ++i) pending[start + i] = static_cast<char>(length >> (8 * i));
+    }
+};
+
+struct Result {
+    vector<uint32_t> latency[3]; // Nanoseconds: deposit, withdraw, transfer
+    int64_t deposited = 0;       // Minor units the server acknowledged
+    int64_t withdrawn = 0;
+    size_t refused = 0;
+};
+
+// One client thread: log in to its accounts, then keep `depth` requests in flight
+void drive(uint16_t port, const vector<int>& own, const vector<int>& all, size_t depth, size_t requests, unsigned seed,
+           Result& result) {
+    Client client(port);
+    for (size_t i = 0; i < own.size(); ++i) client.login(static_cast<uint32_t>(i), own[i], PASSWORD);
+    client.send();
+    Client::Reply reply;
+    for (size_t i = 0; i < own.size(); ++i) {
+        client.next(reply);
+        if (reply.status != static_cast<uint8_t>(TxResult::Ok)) throw runtime_error("Login refused");
+    }
+
+    mt19937_64 rng(seed);
+    struct InFlight {
+        int kind;
+        int64_t amount;
+        chrono::steady_clock::time_point sent;
+    };
+    vector<InFlight> window(depth);
+    size_t issued = 0, completed = 0;
+    auto issue = [&] {
+        InFlight& slot = window[issued % depth];
+        slot.kind = static_cast<int>(rng() % 3);
+        slot.amount = 1 + static_cast<int64_t>(rng() % 5000);
+        int account = own[rng() % own.size()];
+        uint32_t tag = static_cast<uint32_t>(issued);
+        if (slot.kind == 0) client.money(WireOp::Deposit, tag, account, slot.amount);
+        if (slot.kind == 1) client.money(WireOp::Withdraw, tag, account, slot.amount);
+        if (slot.kind == 2) client.transfer(tag, account, all[rng() % all.size()], slot.amount);
+        slot.sent = chrono::steady_clock::now();
+        ++issued;
+    };
+    while (issued < min(depth, requests)) issue();
+    client.send();
+    while (completed < requests) {
+        // Take every reply already buffered, then refill the window in one send
+        bool block = true;
+        while (completed < issued && client.next(reply, block)) {
+            block = false;
+            auto now = chrono::steady_clock::now();
+            InFlight& slot = window[reply.tag % depth];
+            if (reply.tag != completed) throw runtime_error("Reply out of order");
+            result.latency[slot.kind].push_back(static_cast<uint32_t>(chrono::duration_cast<chrono::nanoseconds>(now - slot.sent).count()));
+            if (reply.status == static_cast<uint8_t>(TxResult::Ok)) {
+                if (slot.kind == 0) result.deposited += slot.amount;
+                if (slot.kind == 1) result.withdrawn += slot.amount;
+            } else {
+                ++result.refused;
+            }
+            ++completed;
+        }
+        while (issued < requests && issued - completed < depth) issue();
+        client.send();
+    }
+}
+
+double percentile(vector<uint32_t>& values, double fraction) {
+    if (values.empty()) return 0;
+    size_t index = min(values.size() - 1, static_cast<size_t>(fraction * values.size()));
+    nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index] / 1000.0;
+}
+
+// A request that must come back with `expected` status
+bool expectStatus(uint16_t port, const string& frame, uint8_t expected) {
+    Client client(port);
+    client.raw(frame);
+    client.send();
+    Client::Reply reply;
+    client.next(reply);
+    return reply.status == expected;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t connections = argc > 1 ? stoul(argv[1]) : 16;
+    size_t depth = argc > 2 ? stoul(argv[2]) : 16;
+    size_t requests = argc > 3 ? stoul(argv[3]) : 20000;
+    unsigned loopCount = argc > 4 ? stoul(argv[4]) : 1;
+    bool sync = argc > 5 ? string(argv[5]) == "sync" : false;
+    string dir = argc > 6 ? argv[6] : "/tmp";
+    bool ok = true;
+
+    string path = dir + "/bench_server.journal";
+    remove(path.c_str());
+    Journal journal(path, sync ? Journal::Durability::Sync : Journal::Durability::Async);
+    Bank bank;
+    bank.recover(journal);
+    string hash = hashPassword(PASSWORD, PasswordCost{4, 8, 1}); // Cheap, so logins do not dominate setup
+    vector<int> numbers;
+    for (size_t i = 0; i < connections * ACCOUNTS_PER_CONNECTION; ++i) {
+        numbers.push_back(bank.addAccount("Load " + to_string(i), to_string(6000000000ULL + i), hash, SEED_BALANCE));
+    }
+    Money seeded = bank.totalBalance();
+
+    BankServer server(bank, &journal, 0, loopCount);
+    thread serving([&server] { server.run(); });
+
+    vector<Result> results(connections);
+    vector<thread> clients;
+    atomic<bool> failed{false};
+    auto start = chrono::steady_clock::now();
+    for (size_t c = 0; c < connections; ++c) {
+        clients.emplace_back([&, c] {
+            vector<int> own(numbers.begin() + c * ACCOUNTS_PER_CONNECTION, numbers.begin() + (c + 1) * ACCOUNTS_PER_CONNECTION);
+            try {
+                drive(server.port(), own, numbers, depth, requests, static_cast<unsigned>(c + 1), results[c]);
+            } catch (const exception& e) {
+                printf("Client %zu: %s\n", c, e.what());
+                failed = true;
+            }
+        });
+    }
+    for (thread& client : clients) client.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    printf("%zu connections x %zu in flight, %u event loop(s), %s journal: %.0f requests/s\n", connections, depth, loopCount,
+           sync ? "sync" : "async", connections * requests / seconds);
+    printf("%-10s %10s %10s %10s %10s\n", "op", "count", "p50 us", "p99 us", "p999 us");
+    const char* names[] = {"deposit", "withdraw", "transfer"};
+    int64_t deposited = 0, withdrawn = 0;
+    size_t refused = 0;
+    for (int kind = 0; kind < 3; ++kind) {
+        vector<uint32_t> all;
+        for (Result& result : results) all.insert(all.end(), result.latency[kind].begin(), result.latency[kind].end());
+        printf("%-10s %10zu %10.1f %10.1f %10.1f\n", names[kind], all.size(), percentile(all, 0.50), percentile(all, 0.99),
+               percentile(all, 0.999));
+    }
+    for (Result& result : results) {
+        deposited += result.deposited;
+        withdrawn += result.withdrawn;
+        refused += result.refused;
+    }
+    printf("%zu refused (insufficient funds)\n", refused);
+    if (failed || bank.totalBalance() != seeded + Money::fromMinor(deposited - withdrawn)) {
+        printf("Book does not match the acknowledged replies\n");
+        ok = false;
+    }
+
+    // Refusals: an unknown op, a short body, and a withdrawal without a login
+    string unknownOp("\x05\x00\x00\x00\x7f\x01\x00\x00\x00", 9);
+    string shortBody("\x06\x00\x00\x00\x05\x02\x00\x00\x00\x01", 10);
+    string noLogin("\x11\x00\x00\x00\x05\x03\x00\x00\x00", 9);
+    for (int i = 0; i < 4; ++i) noLogin.push_back(static_cast<char>(numbers[0] >> (8 * i)));
+    noLogin.append(string("\x01\x00\x00\x00\x00\x00\x00\x00", 8));
+    if (!expectStatus(server.port(), unknownOp, static_cast<uint8_t>(WireError::Malformed)) ||
+        !expectStatus(server.port(), shortBody, static_cast<uint8_t>(WireError::Malformed)) ||
+        !expectStatus(server.port(), noLogin, static_cast<uint8_t>(WireError::NotLoggedIn))) {
+        printf("Bad requests were not refused\n");
+        ok = false;
+    }
+
+    // A card opened over the wire: its number and PIN come back once, in the Open reply
+    {
+        Client client(server.port());
+        Client::Reply opened, deposited, wrong, withdrawn;
+        client.open(1, true, "Wire Card", "6900000000", PASSWORD);
+        client.send();
+        client.next(opened);
+        string wrongPin = opened.pin.empty() ? "0000" : string(1, opened.pin[0] == '9' ? '0' : char(opened.pin[0] + 1)) + opened.pin.substr(1);
+        client.money(WireOp::Deposit, 2, static_cast<int>(opened.value), 5000);
+        client.cardWithdraw(3, opened.card, wrongPin, 1000);
+        client.cardWithdraw(4, opened.card, opened.pin, 1000);
+        client.send();
+        client.next(deposited);
+        client.next(wrong);
+        client.next(withdrawn);
+        if (opened.status != static_cast<uint8_t>(TxResult::Ok) || opened.card < CARD_NUMBER_BASE || !CardKeys::isValidPin(opened.pin) ||
+            wrong.status != static_cast<uint8_t>(TxResult::AuthFailed) || withdrawn.status != static_cast<uint8_t>(TxResult::Ok) ||
+            withdrawn.value != 4000) {
+            printf("Card opened over the wire could not withdraw\n");
+            ok = false;
+        }
+
+        // Credits that would overflow a balance are refused, over the wire and in the engine
+        int holder = static_cast<int>(opened.value);
+        Client::Reply huge;
+        client.money(WireOp::Deposit, 5, holder, INT64_MAX);
+        client.send();
+        client.next(huge);
+        Money balance;
+        bool refused = huge.status == static_cast<uint8_t>(TxResult::InvalidAmount) && bank.balance(holder, balance) == TxResult::Ok &&
+                       balance == Money::fromMinor(4000);
+        refused &= bank.deposit(holder, Money::fromMinor(INT64_MAX - 4000)) == TxResult::Ok;
+        refused &= bank.transfer(numbers[0], holder, Money::fromMinor(1)) == TxResult::InvalidAmount;
+        refused &= bank.creditLeg(holder, numbers[0], Money::fromMinor(1), 1) == TxResult::InvalidAmount;
+        refused &= bank.post("", {Posting{numbers[0], -Money::fromMinor(1)}, Posting{holder, Money::fromMinor(1)}}) == TxResult::InvalidAmount;
+        refused &= bank.balance(holder, balance) == TxResult::Ok && balance == Money::fromMinor(INT64_MAX);
+        if (!refused) {
+            printf("A credit overflowed a balance\n");
+            ok = false;
+        }
+    }
+
+    server.stop();
+    serving.join();
+    remove(path.c_str());
+    printf("%s\n", ok ? "Server replies consistent." : "SERVER CHECK FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+// Sharded book experiment (see shards.h): transfer throughput over 1-64
+// client threads against the single striped Bank and the ShardedBank, a
+// conservation audit while cross-shard transfers run, and a recovery check
+// that a transfer cut off between its debit and its credit is refunded.
+// Exits non-zero on failure.
+//
+//   cmake --build build --target bench_shards
+//   ./bench_shards [max threads] [shards] [accounts] [transfers per point] [directory]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "shards.h"
+
+using namespace std;
+
+namespace {
+
+const Money SEED_BALANCE = Money::fromMajor(1000);
+
+template <typename Book>
+vector<int> seed(Book& book, size_t accounts) {
+    vector<int> numbers;
+    for (size_t i = 0; i < accounts; ++i) {
+        numbers.push_back(book.addAccount("Shard " + to_string(i), to_string(5000000000ULL + i), "Pw@1", SEED_BALANCE));
+    }
+    return numbers;
+}
+
+// Transfers per second with `threads` clients sharing `total` random transfers
+template <typename Book>
+double run(Book& book, const vector<int>& numbers, unsigned threads, size_t total) {
+    auto start = chrono::steady_clock::now();
+    vector<thread> clients;
+    for (unsigned t = 0; t < threads; ++t) {
+        clients.emplace_back([&, t] {
+            mt19937_64 rng(t + 1);
+            for (size_t i = 0; i < total / threads; ++i) {
+                int from = numbers[rng() % numbers.size()];
+                int to = numbers[rng() % numbers.size()];
+                book.transfer(from, to, Money::fromMinor(1 + static_cast<int64_t>(rng() % 50000)));
+            }
+        });
+    }
+    for (thread& c : clients) c.join();
+    return (total / threads) * threads / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    unsigned maxThreads = argc > 1 ? stoul(argv[1]) : 64;
+    unsigned shardCount = argc > 2 ? stoul(argv[2]) : 0;
+    size_t accounts = argc > 3 ? stoul(argv[3]) : 100000;
+    size_t total = argc > 4 ? stoul(argv[4]) : 400000;
+    string dir = argc > 5 ? argv[5] : "/tmp";
+    bool ok = true;
+
+    Bank single;
+    vector<int> singleNumbers = seed(single, accounts);
+    ShardedBank sharded(shardCount);
+    vector<int> shardedNumbers = seed(sharded, accounts);
+    const Money seeded = SEED_BALANCE * static_cast<int64_t>(accounts);
+    printf("%u shards on %u hardware threads, %zu accounts, %zu transfers per point\n", sharded.shardCount(),
+           thread::hardware_concurrency(), accounts, total);
+    printf("%8s %16s %16s\n", "threads", "Bank/s", "ShardedBank/s");
+
+    atomic<bool> done{false};
+    atomic<bool> auditFailed{false};
+    // Totals taken mid-run must already balance, cross-shard transfers in flight included
+    thread auditor([&] {
+        while (!done) {
+            if (sharded.totalBalance() != seeded) auditFailed = true;
+            this_thread::sleep_for(chrono::milliseconds(20));
+        }
+    });
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        double plain = run(single, singleNumbers, threads, total);
+        double split = run(sharded, shardedNumbers, threads, total);
+        printf("%8u %16.0f %16.0f\n", threads, plain, split);
+    }
+    done = true;
+    auditor.join();
+    if (single.totalBalance() != seeded || sharded.totalBalance() != seeded || auditFailed) {
+        printf("Total balance not conserved\n");
+        ok = false;
+    }
+
+    // Journaled run, then a debit whose credit never happened, then recovery
+    string journalDir = dir + "/bench_shards_" + to_string(getpid());
+    mkdir(journalDir.c_str(), 0755);
+    vector<Money> before;
+    vector<int> numbers;
+    int stranded = 0;
+    {
+        ShardedBank book(4);
+        book.recover(journalDir, Journal::Durability::Async);
+        numbers = seed(book, 2000);
+        run(book, numbers, 4, 20000);
+        // A sender and recipient on different shards
+        int to = numbers[0];
+        for (int n : numbers) {
+            if (book.shardOf(n) != book.shardOf(to)) stranded = n;
+        }
+        Money amount = Money::fromMajor(7);
+        uint64_t reference = (uint64_t(book.shardOf(stranded)) << 48) | (uint64_t(1) << 47); // Never issued by a live transfer here
+        book.shard(book.shardOf(stranded)).debitLeg(stranded, to, amount, reference);
+        for (int n : numbers) {
+            Money balance;
+            book.balance(n, balance);
+            if (n == stranded) balance += amount; // Refunded on recovery
+            before.push_back(balance);
+        }
+        for (unsigned k = 0; k < book.shardCount(); ++k) book.shard(k).syncJournal();
+    }
+    {
+        ShardedBank book(4);
+        auto start = chrono::steady_clock::now();
+        size_t replayed = book.recover(journalDir, Journal::Durability::Async);
+        printf("Recovered %zu accounts from %zu records in %.1f ms\n", book.accountCount(), replayed,
+               chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        for (size_t i = 0; i < numbers.size(); ++i) {
+            Money balance;
+            if (book.balance(numbers[i], balance) != TxResult::Ok || balance != before[i]) {
+                printf("Account %d recovered wrong\n", numbers[i]);
+                ok = false;
+            }
+        }
+        if (book.totalBalance() != SEED_BALANCE * 2000) {
+            printf("Recovered total does not match\n");
+            ok = false;
+        }
+    }
+    for (unsigned k = 0; k < 4; ++k) remove((journalDir + "/shard-" + to_string(k) + ".journal").c_str());
+    rmdir(journalDir.c_str());
+
+    printf("%s\n", ok ? "Sharded book consistent." : "SHARD CHECK FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+// Startup benchmark: rebuild a book from the CSV text format (operator>> per
+// row) vs from the mmap'ed binary snapshot, and a check that a version 2
+// snapshot still loads. Exits non-zero on failure.
+//
+//   cmake --build build --target bench_snapshot
+//   ./bench_snapshot [accounts] [directory]
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include "project.h"
+
+using namespace std;
+
+namespace {
+
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t count = argc > 1 ? stoul(argv[1]) : 10000000;
+    string dir = argc > 2 ? argv[2] : "/tmp";
+    string textPath = dir + "/bench_book.csv";
+    string snapshotPath = dir + "/bench_book.snapshot";
+    string journalPath = dir + "/bench_book.journal";
+
+    {
+        Bank bank;
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            bank.addAccount("Cust " + to_string(i), to_string(1000000000ULL + i), "Pw@" + to_string(i), Money::fromMinor(static_cast<int64_t>(i % 1000000)));
+        }
+        cout << "Generated " << count << " accounts in " << secondsSince(start) << " s\n";
+
+        ofstream text(textPath);
+        bank.forEachAccount([&text](const Account& account) { text << account << '\n'; });
+        text.close();
+        bank.saveSnapshot(snapshotPath);
+    }
+
+    // Text: parse each row with operator>>, then insert
+    {
+        auto start = chrono::steady_clock::now();
+        AccountStore store;
+        store.reserve(count);
+        ifstream text(textPath);
+        Account account;
+        while (text >> account) {
+            store.insert(account.getAccountNumber(), account.getName(), account.getPhone(), account.getPasswordHash(),
+                         account.getBalance());
+        }
+        cout << "Text load:       " << secondsSince(start) << " s (" << store.size() << " accounts)\n";
+    }
+
+    // Snapshot: map the file and walk the fixed-width records in place
+    {
+        auto start = chrono::steady_clock::now();
+        SnapshotView view(snapshotPath);
+        int64_t total = 0;
+        for (size_t i = 0; i < view.size(); ++i) total += view.record(i).balance;
+        cout << "Snapshot scan:   " << secondsSince(start) << " s (mapped, total " << Money::fromMinor(total) << ")\n";
+    }
+
+    // Snapshot: full Bank recovery (map + insert + replay an empty journal tail)
+    {
+        remove(journalPath.c_str());
+        auto start = chrono::steady_clock::now();
+        Journal journal(journalPath);
+        Bank bank;
+        bank.recover(journal, snapshotPath);
+        cout << "Snapshot load:   " << secondsSince(start) << " s (" << bank.accountCount() << " accounts)\n";
+    }
+
+    // A version 2 file (32-bit heap offsets) still loads: rewrite the header
+    // of this one, whose offsets all fit, and compare the accounts
+    bool ok = true;
+    {
+        string bytes;
+        {
+            ifstream in(snapshotPath, ios::binary);
+            bytes.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        }
+        SnapshotHeader header;
+        memcpy(&header, bytes.data(), sizeof(header));
+        ok &= header.version == SNAPSHOT_VERSION;
+        header.version = 2;
+        header.headerCrc = 0;
+        header.headerCrc = crc32(&header, sizeof(header));
+        memcpy(&bytes[0], &header, sizeof(header));
+        string oldPath = snapshotPath + ".v2";
+        ofstream(oldPath, ios::binary) << bytes;
+
+        SnapshotView current(snapshotPath), old(oldPath);
+        ok &= current.size() == count && old.size() == count && old.header().version == 2;
+        for (size_t i = 0; ok && i < count; i += count / 100 + 1) {
+            ok &= old.name(old.record(i)) == "Cust " + to_string(i) && old.passwordHash(old.record(i)) == current.passwordHash(current.record(i));
+        }
+        remove(oldPath.c_str());
+    }
+    cout << (ok ? "Version 2 snapshot loads." : "SNAPSHOT CHECK FAILED") << "\n";
+
+    remove(textPath.c_str());
+    remove(snapshotPath.c_str());
+    remove(journalPath.c_str());
+    return ok ? 0 : 1;
+}
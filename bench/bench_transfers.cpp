@@ -0,0 +1,77 @@
+// Concurrent transfer stress run: many threads move money between random
+// accounts while the total balance must stay exactly what was seeded.
+// Exits non-zero if money was created or lost.
+//
+//   cmake --build build --target bench_transfers
+//   ./bench_transfers [threads] [accounts] [transfers per thread]
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "project.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+    unsigned threads = argc > 1 ? stoul(argv[1]) : max(2u, thread::hardware_concurrency());
+    size_t accountCount = argc > 2 ? stoul(argv[2]) : 10000;
+    size_t perThread = argc > 3 ? stoul(argv[3]) : 200000;
+
+    Bank bank;
+    vector<int> numbers;
+    numbers.reserve(accountCount);
+    for (size_t i = 0; i < accountCount; ++i) {
+        numbers.push_back(bank.addAccount("Stress " + to_string(i), to_string(7000000000ULL + i), "Secret@1", Money::fromMajor(1000)));
+    }
+    const Money seeded = bank.totalBalance();
+
+    atomic<size_t> ok{0}, insufficient{0};
+    atomic<bool> auditFailed{false};
+    atomic<bool> done{false};
+    // Audit thread: a consistent total must be observable mid-run, not just at the end
+    thread auditor([&] {
+        while (!done.load()) {
+            if (bank.totalBalance() != seeded) auditFailed = true;
+            this_thread::sleep_for(chrono::milliseconds(5));
+        }
+    });
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            mt19937_64 rng(t + 1);
+            size_t localOk = 0, localShort = 0;
+            for (size_t i = 0; i < perThread; ++i) {
+                int from = numbers[rng() % numbers.size()];
+                int to = numbers[rng() % numbers.size()];
+                Money amount = Money::fromMinor(1 + static_cast<int64_t>(rng() % 50000));
+                TxResult result = bank.transfer(from, to, amount);
+                if (result == TxResult::Ok) ++localOk;
+                else if (result == TxResult::InsufficientFunds) ++localShort;
+            }
+            ok += localOk;
+            insufficient += localShort;
+        });
+    }
+    for (thread& w : workers) w.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    done = true;
+    auditor.join();
+
+    Money finalTotal = bank.totalBalance();
+    size_t attempted = threads * perThread;
+    cout << "threads=" << threads << " accounts=" << accountCount << " transfers=" << attempted
+         << " ok=" << ok << " insufficient=" << insufficient << "\n";
+    cout << "throughput=" << static_cast<size_t>(attempted / seconds) << " transfers/s\n";
+    cout << "seeded total=" << seeded << " final total=" << finalTotal << "\n";
+    if (finalTotal != seeded || auditFailed) {
+        cout << "FAIL: total balance not conserved\n";
+        return 1;
+    }
+    cout << "PASS: total balance conserved\n";
+    return 0;
+}
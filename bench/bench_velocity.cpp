@@ -0,0 +1,220 @@
+// Velocity rules on the transaction path.
+//
+// Part 1 parses a rules file and checks that malformed rules are refused
+// with their line, and that amounts past INT64_MAX are refused, not wrapped. Part 2 drives the sliding-window counters with synthetic
+// time through VelocityRules directly, with a withdraw-only rule beside
+// transfers and postings. Part 3 checks that the Bank refuses
+// withdrawals, transfers and posting debits that break a rule with
+// VelocityLimit and leaves the balance alone, that a rule counts only the
+// kinds of outflow it applies to, and that rules loaded before recover()
+// count the replayed journal. Part 4 times withdrawals and
+// transfers with no rules and with a typical rule set that never refuses,
+// for the cost of the check. Exits non-zero on failure.
+//
+//   cmake --build build --target bench_velocity
+//   ./bench_velocity [accounts] [operations] [directory]
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "metrics.h"
+#include "project.h"
+
+using namespace std;
+
+namespace {
+
+const char* const RULES =
+    "# Cash and transfer limits\n"
+    "daily_cash      withdraw           day     amount  2000.00\n"
+    "burst           withdraw,transfer  minute  count   3\n"
+    "large_transfer  transfer           -       single  500.00   # Per transfer\n"
+    "\n"
+    "payroll_hourly  post               hour    amount  1000\n";
+
+// Limits a test book never reaches: the check runs in full but never refuses
+const char* const LOOSE_RULES =
+    "daily_cash      withdraw           day     amount  100000000.00\n"
+    "hourly_out      any                hour    amount  100000000.00\n"
+    "burst           any                minute  count   1000000000\n"
+    "large_transfer  transfer           -       single  100000000.00\n";
+
+VelocityRules parseText(const string& text) {
+    istringstream in(text);
+    return VelocityRules::parse(in);
+}
+
+bool refused(const string& text, const string& line) {
+    try {
+        parseText(text);
+    } catch (const invalid_argument& e) {
+        return string(e.what()).find(line) != string::npos;
+    }
+    return false;
+}
+
+vector<int> seed(Bank& bank, size_t count, Money balance) {
+    vector<int> numbers;
+    for (size_t i = 0; i < count; ++i) {
+        numbers.push_back(bank.addAccount("Velocity " + to_string(i), to_string(4000000000ULL + i), "Pw@1", balance));
+    }
+    return numbers;
+}
+
+// Nanoseconds per call of withdraw then transfer, cycling through the accounts
+pair<double, double> timeOps(Bank& bank, const vector<int>& numbers, size_t operations) {
+    Money amount = Money::fromMinor(1);
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < operations; ++i) bank.withdraw(numbers[i % numbers.size()], amount);
+    double withdraw = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / operations;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < operations; ++i) {
+        bank.transfer(numbers[i % numbers.size()], numbers[(i + 1) % numbers.size()], amount);
+    }
+    double transfer = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / operations;
+    return {withdraw, transfer};
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t accountCount = argc > 1 ? stoul(argv[1]) : 100000;
+    size_t operations = argc > 2 ? stoul(argv[2]) : 2000000;
+    string dir = argc > 3 ? argv[3] : "/tmp";
+    bool ok = true;
+
+    // Part 1: parsing
+    {
+        VelocityRules rules = parseText(RULES);
+        ok &= rules.size() == 4 && rules.name(3) == "payroll_hourly";
+        ok &= refused("a withdraw day amount 10\nb withdraw week amount 10\n", "line 2");
+        ok &= refused("a withdraw day single 10\n", "line 1");
+        ok &= refused("a deposit day amount 10\n", "line 1");
+        ok &= refused("a withdraw day amount ten\n", "line 1");
+        ok &= refused("\n# only a comment\na withdraw day count 3 extra\n", "line 3");
+        ok &= refused("a withdraw day amount 92233720368547758.08\n", "line 1"); // One minor unit past INT64_MAX
+        // The amount parser stops at INT64_MAX, whichever digit would pass it
+        int64_t value = 0;
+        ok &= parseScaledDecimal("9223372036854775807", 0, value) && value == INT64_MAX;
+        ok &= parseScaledDecimal("92233720368547758.07", 2, value) && value == INT64_MAX;
+        ok &= !parseScaledDecimal("9223372036854775808", 0, value) && !parseScaledDecimal("9223372036854775809", 0, value);
+        ok &= !parseScaledDecimal("92233720368547758.09", 2, value) && !parseScaledDecimal("922337203685477581", 2, value);
+        printf("parsing: %zu rules read, malformed rules refused with their line\n", rules.size());
+    }
+
+    // Part 2: sliding windows in synthetic time (seconds)
+    {
+        VelocityRules rules = parseText("burst withdraw minute count 3\ndaily withdraw day amount 100.00\n");
+        VelocityCounters counters;
+        int64_t t = 600; // Start of a minute
+        auto attempt = [&](int64_t amount) {
+            int rule = rules.check(counters, VelocityWithdraw, amount, t);
+            if (rule < 0) rules.record(counters, VelocityWithdraw, amount, t);
+            return rule;
+        };
+        bool windows = true;
+        for (int i = 0; i < 3; ++i) windows &= attempt(100) == -1;
+        windows &= attempt(100) == 0; // Fourth in the minute
+        t += 90;                      // Half way through the next minute: about 1.5 of the 3 still count
+        windows &= attempt(100) == -1;
+        windows &= attempt(100) == 0;
+        t += 120;                     // Two minutes on, nothing counts
+        windows &= attempt(100) == -1;
+        windows &= attempt(9501) == 1;  // 5.00 so far today; 95.01 more breaks 100.00
+        windows &= attempt(9500) == -1;
+        t = 86400 + 86400 / 2;        // Half way through the next day: half of today's 100.00 still counts
+        windows &= attempt(5001) == 1;
+        windows &= attempt(5000) == -1;
+        windows &= rules.blocked(0) == 2 && rules.blocked(1) == 2;
+
+        // A rule counts only the kinds it applies to
+        VelocityRules scoped = parseText("cash withdraw day amount 100.00\nmoves transfer,post day amount 100.00\n");
+        VelocityCounters mixed;
+        scoped.record(mixed, VelocityTransfer, 6000, t);
+        scoped.record(mixed, VelocityPost, 4000, t);
+        windows &= scoped.check(mixed, VelocityWithdraw, 10000, t) == -1;
+        windows &= scoped.check(mixed, VelocityPost, 1, t) == 1;
+        scoped.record(mixed, VelocityWithdraw, 10000, t);
+        windows &= scoped.check(mixed, VelocityWithdraw, 1, t) == 0;
+        ok &= windows;
+        printf("sliding windows: %s\n", windows ? "ok" : "WRONG");
+    }
+
+    // Part 3: the Bank refuses, and recovery rebuilds the counters
+    {
+        string journalPath = dir + "/bank_velocity_" + to_string(getpid()) + ".journal";
+        remove(journalPath.c_str());
+        Money before = Money::fromMajor(100000);
+        bool bank3 = true;
+        {
+            Journal journal(journalPath, Journal::Durability::Async);
+            Bank bank;
+            bank.setVelocityRules(parseText(RULES));
+            bank.attachJournal(&journal);
+            vector<int> numbers = seed(bank, 4, before);
+            Metrics::reset();
+
+            Money balance;
+            bank3 &= bank.withdraw(numbers[0], Money::fromMajor(1500)) == TxResult::Ok;
+            bank3 &= bank.withdraw(numbers[0], Money::fromMajor(600)) == TxResult::VelocityLimit;
+            bank3 &= bank.balance(numbers[0], balance) == TxResult::Ok && balance == before - Money::fromMajor(1500);
+            bank3 &= bank.withdraw(numbers[1], Money::fromMajor(1)) == TxResult::Ok;
+            bank3 &= bank.transfer(numbers[1], numbers[2], Money::fromMajor(501)) == TxResult::VelocityLimit;
+            bank3 &= bank.transfer(numbers[1], numbers[2], Money::fromMajor(500)) == TxResult::Ok;
+            bank3 &= bank.debitLeg(numbers[1], 9999, Money::fromMajor(1), 42) == TxResult::Ok;
+            bank3 &= bank.withdraw(numbers[1], Money::fromMajor(1)) == TxResult::VelocityLimit; // Fourth outflow this minute
+            // A batch is refused whole when one of its debits breaks a rule
+            bank3 &= bank.post("big", {Posting{numbers[2], -Money::fromMajor(1001)}, Posting{numbers[3], Money::fromMajor(1001)}}) ==
+                     TxResult::VelocityLimit;
+            bank3 &= bank.post("big", {Posting{numbers[2], -Money::fromMajor(1000)}, Posting{numbers[3], Money::fromMajor(1000)}}) ==
+                     TxResult::Ok;
+            bank3 &= bank.totalBalance() == before * 4 - Money::fromMajor(1502);
+            // The withdraw-only daily_cash rule ignores the posting debit and this transfer
+            bank3 &= bank.transfer(numbers[2], numbers[3], Money::fromMajor(500)) == TxResult::Ok;
+            bank3 &= bank.withdraw(numbers[2], Money::fromMajor(1500)) == TxResult::Ok;
+
+            vector<pair<string, uint64_t>> blocks = bank.velocityBlocks();
+            bank3 &= blocks.size() == 4 && blocks[0].second == 1 && blocks[1].second == 1 && blocks[2].second == 1 && blocks[3].second == 1;
+            MetricsSnapshot snapshot = Metrics::collect();
+            bank3 &= !Metrics::enabled() || (snapshot.count(MetricOp::Withdraw, TxResult::VelocityLimit) == 2 &&
+                                             snapshot.count(MetricOp::Post, TxResult::VelocityLimit) == 1);
+            bank.syncJournal();
+        }
+        {
+            // Without rules replay counts nothing; with them it counts what the journal holds
+            Journal journal(journalPath);
+            Bank bank;
+            bank.setVelocityRules(parseText(RULES));
+            bank.recover(journal);
+            bank3 &= bank.withdraw(1000, Money::fromMajor(600)) == TxResult::VelocityLimit;
+            bank3 &= bank.withdraw(1000, Money::fromMajor(400)) == TxResult::Ok;
+            bank3 &= bank.withdraw(1002, Money::fromMajor(501)) == TxResult::VelocityLimit; // Replay kept the kinds apart too
+            bank3 &= bank.withdraw(1002, Money::fromMajor(500)) == TxResult::Ok;
+            bank3 &= bank.post("big2", {Posting{1002, -Money::fromMajor(1)}, Posting{1003, Money::fromMajor(1)}}) == TxResult::VelocityLimit;
+        }
+        remove(journalPath.c_str());
+        ok &= bank3;
+        printf("bank: %s\n", bank3 ? "limits refused with VelocityLimit, counters rebuilt on recovery" : "WRONG");
+    }
+
+    // Part 4: what the check costs
+    {
+        Bank bank;
+        vector<int> numbers = seed(bank, accountCount, Money::fromMajor(1000000));
+        timeOps(bank, numbers, operations / 10); // Warm up
+        pair<double, double> none = timeOps(bank, numbers, operations);
+        bank.setVelocityRules(parseText(LOOSE_RULES));
+        timeOps(bank, numbers, operations / 10); // Every account gets its counters
+        pair<double, double> loaded = timeOps(bank, numbers, operations);
+        vector<pair<string, uint64_t>> blocks = bank.velocityBlocks();
+        for (const auto& rule : blocks) ok &= rule.second == 0;
+        printf("%zu accounts, %zu operations each\n", accountCount, operations);
+        printf("withdraw: %.0f ns without rules, %.0f ns with %zu rules (%+.0f ns)\n", none.first, loaded.first, blocks.size(),
+               loaded.first - none.first);
+        printf("transfer: %.0f ns without rules, %.0f ns with %zu rules (%+.0f ns)\n", none.second, loaded.second, blocks.size(),
+               loaded.second - none.second);
+    }
+    return ok ? 0 : 1;
+}
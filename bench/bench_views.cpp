@@ -0,0 +1,128 @@
+// Point-in-time reads under load. Transfer threads move money between
+// random accounts nonstop while a reporter takes totals, full listings and
+// a snapshot through read views. Money only moves, so every report must
+// show the seeded total; the snapshot plus the journal after it must
+// recover the live book exactly. Also prints transfer throughput with and
+// without the reporter. Exits non-zero on failure.
+//
+//   cmake --build build --target bench_views
+//   ./bench_views [accounts] [transfer threads] [seconds per phase] [directory]
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "project.h"
+
+using namespace std;
+
+namespace {
+
+const Money SEED_BALANCE = Money::fromMajor(100);
+
+// Random transfers from `threads` threads until `running` clears; returns how many succeeded
+size_t transfers(Bank& bank, const vector<int>& numbers, unsigned threads, atomic<bool>& running) {
+    atomic<size_t> done{0};
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            mt19937_64 rng(t + 1);
+            size_t local = 0;
+            while (running) {
+                int from = numbers[rng() % numbers.size()];
+                int to = numbers[rng() % numbers.size()];
+                local += bank.transfer(from, to, Money::fromMinor(1 + static_cast<int64_t>(rng() % 5000)), Commit::Defer) == TxResult::Ok;
+            }
+            done += local;
+        });
+    }
+    for (thread& w : workers) w.join();
+    return done;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t accounts = argc > 1 ? stoul(argv[1]) : 100000;
+    unsigned threads = argc > 2 ? stoul(argv[2]) : 4;
+    double seconds = argc > 3 ? stod(argv[3]) : 1.0;
+    string dir = argc > 4 ? argv[4] : "/tmp";
+    string journalPath = dir + "/bank_views_" + to_string(getpid()) + ".journal";
+    string snapshotPath = dir + "/bank_views_" + to_string(getpid()) + ".snapshot";
+    remove(journalPath.c_str());
+    remove(snapshotPath.c_str());
+    bool ok = true;
+
+    Journal journal(journalPath, Journal::Durability::Async);
+    Bank bank;
+    bank.attachJournal(&journal);
+    vector<int> numbers;
+    for (size_t i = 0; i < accounts; ++i) {
+        numbers.push_back(bank.addAccount("View " + to_string(i), to_string(5000000000ULL + i), "Pw@1", SEED_BALANCE));
+    }
+    const Money seeded = SEED_BALANCE * static_cast<int64_t>(accounts);
+    auto phase = chrono::duration<double>(seconds);
+
+    // Baseline: writers alone
+    atomic<bool> running{true};
+    thread stopper([&] {
+        this_thread::sleep_for(phase);
+        running = false;
+    });
+    size_t alone = transfers(bank, numbers, threads, running);
+    stopper.join();
+
+    // Writers with a reporter reading views back to back
+    running = true;
+    size_t totals = 0, listings = 0, wrong = 0;
+    size_t snapshotRows = 0;
+    thread reporter([&] {
+        auto end = chrono::steady_clock::now() + phase;
+        while (chrono::steady_clock::now() < end) {
+            wrong += bank.totalBalance() != seeded;
+            ++totals;
+            if (totals % 4 == 0) {
+                Money listed;
+                size_t rows = 0;
+                bank.forEachAccount([&](const Account& account) {
+                    listed += account.getBalance();
+                    ++rows;
+                });
+                wrong += listed != seeded || rows != accounts;
+                ++listings;
+            }
+            if (!snapshotRows) snapshotRows = bank.saveSnapshot(snapshotPath);
+        }
+        running = false;
+    });
+    size_t shared = transfers(bank, numbers, threads, running);
+    reporter.join();
+
+    printf("%zu accounts, %u transfer threads: %.0f transfers/s alone, %.0f/s beside the reporter\n", accounts, threads,
+           alone / seconds, shared / seconds);
+    printf("reporter: %zu totals, %zu full listings, %zu not conserved\n", totals, listings, wrong);
+    ok &= wrong == 0 && totals > 0;
+
+    // The snapshot was cut mid-run: it and the journal after it must give the live book back
+    journal.sync();
+    Journal reread(journalPath);
+    Bank recovered;
+    size_t replayed = recovered.recover(reread, snapshotPath);
+    size_t mismatched = 0;
+    for (int number : numbers) {
+        Money live, back;
+        bank.balance(number, live);
+        recovered.balance(number, back);
+        mismatched += live != back;
+    }
+    printf("snapshot of %zu rows + %zu journal records: %zu balances differ from the live book\n", snapshotRows, replayed, mismatched);
+    ok &= mismatched == 0 && snapshotRows == accounts && recovered.totalBalance() == seeded;
+
+    remove(journalPath.c_str());
+    remove(snapshotPath.c_str());
+    printf("%s\n", ok ? "Views consistent." : "VIEWS CHECK FAILED");
+    return ok ? 0 : 1;
+}
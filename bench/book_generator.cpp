@@ -0,0 +1,75 @@
+#include "book_generator.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+const char* const FIRST_NAMES[] = {"Aarav", "Aditi", "Amit", "Ananya", "Arjun", "Deepa", "Farhan", "Gita", "Ishaan", "Kavya", "Meera",
+                                   "Neha", "Nikhil", "Pooja", "Rahul", "Ravi", "Riya", "Rohan", "Sachin", "Sanjay", "Sara", "Sneha",
+                                   "Sunil", "Tara", "Uday", "Varun", "Vikram", "Zoya"};
+const char* const LAST_NAMES[] = {"Agarwal", "Bose", "Chopra", "Das", "Desai", "Gupta", "Iyer", "Jain", "Joshi", "Kapoor", "Khan",
+                                  "Kumar", "Mehta", "Menon", "Nair", "Patel", "Rao", "Reddy", "Shah", "Sharma", "Singh", "Verma"};
+const size_t FIRST_COUNT = sizeof(FIRST_NAMES) / sizeof(FIRST_NAMES[0]);
+const size_t LAST_COUNT = sizeof(LAST_NAMES) / sizeof(LAST_NAMES[0]);
+
+const uint64_t PHONE_BASE = 2000000000ULL; // Ten digits for every index below 8 billion
+const int FIRST_ACCOUNT = 1000;           // Bank's first account number
+
+uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+} // namespace
+
+GeneratedAccount generatedAccount(const BookSpec& spec, size_t i) {
+    uint64_t h = mix(spec.seed * 0x100000001b3ULL + i);
+    GeneratedAccount account;
+    account.name = string(FIRST_NAMES[h % FIRST_COUNT]) + " " + LAST_NAMES[(h >> 8) % LAST_COUNT];
+    account.phone = to_string(PHONE_BASE + i);
+    uint64_t draw = h >> 16;
+    unsigned band = draw % 100;
+    draw /= 100;
+    int64_t major;
+    if (band < 10) {
+        major = 0;                          // Empty
+    } else if (band < 60) {
+        major = 100 + draw % 1900;          // 100 to 2000
+    } else if (band < 95) {
+        major = 2000 + draw % 18000;        // 2000 to 20000
+    } else {
+        major = 20000 + draw % 980000;      // 20000 to a million
+    }
+    account.balance = Money::fromMinor(major * Money::MINOR_PER_MAJOR + static_cast<int64_t>((draw >> 20) % 100));
+    return account;
+}
+
+void generateBook(Bank& bank, const BookSpec& spec) {
+    if (bank.accountCount() != 0) {
+        throw logic_error("generateBook needs an empty bank.");
+    }
+    for (size_t i = 0; i < spec.accounts; ++i) {
+        GeneratedAccount account = generatedAccount(spec, i);
+        bank.addAccount(account.name, account.phone, BOOK_PASSWORD, account.balance);
+    }
+}
+
+size_t writeBookSnapshot(const BookSpec& spec, const string& path) {
+    SnapshotWriter writer;
+    string password = BOOK_PASSWORD;
+    for (size_t i = 0; i < spec.accounts; ++i) {
+        GeneratedAccount account = generatedAccount(spec, i);
+        AccountRow row;
+        row.name = account.name;
+        row.passwordHash = password;
+        row.accountNumber = FIRST_ACCOUNT + static_cast<int>(i);
+        row.phone = PackedPhone::pack(account.phone);
+        writer.add(row, account.balance);
+    }
+    writer.write(path, 0, 0, FIRST_ACCOUNT + static_cast<int>(spec.accounts));
+    return writer.size();
+}
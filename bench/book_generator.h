@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "project.h"
+
+using namespace std;
+
+// Synthetic account books for the benchmarks, 10K to 100M accounts.
+//
+// Account i is derived from (seed, i) alone, so any slice of a book can be
+// regenerated on its own and the same spec always gives the same book.
+// Names come from small first/last tables (plenty of shared names and
+// prefixes for the name index), phones are unique, and balances follow a
+// long-tailed mix: some empty accounts, most in the hundreds to thousands,
+// a few large ones. Every row gets the same short legacy password so the
+// slow hash stays out of book building.
+struct BookSpec {
+    size_t accounts = 10000;
+    uint64_t seed = 1;
+};
+
+struct GeneratedAccount {
+    string name;
+    string phone;
+    Money balance;
+};
+
+const char* const BOOK_PASSWORD = "Book@1";
+
+GeneratedAccount generatedAccount(const BookSpec& spec, size_t i);
+
+// Load the book into an empty bank with addAccount(); the accounts are
+// numbered from the bank's first number in generation order
+void generateBook(Bank& bank, const BookSpec& spec);
+
+// Write the book straight to a snapshot file without building a Bank, so
+// the largest books need only the snapshot's own memory. Returns the
+// account count. Bank::recover() loads it.
+size_t writeBookSnapshot(const BookSpec& spec, const string& path);
@@ -0,0 +1,128 @@
+#include "cards.h"
+
+#include <cstring>
+#include <stdexcept>
+#include "credentials.h"
+
+using namespace std;
+
+namespace {
+
+const uint32_t HALF_BITS = 15; // Two halves of 30 bits: the smallest power of two above the space
+const uint32_t HALF_MASK = (1u << HALF_BITS) - 1;
+
+uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+uint32_t roundValue(uint64_t key, uint32_t half) {
+    return static_cast<uint32_t>(mix(key ^ half)) & HALF_MASK;
+}
+
+// Keys for one purpose: SHA-256 of the secret and a label
+void deriveKey(const string& secret, const char* label, uint8_t out[32]) {
+    string input = secret;
+    input += '\0';
+    input += label;
+    sha256(input.data(), input.size(), out);
+}
+
+} // namespace
+
+// CardKeys class methods implementation
+CardKeys::CardKeys(const string& secret) {
+    uint8_t material[64];
+    deriveKey(secret, "card numbers 1", material);
+    deriveKey(secret, "card numbers 2", material + 32);
+    static_assert(sizeof(roundKeys) == sizeof(material), "one 64-bit key per round");
+    memcpy(roundKeys, material, sizeof(roundKeys));
+    deriveKey(secret, "pin values", pinKey);
+}
+
+uint32_t CardKeys::permute(uint32_t x) const {
+    // Cycle-walk: a permutation of [0, 2^30) applied until the value lands
+    // back in the space is a permutation of the space
+    do {
+        uint32_t left = x >> HALF_BITS, right = x & HALF_MASK;
+        for (int i = 0; i < ROUNDS; ++i) {
+            uint32_t next = left ^ roundValue(roundKeys[i], right);
+            left = right;
+            right = next;
+        }
+        x = left << HALF_BITS | right;
+    } while (x >= CARD_NUMBER_SPACE);
+    return x;
+}
+
+uint32_t CardKeys::unpermute(uint32_t x) const {
+    do {
+        uint32_t left = x >> HALF_BITS, right = x & HALF_MASK;
+        for (int i = ROUNDS; i-- > 0;) {
+            uint32_t previous = right ^ roundValue(roundKeys[i], left);
+            right = left;
+            left = previous;
+        }
+        x = left << HALF_BITS | right;
+    } while (x >= CARD_NUMBER_SPACE);
+    return x;
+}
+
+int CardKeys::cardNumber(int accountNumber) const {
+    if (accountNumber < 0 || static_cast<uint32_t>(accountNumber) >= CARD_NUMBER_SPACE) {
+        throw out_of_range("No card number for account " + to_string(accountNumber) + ".");
+    }
+    return CARD_NUMBER_BASE + static_cast<int>(permute(static_cast<uint32_t>(accountNumber)));
+}
+
+int CardKeys::accountNumber(int cardNumber) const {
+    if (cardNumber < CARD_NUMBER_BASE || static_cast<uint32_t>(cardNumber - CARD_NUMBER_BASE) >= CARD_NUMBER_SPACE) {
+        return -1;
+    }
+    return static_cast<int>(unpermute(static_cast<uint32_t>(cardNumber - CARD_NUMBER_BASE)));
+}
+
+int32_t CardKeys::pinValue(int cardNumber, const string& pin) const {
+    // Key, card and PIN fit one SHA-256 block
+    uint8_t input[sizeof(pinKey) + 4 + 6];
+    size_t length = pin.size() < 6 ? pin.size() : 6;
+    memcpy(input, pinKey, sizeof(pinKey));
+    for (int i = 0; i < 4; ++i) input[sizeof(pinKey) + i] = static_cast<uint8_t>(static_cast<uint32_t>(cardNumber) >> (8 * i));
+    memcpy(input + sizeof(pinKey) + 4, pin.data(), length);
+    uint8_t digest[32];
+    sha256(input, sizeof(pinKey) + 4 + length, digest);
+    uint32_t value = uint32_t(digest[0]) | uint32_t(digest[1]) << 8 | uint32_t(digest[2]) << 16 | uint32_t(digest[3]) << 24;
+    return static_cast<int32_t>(value | 0x80000000u);
+}
+
+bool CardKeys::pinMatches(int cardNumber, const string& pin, int32_t stored) const {
+    if (!isValidPin(pin)) {
+        return false;
+    }
+    if (stored >= 0) {
+        return stoi(pin) == stored; // Legacy row
+    }
+    return pinValue(cardNumber, pin) == stored;
+}
+
+bool CardKeys::isValidPin(const string& pin) {
+    if (pin.size() < 4 || pin.size() > 6) {
+        return false;
+    }
+    for (char ch : pin) {
+        if (ch < '0' || ch > '9') return false;
+    }
+    return true;
+}
+
+string CardKeys::randomPin() {
+    uint16_t draw;
+    do {
+        randomBytes(reinterpret_cast<uint8_t*>(&draw), sizeof(draw));
+    } while (draw >= 60000); // Unbiased: 60000 is a multiple of 10000
+    string pin = to_string(draw % 10000);
+    return string(4 - pin.size(), '0') + pin;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Card numbers are ten digits: CARD_NUMBER_BASE plus a number below CARD_NUMBER_SPACE
+const int CARD_NUMBER_BASE = 1000000000;
+const uint32_t CARD_NUMBER_SPACE = 1000000000;
+
+// ATM card numbers and PIN verification values, keyed by one deployment secret.
+//
+// A card number is a keyed permutation of the account number: an 8-round
+// Feistel network over 30 bits, cycle-walked back into CARD_NUMBER_SPACE.
+// Account numbers are unique and never reused, so the cards issued from them
+// are too, with no retries and nothing to persist; shards that share one
+// account-number space share the card space the same way. Consecutive
+// accounts get unrelated cards, so a card number does not lead to its
+// neighbours.
+//
+// PINs are never stored. A card keeps a PIN verification value: 31 bits of
+// SHA-256 over the PIN key, the card number and the PIN, with the top bit
+// set to tell it from the plain PINs of legacy rows. Checking one is a
+// single hash block, cheap enough for every withdrawal, and the values are
+// useless without the key; online guessing is left to the attempt limit.
+//
+// The secret must stay the same for the life of the book: the cards issued
+// and their PIN values depend on it.
+class CardKeys {
+public:
+    explicit CardKeys(const string& secret);
+
+    int cardNumber(int accountNumber) const; // Throws out_of_range past the card space
+    int accountNumber(int cardNumber) const; // The inverse; -1 for a number outside the card range
+    int32_t pinValue(int cardNumber, const string& pin) const;
+    // Legacy values (not negative) are the plain PIN
+    bool pinMatches(int cardNumber, const string& pin, int32_t stored) const;
+
+    static bool isValidPin(const string& pin); // 4 to 6 digits
+    static string randomPin();                 // 4 digits, from getrandom
+
+private:
+    static const int ROUNDS = 8;
+    uint64_t roundKeys[ROUNDS];
+    uint8_t pinKey[32];
+
+    uint32_t permute(uint32_t x) const;
+    uint32_t unpermute(uint32_t x) const;
+};
@@ -0,0 +1,482 @@
+#include "credentials.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <sys/random.h>
+
+using namespace std;
+
+namespace {
+
+const char SCRYPT_PREFIX[] = "$scrypt$";
+const size_t SALT_BYTES = 16;
+const size_t HASH_BYTES = 32;
+
+// Stored hashes come from our own book, but bound what one may ask for anyway
+const unsigned MAX_LOG_N = 24;
+const unsigned MAX_R = 32;
+const unsigned MAX_P = 16;
+
+// --- SHA-256 (FIPS 180-4) ---
+
+const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+inline uint32_t rotl(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+class Sha256 {
+public:
+    Sha256() {
+        static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        memcpy(state, initial, sizeof(state));
+    }
+
+    void update(const void* data, size_t length) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        total += length;
+        while (length > 0) {
+            size_t take = min(length, sizeof(block) - used);
+            memcpy(block + used, p, take);
+            used += take;
+            p += take;
+            length -= take;
+            if (used == sizeof(block)) {
+                compress();
+                used = 0;
+            }
+        }
+    }
+
+    void finish(uint8_t digest[32]) {
+        uint64_t bits = total * 8;
+        uint8_t pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (used != 56) update(&pad, 1);
+        uint8_t length[8];
+        for (int i = 0; i < 8; ++i) length[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+        update(length, 8);
+        for (int i = 0; i < 8; ++i) {
+            for (int k = 0; k < 4; ++k) digest[4 * i + k] = static_cast<uint8_t>(state[i] >> (24 - 8 * k));
+        }
+    }
+
+private:
+    uint32_t state[8];
+    uint8_t block[64];
+    size_t used = 0;
+    uint64_t total = 0;
+
+    void compress() {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = uint32_t(block[4 * i]) << 24 | uint32_t(block[4 * i + 1]) << 16 | uint32_t(block[4 * i + 2]) << 8 | block[4 * i + 3];
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K256[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+};
+
+// HMAC-SHA256 with the key pads prepared once, for PBKDF2 and the cache
+class HmacSha256 {
+public:
+    HmacSha256(const void* key, size_t length) {
+        uint8_t k[64] = {0};
+        if (length > sizeof(k)) {
+            sha256(key, length, k);
+        } else {
+            memcpy(k, key, length);
+        }
+        uint8_t pad[64];
+        for (int i = 0; i < 64; ++i) pad[i] = k[i] ^ 0x36;
+        inner.update(pad, sizeof(pad));
+        for (int i = 0; i < 64; ++i) pad[i] = k[i] ^ 0x5c;
+        outer.update(pad, sizeof(pad));
+    }
+
+    Sha256 start() const { return inner; }
+
+    void finish(Sha256 innerHash, uint8_t mac[32]) const {
+        uint8_t digest[32];
+        innerHash.finish(digest);
+        Sha256 o = outer;
+        o.update(digest, sizeof(digest));
+        o.finish(mac);
+    }
+
+private:
+    Sha256 inner;
+    Sha256 outer;
+};
+
+// PBKDF2-HMAC-SHA256 with one iteration, which is all scrypt uses
+void pbkdf2Once(const string& password, const uint8_t* salt, size_t saltLength, uint8_t* out, size_t outLength) {
+    HmacSha256 hmac(password.data(), password.size());
+    for (uint32_t block = 1; outLength > 0; ++block) {
+        Sha256 h = hmac.start();
+        h.update(salt, saltLength);
+        uint8_t counter[4] = {uint8_t(block >> 24), uint8_t(block >> 16), uint8_t(block >> 8), uint8_t(block)};
+        h.update(counter, sizeof(counter));
+        uint8_t mac[32];
+        hmac.finish(h, mac);
+        size_t take = min(outLength, sizeof(mac));
+        memcpy(out, mac, take);
+        out += take;
+        outLength -= take;
+    }
+}
+
+// --- scrypt core (RFC 7914) ---
+
+void salsa20_8(uint32_t b[16]) {
+    uint32_t x[16];
+    memcpy(x, b, sizeof(x));
+    for (int i = 0; i < 8; i += 2) {
+        x[4] ^= rotl(x[0] + x[12], 7);   x[8] ^= rotl(x[4] + x[0], 9);
+        x[12] ^= rotl(x[8] + x[4], 13);  x[0] ^= rotl(x[12] + x[8], 18);
+        x[9] ^= rotl(x[5] + x[1], 7);    x[13] ^= rotl(x[9] + x[5], 9);
+        x[1] ^= rotl(x[13] + x[9], 13);  x[5] ^= rotl(x[1] + x[13], 18);
+        x[14] ^= rotl(x[10] + x[6], 7);  x[2] ^= rotl(x[14] + x[10], 9);
+        x[6] ^= rotl(x[2] + x[14], 13);  x[10] ^= rotl(x[6] + x[2], 18);
+        x[3] ^= rotl(x[15] + x[11], 7);  x[7] ^= rotl(x[3] + x[15], 9);
+        x[11] ^= rotl(x[7] + x[3], 13);  x[15] ^= rotl(x[11] + x[7], 18);
+        x[1] ^= rotl(x[0] + x[3], 7);    x[2] ^= rotl(x[1] + x[0], 9);
+        x[3] ^= rotl(x[2] + x[1], 13);   x[0] ^= rotl(x[3] + x[2], 18);
+        x[6] ^= rotl(x[5] + x[4], 7);    x[7] ^= rotl(x[6] + x[5], 9);
+        x[4] ^= rotl(x[7] + x[6], 13);   x[5] ^= rotl(x[4] + x[7], 18);
+        x[11] ^= rotl(x[10] + x[9], 7);  x[8] ^= rotl(x[11] + x[10], 9);
+        x[9] ^= rotl(x[8] + x[11], 13);  x[10] ^= rotl(x[9] + x[8], 18);
+        x[12] ^= rotl(x[15] + x[14], 7); x[13] ^= rotl(x[12] + x[15], 9);
+        x[14] ^= rotl(x[13] + x[12], 13); x[15] ^= rotl(x[14] + x[13], 18);
+    }
+    for (int i = 0; i < 16; ++i) b[i] += x[i];
+}
+
+// B (2r 64-byte blocks) -> B, with y as scratch of the same size
+void blockMix(uint32_t* b, uint32_t* y, unsigned r) {
+    uint32_t x[16];
+    memcpy(x, b + (2 * r - 1) * 16, sizeof(x));
+    for (unsigned i = 0; i < 2 * r; ++i) {
+        for (int k = 0; k < 16; ++k) x[k] ^= b[i * 16 + k];
+        salsa20_8(x);
+        // Even blocks go to the first half of the output, odd to the second
+        memcpy(y + ((i / 2) + (i & 1) * r) * 16, x, sizeof(x));
+    }
+    memcpy(b, y, 2 * r * 64);
+}
+
+void roMix(uint8_t* block, unsigned r, uint64_t n, vector<uint32_t>& v) {
+    size_t words = 32 * r;
+    v.resize(words * (n + 2));
+    uint32_t* x = v.data() + words * n;
+    uint32_t* y = x + words;
+    for (size_t k = 0; k < words; ++k) {
+        x[k] = uint32_t(block[4 * k]) | uint32_t(block[4 * k + 1]) << 8 | uint32_t(block[4 * k + 2]) << 16 | uint32_t(block[4 * k + 3]) << 24;
+    }
+    for (uint64_t i = 0; i < n; ++i) {
+        memcpy(v.data() + words * i, x, words * 4);
+        blockMix(x, y, r);
+    }
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t j = x[(2 * r - 1) * 16] & (n - 1); // Integerify mod N, N <= 2^32
+        const uint32_t* vj = v.data() + words * j;
+        for (size_t k = 0; k < words; ++k) x[k] ^= vj[k];
+        blockMix(x, y, r);
+    }
+    for (size_t k = 0; k < words; ++k) {
+        for (int b = 0; b < 4; ++b) block[4 * k + b] = static_cast<uint8_t>(x[k] >> (8 * b));
+    }
+}
+
+// --- encoding ---
+
+const char BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+string base64(const uint8_t* data, size_t length) {
+    string out;
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t v = uint32_t(data[i]) << 16;
+        if (i + 1 < length) v |= uint32_t(data[i + 1]) << 8;
+        if (i + 2 < length) v |= data[i + 2];
+        size_t chars = min<size_t>(4, (length - i) * 8 / 6 + 1);
+        for (size_t k = 0; k < chars; ++k) out += BASE64[(v >> (18 - 6 * k)) & 63];
+    }
+    return out;
+}
+
+bool unbase64(const string& text, vector<uint8_t>& out) {
+    out.clear();
+    uint32_t v = 0;
+    int bits = 0;
+    for (char c : text) {
+        const char* p = strchr(BASE64, c);
+        if (!p || c == '\0') return false;
+        v = (v << 6) | static_cast<uint32_t>(p - BASE64);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back(static_cast<uint8_t>(v >> bits));
+        }
+    }
+    return true;
+}
+
+bool equalConstantTime(const uint8_t* a, const uint8_t* b, size_t length) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < length; ++i) diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+struct ParsedHash {
+    PasswordCost cost;
+    vector<uint8_t> salt;
+    vector<uint8_t> hash;
+};
+
+// "$scrypt$logN$r$p$salt$hash"
+bool parseHash(const string& stored, ParsedHash& parsed) {
+    if (stored.compare(0, sizeof(SCRYPT_PREFIX) - 1, SCRYPT_PREFIX) != 0) return false;
+    vector<string> fields;
+    size_t start = sizeof(SCRYPT_PREFIX) - 1;
+    for (;;) {
+        size_t end = stored.find('$', start);
+        fields.push_back(stored.substr(start, end - start));
+        if (end == string::npos) break;
+        start = end + 1;
+    }
+    if (fields.size() != 5) return false;
+    unsigned values[3];
+    for (int i = 0; i < 3; ++i) {
+        if (fields[i].empty() || fields[i].size() > 3 || fields[i].find_first_not_of("0123456789") != string::npos) return false;
+        values[i] = static_cast<unsigned>(stoul(fields[i]));
+    }
+    if (values[0] < 1 || values[0] > MAX_LOG_N || values[1] < 1 || values[1] > MAX_R || values[2] < 1 || values[2] > MAX_P) return false;
+    parsed.cost.logN = static_cast<uint8_t>(values[0]);
+    parsed.cost.r = static_cast<uint8_t>(values[1]);
+    parsed.cost.p = static_cast<uint8_t>(values[2]);
+    return unbase64(fields[3], parsed.salt) && unbase64(fields[4], parsed.hash) && !parsed.hash.empty();
+}
+
+} // namespace
+
+void randomBytes(uint8_t* out, size_t length) {
+    while (length > 0) {
+        ssize_t n = getrandom(out, length, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error("getrandom failed: " + string(strerror(errno)));
+        }
+        out += n;
+        length -= static_cast<size_t>(n);
+    }
+}
+
+void sha256(const void* data, size_t length, uint8_t digest[32]) {
+    Sha256 h;
+    h.update(data, length);
+    h.finish(digest);
+}
+
+void scrypt(const string& password, const uint8_t* salt, size_t saltLength, PasswordCost cost, uint8_t* out, size_t outLength) {
+    if (cost.logN < 1 || cost.logN > 31 || cost.r < 1 || cost.p < 1) {
+        throw invalid_argument("Invalid scrypt cost.");
+    }
+    size_t blockBytes = 128 * size_t(cost.r);
+    vector<uint8_t> b(blockBytes * cost.p);
+    pbkdf2Once(password, salt, saltLength, b.data(), b.size());
+    // The N-entry table is the memory-hard part; keep it per thread so a
+    // busy login path does not fault in fresh pages on every hash
+    thread_local vector<uint32_t> table;
+    for (unsigned i = 0; i < cost.p; ++i) {
+        roMix(b.data() + i * blockBytes, cost.r, uint64_t(1) << cost.logN, table);
+    }
+    pbkdf2Once(password, b.data(), b.size(), out, outLength);
+}
+
+string hashPassword(const string& password, PasswordCost cost) {
+    if (cost.logN < 1 || cost.logN > MAX_LOG_N || cost.r < 1 || cost.r > MAX_R || cost.p < 1 || cost.p > MAX_P) {
+        throw invalid_argument("Invalid password hashing cost.");
+    }
+    uint8_t salt[SALT_BYTES];
+    randomBytes(salt, sizeof(salt));
+    uint8_t hash[HASH_BYTES];
+    scrypt(password, salt, sizeof(salt), cost, hash, sizeof(hash));
+    return string(SCRYPT_PREFIX) + to_string(cost.logN) + "$" + to_string(cost.r) + "$" + to_string(cost.p) + "$" +
+           base64(salt, sizeof(salt)) + "$" + base64(hash, sizeof(hash));
+}
+
+bool isPasswordHash(const string& stored) {
+    ParsedHash parsed;
+    return parseHash(stored, parsed);
+}
+
+bool passwordMatches(const string& password, const string& stored) {
+    ParsedHash parsed;
+    if (!parseHash(stored, parsed)) {
+        // Legacy plaintext row
+        return password.size() == stored.size() &&
+               equalConstantTime(reinterpret_cast<const uint8_t*>(password.data()), reinterpret_cast<const uint8_t*>(stored.data()), stored.size());
+    }
+    vector<uint8_t> computed(parsed.hash.size());
+    scrypt(password, parsed.salt.data(), parsed.salt.size(), parsed.cost, computed.data(), computed.size());
+    return equalConstantTime(computed.data(), parsed.hash.data(), computed.size());
+}
+
+// VerifiedCache class methods implementation
+VerifiedCache::VerifiedCache(size_t capacity, int64_t ttlMicros) : capacity(capacity), ttl(ttlMicros) {
+    randomBytes(key, sizeof(key));
+}
+
+void VerifiedCache::digest(const string& stored, const string& password, uint8_t out[32]) const {
+    HmacSha256 hmac(key, sizeof(key));
+    Sha256 h = hmac.start();
+    h.update(stored.data(), stored.size());
+    h.update("", 1); // Separator
+    h.update(password.data(), password.size());
+    hmac.finish(h, out);
+}
+
+bool VerifiedCache::contains(int accountNumber, const string& stored, const string& password, int64_t now) {
+    uint8_t d[32];
+    digest(stored, password, d);
+    lock_guard<mutex> guard(lock);
+    auto it = index.find(accountNumber);
+    if (it == index.end()) {
+        return false;
+    }
+    if (it->second->expires <= now) {
+        order.erase(it->second);
+        index.erase(it);
+        return false;
+    }
+    if (!equalConstantTime(it->second->digest, d, sizeof(d))) {
+        return false;
+    }
+    order.splice(order.begin(), order, it->second);
+    return true;
+}
+
+void VerifiedCache::insert(int accountNumber, const string& stored, const string& password, int64_t now) {
+    if (capacity == 0) {
+        return;
+    }
+    Entry entry;
+    entry.accountNumber = accountNumber;
+    digest(stored, password, entry.digest);
+    entry.expires = now + ttl;
+    lock_guard<mutex> guard(lock);
+    auto it = index.find(accountNumber);
+    if (it != index.end()) {
+        *it->second = entry;
+        order.splice(order.begin(), order, it->second);
+        return;
+    }
+    order.push_front(entry);
+    index[accountNumber] = order.begin();
+    while (order.size() > capacity) {
+        index.erase(order.back().accountNumber);
+        order.pop_back();
+    }
+}
+
+void VerifiedCache::erase(int accountNumber) {
+    lock_guard<mutex> guard(lock);
+    auto it = index.find(accountNumber);
+    if (it != index.end()) {
+        order.erase(it->second);
+        index.erase(it);
+    }
+}
+
+void VerifiedCache::setCapacity(size_t capacity) {
+    lock_guard<mutex> guard(lock);
+    this->capacity = capacity;
+    while (order.size() > capacity) {
+        index.erase(order.back().accountNumber);
+        order.pop_back();
+    }
+}
+
+size_t VerifiedCache::size() const {
+    lock_guard<mutex> guard(lock);
+    return order.size();
+}
+
+// AttemptLimiter class methods implementation
+AttemptLimiter::AttemptLimiter(unsigned burst, int64_t intervalMicros)
+    : interval(intervalMicros), tolerance(int64_t(burst ? burst - 1 : 0) * intervalMicros) {}
+
+bool AttemptLimiter::acquire(int accountNumber, int64_t now) {
+    lock_guard<mutex> guard(lock);
+    auto it = arrival.find(accountNumber);
+    int64_t tat = (it == arrival.end() || it->second < now) ? now : it->second;
+    if (tat - now > tolerance) {
+        return false;
+    }
+    if (it == arrival.end()) {
+        arrival.emplace(accountNumber, tat + interval);
+    } else {
+        it->second = tat + interval;
+    }
+    // Accounts whose budget has fully recovered carry no state
+    if (arrival.size() >= sweepAt) {
+        for (auto i = arrival.begin(); i != arrival.end();) {
+            i = (i->second <= now) ? arrival.erase(i) : next(i);
+        }
+        sweepAt = max<size_t>(1024, arrival.size() * 2);
+    }
+    return true;
+}
+
+bool AttemptLimiter::exhausted(int accountNumber, int64_t now) const {
+    lock_guard<mutex> guard(lock);
+    auto it = arrival.find(accountNumber);
+    return it != arrival.end() && it->second - now > tolerance;
+}
+
+void AttemptLimiter::reset(int accountNumber) {
+    lock_guard<mutex> guard(lock);
+    arrival.erase(accountNumber);
+}
+
+size_t AttemptLimiter::tracked() const {
+    lock_guard<mutex> guard(lock);
+    return arrival.size();
+}
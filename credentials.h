@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+// scrypt cost: N = 2^logN iterations over a 128 * r * N byte table, p lanes.
+// Memory and time both scale with N * r, so raising logN by one doubles
+// each. The cost is written into every hash, so changing it only affects
+// passwords hashed afterwards.
+struct PasswordCost {
+    uint8_t logN = 14; // 16 MiB, roughly 40 ms per hash
+    uint8_t r = 8;
+    uint8_t p = 1;
+};
+
+// Salted scrypt hash encoded as "$scrypt$logN$r$p$<salt>$<hash>" (base64,
+// no commas, so it fits the CSV rows as is)
+string hashPassword(const string& password, PasswordCost cost = PasswordCost());
+// Constant-time check of a password against a stored value. Values that are
+// not scrypt hashes are compared as legacy plaintext.
+bool passwordMatches(const string& password, const string& stored);
+bool isPasswordHash(const string& stored);
+
+void sha256(const void* data, size_t length, uint8_t digest[32]);
+void randomBytes(uint8_t* out, size_t length); // From getrandom: salts, keys, PINs
+// RFC 7914 scrypt, exposed for the test vectors
+void scrypt(const string& password, const uint8_t* salt, size_t saltLength, PasswordCost cost, uint8_t* out, size_t outLength);
+
+// Bounded LRU of recently verified logins, so a client that re-presents the
+// same password skips the slow hash. Entries hold a keyed digest of the
+// stored hash and the password under a per-process random key, never the
+// password itself, and expire after a fixed time.
+class VerifiedCache {
+public:
+    explicit VerifiedCache(size_t capacity = 4096, int64_t ttlMicros = int64_t(300) * 1000000);
+
+    bool contains(int accountNumber, const string& stored, const string& password, int64_t now);
+    void insert(int accountNumber, const string& stored, const string& password, int64_t now);
+    void erase(int accountNumber);
+    void setCapacity(size_t capacity);
+    size_t size() const;
+
+private:
+    struct Entry {
+        int accountNumber;
+        uint8_t digest[32];
+        int64_t expires;
+    };
+
+    size_t capacity;
+    int64_t ttl;
+    uint8_t key[32];
+    list<Entry> order; // Most recently used first
+    unordered_map<int, list<Entry>::iterator> index;
+    mutable mutex lock;
+
+    void digest(const string& stored, const string& password, uint8_t out[32]) const;
+};
+
+// Per-account limit on password attempts (GCRA): a burst of `burst`
+// attempts, then one every `intervalMicros`. Each limited account costs one
+// int64 (its theoretical arrival time); a successful login or a fully
+// recovered budget drops it.
+class AttemptLimiter {
+public:
+    explicit AttemptLimiter(unsigned burst = 5, int64_t intervalMicros = int64_t(30) * 1000000);
+
+    bool acquire(int accountNumber, int64_t now); // False once the budget is spent
+    bool exhausted(int accountNumber, int64_t now) const; // Would acquire() refuse now?
+    void reset(int accountNumber);
+    size_t tracked() const;
+
+private:
+    int64_t interval;
+    int64_t tolerance; // (burst - 1) * interval
+    unordered_map<int, int64_t> arrival;
+    size_t sweepAt = 1024;
+    mutable mutex lock;
+};
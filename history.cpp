@@ -0,0 +1,247 @@
+#include "history.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+using namespace std;
+
+namespace {
+
+const size_t MAX_ENTRY_BYTES = 1 + 5 + 4 * 10; // kind, counterparty, four varints
+
+inline uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+inline int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+inline size_t putVarint(unsigned char* out, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = static_cast<unsigned char>(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = static_cast<unsigned char>(v);
+    return n;
+}
+
+inline uint64_t getVarint(const unsigned char*& p) {
+    uint64_t v = 0;
+    for (int shift = 0;; shift += 7) {
+        unsigned char byte = *p++;
+        v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return v;
+    }
+}
+
+inline bool hasCounterparty(HistoryKind kind) {
+    return kind == HistoryKind::TransferIn || kind == HistoryKind::TransferOut;
+}
+
+// The first entry of a segment is encoded against zero bases and also
+// carries the balance before it, so every segment decodes on its own
+size_t encodeEntry(unsigned char* out, HistoryKind kind, int counterparty, int64_t amount, int64_t timestampDelta,
+                   int64_t lsnDelta, const int64_t* openingBalance) {
+    size_t n = 0;
+    out[n++] = static_cast<unsigned char>(kind);
+    if (hasCounterparty(kind)) n += putVarint(out + n, zigzag(counterparty));
+    n += putVarint(out + n, zigzag(amount));
+    n += putVarint(out + n, zigzag(timestampDelta));
+    n += putVarint(out + n, zigzag(lsnDelta));
+    if (openingBalance) n += putVarint(out + n, zigzag(*openingBalance));
+    return n;
+}
+
+} // namespace
+
+const char* historyKindName(HistoryKind kind) {
+    switch (kind) {
+        case HistoryKind::Open:          return "Account opened";
+        case HistoryKind::Deposit:       return "Deposit";
+        case HistoryKind::Withdrawal:    return "Withdrawal";
+        case HistoryKind::TransferIn:    return "Transfer in";
+        case HistoryKind::TransferOut:   return "Transfer out";
+        case HistoryKind::Interest:      return "Interest";
+        case HistoryKind::ServiceCharge: return "Service charge";
+    }
+    return "Unknown";
+}
+
+// HistoryPool class methods implementation
+HistoryPool::HistoryPool(size_t bytesPerAccount)
+    : blocks((MAX_SEGMENTS + BLOCK_SEGMENTS - 1) / BLOCK_SEGMENTS), maxSlabs(MAX_SEGMENTS / SLAB_SEGMENTS) {
+    setLimit(bytesPerAccount);
+}
+
+HistoryPool::~HistoryPool() {}
+
+void HistoryPool::setLimit(size_t bytesPerAccount) {
+    size_t count = bytesPerAccount / sizeof(HistorySegment);
+    maxSegments.store(static_cast<uint32_t>(count < 1 ? 1 : count > UINT16_MAX ? UINT16_MAX : count));
+}
+
+size_t HistoryPool::limit() const { return maxSegments.load() * sizeof(HistorySegment); }
+
+void HistoryPool::setCapacity(size_t bytes) {
+    lock_guard<mutex> guard(lock);
+    maxSlabs = min(bytes / sizeof(HistorySegment), MAX_SEGMENTS) / SLAB_SEGMENTS;
+}
+
+size_t HistoryPool::capacity() const {
+    lock_guard<mutex> guard(lock);
+    return maxSlabs * SLAB_SEGMENTS * sizeof(HistorySegment);
+}
+
+HistorySegment& HistoryPool::segment(uint32_t index) const {
+    return blocks[index / BLOCK_SEGMENTS][index / SLAB_SEGMENTS % BLOCK_SLABS][index % SLAB_SEGMENTS];
+}
+
+// Add a slab to the free list; caller holds the lock
+bool HistoryPool::grow() {
+    if (slabCount >= maxSlabs) {
+        return false;
+    }
+    try {
+        unique_ptr<unique_ptr<HistorySegment[]>[]>& block = blocks[slabCount / BLOCK_SLABS];
+        if (!block) block.reset(new unique_ptr<HistorySegment[]>[BLOCK_SLABS]);
+        block[slabCount % BLOCK_SLABS].reset(new HistorySegment[SLAB_SEGMENTS]);
+    } catch (const bad_alloc&) {
+        return false;
+    }
+    uint32_t first = static_cast<uint32_t>(slabCount * SLAB_SEGMENTS);
+    for (uint32_t i = 0; i < SLAB_SEGMENTS; ++i) {
+        segment(first + i).next = (i + 1 < SLAB_SEGMENTS) ? first + i + 1 : HistoryLog::NONE;
+    }
+    freeList = first;
+    ++slabCount;
+    return true;
+}
+
+uint32_t HistoryPool::allocate() {
+    lock_guard<mutex> guard(lock);
+    if (freeList == HistoryLog::NONE && !grow()) {
+        return HistoryLog::NONE;
+    }
+    uint32_t index = freeList;
+    freeList = segment(index).next;
+    ++inUse;
+    return index;
+}
+
+void HistoryPool::record(HistoryLog& log, HistoryKind kind, int counterparty, Money balance, int64_t timestamp, uint64_t lsn) {
+    unsigned char entry[MAX_ENTRY_BYTES];
+    int64_t amount = balance.minorUnits() - log.balance;
+    size_t length = 0;
+    if (log.tail != HistoryLog::NONE) {
+        length = encodeEntry(entry, kind, counterparty, amount, timestamp - log.lastTimestamp,
+                             static_cast<int64_t>(lsn - log.lastLsn), nullptr);
+    }
+
+    if (log.tail == HistoryLog::NONE || segment(log.tail).used + length > HistorySegment::CAPACITY) {
+        uint32_t cap = maxSegments.load();
+        bool recycled = log.segments >= cap;
+        uint32_t index = recycled ? HistoryLog::NONE : allocate();
+        if (index == HistoryLog::NONE && log.segments == 0) {
+            // Pool full and nothing of its own to recycle: the entry is only in the journal
+            log.balance = balance.minorUnits();
+            if (lsn + 1 > log.spilledBeforeLsn) log.spilledBeforeLsn = lsn + 1;
+            return;
+        }
+        if (index == HistoryLog::NONE) recycled = true;
+        if (recycled) {
+            // Full: drop anything over a lowered limit, then recycle the oldest
+            while (log.segments > cap) {
+                uint32_t dropped = log.head;
+                log.head = segment(dropped).next;
+                --log.segments;
+                lock_guard<mutex> guard(lock);
+                segment(dropped).next = freeList;
+                freeList = dropped;
+                --inUse;
+            }
+            index = log.head;
+            log.head = segment(index).next;
+            --log.segments;
+            if (log.head == HistoryLog::NONE) log.tail = HistoryLog::NONE;
+        }
+
+        HistorySegment& fresh = segment(index);
+        fresh.next = HistoryLog::NONE;
+        fresh.used = 0;
+        fresh.count = 0;
+        if (log.tail != HistoryLog::NONE) {
+            segment(log.tail).next = index;
+        } else {
+            log.head = index;
+        }
+        log.tail = index;
+        ++log.segments;
+        if (recycled) {
+            // Entries below the oldest LSN still in memory now live only in the journal
+            uint64_t oldest = lsn;
+            if (log.head != index) {
+                const unsigned char* p = segment(log.head).data;
+                HistoryKind headKind = static_cast<HistoryKind>(*p++);
+                if (hasCounterparty(headKind)) getVarint(p);
+                getVarint(p);
+                getVarint(p);
+                oldest = static_cast<uint64_t>(unzigzag(getVarint(p)));
+            }
+            if (oldest > log.spilledBeforeLsn) log.spilledBeforeLsn = oldest;
+        }
+        int64_t opening = log.balance;
+        length = encodeEntry(entry, kind, counterparty, amount, timestamp, static_cast<int64_t>(lsn), &opening);
+    }
+
+    HistorySegment& tail = segment(log.tail);
+    memcpy(tail.data + tail.used, entry, length);
+    tail.used = static_cast<uint8_t>(tail.used + length);
+    ++tail.count;
+    log.balance = balance.minorUnits();
+    log.lastTimestamp = timestamp;
+    log.lastLsn = lsn;
+}
+
+void HistoryPool::resume(HistoryLog& log, Money balance, uint64_t spilledBeforeLsn) {
+    release(log);
+    log.balance = balance.minorUnits();
+    log.spilledBeforeLsn = spilledBeforeLsn;
+}
+
+void HistoryPool::release(HistoryLog& log) {
+    if (log.head != HistoryLog::NONE) {
+        lock_guard<mutex> guard(lock);
+        segment(log.tail).next = freeList;
+        freeList = log.head;
+        inUse -= log.segments;
+    }
+    log = HistoryLog();
+}
+
+void HistoryPool::collect(const HistoryLog& log, vector<HistoryEntry>& out) const {
+    for (uint32_t index = log.head; index != HistoryLog::NONE;) {
+        const HistorySegment& s = segment(index);
+        const unsigned char* p = s.data;
+        int64_t timestamp = 0, balance = 0;
+        uint64_t lsn = 0;
+        for (unsigned i = 0; i < s.count; ++i) {
+            HistoryEntry entry;
+            entry.kind = static_cast<HistoryKind>(*p++);
+            if (hasCounterparty(entry.kind)) entry.counterparty = static_cast<int>(unzigzag(getVarint(p)));
+            int64_t amount = unzigzag(getVarint(p));
+            timestamp += unzigzag(getVarint(p));
+            lsn += static_cast<uint64_t>(unzigzag(getVarint(p)));
+            if (i == 0) balance = unzigzag(getVarint(p));
+            balance += amount;
+            entry.timestamp = timestamp;
+            entry.lsn = lsn;
+            entry.amount = Money::fromMinor(amount);
+            entry.balance = Money::fromMinor(balance);
+            out.push_back(entry);
+        }
+        index = s.next;
+    }
+}
+
+size_t HistoryPool::segmentsInUse() const {
+    lock_guard<mutex> guard(lock);
+    return inUse;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "money.h"
+
+using namespace std;
+
+// What a history entry records
+enum class HistoryKind : uint8_t {
+    Open,          // Opening balance
+    Deposit,
+    Withdrawal,
+    TransferIn,
+    TransferOut,
+    Interest,
+    ServiceCharge
+};
+
+const char* historyKindName(HistoryKind kind);
+
+// One decoded history entry
+struct HistoryEntry {
+    int64_t timestamp = 0;  // Microseconds since the epoch
+    uint64_t lsn = 0;       // Journal record of the change; 0 when not journaled
+    HistoryKind kind = HistoryKind::Deposit;
+    int counterparty = 0;   // Other account of a transfer
+    Money amount;           // Signed: credits positive, debits negative
+    Money balance;          // Balance after the entry
+};
+
+// Per-account history header, kept in a column next to the balances.
+// Entries live in a chain of pooled segments, oldest first.
+struct HistoryLog {
+    static const uint32_t NONE = UINT32_MAX;
+
+    uint32_t head = NONE;
+    uint32_t tail = NONE;
+    uint32_t segments = 0;
+    int64_t balance = 0;          // Balance after the newest entry; must track the live balance
+    int64_t lastTimestamp = 0;    // Delta bases for the next entry in the tail segment
+    uint64_t lastLsn = 0;
+    uint64_t spilledBeforeLsn = 0; // Entries below this LSN are only in the journal; 0 if none
+};
+
+// Fixed-size segment. The first entry of a segment carries absolute
+// timestamp, LSN and opening balance; later ones carry deltas from the
+// previous entry, all as LEB128 varints, so a typical entry takes 6-9 bytes.
+struct HistorySegment {
+    static const size_t CAPACITY = 56;
+
+    uint32_t next;
+    uint8_t used;     // Bytes of data in use
+    uint8_t count;    // Entries in data
+    uint8_t reserved[2];
+    unsigned char data[CAPACITY];
+};
+
+static_assert(sizeof(HistorySegment) == 64, "History segments are one cache line");
+
+// Pool of history segments shared by every account.
+//
+// Segments come from 64 KiB slabs that are never freed, so the history never
+// fragments the heap; a released segment goes on a free list. Each account
+// holds at most limit() bytes of segments: once full, its oldest segment is
+// recycled as the new tail and the entries in it remain only in the journal.
+// The pool grows a slab at a time up to capacity(); past that, or when
+// memory runs out, an account recycles its own oldest segment early, and
+// one with none keeps its entries only in the journal. Recording never
+// fails, since it runs after the change has committed.
+//
+// A log is only touched under its account's lock; the pool takes its own
+// lock just to hand out or take back segments.
+class HistoryPool {
+public:
+    static const size_t DEFAULT_BYTES_PER_ACCOUNT = 1024;
+
+    explicit HistoryPool(size_t bytesPerAccount = DEFAULT_BYTES_PER_ACCOUNT);
+    ~HistoryPool();
+    HistoryPool(const HistoryPool&) = delete;
+    HistoryPool& operator=(const HistoryPool&) = delete;
+
+    void setLimit(size_t bytesPerAccount); // Rounded down to whole segments, at least one
+    size_t limit() const;
+    // Most bytes of segments for every account together; slabs already taken are kept
+    void setCapacity(size_t bytes);
+    size_t capacity() const;
+
+    // Append the change that took the account to `balance`
+    void record(HistoryLog& log, HistoryKind kind, int counterparty, Money balance, int64_t timestamp, uint64_t lsn);
+    // Start a log whose earlier entries are only in the journal (e.g. loaded from a snapshot)
+    void resume(HistoryLog& log, Money balance, uint64_t spilledBeforeLsn);
+    void release(HistoryLog& log); // Return every segment to the pool
+
+    // Append every in-memory entry of the log, oldest first
+    void collect(const HistoryLog& log, vector<HistoryEntry>& out) const;
+
+    size_t segmentsInUse() const;
+
+private:
+    static const size_t SLAB_SEGMENTS = 1024;
+    static const size_t BLOCK_SLABS = 1024;   // Slabs per directory block
+    static const size_t BLOCK_SEGMENTS = BLOCK_SLABS * SLAB_SEGMENTS;
+    static const size_t MAX_SEGMENTS = (size_t(1) << 32) - SLAB_SEGMENTS; // Indexes are u32 and NONE is the last
+
+    // Directory blocks of slab pointers, added as the pool grows. Neither
+    // blocks nor slabs ever move, so readers need no lock.
+    vector<unique_ptr<unique_ptr<HistorySegment[]>[]>> blocks;
+    size_t slabCount = 0;
+    size_t maxSlabs;
+    uint32_t freeList = HistoryLog::NONE;
+    size_t inUse = 0;
+    atomic<uint32_t> maxSegments;
+    mutable mutex lock;
+
+    HistorySegment& segment(uint32_t index) const;
+    uint32_t allocate(); // NONE when the pool cannot grow
+    bool grow();
+};
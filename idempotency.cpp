@@ -0,0 +1,142 @@
+#include "idempotency.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+const size_t BLOOM_BITS_PER_KEY = 10;
+const int BLOOM_PROBES = 4;
+
+uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+} // namespace
+
+uint64_t idempotencyHash(string_view key) {
+    uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a, then mixed
+    for (char c : key) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 0x100000001b3ULL;
+    }
+    h = mix(h);
+    return h == 0 || h == UINT64_MAX ? 1 : h; // 0 means no key; UINT64_MAX is FlatIndex's empty marker
+}
+
+IdempotencyKeys::IdempotencyKeys(size_t capacity) : capacity(max<size_t>(capacity, 2)) {
+    size_t bits = 64;
+    while (bits < this->capacity / 2 * BLOOM_BITS_PER_KEY) bits <<= 1;
+    bloomMask = bits - 1;
+}
+
+bool IdempotencyKeys::mayContain(const Generation& generation, uint64_t key) const {
+    if (generation.bloom.empty()) return false;
+    uint64_t h = mix(key), step = (h >> 32) | 1;
+    for (int i = 0; i < BLOOM_PROBES; ++i, h += step) {
+        size_t bit = h & bloomMask;
+        if (!(generation.bloom[bit / 64] >> (bit % 64) & 1)) return false;
+    }
+    return true;
+}
+
+size_t IdempotencyKeys::find(uint64_t key, size_t& generation) const {
+    for (size_t age = 0; age < 2; ++age) {
+        generation = (current + age) % 2; // Newest first
+        if (mayContain(generations[generation], key)) {
+            size_t value = generations[generation].exact.find(key);
+            if (value != FlatIndex::npos) return value;
+        }
+    }
+    return FlatIndex::npos;
+}
+
+// Into the current generation, retiring the older one first if it is full
+void IdempotencyKeys::insert(uint64_t key, uint64_t value) {
+    if (generations[current].added >= capacity / 2) {
+        current = 1 - current;
+        Generation fresh;
+        swap(generations[current], fresh);
+    }
+    Generation& generation = generations[current];
+    if (generation.bloom.empty()) generation.bloom.assign((bloomMask + 1) / 64, 0);
+    uint64_t h = mix(key), step = (h >> 32) | 1;
+    for (int i = 0; i < BLOOM_PROBES; ++i, h += step) {
+        size_t bit = h & bloomMask;
+        generation.bloom[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+    generation.exact.insert(key, value);
+    ++generation.added;
+}
+
+bool IdempotencyKeys::claim(uint64_t key, uint64_t& appliedLsn) {
+    unique_lock<mutex> guard(lock);
+    for (;;) {
+        size_t generation;
+        size_t value = find(key, generation);
+        if (value == FlatIndex::npos) {
+            if (!mayContain(generations[0], key) && !mayContain(generations[1], key)) ++filtered;
+            insert(key, RUNNING);
+            return true;
+        }
+        if (value != RUNNING) {
+            appliedLsn = value - 1;
+            return false;
+        }
+        settled.wait(guard);
+    }
+}
+
+void IdempotencyKeys::release(uint64_t key, bool applied, uint64_t lsn) {
+    {
+        lock_guard<mutex> guard(lock);
+        size_t generation;
+        bool found = find(key, generation) != FlatIndex::npos;
+        if (applied && found && generation == current) {
+            generations[current].exact.insert(key, lsn + 1); // In place: the claim already counted it
+        } else {
+            if (found) generations[generation].exact.erase(key);
+            if (applied) insert(key, lsn + 1);
+        }
+    }
+    settled.notify_all();
+}
+
+void IdempotencyKeys::remember(uint64_t key, uint64_t lsn) {
+    lock_guard<mutex> guard(lock);
+    size_t generation;
+    if (find(key, generation) == FlatIndex::npos) insert(key, lsn + 1);
+}
+
+vector<uint64_t> IdempotencyKeys::applied() const {
+    lock_guard<mutex> guard(lock);
+    vector<uint64_t> keys;
+    for (size_t age = 2; age-- > 0;) {
+        generations[(current + age) % 2].exact.forEach([&keys](uint64_t key, size_t value) {
+            if (value != RUNNING) keys.push_back(key);
+        });
+    }
+    return keys;
+}
+
+size_t IdempotencyKeys::size() const {
+    lock_guard<mutex> guard(lock);
+    return generations[0].exact.size() + generations[1].exact.size();
+}
+
+size_t IdempotencyKeys::bytes() const {
+    lock_guard<mutex> guard(lock);
+    size_t total = 0;
+    for (const Generation& generation : generations) total += generation.bloom.capacity() * sizeof(uint64_t) + generation.exact.bytes();
+    return total;
+}
+
+uint64_t IdempotencyKeys::filteredLookups() const {
+    lock_guard<mutex> guard(lock);
+    return filtered;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <vector>
+#include "arena.h"
+
+using namespace std;
+
+// 64-bit hash of a client's idempotency key, as journaled; never 0
+uint64_t idempotencyHash(string_view key);
+
+// Idempotency keys of recently applied batches, in bounded memory.
+//
+// Keys sit in two generations, each an exact FlatIndex behind a Bloom
+// filter (10 bits and 4 probes per key, ~1% false positives). Nearly every
+// key a batch brings is new, and a filter answers that without probing its
+// exact set. Once the current generation holds half the capacity the older
+// one is dropped whole, so memory stays bounded and a key is remembered for
+// at least the next capacity / 2 keys; a retry later than that applies again.
+class IdempotencyKeys {
+public:
+    explicit IdempotencyKeys(size_t capacity = 1 << 18);
+
+    IdempotencyKeys(const IdempotencyKeys&) = delete;
+    IdempotencyKeys& operator=(const IdempotencyKeys&) = delete;
+
+    // Claim `key` for a batch about to run. Returns false, with the LSN of
+    // the batch's journal record, if a batch with the key already applied;
+    // while one with the key is still running, waits for its outcome.
+    bool claim(uint64_t key, uint64_t& appliedLsn);
+    void release(uint64_t key, bool applied, uint64_t lsn); // After a claim that returned true
+    void remember(uint64_t key, uint64_t lsn);              // An applied batch found by recovery
+
+    vector<uint64_t> applied() const; // Older generation first, for snapshots
+    size_t size() const;
+    size_t bytes() const;
+    uint64_t filteredLookups() const; // Claims a Bloom filter settled alone
+
+private:
+    static const uint64_t RUNNING = 0; // Index value of a claimed key; applied ones hold lsn + 1
+
+    struct Generation {
+        vector<uint64_t> bloom; // Allocated with the first key
+        FlatIndex exact;
+        size_t added = 0;
+    };
+
+    size_t capacity;
+    size_t bloomMask;
+    mutable mutex lock;
+    condition_variable settled;
+    Generation generations[2];
+    size_t current = 0;
+    uint64_t filtered = 0;
+
+    size_t find(uint64_t key, size_t& generation) const; // FlatIndex::npos if unknown
+    void insert(uint64_t key, uint64_t value);
+    bool mayContain(const Generation& generation, uint64_t key) const;
+};
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include "project.h"
+
+using namespace std;
+
+JobSpec JobSpec::interest(Rate rate, RoundingMode rounding) {
+    JobSpec spec;
+    spec.kind = JobKind::Interest;
+    spec.tiers.push_back(RateTier{Money(), rate.partsPerMillion()});
+    spec.rounding = rounding;
+    return spec;
+}
+
+JobSpec JobSpec::serviceCharge(Money charge) {
+    JobSpec spec;
+    spec.kind = JobKind::ServiceCharge;
+    spec.tiers.push_back(RateTier{Money(), charge.minorUnits()});
+    return spec;
+}
+
+JobSpec JobSpec::parse(JobKind kind, const string& schedule) {
+    auto value = [kind](const string& text) {
+        return kind == JobKind::Interest ? Rate::parsePercent(text).partsPerMillion() : Money::parse(text).minorUnits();
+    };
+    JobSpec spec;
+    spec.kind = kind;
+    if (schedule.find(':') == string::npos) {
+        spec.tiers.push_back(RateTier{Money(), value(schedule)});
+    } else {
+        size_t start = 0;
+        while (start <= schedule.size()) {
+            size_t end = min(schedule.find(',', start), schedule.size());
+            string tier = schedule.substr(start, end - start);
+            size_t colon = tier.find(':');
+            if (colon == string::npos) {
+                throw invalid_argument("Invalid tier: " + tier);
+            }
+            spec.tiers.push_back(RateTier{Money::parse(tier.substr(0, colon)), value(tier.substr(colon + 1))});
+            start = end + 1;
+        }
+    }
+    if (!spec.valid()) {
+        throw invalid_argument("Tiers need ascending balances and values that are not negative: " + schedule);
+    }
+    return spec;
+}
+
+bool JobSpec::valid() const {
+    if (tiers.empty() || chunkAccounts == 0 || chunkAccounts > MAX_CHUNK_ACCOUNTS) return false;
+    bool anyPositive = false;
+    for (size_t i = 0; i < tiers.size(); ++i) {
+        if (tiers[i].value < 0 || (i > 0 && !(tiers[i - 1].minimum < tiers[i].minimum))) return false;
+        anyPositive |= tiers[i].value > 0;
+    }
+    return kind == JobKind::Interest || anyPositive;
+}
+
+const RateTier* JobSpec::tierFor(Money balance) const {
+    auto above = upper_bound(tiers.begin(), tiers.end(), balance,
+                             [](Money value, const RateTier& tier) { return value < tier.minimum; });
+    return above == tiers.begin() ? nullptr : &*(above - 1);
+}
+
+int64_t JobSpec::changeFor(Money balance) const {
+    const RateTier* tier = tierFor(balance);
+    if (!tier) return 0;
+    if (kind == JobKind::Interest) {
+        return balance.isPositive() ? Money::scaleRounded(balance.minorUnits(), tier->value, 1000000, rounding) : 0;
+    }
+    return tier->value > 0 && balance.minorUnits() >= tier->value ? -tier->value : 0;
+}
+
+size_t JobProgress::chunksDone() const {
+    return count(chunkState.begin(), chunkState.end(), static_cast<unsigned char>(Done));
+}
+
+JobRunner::JobRunner(Bank& bank, unsigned threads) : bank(bank), threads(max(1u, threads)) {}
+
+void JobRunner::onProgress(function<void(size_t chunksDone, size_t chunks)> progress) {
+    this->progress = move(progress);
+}
+
+TxResult JobRunner::run(const JobSpec& spec, BulkRunSummary& summary) {
+    uint64_t jobId;
+    TxResult result = bank.startJob(spec, jobId);
+    if (result == TxResult::Ok) summary = drive(jobId);
+    return result;
+}
+
+vector<BulkRunSummary> JobRunner::resume() {
+    vector<BulkRunSummary> summaries;
+    for (uint64_t jobId : bank.unfinishedJobs()) summaries.push_back(drive(jobId));
+    return summaries;
+}
+
+BulkRunSummary JobRunner::drive(uint64_t jobId) {
+    JobProgress job;
+    if (!bank.jobProgress(jobId, job)) {
+        throw logic_error("Unknown bulk job " + to_string(jobId));
+    }
+    vector<size_t> pending;
+    for (size_t chunk = 0; chunk < job.chunks(); ++chunk) {
+        if (job.chunkState[chunk] != JobProgress::Done) pending.push_back(chunk);
+    }
+
+    atomic<size_t> next{0};
+    atomic<size_t> done{job.chunksDone()};
+    exception_ptr failure;
+    mutex failureLock;
+    auto work = [&] {
+        try {
+            for (size_t i; (i = next.fetch_add(1)) < pending.size();) {
+                bank.runJobChunk(jobId, pending[i]);
+                size_t finished = done.fetch_add(1) + 1;
+                if (progress) progress(finished, job.chunks());
+            }
+        } catch (...) {
+            next = pending.size(); // Stop the others
+            lock_guard<mutex> guard(failureLock);
+            if (!failure) failure = current_exception();
+        }
+    };
+    size_t workers = min<size_t>(threads, pending.size());
+    vector<thread> pool;
+    for (size_t t = 1; t < workers; ++t) pool.emplace_back(work);
+    work();
+    for (thread& worker : pool) worker.join();
+    if (failure) {
+        rethrow_exception(failure);
+    }
+    return bank.endJob(jobId);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "balance_kernels.h"
+#include "money.h"
+
+using namespace std;
+
+class Bank;
+enum class TxResult;
+
+enum class JobKind : uint8_t {
+    Interest = 1,
+    ServiceCharge
+};
+
+// One band of a tiered schedule: balances of at least `minimum` get `value`,
+// in ppm of the balance for interest and in minor units for a service charge
+struct RateTier {
+    Money minimum;
+    int64_t value = 0;
+};
+
+// What a bulk job does to each account. An account gets the value of the
+// highest tier its balance reaches when its chunk runs; below the lowest
+// tier it is left alone. Only positive balances earn interest, and a charge
+// is taken only from a balance that covers it.
+struct JobSpec {
+    static const size_t MAX_CHUNK_ACCOUNTS = 16384; // Keeps a chunk's journal record under its size limit
+
+    JobKind kind = JobKind::Interest;
+    vector<RateTier> tiers; // Ascending minimums
+    RoundingMode rounding = RoundingMode::HalfEven; // Interest only
+    size_t chunkAccounts = 1024; // Account numbers per chunk
+
+    static JobSpec interest(Rate rate, RoundingMode rounding = RoundingMode::HalfEven); // One rate for every balance
+    static JobSpec serviceCharge(Money charge);
+    // "2.5" for one value, or "0:1.5,10000:2.5" for tiers of balance:value.
+    // Interest values are percentages, charges amounts. Throws invalid_argument.
+    static JobSpec parse(JobKind kind, const string& schedule);
+
+    bool valid() const;
+    const RateTier* tierFor(Money balance) const; // nullptr below the lowest tier
+    int64_t changeFor(Money balance) const;       // Interest credited (> 0) or charge taken (< 0); 0 for none
+};
+
+// A job that was started and has not ended, as the Bank sees it
+struct JobProgress {
+    enum ChunkState : unsigned char { Pending, Running, Done };
+
+    uint64_t id = 0;
+    JobSpec spec;
+    int firstAccount = 0; // Chunk k holds the numbers [firstAccount + k * span, + span)
+    int endAccount = 0;   // One past the last number; accounts opened later are not in the job
+    int span = 0;
+    vector<unsigned char> chunkState; // ChunkState of each chunk
+    BulkRunSummary summary;           // Of the chunks done so far
+
+    size_t chunks() const { return chunkState.size(); }
+    size_t chunksDone() const;
+};
+
+// Runs bulk jobs on a Bank with a pool of worker threads, each taking the
+// next pending chunk. Every chunk is applied and journaled on its own and
+// holds only its accounts' locks, so other calls go on during a job, and a
+// crash loses at most the chunks in flight: resume() picks the job up after
+// recover() and runs only the chunks that never made it to the journal.
+class JobRunner {
+public:
+    explicit JobRunner(Bank& bank, unsigned threads = thread::hardware_concurrency());
+
+    // Called after each chunk, from the worker that ran it
+    void onProgress(function<void(size_t chunksDone, size_t chunks)> progress);
+
+    // Start the job and run it to the end; InvalidAmount if the spec is not valid()
+    TxResult run(const JobSpec& spec, BulkRunSummary& summary);
+    // Finish every job the bank recovered unfinished; returns their summaries
+    vector<BulkRunSummary> resume();
+
+private:
+    Bank& bank;
+    unsigned threads;
+    function<void(size_t, size_t)> progress;
+
+    BulkRunSummary drive(uint64_t jobId);
+};
@@ -0,0 +1,587 @@
+#include "journal.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+const size_t HEADER_BYTES = 8;                 // u32 length + u32 crc
+const uint32_t MAX_PAYLOAD = 1u << 20;         // Anything larger is corruption
+const size_t READ_CHUNK = 1 << 20;
+
+// File header: magic, u32 format version, u32 reserved. As a record length
+// the magic would be far past MAX_PAYLOAD, so it never reads as a record.
+const char MAGIC[8] = {'B', 'K', 'J', 'O', 'U', 'R', 'N', 'L'};
+const size_t FILE_HEADER_BYTES = 16;
+// Record layouts: 1 has no timestamp and only ever appears in files from
+// before the header; 2 adds the timestamp
+const uint32_t UNTIMED_VERSION = 1;
+const uint32_t JOURNAL_VERSION = 2;
+
+template <typename T>
+void put(vector<char>& out, T value) {
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+void putString(vector<char>& out, const string& s) {
+    if (s.size() > MAX_JOURNAL_STRING) {
+        throw length_error("Journal string of " + to_string(s.size()) + " bytes is over the record limit.");
+    }
+    put<uint16_t>(out, static_cast<uint16_t>(s.size()));
+    out.insert(out.end(), s.begin(), s.end());
+}
+
+void putEntries(vector<char>& out, const vector<pair<int64_t, int64_t>>& entries) {
+    put<uint32_t>(out, static_cast<uint32_t>(entries.size()));
+    for (const auto& entry : entries) {
+        put(out, entry.first);
+        put(out, entry.second);
+    }
+}
+
+// Bounds-checked reader over one record payload
+class Reader {
+public:
+    Reader(const char* data, size_t size) : p(data), end(data + size) {}
+
+    template <typename T>
+    bool get(T& value) {
+        if (static_cast<size_t>(end - p) < sizeof(T)) return false;
+        memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+
+    bool getString(string& s) {
+        uint16_t length;
+        if (!get(length) || static_cast<size_t>(end - p) < length) return false;
+        s.assign(p, length);
+        p += length;
+        return true;
+    }
+
+    bool done() const { return p == end; }
+
+    bool getEntries(vector<pair<int64_t, int64_t>>& entries) {
+        uint32_t count;
+        if (!get(count) || static_cast<size_t>(end - p) / (2 * sizeof(int64_t)) < count) return false;
+        entries.resize(count);
+        for (auto& entry : entries) {
+            get(entry.first);
+            get(entry.second);
+        }
+        return true;
+    }
+
+private:
+    const char* p;
+    const char* end;
+};
+
+void encode(const JournalRecord& r, vector<char>& out) {
+    size_t start = out.size();
+    out.resize(start + HEADER_BYTES);
+    put(out, r.lsn);
+    put(out, r.timestamp);
+    put(out, static_cast<uint8_t>(r.op));
+    put(out, r.account);
+    switch (r.op) {
+        case JournalOp::Open:
+            put(out, r.amount);
+            putString(out, r.name);
+            putString(out, r.phone);
+            putString(out, r.passwordHash);
+            put<uint8_t>(out, r.hasATM);
+            put(out, r.atmCardNumber);
+            put(out, r.atmPin);
+            break;
+        case JournalOp::Close:
+            break;
+        case JournalOp::Transfer:
+            put(out, r.counterparty);
+            put(out, r.amount);
+            break;
+        case JournalOp::Interest:
+            put(out, r.amount);
+            put(out, r.rounding);
+            break;
+        case JournalOp::TransferDebit:
+        case JournalOp::TransferCredit:
+            put(out, r.counterparty);
+            put(out, r.amount);
+            put(out, r.reference);
+            break;
+        case JournalOp::JobStart:
+            put(out, r.reference);
+            put(out, r.counterparty);
+            put(out, r.amount);
+            put(out, r.rounding);
+            put(out, r.jobKind);
+            putEntries(out, r.entries);
+            break;
+        case JournalOp::JobChunk:
+            put(out, r.reference);
+            put(out, r.amount);
+            put(out, r.jobKind);
+            putEntries(out, r.entries);
+            break;
+        case JournalOp::JobEnd:
+            put(out, r.reference);
+            break;
+        case JournalOp::Post:
+            put(out, r.reference);
+            putEntries(out, r.entries);
+            break;
+        default:
+            put(out, r.amount);
+            break;
+    }
+    uint32_t length = static_cast<uint32_t>(out.size() - start - HEADER_BYTES);
+    uint32_t crc = crc32(out.data() + start + HEADER_BYTES, length);
+    memcpy(out.data() + start, &length, sizeof(length));
+    memcpy(out.data() + start + sizeof(length), &crc, sizeof(crc));
+}
+
+bool decodeFields(Reader& in, JournalRecord& r) {
+    switch (r.op) {
+        case JournalOp::Open: {
+            uint8_t hasATM;
+            if (!in.get(r.amount) || !in.getString(r.name) || !in.getString(r.phone) || !in.getString(r.passwordHash) ||
+                !in.get(hasATM) || !in.get(r.atmCardNumber) || !in.get(r.atmPin)) {
+                return false;
+            }
+            r.hasATM = hasATM != 0;
+            return true;
+        }
+        case JournalOp::Close:
+            return true;
+        case JournalOp::Transfer:
+            return in.get(r.counterparty) && in.get(r.amount);
+        case JournalOp::Interest:
+            return in.get(r.amount) && in.get(r.rounding);
+        case JournalOp::TransferDebit:
+        case JournalOp::TransferCredit:
+            return in.get(r.counterparty) && in.get(r.amount) && in.get(r.reference);
+        case JournalOp::JobStart:
+            return in.get(r.reference) && in.get(r.counterparty) && in.get(r.amount) && in.get(r.rounding) && in.get(r.jobKind) &&
+                   in.getEntries(r.entries);
+        case JournalOp::JobChunk:
+            return in.get(r.reference) && in.get(r.amount) && in.get(r.jobKind) && in.getEntries(r.entries);
+        case JournalOp::JobEnd:
+            return in.get(r.reference);
+        case JournalOp::Post:
+            return in.get(r.reference) && in.getEntries(r.entries);
+        case JournalOp::Deposit:
+        case JournalOp::Withdraw:
+        case JournalOp::ServiceCharge:
+            return in.get(r.amount);
+    }
+    return false;
+}
+
+// A payload in record layout `version`; every byte must be accounted for
+bool decode(const char* payload, size_t length, JournalRecord& r, uint32_t version = JOURNAL_VERSION) {
+    Reader in(payload, length);
+    uint8_t op;
+    if (!in.get(r.lsn) || (version >= JOURNAL_VERSION && !in.get(r.timestamp)) || !in.get(op) || !in.get(r.account)) {
+        return false;
+    }
+    r.op = static_cast<JournalOp>(op);
+    return decodeFields(in, r) && in.done();
+}
+
+vector<char> fileHeader() {
+    vector<char> header(MAGIC, MAGIC + sizeof(MAGIC));
+    put(header, JOURNAL_VERSION);
+    put<uint32_t>(header, 0);
+    return header;
+}
+
+uint64_t fileSize(int fd) {
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        throw runtime_error("Journal stat failed: " + string(strerror(errno)));
+    }
+    return static_cast<uint64_t>(st.st_size);
+}
+
+// Read up to `size` bytes at `offset`; fewer only at end of file
+size_t readAt(int fd, char* data, size_t size, uint64_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = ::pread(fd, data + done, size - done, static_cast<off_t>(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error("Journal read failed: " + string(strerror(errno)));
+        }
+        if (n == 0) break;
+        done += static_cast<size_t>(n);
+    }
+    return done;
+}
+
+// Whether every byte from `offset` to `end` is zero: blocks a crash left
+// allocated but unwritten
+bool zeroFrom(int fd, uint64_t offset, uint64_t end) {
+    vector<char> buffer(READ_CHUNK);
+    while (offset < end) {
+        size_t n = readAt(fd, buffer.data(), static_cast<size_t>(min<uint64_t>(buffer.size(), end - offset)), offset);
+        if (n == 0) break;
+        for (size_t i = 0; i < n; ++i) {
+            if (buffer[i] != 0) return false;
+        }
+        offset += n;
+    }
+    return true;
+}
+
+struct Walk {
+    uint64_t validEnd = 0; // Just past the last intact record visited
+    bool stopped = false;  // visit() returned false
+};
+
+// Visit the records from `offset` to the end of the file. Only a torn tail
+// ends the walk quietly: a record that runs short at end of file, a last
+// record that fails its check, or a zero-filled tail. Any other record that
+// fails its CRC or does not decode is corruption: a strict walk throws, a
+// lenient one stops there.
+Walk walkRecords(int fd, const string& path, uint64_t offset, uint32_t version, bool strict,
+                 const function<bool(const JournalRecord&)>& visit) {
+    uint64_t end = fileSize(fd);
+    vector<char> buffer;
+    uint64_t bufferStart = offset; // File offset of buffer[0]
+    size_t begin = 0;              // Unconsumed bytes start here in buffer
+    // Make `need` bytes available at `begin`
+    auto fill = [&](size_t need) {
+        if (buffer.size() - begin >= need) return true;
+        buffer.erase(buffer.begin(), buffer.begin() + begin);
+        bufferStart += begin;
+        begin = 0;
+        size_t old = buffer.size();
+        buffer.resize(max(need, READ_CHUNK));
+        buffer.resize(old + readAt(fd, buffer.data() + old, buffer.size() - old, bufferStart + old));
+        return buffer.size() >= need;
+    };
+
+    Walk walk;
+    walk.validEnd = offset;
+    while (walk.validEnd < end) {
+        uint64_t at = walk.validEnd;
+        if (end - at < HEADER_BYTES || !fill(HEADER_BYTES)) break; // Torn header
+        uint32_t length, crc;
+        memcpy(&length, buffer.data() + begin, sizeof(length));
+        memcpy(&crc, buffer.data() + begin + sizeof(length), sizeof(crc));
+        if (length <= MAX_PAYLOAD && end - at - HEADER_BYTES < length) break; // Runs short at end of file
+        JournalRecord record;
+        bool intact = length <= MAX_PAYLOAD && fill(HEADER_BYTES + length) &&
+                      crc32(buffer.data() + begin + HEADER_BYTES, length) == crc &&
+                      decode(buffer.data() + begin + HEADER_BYTES, length, record, version);
+        if (!intact) {
+            if (!strict || at + HEADER_BYTES + length == end || zeroFrom(fd, at, end)) break;
+            throw runtime_error("Journal " + path + " is corrupt at offset " + to_string(at) +
+                                "; refusing to replay or truncate past it.");
+        }
+        if (!visit(record)) {
+            walk.stopped = true;
+            break;
+        }
+        begin += HEADER_BYTES + length;
+        walk.validEnd = at + HEADER_BYTES + length;
+    }
+    return walk;
+}
+
+struct Format {
+    uint32_t version = JOURNAL_VERSION; // Record layout
+    uint64_t dataStart = 0;             // Offset of the first record
+    bool headered = false;              // False for files from before the header, and new empty files
+};
+
+// Read the file header. A file without one is probed: its first record
+// must decode exactly in one of the layouts.
+Format formatOf(int fd, const string& path) {
+    Format format;
+    char header[FILE_HEADER_BYTES];
+    size_t n = readAt(fd, header, sizeof(header), 0);
+    if (n >= sizeof(MAGIC) && memcmp(header, MAGIC, sizeof(MAGIC)) == 0) {
+        if (n < FILE_HEADER_BYTES) {
+            throw runtime_error("Journal " + path + " has a truncated header.");
+        }
+        memcpy(&format.version, header + sizeof(MAGIC), sizeof(format.version));
+        if (format.version != JOURNAL_VERSION) {
+            throw runtime_error("Journal " + path + " is format version " + to_string(format.version) + "; this build reads version " +
+                                to_string(JOURNAL_VERSION) + ".");
+        }
+        format.dataStart = FILE_HEADER_BYTES;
+        format.headered = true;
+        return format;
+    }
+    auto first = [](const JournalRecord&) { return false; };
+    for (uint32_t version : {JOURNAL_VERSION, UNTIMED_VERSION}) {
+        if (walkRecords(fd, path, 0, version, false, first).stopped) {
+            format.version = version;
+            return format;
+        }
+    }
+    // Neither: only an empty file or one holding a torn first record will do
+    try {
+        walkRecords(fd, path, 0, JOURNAL_VERSION, true, first);
+    } catch (const runtime_error&) {
+        throw runtime_error("Journal " + path + " is not in a known format.");
+    }
+    return format;
+}
+
+void writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error("Journal write failed: " + string(strerror(errno)));
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+}
+
+} // namespace
+
+uint32_t crc32(const void* data, size_t length) {
+    static uint32_t table[256];
+    static bool ready = [] {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)ready;
+    uint32_t crc = 0xFFFFFFFFu;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < length; ++i) crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Journal class methods implementation
+Journal::Journal(const string& path, Durability durability) : filePath(path), mode(durability) {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        throw runtime_error("Cannot open journal " + path + ": " + strerror(errno));
+    }
+    flusher = thread(&Journal::flushLoop, this);
+}
+
+Journal::~Journal() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    pendingReady.notify_all();
+    flusher.join();
+    ::close(fd);
+}
+
+size_t Journal::replay(const function<void(const JournalRecord&)>& apply, uint64_t startOffset, uint64_t afterLsn) {
+    lock_guard<mutex> guard(lock);
+    return scan(&apply, startOffset, afterLsn);
+}
+
+// Walk the file from startOffset, truncate a torn tail and position for
+// appends. A file from before the header is upgraded first. Caller holds
+// `lock`.
+size_t Journal::scan(const function<void(const JournalRecord&)>* apply, uint64_t startOffset, uint64_t afterLsn) {
+    if (scanned) {
+        throw logic_error("Journal replay must run before the first append.");
+    }
+    Format format = formatOf(fd, filePath);
+    if (!format.headered) {
+        upgrade(format.version);
+        startOffset = 0; // Offsets into the old file mean nothing now
+    }
+    uint64_t end = fileSize(fd);
+    if (startOffset < FILE_HEADER_BYTES || startOffset > end) {
+        startOffset = FILE_HEADER_BYTES; // Not the journal the snapshot was taken against
+    }
+    if (startOffset != FILE_HEADER_BYTES && startOffset != end) {
+        // The record at the snapshot's offset must be the one after its LSN
+        bool linesUp = false;
+        walkRecords(fd, filePath, startOffset, JOURNAL_VERSION, false, [&](const JournalRecord& record) {
+            linesUp = record.lsn == afterLsn + 1;
+            return false;
+        });
+        if (!linesUp) startOffset = FILE_HEADER_BYTES;
+    }
+
+    size_t records = 0;
+    Walk walk = walkRecords(fd, filePath, startOffset, JOURNAL_VERSION, true, [&](const JournalRecord& record) {
+        if (apply && record.lsn > afterLsn) (*apply)(record);
+        nextLsn = record.lsn + 1;
+        ++records;
+        return true;
+    });
+    off_t validEnd = static_cast<off_t>(walk.validEnd);
+    if (::ftruncate(fd, validEnd) != 0 || ::lseek(fd, validEnd, SEEK_SET) < 0) {
+        throw runtime_error("Journal truncate failed: " + string(strerror(errno)));
+    }
+    nextLsn = max(nextLsn, afterLsn + 1);
+    appendedLsn = flushedLsn = nextLsn - 1;
+    appendedBytes = walk.validEnd;
+    scanned = true;
+    return records;
+}
+
+// Rewrite a file from before the header (record layout `version`), or a new
+// empty one, in the current format: written aside, synced, then renamed over
+// the original, so a crash leaves one or the other whole
+void Journal::upgrade(uint32_t version) {
+    string temp = filePath + ".upgrade";
+    int out = ::open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        throw runtime_error("Cannot create journal " + temp + ": " + strerror(errno));
+    }
+    try {
+        vector<char> data = fileHeader();
+        walkRecords(fd, filePath, 0, version, true, [&](const JournalRecord& record) {
+            encode(record, data); // Layout 1 records get a zero timestamp
+            if (data.size() >= READ_CHUNK) {
+                writeAll(out, data.data(), data.size());
+                data.clear();
+            }
+            return true;
+        });
+        writeAll(out, data.data(), data.size());
+        if (::fdatasync(out) != 0) {
+            throw runtime_error("Cannot sync journal " + temp + ": " + strerror(errno));
+        }
+        if (::rename(temp.c_str(), filePath.c_str()) != 0) {
+            throw runtime_error("Cannot replace journal " + filePath + ": " + strerror(errno));
+        }
+    } catch (...) {
+        ::close(out);
+        ::unlink(temp.c_str());
+        throw;
+    }
+    ::close(fd);
+    fd = out;
+}
+
+void Journal::read(const function<bool(const JournalRecord&)>& visit) const {
+    int in = ::open(filePath.c_str(), O_RDONLY);
+    if (in < 0) {
+        throw runtime_error("Cannot open journal " + filePath + ": " + strerror(errno));
+    }
+    try {
+        // A record still being written by the flusher reads as torn: the walk stops there
+        Format format = formatOf(in, filePath);
+        walkRecords(in, filePath, format.dataStart, format.version, false, visit);
+    } catch (...) {
+        ::close(in);
+        throw;
+    }
+    ::close(in);
+}
+
+uint64_t Journal::append(JournalRecord& record) {
+    {
+        lock_guard<mutex> guard(lock);
+        if (!scanned) scan(nullptr, 0, 0);
+        if (failed) throw runtime_error(failure);
+        record.lsn = nextLsn;
+        size_t before = pending.size();
+        try {
+            encode(record, pending);
+        } catch (...) {
+            pending.resize(before);
+            throw;
+        }
+        ++nextLsn;
+        appendedBytes += pending.size() - before;
+        appendedLsn = record.lsn;
+    }
+    pendingReady.notify_one();
+    return record.lsn;
+}
+
+void Journal::waitDurable(uint64_t lsn) {
+    if (mode == Durability::Async) {
+        if (failed) throw runtime_error(failure); // Set once, before any reader sees `failed`
+        return;
+    }
+    unique_lock<mutex> guard(lock);
+    durableAdvanced.wait(guard, [&] { return flushedLsn >= lsn || failed; });
+    if (flushedLsn < lsn) throw runtime_error(failure);
+}
+
+void Journal::sync() {
+    uint64_t target;
+    {
+        lock_guard<mutex> guard(lock);
+        target = appendedLsn;
+    }
+    pendingReady.notify_one();
+    unique_lock<mutex> guard(lock);
+    durableAdvanced.wait(guard, [&] { return flushedLsn >= target || failed; });
+    if (flushedLsn < target) throw runtime_error(failure);
+}
+
+void Journal::flushLoop() {
+    vector<char> batch;
+    unique_lock<mutex> guard(lock);
+    for (;;) {
+        pendingReady.wait(guard, [&] { return stopping || !pending.empty(); });
+        if (pending.empty() && stopping) return;
+        // Everything appended while the previous batch was being fsynced goes
+        // out together: that is the group commit
+        batch.swap(pending);
+        uint64_t upto = appendedLsn;
+        guard.unlock();
+        string error;
+        try {
+            writeAll(fd, batch.data(), batch.size());
+            if (::fdatasync(fd) != 0) {
+                // The kernel may have dropped the dirty pages: retrying could report success for lost data
+                error = "Journal fsync failed: " + string(strerror(errno));
+            }
+        } catch (const runtime_error& e) {
+            error = e.what();
+        }
+        batch.clear();
+        guard.lock();
+        if (!error.empty()) {
+            failure = error;
+            failed = true;
+            pending.clear(); // Never written: nothing after the failed batch can be durable
+            durableAdvanced.notify_all();
+            return;
+        }
+        flushedLsn = upto;
+        durableAdvanced.notify_all();
+    }
+}
+
+Journal::Durability Journal::durability() const { return mode; }
+const string& Journal::path() const { return filePath; }
+
+uint64_t Journal::lastLsn() const {
+    lock_guard<mutex> guard(lock);
+    return appendedLsn;
+}
+
+uint64_t Journal::endOffset() const {
+    lock_guard<mutex> guard(lock);
+    return appendedBytes;
+}
+
+uint64_t Journal::durableLsn() const {
+    lock_guard<mutex> guard(lock);
+    return flushedLsn;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Longest string (name, phone, password hash) a record can carry
+const size_t MAX_JOURNAL_STRING = 65535;
+
+// Kinds of state change recorded in the journal
+enum class JournalOp : uint8_t {
+    Open = 1,
+    Close,
+    Deposit,
+    Withdraw,
+    Transfer,
+    Interest,
+    ServiceCharge,
+    TransferDebit, // Sending leg of a transfer between two Banks (shards)
+    TransferCredit, // Receiving leg, or the refund of a debit whose credit failed
+    JobStart,       // A bulk job: its schedule and how the accounts are cut into chunks
+    JobChunk,       // One chunk of a bulk job, with the change made to each account
+    JobEnd,         // Every chunk of the job is done
+    Post            // A batch of postings applied as one transaction
+};
+
+// One journaled state change. Only the fields its op uses are written.
+struct JournalRecord {
+    JournalOp op = JournalOp::Deposit;
+    uint64_t lsn = 0;          // Assigned by Journal::append
+    int64_t timestamp = 0;     // Microseconds since the epoch when applied
+    int32_t account = 0;       // Subject account (sender for Transfer)
+    int32_t counterparty = 0;  // Transfer recipient; the other account of a leg
+    int64_t amount = 0;        // Minor units; ppm for Interest; opening balance for Open
+    uint8_t rounding = 0;      // RoundingMode for Interest
+    uint64_t reference = 0;    // Shared by both legs of a cross-shard transfer; job id of job records; idempotency key of Post
+
+    // Open only
+    string name;
+    string phone;
+    string passwordHash;
+    bool hasATM = false;
+    int32_t atmCardNumber = 0;
+    int32_t atmPin = 0;
+
+    // Job records. JobStart: account and counterparty bound the account
+    // numbers in the job, amount is the numbers per chunk and entries are the
+    // tiers as (minimum balance, value). JobChunk: amount is the chunk index
+    // and entries are (account, change) for every account changed. Post:
+    // entries are (account, net change) in account-number order.
+    uint8_t jobKind = 0; // JobKind
+    vector<pair<int64_t, int64_t>> entries;
+};
+
+// Append-only binary write-ahead journal with group commit.
+//
+// The file starts with a header: magic and format version. After it every
+// record is [u32 payload length][u32 crc32][payload]. A file from before the
+// header (records with or without timestamps) is rewritten in the current
+// format the first time it is opened for replay. append()
+// only copies the encoded record into an in-memory batch; a flusher thread
+// writes each batch with one write() and one fdatasync(), so every caller
+// waiting in waitDurable() during that window shares a single fsync.
+// Records must be appended in the order they were applied to the book, which
+// the Bank guarantees by appending while it still holds the account locks.
+class Journal {
+public:
+    enum class Durability {
+        Sync, // Bank operations wait for their record to reach disk
+        Async // Records are flushed in the background; a crash may lose the last batch
+    };
+
+    explicit Journal(const string& path, Durability durability = Durability::Sync);
+    ~Journal(); // Flushes what is pending
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Read every record in order. A torn tail left by a crash is truncated
+    // away; a record that fails its check anywhere else throws, leaving the
+    // file as it was. Must run before the first append.
+    // With a snapshot, pass the journal offset and LSN it was taken at: the
+    // scan starts there and only records after `afterLsn` are applied. If the
+    // offset does not line up with that LSN the whole file is scanned instead.
+    size_t replay(const function<void(const JournalRecord&)>& apply, uint64_t startOffset = 0, uint64_t afterLsn = 0);
+
+    // Read-only pass over the intact records from the start of the file, in
+    // order, alongside appends; stops early once `visit` returns false.
+    // Covers what has been flushed so far.
+    void read(const function<bool(const JournalRecord&)>& visit) const;
+
+    // Thread-safe; fills in and returns record.lsn. Throws length_error for a
+    // string over MAX_JOURNAL_STRING, and the flusher's error once a write
+    // or fsync has failed.
+    uint64_t append(JournalRecord& record);
+    // Both throw the flusher's error once a write or fsync has failed: what
+    // was appended after the last good fsync may never reach disk
+    void waitDurable(uint64_t lsn);         // Returns at once in Async mode
+    void sync();                            // Flush and fsync everything appended so far
+
+    Durability durability() const;
+    const string& path() const;
+    uint64_t lastLsn() const;
+    uint64_t durableLsn() const;
+    uint64_t endOffset() const; // File size once everything appended is flushed
+
+private:
+    string filePath;
+    Durability mode;
+    int fd;
+
+    mutable mutex lock;
+    condition_variable pendingReady;   // Flusher waits for work
+    condition_variable durableAdvanced; // Committers wait for their LSN
+    vector<char> pending;
+    uint64_t nextLsn = 1;
+    uint64_t appendedLsn = 0;
+    uint64_t flushedLsn = 0;
+    string failure;           // First write or fsync error; sticky, since the batch it hit is lost
+    atomic<bool> failed{false}; // failure is set, for the Async fast path
+    uint64_t appendedBytes = 0;
+    bool scanned = false;
+    bool stopping = false;
+    thread flusher;
+
+    void flushLoop();
+    void upgrade(uint32_t version);
+    size_t scan(const function<void(const JournalRecord&)>* apply, uint64_t startOffset, uint64_t afterLsn);
+};
+
+uint32_t crc32(const void* data, size_t length);
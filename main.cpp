@@ -3,17 +3,96 @@
 #include <string>
 #include <algorithm>
 #include <stdexcept> // For exception handling
+#include <thread>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include "batch.h"
 #include "project.h"
+#include "server.h"
 
 using namespace std;
 
 bool adminLogin(Admin& admin);
 
-int main() {
+// Jobs a crash cut short are finished before anything else runs
+void reportResumed(const vector<BulkRunSummary>& summaries) {
+    for (const BulkRunSummary& summary : summaries) {
+        cout << "Resumed an interrupted bulk job: " << summary.accountsAffected << " accounts changed by " << summary.total << ".\n";
+    }
+}
+
+// Velocity rules apply if their file exists; loaded before recovery so the
+// replayed journal rebuilds the windows they count
+void loadRules(Bank& bank, const string& path) {
+    if (ifstream(path)) {
+        bank.loadVelocityRules(path);
+        cout << "Loaded velocity rules from " << path << ".\n";
+    }
+}
+
+// Card numbers and PIN values are keyed by $BANK_CARD_SECRET when it is set;
+// it must stay the same for the life of the book
+void loadCardSecret(Bank& bank) {
+    if (const char* secret = getenv("BANK_CARD_SECRET")) {
+        bank.setCardSecret(secret);
+    }
+}
+
+// bank --serve [port] [journal] [snapshot] [event loops] [velocity rules]: serve the book over
+// TCP on 127.0.0.1 (see server.h) until SIGINT or SIGTERM
+int serve(int argc, char* argv[]) {
+    uint16_t port = static_cast<uint16_t>(argc > 2 ? stoi(argv[2]) : 7878);
+    Journal journal(argc > 3 ? argv[3] : "bank.journal");
+    string snapshotPath = argc > 4 ? argv[4] : "bank.snapshot";
+    unsigned loops = argc > 5 ? stoul(argv[5]) : thread::hardware_concurrency();
+    string rulesPath = argc > 6 ? argv[6] : "velocity.rules";
+
+    // Taken by sigwait below rather than by a handler, so stop() runs on a normal thread
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    Bank bank;
+    loadCardSecret(bank);
+    loadRules(bank, rulesPath);
+    size_t replayed = bank.recover(journal, snapshotPath);
+    BankServer server(bank, &journal, port, loops);
+    cout << "Recovered " << bank.accountCount() << " accounts from " << replayed << " journal records.\n";
+    reportResumed(JobRunner(bank).resume());
+    cout << "Serving on 127.0.0.1:" << server.port() << "\n";
+    thread loop([&server] { server.run(); });
+    int signal;
+    sigwait(&signals, &signal);
+    server.stop();
+    loop.join();
+    journal.sync();
+    cout << "Server stopped.\n";
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--serve") {
+        return serve(argc, argv);
+    }
     AccountManager manager;
     Admin admin;
     int choice;
 
+    // Rebuild the book from the latest snapshot plus the journal written
+    // after it, then keep journaling every change
+    Journal journal(argc > 1 ? argv[1] : "bank.journal");
+    string snapshotPath = argc > 2 ? argv[2] : "bank.snapshot";
+    loadCardSecret(manager.engine());
+    loadRules(manager.engine(), argc > 3 ? argv[3] : "velocity.rules");
+    size_t replayed = manager.engine().recover(journal, snapshotPath);
+    if (replayed || manager.engine().accountCount()) {
+        cout << "Recovered " << manager.engine().accountCount() << " accounts from " << replayed << " journal records.\n";
+    }
+    reportResumed(JobRunner(manager.engine()).resume());
+
     do {
         cout << "\nBanking System Menu:\n";
         cout << "1. Create Account\n";
@@ -21,6 +100,7 @@ int main() {
         cout << "3. Delete Account\n";
         cout << "4. Admin Login\n";
         cout << "5. Exit\n";
+        cout << "6. ATM Withdrawal\n";
         cout << "Enter your choice: ";
         cin >> choice;
 
@@ -51,6 +131,12 @@ int main() {
                             cout << "4. Apply Service Charge\n";
                             cout << "5. Display Admin Info\n"; // New option
                             cout << "6. Exit Admin Menu\n";
+                            cout << "7. Save Snapshot\n";
+                            cout << "8. Process Batch File\n";
+                            cout << "9. Search Accounts by Name\n";
+                            cout << "10. Accounts with Balance Over\n";
+                            cout << "11. View Metrics\n";
+                            cout << "12. Export Metrics (Prometheus)\n";
                             cout << "Enter your choice: ";
                             cin >> adminChoice;
 
@@ -66,17 +152,24 @@ int main() {
                                     break;
                                 }
                                 case 3: {
-                                    double interestRate;
-                                    cout << "Enter interest rate (in percentage): ";
-                                    cin >> interestRate;
-                                    manager.applyInterest(interestRate);
+                                    string schedule;
+                                    cout << "Enter interest rate (in percentage), or tiers as balance:rate,... : ";
+                                    cin >> schedule;
+                                    BulkRunSummary summary = manager.runJob(JobSpec::parse(JobKind::Interest, schedule));
+                                    cout << "Interest of " << summary.total << " credited to " << summary.accountsAffected
+                                         << " of " << summary.accountsScanned << " accounts.\n";
                                     break;
                                 }
                                 case 4: {
-                                    double serviceCharge;
-                                    cout << "Enter service charge amount: ";
-                                    cin >> serviceCharge;
-                                    manager.applyServiceCharge(serviceCharge);
+                                    string schedule;
+                                    cout << "Enter service charge amount, or tiers as balance:amount,... : ";
+                                    cin >> schedule;
+                                    BulkRunSummary summary = manager.runJob(JobSpec::parse(JobKind::ServiceCharge, schedule));
+                                    cout << "Service charge collected from " << summary.accountsAffected << " of "
+                                         << summary.accountsScanned << " accounts (total " << summary.total << ").\n";
+                                    if (summary.accountsSkipped) {
+                                        cout << summary.accountsSkipped << " accounts skipped: insufficient funds.\n";
+                                    }
                                     break;
                                 }
                                 case 5:
@@ -85,6 +178,34 @@ int main() {
                                 case 6:
                                     cout << "Exiting admin menu.\n";
                                     break;
+                                case 7: {
+                                    size_t saved = manager.engine().saveSnapshot(snapshotPath);
+                                    cout << "Snapshot of " << saved << " accounts written to " << snapshotPath << ".\n";
+                                    break;
+                                }
+                                case 8: {
+                                    string inputPath, resultPath;
+                                    cout << "Enter batch file path: ";
+                                    cin >> inputPath;
+                                    cout << "Enter result file path: ";
+                                    cin >> resultPath;
+                                    BatchSummary summary = BatchProcessor(manager.engine()).run(inputPath, resultPath);
+                                    cout << "Processed " << summary.rows << " rows in " << summary.seconds << " s: " << summary.applied
+                                         << " applied, " << summary.rejected << " rejected, " << summary.parseErrors << " unparseable.\n";
+                                    break;
+                                }
+                                case 9:
+                                    manager.searchAccountsByName();
+                                    break;
+                                case 10:
+                                    manager.listAccountsOver();
+                                    break;
+                                case 11:
+                                    manager.showMetrics();
+                                    break;
+                                case 12:
+                                    manager.exportMetrics();
+                                    break;
                                 default:
                                     cout << "Invalid choice. Please try again.\n";
                             }
@@ -97,6 +218,9 @@ int main() {
                 case 5:
                     cout << "Thank you for using the Banking System! Have a great day ahead!";
                     break;
+                case 6:
+                    manager.atmWithdraw();
+                    break;
                 default:
                     cout << "Invalid choice. Please try again.\n";
             }
@@ -0,0 +1,338 @@
+#include "metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+
+const char* const OP_NAMES[METRIC_OPS] = {"open", "close", "authenticate", "deposit", "withdraw",
+                                          "transfer", "transfer_leg", "balance", "apply_interest", "apply_service_charge",
+                                          "job_chunk", "post", "card_authorize", "card_withdraw"};
+// In TxResult order
+const char* const RESULT_NAMES[METRIC_RESULTS] = {"ok", "invalid_amount", "account_not_found", "insufficient_funds", "invalid_phone",
+                                                  "duplicate_phone", "weak_password", "auth_failed", "too_many_attempts", "velocity_limit",
+                                                  "invalid_name", "invalid_password_hash"};
+// Histogram bucket bounds of the Prometheus export, in seconds
+const double EXPORT_BOUNDS[] = {1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3,
+                                5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+
+#ifndef BANK_NO_METRICS
+// One thread's counters. Only the owning thread writes, so an increment is
+// a relaxed load and store rather than a locked read-modify-write.
+struct ThreadBlock {
+    atomic<uint64_t> calls[METRIC_OPS][METRIC_RESULTS];
+    atomic<uint64_t> buckets[METRIC_OPS][LatencyHistogram::BUCKETS];
+    atomic<uint64_t> sumNanos[METRIC_OPS];
+    atomic<uint64_t> maxNanos[METRIC_OPS];
+
+    ThreadBlock() { clear(); }
+    void clear() {
+        for (auto& row : calls) for (auto& c : row) c.store(0, memory_order_relaxed);
+        for (auto& row : buckets) for (auto& c : row) c.store(0, memory_order_relaxed);
+        for (auto& c : sumNanos) c.store(0, memory_order_relaxed);
+        for (auto& c : maxNanos) c.store(0, memory_order_relaxed);
+    }
+};
+
+void bump(atomic<uint64_t>& counter, uint64_t by = 1) {
+    counter.store(counter.load(memory_order_relaxed) + by, memory_order_relaxed);
+}
+
+atomic<unsigned> sampleEvery{Metrics::DEFAULT_SAMPLE_EVERY};
+
+// Every block ever handed out; blocks of exited threads wait in `idle`
+struct Registry {
+    mutex lock;
+    vector<unique_ptr<ThreadBlock>> blocks;
+    vector<ThreadBlock*> idle;
+};
+
+Registry& registry() {
+    static Registry* instance = new Registry(); // Never destroyed: threads may still exit after main
+    return *instance;
+}
+
+// Plain thread-local state, constant-initialised so the hot path reaches it
+// without a guard
+struct Local {
+    ThreadBlock* block;
+    unsigned untilTimed[METRIC_OPS]; // Calls left before the next timed one
+};
+thread_local Local local = {};
+
+// Hands the block back when its thread exits
+struct Lease {
+    ~Lease() {
+        Registry& r = registry();
+        lock_guard<mutex> guard(r.lock);
+        r.idle.push_back(local.block);
+        local.block = nullptr;
+    }
+};
+
+ThreadBlock& attach() {
+    Registry& r = registry();
+    {
+        lock_guard<mutex> guard(r.lock);
+        if (!r.idle.empty()) {
+            local.block = r.idle.back();
+            r.idle.pop_back();
+        } else {
+            r.blocks.emplace_back(new ThreadBlock());
+            local.block = r.blocks.back().get();
+        }
+    }
+    static thread_local Lease release; // Constructed on the thread's first attach
+    (void)release;
+    return *local.block;
+}
+
+int64_t nowNanos() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+string seconds(uint64_t nanos) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.9g", nanos / 1e9);
+    return text;
+}
+
+// Nanoseconds for the admin table: "850ns", "12.5us", "3.20ms"
+string shortDuration(uint64_t nanos) {
+    char text[32];
+    if (nanos < 1000) {
+        snprintf(text, sizeof(text), "%lluns", static_cast<unsigned long long>(nanos));
+    } else if (nanos < 1000000) {
+        snprintf(text, sizeof(text), "%.1fus", nanos / 1e3);
+    } else if (nanos < 1000000000) {
+        snprintf(text, sizeof(text), "%.2fms", nanos / 1e6);
+    } else {
+        snprintf(text, sizeof(text), "%.2fs", nanos / 1e9);
+    }
+    return text;
+}
+
+} // namespace
+
+const char* metricOpName(MetricOp op) {
+    return OP_NAMES[static_cast<size_t>(op)];
+}
+
+const char* metricResultName(TxResult result) {
+    return RESULT_NAMES[static_cast<size_t>(result)];
+}
+
+// LatencyHistogram methods implementation
+size_t LatencyHistogram::bucketOf(uint64_t nanos) {
+    if (nanos < LINEAR) {
+        return static_cast<size_t>(nanos);
+    }
+    size_t octave = 63 - __builtin_clzll(nanos); // >= 5
+    if (octave >= 5 + OCTAVES) {
+        return BUCKETS - 1;
+    }
+    size_t mantissa = static_cast<size_t>(nanos >> (octave - 4)); // 16..31
+    return LINEAR + (octave - 5) * SUB_BUCKETS + (mantissa - SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::lowerBound(size_t bucket) {
+    if (bucket < LINEAR) {
+        return bucket;
+    }
+    size_t octave = 5 + (bucket - LINEAR) / SUB_BUCKETS;
+    uint64_t mantissa = SUB_BUCKETS + (bucket - LINEAR) % SUB_BUCKETS;
+    return mantissa << (octave - 4);
+}
+
+uint64_t LatencyHistogram::upperBound(size_t bucket) {
+    if (bucket < LINEAR) {
+        return bucket;
+    }
+    size_t octave = 5 + (bucket - LINEAR) / SUB_BUCKETS;
+    return lowerBound(bucket) + (uint64_t(1) << (octave - 4)) - 1;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < BUCKETS; ++i) counts[i] += other.counts[i];
+    total += other.total;
+    sumNanos += other.sumNanos;
+    maxNanos = max(maxNanos, other.maxNanos);
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const {
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(ceil(fraction * total)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank) return min(upperBound(i), maxNanos);
+    }
+    return maxNanos;
+}
+
+// MetricsSnapshot methods implementation
+uint64_t MetricsSnapshot::total(MetricOp op) const {
+    uint64_t sum = 0;
+    for (uint64_t c : calls[static_cast<size_t>(op)]) sum += c;
+    return sum;
+}
+
+uint64_t MetricsSnapshot::count(MetricOp op, TxResult result) const {
+    return calls[static_cast<size_t>(op)][static_cast<size_t>(result)];
+}
+
+// Metrics methods implementation
+bool Metrics::enabled() {
+#ifdef BANK_NO_METRICS
+    return false;
+#else
+    return true;
+#endif
+}
+
+void Metrics::setSampleEvery(unsigned calls) {
+#ifndef BANK_NO_METRICS
+    sampleEvery.store(max(1u, calls), memory_order_relaxed);
+#else
+    (void)calls;
+#endif
+}
+
+int64_t Metrics::begin(MetricOp op) {
+#ifdef BANK_NO_METRICS
+    (void)op;
+    return 0;
+#else
+    unsigned& left = local.untilTimed[static_cast<size_t>(op)];
+    if (left != 0) {
+        --left;
+        return 0;
+    }
+    left = sampleEvery.load(memory_order_relaxed) - 1;
+    return nowNanos();
+#endif
+}
+
+void Metrics::record(MetricOp op, TxResult result, int64_t start) {
+#ifdef BANK_NO_METRICS
+    (void)op, (void)result, (void)start;
+#else
+    ThreadBlock& block = local.block ? *local.block : attach();
+    size_t o = static_cast<size_t>(op);
+    bump(block.calls[o][static_cast<size_t>(result)]);
+    if (start == 0) {
+        return;
+    }
+    uint64_t nanos = static_cast<uint64_t>(max<int64_t>(0, nowNanos() - start));
+    bump(block.buckets[o][LatencyHistogram::bucketOf(nanos)]);
+    bump(block.sumNanos[o], nanos);
+    if (nanos > block.maxNanos[o].load(memory_order_relaxed)) block.maxNanos[o].store(nanos, memory_order_relaxed);
+#endif
+}
+
+MetricsSnapshot Metrics::collect() {
+    MetricsSnapshot snapshot;
+#ifndef BANK_NO_METRICS
+    Registry& r = registry();
+    lock_guard<mutex> guard(r.lock);
+    for (auto& block : r.blocks) {
+        for (size_t o = 0; o < METRIC_OPS; ++o) {
+            for (size_t k = 0; k < METRIC_RESULTS; ++k) snapshot.calls[o][k] += block->calls[o][k].load(memory_order_relaxed);
+            LatencyHistogram& h = snapshot.latency[o];
+            for (size_t i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+                uint64_t c = block->buckets[o][i].load(memory_order_relaxed);
+                h.counts[i] += c;
+                h.total += c;
+            }
+            h.sumNanos += block->sumNanos[o].load(memory_order_relaxed);
+            h.maxNanos = max(h.maxNanos, block->maxNanos[o].load(memory_order_relaxed));
+        }
+    }
+#endif
+    return snapshot;
+}
+
+void Metrics::reset() {
+#ifndef BANK_NO_METRICS
+    Registry& r = registry();
+    lock_guard<mutex> guard(r.lock);
+    for (auto& block : r.blocks) block->clear();
+#endif
+}
+
+string Metrics::prometheus() {
+    MetricsSnapshot snapshot = collect();
+    ostringstream out;
+    out << "# HELP bank_operations_total Engine calls by operation and outcome.\n";
+    out << "# TYPE bank_operations_total counter\n";
+    for (size_t o = 0; o < METRIC_OPS; ++o) {
+        for (size_t k = 0; k < METRIC_RESULTS; ++k) {
+            if (snapshot.calls[o][k] == 0) continue;
+            out << "bank_operations_total{op=\"" << OP_NAMES[o] << "\",result=\"" << RESULT_NAMES[k] << "\"} " << snapshot.calls[o][k]
+                << "\n";
+        }
+    }
+    out << "# HELP bank_operation_duration_seconds Engine call latency.\n";
+    out << "# TYPE bank_operation_duration_seconds histogram\n";
+    for (size_t o = 0; o < METRIC_OPS; ++o) {
+        const LatencyHistogram& h = snapshot.latency[o];
+        if (h.total == 0) continue;
+        // A fine bucket counts under a bound once all its values are within it
+        size_t bucket = 0;
+        uint64_t cumulative = 0;
+        for (double bound : EXPORT_BOUNDS) {
+            uint64_t limit = static_cast<uint64_t>(bound * 1e9);
+            for (; bucket < LatencyHistogram::BUCKETS && LatencyHistogram::upperBound(bucket) <= limit; ++bucket) {
+                cumulative += h.counts[bucket];
+            }
+            out << "bank_operation_duration_seconds_bucket{op=\"" << OP_NAMES[o] << "\",le=\"" << bound << "\"} " << cumulative << "\n";
+        }
+        out << "bank_operation_duration_seconds_bucket{op=\"" << OP_NAMES[o] << "\",le=\"+Inf\"} " << h.total << "\n";
+        out << "bank_operation_duration_seconds_sum{op=\"" << OP_NAMES[o] << "\"} " << seconds(h.sumNanos) << "\n";
+        out << "bank_operation_duration_seconds_count{op=\"" << OP_NAMES[o] << "\"} " << h.total << "\n";
+    }
+    return out.str();
+}
+
+string Metrics::report() {
+    if (!enabled()) {
+        return "Metrics were compiled out (BANK_NO_METRICS).\n";
+    }
+    MetricsSnapshot snapshot = collect();
+    ostringstream out;
+    char line[160];
+    snprintf(line, sizeof(line), "%-21s %10s %10s %9s %9s %9s %9s\n", "Operation", "Calls", "Failed", "p50", "p99", "p99.9", "Max");
+    out << line;
+    for (size_t o = 0; o < METRIC_OPS; ++o) {
+        MetricOp op = static_cast<MetricOp>(o);
+        uint64_t calls = snapshot.total(op);
+        if (calls == 0) continue;
+        const LatencyHistogram& h = snapshot.latency[o];
+        snprintf(line, sizeof(line), "%-21s %10llu %10llu %9s %9s %9s %9s\n", OP_NAMES[o], static_cast<unsigned long long>(calls),
+                 static_cast<unsigned long long>(calls - snapshot.count(op, TxResult::Ok)), shortDuration(h.percentile(0.5)).c_str(),
+                 shortDuration(h.percentile(0.99)).c_str(), shortDuration(h.percentile(0.999)).c_str(), shortDuration(h.maxNanos).c_str());
+        out << line;
+    }
+    // The failures people ask about, whichever operation hit them
+    uint64_t insufficient = 0;
+    uint64_t velocity = 0;
+    for (size_t o = 0; o < METRIC_OPS; ++o) {
+        insufficient += snapshot.calls[o][static_cast<size_t>(TxResult::InsufficientFunds)];
+        velocity += snapshot.calls[o][static_cast<size_t>(TxResult::VelocityLimit)];
+    }
+    out << "Failed logins: " << snapshot.count(MetricOp::Authenticate, TxResult::AuthFailed)
+        << " (throttled: " << snapshot.count(MetricOp::Authenticate, TxResult::TooManyAttempts) << ")\n";
+    out << "Insufficient funds: " << insufficient << "\n";
+    out << "Velocity limits: " << velocity << "\n";
+    return out.str();
+}
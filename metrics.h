@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "project.h"
+
+using namespace std;
+
+// Engine calls that are counted and timed
+enum class MetricOp : uint8_t {
+    Open,
+    Close,
+    Authenticate,
+    Deposit,
+    Withdraw,
+    Transfer,
+    TransferLeg, // One leg of a cross-shard transfer
+    Balance,
+    ApplyInterest,
+    ApplyServiceCharge,
+    JobChunk,      // One chunk of a bulk job
+    Post,          // A batch of postings
+    CardAuthorize, // Card and PIN check
+    CardWithdraw   // Card and PIN withdrawal
+};
+
+const size_t METRIC_OPS = 14;
+const size_t METRIC_RESULTS = 12; // TxResult values
+
+const char* metricOpName(MetricOp op);
+const char* metricResultName(TxResult result); // Prometheus label, e.g. "insufficient_funds"
+
+// Log-linear latency histogram in nanoseconds, HDR style: exact below 32 ns,
+// then 16 buckets per power of two, so any value is within 1/16 (6.25%) of
+// its bucket. Values past ~18 minutes land in the last bucket.
+struct LatencyHistogram {
+    static const size_t LINEAR = 32;
+    static const size_t SUB_BUCKETS = 16;
+    static const size_t OCTAVES = 36;
+    static const size_t BUCKETS = LINEAR + OCTAVES * SUB_BUCKETS;
+
+    vector<uint64_t> counts = vector<uint64_t>(BUCKETS);
+    uint64_t total = 0;
+    uint64_t sumNanos = 0;
+    uint64_t maxNanos = 0;
+
+    static size_t bucketOf(uint64_t nanos);
+    static uint64_t lowerBound(size_t bucket); // Smallest value in the bucket
+    static uint64_t upperBound(size_t bucket); // Largest value in the bucket
+
+    void merge(const LatencyHistogram& other);
+    uint64_t percentile(double fraction) const; // Upper bound of the bucket holding it; 0 if empty
+};
+
+// Counters and histograms of every thread, summed
+struct MetricsSnapshot {
+    uint64_t calls[METRIC_OPS][METRIC_RESULTS] = {};
+    LatencyHistogram latency[METRIC_OPS];
+
+    uint64_t total(MetricOp op) const;
+    uint64_t count(MetricOp op, TxResult result) const;
+};
+
+// Process-wide instrumentation of the engine. Every thread records into its
+// own block of counters and histograms with plain (uncontended) stores; a
+// block outlives its thread and is handed to the next new thread, so counts
+// are never lost. collect() sums the blocks on demand; it may run while
+// others record, in which case it sees each counter at some recent value.
+//
+// Every call is counted. Reading the clock costs more than the counting, so
+// only one call in setSampleEvery() (per thread and operation, the first
+// included) is timed into the histograms; 1 times them all.
+//
+// Building with -DBANK_NO_METRICS compiles the timers to nothing: the
+// engine then carries no clock reads and no stores, and collect() is empty.
+class Metrics {
+public:
+    static const unsigned DEFAULT_SAMPLE_EVERY = 8;
+
+    static bool enabled();
+    static void setSampleEvery(unsigned calls);
+    static int64_t begin(MetricOp op); // Start time in ns if this call is timed, else 0
+    static void record(MetricOp op, TxResult result, int64_t start);
+    static MetricsSnapshot collect();
+    static void reset();
+
+    static string prometheus(); // Text exposition format
+    static string report();     // Table for the admin menu
+};
+
+// Counts one engine call, timing it from construction until done() when it
+// is sampled: `OpTimer timer(op); ... return timer.done(result);`
+#ifdef BANK_NO_METRICS
+class OpTimer {
+public:
+    explicit OpTimer(MetricOp) {}
+    TxResult done(TxResult result) { return result; }
+};
+
+inline TxResult refused(MetricOp, TxResult result) { return result; }
+#else
+class OpTimer {
+public:
+    explicit OpTimer(MetricOp op) : op(op), start(Metrics::begin(op)) {}
+    TxResult done(TxResult result) {
+        Metrics::record(op, result, start);
+        return result;
+    }
+
+private:
+    MetricOp op;
+    int64_t start;
+};
+
+// Counts a call turned away before any work, untimed: `return refused(op, result);`
+inline TxResult refused(MetricOp op, TxResult result) {
+    Metrics::record(op, result, 0);
+    return result;
+}
+#endif
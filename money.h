@@ -0,0 +1,201 @@
+#pragma once
+
+#include <cstdint>
+#include <cctype>
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <limits>
+
+using namespace std;
+
+// How a fractional minor unit is resolved when a rate is applied
+enum class RoundingMode {
+    HalfEven, // Banker's rounding, the default for interest
+    HalfUp,
+    Down,     // Toward zero
+    Up        // Away from zero
+};
+
+// An interest or charge rate held as parts per million (1% == 10000 ppm),
+// so applying it stays in integer arithmetic.
+class Rate {
+public:
+    constexpr Rate() : ppm(0) {}
+    static constexpr Rate fromPpm(int64_t ppm) { return Rate(ppm); }
+    static constexpr Rate fromBasisPoints(int64_t bp) { return Rate(bp * 100); }
+    static Rate parsePercent(const string& text); // "3.5" -> 3.5%
+
+    constexpr int64_t partsPerMillion() const { return ppm; }
+    constexpr bool operator==(Rate other) const { return ppm == other.ppm; }
+    constexpr bool operator!=(Rate other) const { return ppm != other.ppm; }
+
+private:
+    constexpr explicit Rate(int64_t ppm) : ppm(ppm) {}
+    int64_t ppm;
+};
+
+// A currency amount stored as an exact count of minor units (cents).
+// There is deliberately no conversion from double: amounts come from
+// minor units or from parsing decimal text, never from binary floating point.
+class Money {
+public:
+    static constexpr int64_t MINOR_PER_MAJOR = 100;
+
+    constexpr Money() : minor(0) {}
+    static constexpr Money fromMinor(int64_t minorUnits) { return Money(minorUnits); }
+    static constexpr Money fromMajor(int64_t majorUnits) { return Money(majorUnits * MINOR_PER_MAJOR); }
+    static Money parse(const string& text); // "12.34", "-5", "0.5"; more than two decimals is an error
+
+    constexpr int64_t minorUnits() const { return minor; }
+    string toString() const;
+
+    constexpr bool isPositive() const { return minor > 0; }
+    constexpr bool isZero() const { return minor == 0; }
+
+    constexpr Money operator+(Money other) const { return Money(minor + other.minor); }
+    constexpr Money operator-(Money other) const { return Money(minor - other.minor); }
+    constexpr Money operator-() const { return Money(-minor); }
+    constexpr Money operator*(int64_t factor) const { return Money(minor * factor); }
+    Money& operator+=(Money other) { minor += other.minor; return *this; }
+    Money& operator-=(Money other) { minor -= other.minor; return *this; }
+    // this + other into `sum`; false, leaving `sum` alone, if it would overflow
+    bool checkedAdd(Money other, Money& sum) const {
+        int64_t result;
+        if (__builtin_add_overflow(minor, other.minor, &result)) return false;
+        sum.minor = result;
+        return true;
+    }
+
+    constexpr bool operator==(Money other) const { return minor == other.minor; }
+    constexpr bool operator!=(Money other) const { return minor != other.minor; }
+    constexpr bool operator<(Money other) const { return minor < other.minor; }
+    constexpr bool operator<=(Money other) const { return minor <= other.minor; }
+    constexpr bool operator>(Money other) const { return minor > other.minor; }
+    constexpr bool operator>=(Money other) const { return minor >= other.minor; }
+
+    // this * rate, rounded to a whole minor unit
+    constexpr Money applyRate(Rate rate, RoundingMode mode = RoundingMode::HalfEven) const {
+        return Money(scaleRounded(minor, rate.partsPerMillion(), 1000000, mode));
+    }
+
+    // value * numerator / denominator in 128-bit, rounded with `mode`
+    static constexpr int64_t scaleRounded(int64_t value, int64_t numerator, int64_t denominator, RoundingMode mode) {
+        __int128 product = static_cast<__int128>(value) * numerator;
+        __int128 quotient = product / denominator; // Truncates toward zero
+        __int128 remainder = product % denominator;
+        if (remainder != 0) {
+            bool negative = (product < 0);
+            __int128 twice = (remainder < 0 ? -remainder : remainder) * 2;
+            bool awayFromZero = false;
+            switch (mode) {
+                case RoundingMode::Down:     awayFromZero = false; break;
+                case RoundingMode::Up:       awayFromZero = true; break;
+                case RoundingMode::HalfUp:   awayFromZero = twice >= denominator; break;
+                case RoundingMode::HalfEven:
+                    awayFromZero = twice > denominator || (twice == denominator && (quotient % 2) != 0);
+                    break;
+            }
+            if (awayFromZero) quotient += negative ? -1 : 1;
+        }
+        return static_cast<int64_t>(quotient);
+    }
+
+    friend ostream& operator<<(ostream& os, Money money);
+    friend istream& operator>>(istream& is, Money& money);
+
+private:
+    constexpr explicit Money(int64_t minorUnits) : minor(minorUnits) {}
+    int64_t minor;
+};
+
+static_assert(sizeof(Money) == sizeof(int64_t), "Money must stay a bare int64 so balance columns pack tightly");
+static_assert(Money::fromMinor(250).applyRate(Rate::fromPpm(10000)) == Money::fromMinor(2), "2.50 at 1% is 0.025 -> 0.02 (half-even)");
+static_assert(Money::fromMinor(350).applyRate(Rate::fromPpm(10000)) == Money::fromMinor(4), "3.50 at 1% is 0.035 -> 0.04 (half-even)");
+static_assert(Money::fromMinor(250).applyRate(Rate::fromPpm(10000), RoundingMode::HalfUp) == Money::fromMinor(3), "half-up rounds .5 away from zero");
+static_assert(Money::fromMinor(-199).applyRate(Rate::fromPpm(500000), RoundingMode::Down) == Money::fromMinor(-99), "down truncates toward zero");
+
+// Parse an optionally signed decimal with at most `maxDecimals` fraction digits
+// into an integer scaled by 10^maxDecimals. Returns false on malformed input.
+inline bool parseScaledDecimal(const char* text, size_t length, int maxDecimals, int64_t& out);
+inline bool parseScaledDecimal(const string& text, int maxDecimals, int64_t& out) {
+    return parseScaledDecimal(text.data(), text.size(), maxDecimals, out);
+}
+
+inline Rate Rate::parsePercent(const string& text) {
+    int64_t scaled; // Percent with four decimals == ppm
+    if (!parseScaledDecimal(text, 4, scaled)) {
+        throw invalid_argument("Invalid rate: " + text);
+    }
+    return Rate(scaled);
+}
+
+inline Money Money::parse(const string& text) {
+    int64_t scaled;
+    if (!parseScaledDecimal(text, 2, scaled)) {
+        throw invalid_argument("Invalid amount: " + text);
+    }
+    return Money(scaled);
+}
+
+inline bool parseScaledDecimal(const char* text, size_t length, int maxDecimals, int64_t& out) {
+    size_t i = 0;
+    bool negative = false;
+    if (i < length && (text[i] == '-' || text[i] == '+')) {
+        negative = (text[i] == '-');
+        ++i;
+    }
+    const int64_t max = numeric_limits<int64_t>::max();
+    const int64_t limit = max / 10;
+    int64_t value = 0;
+    bool anyDigit = false;
+    for (; i < length && isdigit(static_cast<unsigned char>(text[i])); ++i) {
+        int digit = text[i] - '0';
+        if (value > (max - digit) / 10) return false;
+        value = value * 10 + digit;
+        anyDigit = true;
+    }
+    int decimals = 0;
+    if (i < length && text[i] == '.') {
+        for (++i; i < length && isdigit(static_cast<unsigned char>(text[i])); ++i) {
+            int digit = text[i] - '0';
+            if (++decimals > maxDecimals || value > (max - digit) / 10) return false;
+            value = value * 10 + digit;
+            anyDigit = true;
+        }
+    }
+    if (!anyDigit || i != length) return false;
+    for (; decimals < maxDecimals; ++decimals) {
+        if (value > limit) return false;
+        value *= 10;
+    }
+    out = negative ? -value : value;
+    return true;
+}
+
+inline string Money::toString() const {
+    uint64_t magnitude = minor < 0 ? 0 - static_cast<uint64_t>(minor) : static_cast<uint64_t>(minor);
+    string fraction = to_string(magnitude % MINOR_PER_MAJOR);
+    if (fraction.size() < 2) fraction.insert(0, 1, '0');
+    return (minor < 0 ? "-" : "") + to_string(magnitude / MINOR_PER_MAJOR) + "." + fraction;
+}
+
+inline ostream& operator<<(ostream& os, Money money) {
+    return os << money.toString();
+}
+
+// Reads sign, digits and an optional fraction, stopping at the first other
+// character so it can sit in the middle of a CSV row.
+inline istream& operator>>(istream& is, Money& money) {
+    string text;
+    is >> ws;
+    if (is.peek() == '-' || is.peek() == '+') text += static_cast<char>(is.get());
+    while (isdigit(is.peek()) || is.peek() == '.') text += static_cast<char>(is.get());
+    int64_t scaled;
+    if (parseScaledDecimal(text, 2, scaled)) {
+        money = Money(scaled);
+    } else {
+        is.setstate(ios::failbit);
+    }
+    return is;
+}
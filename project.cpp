@@ -1,39 +1,45 @@
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <stdexcept>
 #include <cctype> // For character checking
 #include "project.h"
+#include "metrics.h"
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
 
 using namespace std;
 
 // Account class methods implementation
-Account::Account(int accountNumber, const string& name, const string& phone, const string& password, double balance, bool hasATM, int atmCardNumber, int atmPin)
-    : accountNumber(accountNumber), name(name), phone(phone), password(password), balance(balance), hasATM(hasATM), atmCardNumber(atmCardNumber), atmPin(atmPin) {}
+Account::Account(int accountNumber, const string& name, const string& phone, const string& passwordHash, Money balance, bool hasATM, int atmCardNumber, int atmPin)
+    : accountNumber(accountNumber), name(name), phone(phone), passwordHash(passwordHash), balance(balance), hasATM(hasATM), atmCardNumber(atmCardNumber), atmPin(atmPin) {}
 
 int Account::getAccountNumber() const { return accountNumber; }
-double Account::getBalance() const { return balance; }
+Money Account::getBalance() const { return balance; }
 string Account::getName() const { return name; }
 string Account::getPhone() const { return phone; }
-bool Account::verifyPassword(const string& inputPassword) const { return inputPassword == password; }
+bool Account::hasAtmCard() const { return hasATM; }
+int Account::getAtmCardNumber() const { return atmCardNumber; }
+const string& Account::getPasswordHash() const { return passwordHash; }
+bool Account::verifyPassword(const string& inputPassword) const { return passwordMatches(inputPassword, passwordHash); }
 
-void Account::deposit(double amount) {
-    if (amount <= 0) {
+void Account::deposit(Money amount) {
+    if (!amount.isPositive()) {
         throw invalid_argument("Invalid deposit amount.");
     }
     balance += amount;
-    cout << "Deposited: " << amount << ", New Balance: " << balance << "\n";
 }
 
-void Account::withdraw(double amount) {
-    if (amount <= 0) {
+void Account::withdraw(Money amount) {
+    if (!amount.isPositive()) {
         throw invalid_argument("Invalid withdrawal amount.");
     }
     if (amount > balance) {
         throw runtime_error("Insufficient funds for withdrawal.");
     }
     balance -= amount;
-    cout << "Withdrawn: " << amount << ", New Balance: " << balance << "\n";
 }
 
 void Account::displayAccountInfo() const {
@@ -50,7 +56,7 @@ void Account::displayAccountInfo() const {
 
 ostream& operator<<(ostream& os, const Account& account) {
     os << account.accountNumber << "," << account.name << "," << account.phone << ","
-       << account.password << "," << account.balance << "," << account.hasATM << ","
+       << account.passwordHash << "," << account.balance << "," << account.hasATM << ","
        << account.atmCardNumber << "," << account.atmPin;
     return os;
 }
@@ -60,7 +66,7 @@ istream& operator>>(istream& is, Account& account) {
     is.ignore(); // Ignore comma
     getline(is, account.name, ',');
     getline(is, account.phone, ',');
-    getline(is, account.password, ',');
+    getline(is, account.passwordHash, ',');
     is >> account.balance;
     is.ignore(); // Ignore comma
     is >> account.hasATM;
@@ -71,77 +77,374 @@ istream& operator>>(istream& is, Account& account) {
     return is;
 }
 
-Account& Account::operator=(const Account& account) {
-    if (this != &account) {
-        accountNumber = account.accountNumber;
-        name = account.name;
-        phone = account.phone;
-        password = account.password;
-        balance = account.balance;
-        hasATM = account.hasATM;
-        atmCardNumber = account.atmCardNumber;
-        atmPin = account.atmPin;
+// PackedPhone and AccountStore class methods implementation
+PackedPhone PackedPhone::pack(string_view phone) {
+    if (phone.size() != sizeof(digits) || !all_of(phone.begin(), phone.end(), ::isdigit)) {
+        throw invalid_argument("Invalid phone number. It must be exactly 10 digits.");
+    }
+    PackedPhone packed;
+    memcpy(packed.digits, phone.data(), sizeof(digits));
+    return packed;
+}
+
+uint64_t PackedPhone::key() const {
+    uint64_t key = 0;
+    for (char digit : digits) key = key * 10 + static_cast<uint64_t>(digit - '0');
+    return key;
+}
+
+// Index key of a phone, or false if it is not 10 digits (so no account has it)
+static bool phoneKey(string_view phone, uint64_t& key) {
+    if (phone.size() != sizeof(PackedPhone::digits) || !all_of(phone.begin(), phone.end(), ::isdigit)) {
+        return false;
+    }
+    key = PackedPhone::pack(phone).key();
+    return true;
+}
+
+AccountStore::AccountStore() : byName(NameOrder(), PoolAllocator<NameKey>(&nameNodes)) {}
+
+size_t AccountStore::size() const { return liveCount; }
+bool AccountStore::empty() const { return liveCount == 0; }
+size_t AccountStore::tombstones() const { return slots.size() - liveCount; }
+
+size_t AccountStore::slotOf(int accountNumber) const {
+    return byNumber.find(static_cast<uint64_t>(accountNumber));
+}
+
+size_t AccountStore::slotOfPhone(string_view phone) const {
+    uint64_t key;
+    return phoneKey(phone, key) ? byPhone.find(key) : npos;
+}
+
+size_t AccountStore::slotOfCard(int cardNumber) const {
+    return byCard.find(static_cast<uint64_t>(static_cast<uint32_t>(cardNumber)));
+}
+
+bool AccountStore::contains(int accountNumber) const {
+    return slotOf(accountNumber) != npos;
+}
+
+bool AccountStore::containsPhone(string_view phone) const {
+    return slotOfPhone(phone) != npos;
+}
+
+bool AccountStore::containsCard(int cardNumber) const {
+    return slotOfCard(cardNumber) != npos;
+}
+
+string AccountStore::foldName(string_view name) {
+    string folded(name);
+    for (char& ch : folded) ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+    return folded;
+}
+
+// Folds on the stack so that common names intern without a temporary string
+string_view AccountStore::internFolded(StringArena& arena, string_view name) {
+    char buffer[64];
+    if (name.size() > sizeof(buffer)) {
+        return arena.intern(foldName(name));
+    }
+    for (size_t i = 0; i < name.size(); ++i) buffer[i] = static_cast<char>(tolower(static_cast<unsigned char>(name[i])));
+    return arena.intern(string_view(buffer, name.size()));
+}
+
+Account AccountStore::get(size_t slot) const {
+    const AccountRow& row = slots[slot];
+    return Account(row.accountNumber, string(row.name), string(row.phone.view()), string(row.passwordHash), balances[slot],
+                   row.hasATM, row.atmCardNumber, row.atmPin);
+}
+
+Account AccountStore::get(size_t slot, Money balance) const {
+    const AccountRow& row = slots[slot];
+    return Account(row.accountNumber, string(row.name), string(row.phone.view()), string(row.passwordHash), balance, row.hasATM,
+                   row.atmCardNumber, row.atmPin);
+}
+
+const AccountRow& AccountStore::record(size_t slot) const { return slots[slot]; }
+Money& AccountStore::balance(size_t slot) { return balances[slot]; }
+Money AccountStore::balance(size_t slot) const { return balances[slot]; }
+HistoryLog& AccountStore::history(size_t slot) { return histories[slot]; }
+const HistoryLog& AccountStore::history(size_t slot) const { return histories[slot]; }
+uint64_t& AccountStore::version(size_t slot) { return versions[slot]; }
+uint64_t AccountStore::version(size_t slot) const { return versions[slot]; }
+
+size_t AccountStore::insert(int accountNumber, string_view name, string_view phone, string_view passwordHash, Money balance,
+                            bool hasATM, int atmCardNumber, int atmPin) {
+    if (contains(accountNumber)) {
+        throw runtime_error("Account number already in use.");
+    }
+    AccountRow row;
+    row.phone = PackedPhone::pack(phone);
+    compactStep(COMPACT_STEP_BUDGET); // Before the strings go in: it may repack the arena
+    row.name = strings.intern(name);
+    row.foldedName = internFolded(strings, name);
+    row.passwordHash = strings.store(passwordHash);
+    row.accountNumber = accountNumber;
+    row.atmCardNumber = atmCardNumber;
+    row.atmPin = atmPin;
+    row.hasATM = hasATM;
+    size_t slot = slots.size();
+    slots.push_back(row);
+    balances.push_back(balance);
+    live.push_back(1);
+    histories.push_back(HistoryLog());
+    versions.push_back(0);
+    ++liveCount;
+    byNumber.insert(static_cast<uint64_t>(accountNumber), slot);
+    byPhone.insert(row.phone.key(), slot);
+    if (hasATM && !containsCard(atmCardNumber)) {
+        byCard.insert(static_cast<uint32_t>(atmCardNumber), slot);
+    }
+    byName.insert(NameKey{row.foldedName, accountNumber});
+    return slot;
+}
+
+void AccountStore::reserve(size_t count) {
+    slots.reserve(count);
+    balances.reserve(count);
+    live.reserve(count);
+    histories.reserve(count);
+    versions.reserve(count);
+    byNumber.reserve(count);
+    byPhone.reserve(count);
+}
+
+size_t AccountStore::arenaBytes() const { return strings.bytes(); }
+
+bool AccountStore::erase(int accountNumber) {
+    size_t slot = slotOf(accountNumber);
+    if (slot == npos) {
+        return false;
+    }
+    AccountRow& row = slots[slot];
+    byPhone.erase(row.phone.key());
+    if (row.hasATM && slotOfCard(row.atmCardNumber) == slot) {
+        byCard.erase(static_cast<uint32_t>(row.atmCardNumber));
+    }
+    byName.erase(NameKey{row.foldedName, accountNumber});
+    byNumber.erase(static_cast<uint64_t>(accountNumber));
+    deadStringBytes += row.passwordHash.size(); // Names may be shared, so only hashes count
+    row = AccountRow(); // The slot itself stays as a tombstone, numbered so slots stay sorted
+    row.accountNumber = accountNumber;
+    balances[slot] = Money();
+    live[slot] = 0;
+    histories[slot] = HistoryLog();
+    --liveCount;
+    maybeStartCompaction();
+    compactStep(COMPACT_STEP_BUDGET);
+    return true;
+}
+
+BulkRunSummary AccountStore::applyInterest(Rate rate, RoundingMode rounding, KernelIsa isa) {
+    BulkRunSummary summary = interestKernel(balances.data(), balances.size(), rate, rounding, isa);
+    summary.accountsScanned = liveCount;
+    return summary;
+}
+
+BulkRunSummary AccountStore::applyServiceCharge(Money charge, KernelIsa isa) {
+    if (!charge.isPositive()) {
+        throw invalid_argument("Invalid withdrawal amount.");
+    }
+    BulkRunSummary summary = serviceChargeKernel(balances.data(), live.data(), balances.size(), charge, isa);
+    summary.accountsScanned = liveCount;
+    return summary;
+}
+
+void AccountStore::moveSlot(size_t from, size_t to) {
+    slots[to] = slots[from];
+    balances[to] = balances[from];
+    live[to] = 1;
+    histories[to] = histories[from];
+    versions[to] = versions[from];
+    slots[from] = AccountRow();
+    balances[from] = Money();
+    live[from] = 0;
+    histories[from] = HistoryLog();
+    byNumber.insert(static_cast<uint64_t>(slots[to].accountNumber), to);
+    byPhone.insert(slots[to].phone.key(), to);
+    if (slots[to].hasATM && slotOfCard(slots[to].atmCardNumber) == from) {
+        byCard.insert(static_cast<uint32_t>(slots[to].atmCardNumber), to);
+    }
+}
+
+size_t AccountStore::firstSlotAfter(int afterNumber) const {
+    // Slots before writePos and from readPos on are each in number order;
+    // between them a compaction pass leaves only vacated slots
+    size_t gapStart = compacting ? writePos : slots.size();
+    size_t gapEnd = compacting ? readPos : slots.size();
+    auto notAfter = [](const AccountRow& row, int number) { return row.accountNumber <= number; };
+    size_t slot = lower_bound(slots.begin(), slots.begin() + gapStart, afterNumber, notAfter) - slots.begin();
+    if (slot < gapStart) {
+        return slot;
+    }
+    return lower_bound(slots.begin() + gapEnd, slots.end(), afterNumber, notAfter) - slots.begin();
+}
+
+void AccountStore::maybeStartCompaction() {
+    if (compacting || slots.size() < COMPACT_MIN_SLOTS) {
+        return;
+    }
+    // Start a pass once a quarter of the slots are tombstones
+    if (tombstones() * 4 >= slots.size()) {
+        compacting = true;
+        readPos = 0;
+        writePos = 0;
+    }
+}
+
+bool AccountStore::compactStep(size_t budget) {
+    if (!compacting) {
+        return true;
+    }
+    // Slots appended during the pass land past readPos and are picked up too,
+    // so the pass preserves slot order
+    for (; budget > 0 && readPos < slots.size(); --budget, ++readPos) {
+        if (!live[readPos]) continue;
+        if (readPos != writePos) {
+            moveSlot(readPos, writePos);
+        }
+        ++writePos;
+    }
+    if (readPos < slots.size()) {
+        return false;
+    }
+    slots.resize(writePos);
+    balances.resize(writePos);
+    live.resize(writePos);
+    histories.resize(writePos);
+    versions.resize(writePos);
+    compacting = false;
+    // Erased rows leave their strings behind; copy the live ones to a fresh
+    // arena once that garbage is a quarter of what the arena holds
+    if (deadStringBytes != 0 && deadStringBytes * 4 >= strings.used()) {
+        repackStrings();
+    }
+    return true;
+}
+
+void AccountStore::compact() {
+    if (!compacting && tombstones() != 0) {
+        compacting = true;
+        readPos = 0;
+        writePos = 0;
+    }
+    compactStep(slots.size());
+}
+
+void AccountStore::repackStrings() {
+    StringArena fresh;
+    byName.clear();
+    for (size_t i = 0; i < slots.size(); ++i) {
+        AccountRow& row = slots[i];
+        if (!live[i]) continue;
+        row.name = fresh.intern(row.name);
+        row.foldedName = fresh.intern(row.foldedName);
+        row.passwordHash = fresh.store(row.passwordHash);
+        byName.insert(NameKey{row.foldedName, row.accountNumber});
+    }
+    strings.swap(fresh);
+    deadStringBytes = 0;
+}
+
+// Throw the exception the console menus expect for a failed engine call
+static void check(TxResult result) {
+    switch (result) {
+        case TxResult::Ok:
+            return;
+        case TxResult::InsufficientFunds:
+        case TxResult::AccountNotFound:
+        case TxResult::AuthFailed:
+        case TxResult::TooManyAttempts:
+        case TxResult::VelocityLimit:
+            throw runtime_error(txResultMessage(result));
+        default:
+            throw invalid_argument(txResultMessage(result));
     }
-    return *this;
 }
 
 // AccountManager class methods implementation
-AccountManager::AccountManager() : accountCount(0) {}
+AccountManager::AccountManager() {}
 
 AccountManager::~AccountManager() {}
 
-void AccountManager::createAccount() {
-    if (accountCount >= MAX_ACCOUNTS) {
-        throw runtime_error("Cannot create more accounts. Maximum limit reached.");
-    }
+Bank& AccountManager::engine() { return bank; }
 
+void AccountManager::createAccount() {
     string phone;
     cout << "Enter your phone number (10 digits only): ";
     cin >> phone;
-    if (phone.length() != 10 || !isValidNumber(phone)) {
-        throw invalid_argument("Invalid phone number. It must be exactly 10 digits.");
+    if (!Bank::isValidPhone(phone)) {
+        check(TxResult::InvalidPhone);
     }
 
-    // Check if the mobile number already exists
+    // Check if the mobile number already exists (open() checks again atomically)
     if (phoneExists(phone)) {
-        throw invalid_argument("An account with this mobile number already exists.");
+        check(TxResult::DuplicatePhone);
     }
 
     string name, password;
     cout << "Enter your name: ";
     cin.ignore(); // To ignore any newline character left in the buffer
     getline(cin, name); // Use getline to read the full name including spaces
+    if (!Bank::isValidName(name)) {
+        check(TxResult::InvalidName);
+    }
     cout << "Set your password (must contain at least one uppercase letter and one special character): ";
     cin >> password;
-
-    // Password validation
-    bool hasUpper = false, hasSpecial = false;
-    for (char ch : password) {
-        if (isupper(ch)) hasUpper = true;
-        if (!isalnum(ch)) hasSpecial = true;
-    }
-    if (!hasUpper || !hasSpecial) {
-        throw invalid_argument("Password must contain at least one uppercase letter and one special character.");
+    if (!Bank::isStrongPassword(password)) {
+        check(TxResult::WeakPassword);
     }
 
-    bool hasATM = false;
-    int atmCardNumber = 0;
-    int atmPin = 0;
     cout << "Do you want an ATM card? (yes/no): ";
     string response;
     cin >> response;
-    if (response == "yes") {
-        hasATM = true;
-        atmCardNumber = 10000 + rand() % 90000; // Simple random ATM card number
-        atmPin = 1234; // Simple fixed ATM pin for demonstration
-        cout << "Your ATM Card Number is: " << atmCardNumber << "\n";
-    }
 
-    int newAccountNumber = generateNewAccountNumber();
-    accounts[accountCount++] = Account(newAccountNumber, name, phone, password, 0.0, hasATM, atmCardNumber, atmPin);
+    int newAccountNumber;
+    string atmPin;
+    check(bank.open(name, phone, password, response == "yes", newAccountNumber, &atmPin));
+    Account account;
+    if (bank.getAccount(newAccountNumber, account) == TxResult::Ok && account.hasAtmCard()) {
+        cout << "Your ATM Card Number is: " << account.getAtmCardNumber() << "\n";
+        cout << "Your ATM PIN is: " << atmPin << " (shown only once; it cannot be recovered)\n";
+    }
     cout << "Account created successfully. Your account number is: " << newAccountNumber << "\n";
 }
 
+// One statement line per history entry
+static void printHistory(const vector<HistoryEntry>& entries) {
+    if (entries.empty()) {
+        cout << "No transactions found.\n";
+        return;
+    }
+    for (const HistoryEntry& entry : entries) {
+        time_t seconds = static_cast<time_t>(entry.timestamp / 1000000);
+        tm local;
+        localtime_r(&seconds, &local);
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &local);
+        cout << when << "  " << historyKindName(entry.kind) << ": " << entry.amount;
+        if (entry.kind == HistoryKind::TransferOut) cout << " to " << entry.counterparty;
+        if (entry.kind == HistoryKind::TransferIn) cout << " from " << entry.counterparty;
+        cout << ", Balance: " << entry.balance << "\n";
+    }
+}
+
+// Read a local YYYY-MM-DD date as microseconds since the epoch (start of that day)
+static int64_t readDate(istream& is) {
+    string text;
+    is >> text;
+    tm date = {};
+    char rest;
+    if (sscanf(text.c_str(), "%4d-%2d-%2d%c", &date.tm_year, &date.tm_mon, &date.tm_mday, &rest) != 3) {
+        throw invalid_argument("Invalid date. Use YYYY-MM-DD.");
+    }
+    date.tm_year -= 1900;
+    date.tm_mon -= 1;
+    date.tm_isdst = -1;
+    return static_cast<int64_t>(mktime(&date)) * 1000000;
+}
+
 void AccountManager::accessAccount() {
     int accountNumber;
     cout << "Enter your account number: ";
@@ -151,142 +454,231 @@ void AccountManager::accessAccount() {
     cout << "Enter your password: ";
     cin >> password;
 
-    for (int i = 0; i < accountCount; ++i) {
-        if (accounts[i].getAccountNumber() == accountNumber && accounts[i].verifyPassword(password)) {
-            cout << "Access granted.\n";
-            int actionChoice;
-            do {
-                cout << "\nAccount Menu:\n";
-                cout << "1. View Balance\n";
-                cout << "2. Deposit\n";
-                cout << "3. Withdraw\n";
-                cout << "4. Transfer Money\n"; // New option for transferring money
-                cout << "5. Exit Account Menu\n";
-                cout << "Enter your choice: ";
-                cin >> actionChoice;
-
-                try {
-                    switch (actionChoice) {
-                        case 1:
-                            cout << "Current Balance: " << accounts[i].getBalance() << "\n";
-                            break;
-                        case 2: {
-                            double amount;
-                            cout << "Enter amount to deposit: ";
-                            cin >> amount;
-                            accounts[i].deposit(amount);
-                            break;
-                        }
-                        case 3: {
-                            double amount;
-                            cout << "Enter amount to withdraw: ";
-                            cin >> amount;
-                            accounts[i].withdraw(amount);
-                            break;
-                        }
-                        case 4: { // Transfer Money
-                            transferMoney(accounts[i].getAccountNumber());
-                            break;
-                        }
-                        case 5:
-                            cout << "Exiting account menu.\n";
-                            break;
-                        default:
-                            cout << "Invalid choice. Please try again.\n";
+    TxResult access = bank.authenticate(accountNumber, password);
+    if (access == TxResult::Ok) {
+        cout << "Access granted.\n";
+        int actionChoice;
+        do {
+            cout << "\nAccount Menu:\n";
+            cout << "1. View Balance\n";
+            cout << "2. Deposit\n";
+            cout << "3. Withdraw\n";
+            cout << "4. Transfer Money\n"; // New option for transferring money
+            cout << "5. Recent Transactions\n";
+            cout << "6. Statement for a Date Range\n";
+            cout << "7. Exit Account Menu\n";
+            cout << "Enter your choice: ";
+            cin >> actionChoice;
+
+            try {
+                switch (actionChoice) {
+                    case 1: {
+                        Money balance;
+                        check(bank.balance(accountNumber, balance));
+                        cout << "Current Balance: " << balance << "\n";
+                        break;
+                    }
+                    case 2: {
+                        cout << "Enter amount to deposit: ";
+                        Money amount = readAmount(cin);
+                        Money balance;
+                        check(bank.deposit(accountNumber, amount, &balance));
+                        cout << "Deposited: " << amount << ", New Balance: " << balance << "\n";
+                        break;
                     }
-                } catch (const invalid_argument& e) {
-                    cout << "Error: " << e.what() << endl;
-                } catch (const runtime_error& e) {
-                    cout << "Error: " << e.what() << endl;
+                    case 3: {
+                        cout << "Enter amount to withdraw: ";
+                        Money amount = readAmount(cin);
+                        Money balance;
+                        check(bank.withdraw(accountNumber, amount, &balance));
+                        cout << "Withdrawn: " << amount << ", New Balance: " << balance << "\n";
+                        break;
+                    }
+                    case 4: { // Transfer Money
+                        transferMoney(accountNumber);
+                        break;
+                    }
+                    case 5: {
+                        size_t count;
+                        cout << "How many transactions? ";
+                        cin >> count;
+                        vector<HistoryEntry> entries;
+                        check(bank.recentHistory(accountNumber, count, entries));
+                        printHistory(entries);
+                        break;
+                    }
+                    case 6: {
+                        cout << "Enter start date (YYYY-MM-DD): ";
+                        int64_t from = readDate(cin);
+                        cout << "Enter end date (YYYY-MM-DD): ";
+                        int64_t to = readDate(cin) + int64_t(86400) * 1000000; // End date inclusive
+                        vector<HistoryEntry> entries;
+                        check(bank.historyBetween(accountNumber, from, to, entries));
+                        printHistory(entries);
+                        break;
+                    }
+                    case 7:
+                        cout << "Exiting account menu.\n";
+                        break;
+                    default:
+                        cout << "Invalid choice. Please try again.\n";
                 }
-            } while (actionChoice != 5);
-            return;
-        }
+            } catch (const invalid_argument& e) {
+                cout << "Error: " << e.what() << endl;
+            } catch (const runtime_error& e) {
+                cout << "Error: " << e.what() << endl;
+            }
+        } while (actionChoice != 7);
+        return;
     }
-    cout << "Invalid account number or password.\n";
+    cout << txResultMessage(access) << "\n";
+}
+
+void AccountManager::atmWithdraw() {
+    int cardNumber;
+    cout << "Enter your ATM card number: ";
+    cin >> cardNumber;
+    string pin;
+    cout << "Enter your PIN: ";
+    cin >> pin;
+    cout << "Enter amount to withdraw: ";
+    Money amount = readAmount(cin);
+    Money balance;
+    TxResult result = bank.cardWithdraw(cardNumber, pin, amount, &balance);
+    if (result == TxResult::AuthFailed) {
+        throw runtime_error("Invalid card number or PIN.");
+    }
+    check(result);
+    cout << "Withdrawn: " << amount << ", New Balance: " << balance << "\n";
 }
 
 void AccountManager::deleteAccount(int accountNumber) {
-    for (int i = 0; i < accountCount; ++i) {
-        if (accounts[i].getAccountNumber() == accountNumber) {
-            for (int j = i; j < accountCount - 1; ++j) {
-                accounts[j] = accounts[j + 1];
-            }
-            --accountCount;
-            cout << "Account deleted successfully.\n";
-            return;
-        }
+    if (bank.close(accountNumber) == TxResult::Ok) {
+        cout << "Account deleted successfully.\n";
+        return;
     }
     cout << "Account not found.\n";
 }
 
 void AccountManager::displayAllAccounts() const {
     cout << "\nAll Accounts:\n";
-    for (int i = 0; i < accountCount; ++i) {
-        accounts[i].displayAccountInfo();
+    bank.forEachAccount([](const Account& account) {
+        account.displayAccountInfo();
         cout << "--------------------------------\n";
+    });
+}
+
+// Print query results a page at a time until they run out or the admin stops
+template <typename Query>
+static void showPages(Query query) {
+    const size_t PAGE_SIZE = 10;
+    PageCursor cursor;
+    size_t shown = 0;
+    for (;;) {
+        AccountPage page = query(PAGE_SIZE, cursor);
+        for (const Account& account : page.accounts) {
+            account.displayAccountInfo();
+            cout << "--------------------------------\n";
+        }
+        shown += page.accounts.size();
+        if (!page.hasMore) {
+            break;
+        }
+        string response;
+        cout << "Show more? (yes/no): ";
+        cin >> response;
+        if (response != "yes") {
+            break;
+        }
+        cursor = page.next;
     }
+    cout << shown << (shown == 1 ? " account shown.\n" : " accounts shown.\n");
+}
+
+void AccountManager::searchAccountsByName() const {
+    string prefix;
+    cout << "Enter the start of the name: ";
+    cin.ignore();
+    getline(cin, prefix);
+    showPages([&](size_t pageSize, const PageCursor& after) { return bank.accountsByNamePrefix(prefix, pageSize, after); });
+}
+
+void AccountManager::listAccountsOver() const {
+    cout << "Enter minimum balance: ";
+    Money minimum = readAmount(cin);
+    showPages([&](size_t pageSize, const PageCursor& after) { return bank.accountsWithBalanceOver(minimum, pageSize, after); });
 }
 
-void AccountManager::applyInterest(double rate) {
-    for (int i = 0; i < accountCount; ++i) {
-        double interest = accounts[i].getBalance() * (rate / 100);
-        accounts[i].deposit(interest);
+void AccountManager::showMetrics() const {
+    cout << Metrics::report();
+    for (const auto& rule : bank.velocityBlocks()) {
+        cout << "  refused by " << rule.first << ": " << rule.second << "\n";
     }
-    cout << "Interest applied to all accounts.\n";
 }
 
-void AccountManager::applyServiceCharge(double charge) {
-    for (int i = 0; i < accountCount; ++i) {
-        try {
-            accounts[i].withdraw(charge);
-        } catch (const runtime_error& e) {
-            cout << "Error for account " << accounts[i].getAccountNumber() << ": " << e.what() << endl;
-        }
+void AccountManager::exportMetrics() const {
+    string path;
+    cout << "Enter file path for the Prometheus dump: ";
+    cin >> path;
+    ofstream out(path);
+    out << Metrics::prometheus();
+    if (!out) {
+        throw runtime_error("Cannot write metrics to " + path);
     }
-    cout << "Service charge applied to all accounts.\n";
+    cout << "Metrics written to " << path << ".\n";
+}
+
+BulkRunSummary AccountManager::applyInterest(Rate rate, RoundingMode rounding) {
+    return runJob(JobSpec::interest(rate, rounding));
+}
+
+BulkRunSummary AccountManager::applyServiceCharge(Money charge) {
+    return runJob(JobSpec::serviceCharge(charge));
+}
+
+BulkRunSummary AccountManager::runJob(const JobSpec& spec) {
+    BulkRunSummary summary;
+    check(JobRunner(bank).run(spec, summary));
+    return summary;
 }
 
 void AccountManager::transferMoney(int senderAccountNumber) {
-    double amount;
     int recipientAccountNumber;
     
     cout << "Enter the recipient's account number: ";
     cin >> recipientAccountNumber;
     
     cout << "Enter amount to transfer: ";
-    cin >> amount;
-
-    if (amount <= 0) {
-        throw invalid_argument("Transfer amount must be positive.");
-    }
+    Money amount = readAmount(cin);
 
-    auto senderIt = find_if(accounts, accounts + accountCount, [&](const Account& acc) { return acc.getAccountNumber() == senderAccountNumber; });
-    auto recipientIt = find_if(accounts, accounts + accountCount, [&](const Account& acc) { return acc.getAccountNumber() == recipientAccountNumber; });
-
-    if (senderIt != accounts + accountCount && recipientIt != accounts + accountCount) {
-        if (senderIt->getBalance() >= amount) {
-            senderIt->withdraw(amount);
-            recipientIt->deposit(amount);
+    switch (bank.transfer(senderAccountNumber, recipientAccountNumber, amount)) {
+        case TxResult::Ok:
             cout << "Transfer successful! " << amount << " transferred to Account Number: " << recipientAccountNumber << "\n";
-        } else {
+            break;
+        case TxResult::InvalidAmount:
+            throw invalid_argument("Transfer amount must be positive.");
+        case TxResult::InsufficientFunds:
             throw runtime_error("Insufficient funds for transfer.");
-        }
-    } else {
-        cout << "One of the account numbers is invalid.\n";
+        case TxResult::VelocityLimit:
+            throw runtime_error(txResultMessage(TxResult::VelocityLimit));
+        default:
+            cout << "One of the account numbers is invalid.\n";
+            break;
     }
 }
 
-int AccountManager::generateNewAccountNumber() {
-    return accountCount + 1000; // Simple new account number generation
-}
-
-bool AccountManager::isValidNumber(const string& str) {
-    return all_of(str.begin(), str.end(), ::isdigit);
+Money readAmount(istream& is) {
+    Money amount;
+    if (!(is >> amount)) {
+        is.clear();
+        is.ignore(numeric_limits<streamsize>::max(), '\n');
+        throw invalid_argument("Invalid amount. Use digits with at most two decimals.");
+    }
+    return amount;
 }
 
 // Admin class methods implementation
-Admin::Admin() : username(""), password("") {}
+Admin::Admin() : username(""), passwordHash("") {}
 
 bool Admin::isRegistered() const {
     return !username.empty();
@@ -294,12 +686,14 @@ bool Admin::isRegistered() const {
 
 void Admin::registerAdmin(const string& user, const string& pass) {
     username = user;
-    password = pass;
+    passwordHash = hashPassword(pass);
     cout << "Admin registered successfully.\n";
 }
 
 bool Admin::verifyCredentials(const string& user, const string& pass) const {
-    return user == username && pass == password;
+    // Hash even for a wrong username so the timing does not tell them apart
+    bool passwordOk = passwordMatches(pass, passwordHash);
+    return user == username && passwordOk;
 }
 
 // New function to display admin information
@@ -307,12 +701,7 @@ void Admin::displayAdminInfo() const {
     cout << "Admin Username: " << username << "\n";
 }
 bool AccountManager::phoneExists(const string& phone) {
-    for (int i = 0; i < accountCount; ++i) {
-        if (accounts[i].getPhone() == phone) {
-            return true; // Phone number already exists
-        }
-    }
-    return false; // Phone number does not exist
+    return bank.phoneExists(phone);
 }
 
 // Admin login function
@@ -1,41 +1,564 @@
+#pragma once
+
 #include <iostream>
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <set>
+#include <string_view>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
 #include <stdexcept> // For exception handling
+#include "money.h"
+#include "arena.h"
+#include "balance_kernels.h"
+#include "cards.h"
+#include "credentials.h"
+#include "history.h"
+#include "idempotency.h"
+#include "jobs.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "velocity.h"
 
 using namespace std;
 
 // Account class declaration
 class Account {
 public:
-    Account(int accountNumber = 0, const string& name = "", const string& phone = "", const string& password = "", double balance = 0.0, bool hasATM = false, int atmCardNumber = 0, int atmPin = 0);
+    Account(int accountNumber = 0, const string& name = "", const string& phone = "", const string& passwordHash = "", Money balance = Money(), bool hasATM = false, int atmCardNumber = 0, int atmPin = 0);
     
     int getAccountNumber() const;
-    double getBalance() const;
+    Money getBalance() const;
     string getName() const;
     string getPhone() const;
-    bool verifyPassword(const string& inputPassword) const;
+    bool hasAtmCard() const;
+    int getAtmCardNumber() const;
+    const string& getPasswordHash() const;
+    bool verifyPassword(const string& inputPassword) const; // Runs the full hash; see Bank::authenticate
 
-    void deposit(double amount);
-    void withdraw(double amount);
+    void deposit(Money amount);
+    void withdraw(Money amount);
     void displayAccountInfo() const;
 
     // Operator Overloading
     friend ostream& operator<<(ostream& os, const Account& account);
     friend istream& operator>>(istream& is, Account& account);
-    
-    Account& operator=(const Account& account); // Assignment operator
 
 private:
     int accountNumber;
     string name;
     string phone;
-    string password;
-    double balance;
+    string passwordHash; // hashPassword() output, or plaintext from a legacy row
+    Money balance;
     bool hasATM;
     int atmCardNumber;
     int atmPin;
 };
 
+// Phone number as ten ASCII digits held inline, so a row needs no string
+// for it; its numeric value keys the phone index
+struct PackedPhone {
+    char digits[10] = {};
+
+    static PackedPhone pack(string_view phone); // Throws invalid_argument unless exactly 10 digits
+    string_view view() const { return string_view(digits, sizeof(digits)); }
+    uint64_t key() const;
+};
+
+// Cold fields of a stored account, fixed size with no heap of its own: the
+// strings are views into the store's arena, valid while the account exists
+struct AccountRow {
+    string_view name;         // Interned: accounts with the same name share it
+    string_view foldedName;   // Interned lower-case name, the name index key
+    string_view passwordHash; // hashPassword() output, or plaintext from a legacy row
+    int accountNumber = 0;
+    int atmCardNumber = 0;
+    int atmPin = 0;           // PIN verification value (see CardKeys), or a legacy row's plain PIN
+    PackedPhone phone;
+    bool hasATM = false;
+};
+
+// Growable account store with O(1) lookup by account number, by phone and
+// by ATM card.
+// Storage is column-oriented: balances sit in one contiguous hot column that
+// bulk kernels sweep, apart from the cold rows holding name, phone and
+// password. Rows are fixed-size values in one vector and their strings live
+// in an arena, so storing an account allocates nothing of its own; the
+// number and phone indexes are flat hash tables and the name index draws its
+// nodes from a pool. Indexes are kept in sync on every insert/erase/move, so
+// lookups never go stale.
+// Erase only tombstones the slot; an incremental compaction pass reclaims
+// tombstones a few slots at a time on later inserts and erases.
+class AccountStore {
+public:
+    static const size_t npos = static_cast<size_t>(-1);
+
+    AccountStore();
+    AccountStore(const AccountStore&) = delete; // Rows point into this store's arena
+    AccountStore& operator=(const AccountStore&) = delete;
+
+    size_t size() const;   // live accounts
+    bool empty() const;
+    size_t tombstones() const;
+
+    size_t slotOf(int accountNumber) const; // npos if absent
+    size_t slotOfPhone(string_view phone) const;
+    size_t slotOfCard(int cardNumber) const;
+    bool contains(int accountNumber) const;
+    bool containsPhone(string_view phone) const;
+    bool containsCard(int cardNumber) const;
+
+    // Names are indexed case-insensitively; this is the key they sort by
+    static string foldName(string_view name);
+
+    Account get(size_t slot) const;            // Full account, balance included
+    Account get(size_t slot, Money balance) const; // Same, with the balance given (as seen by a read view)
+    const AccountRow& record(size_t slot) const; // Cold fields only
+    Money& balance(size_t slot);
+    Money balance(size_t slot) const;
+    // Start loading a slot's balance and history header before taking its lock
+    void prefetch(size_t slot) const {
+        __builtin_prefetch(&balances[slot], 1);
+        __builtin_prefetch(&histories[slot], 1);
+    }
+    HistoryLog& history(size_t slot); // Segments are owned by the Bank's HistoryPool
+    uint64_t& version(size_t slot);   // Read-view epoch of the balance's last change; see Bank::ReadView
+    uint64_t version(size_t slot) const;
+    const HistoryLog& history(size_t slot) const;
+
+    // Copies the strings into the arena; the phone must be exactly 10 digits
+    size_t insert(int accountNumber, string_view name, string_view phone, string_view passwordHash, Money balance,
+                  bool hasATM = false, int atmCardNumber = 0, int atmPin = 0);
+    bool erase(int accountNumber);
+    void reserve(size_t count);
+    size_t arenaBytes() const;
+
+    // Bulk passes over the balance column; tombstoned slots hold a zero balance
+    BulkRunSummary applyInterest(Rate rate, RoundingMode rounding, KernelIsa isa = bestKernelIsa());
+    BulkRunSummary applyServiceCharge(Money charge, KernelIsa isa = bestKernelIsa());
+
+    // Run compaction for at most `budget` slots; returns true once no pass is active
+    bool compactStep(size_t budget);
+    void compact(); // Finish any pass and reclaim every tombstone
+
+    // Every live slot, in slot (account-number) order
+    template <typename Fn>
+    void forEachSlot(Fn fn) const {
+        for (size_t i = 0; i < slots.size(); ++i) {
+            if (live[i]) fn(i);
+        }
+    }
+
+    // Live slots with an account number above `afterNumber`, in order,
+    // starting from a binary search. Stops when fn(slot) returns false.
+    template <typename Fn>
+    void forEachSlotAfter(int afterNumber, Fn fn) const {
+        for (size_t i = firstSlotAfter(afterNumber); i < slots.size(); ++i) {
+            if (live[i] && !fn(i)) return;
+        }
+    }
+
+    // Balance and history header of every live slot, for recording bulk passes
+    template <typename Fn>
+    void forEachHistory(Fn fn) {
+        for (size_t i = 0; i < slots.size(); ++i) {
+            if (live[i]) fn(balances[i], histories[i]);
+        }
+    }
+
+    // Iterate live accounts in slot order
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (size_t i = 0; i < slots.size(); ++i) {
+            if (live[i]) fn(get(i));
+        }
+    }
+
+    // Accounts whose folded name starts with the folded `prefix`, in (folded
+    // name, number) order, strictly after the given position. Stops when
+    // fn(slot) returns false.
+    template <typename Fn>
+    void forEachNamePrefix(string_view prefix, string_view afterName, int afterNumber, Fn fn) const {
+        auto it = byName.lower_bound(NameKey{prefix, 0});
+        if (afterNumber && afterName >= prefix) it = byName.upper_bound(NameKey{afterName, afterNumber});
+        for (; it != byName.end() && it->name.substr(0, prefix.size()) == prefix; ++it) {
+            if (!fn(byNumber.find(static_cast<uint64_t>(it->accountNumber)))) return;
+        }
+    }
+
+private:
+    static const size_t COMPACT_MIN_SLOTS = 64;  // Don't bother compacting tiny stores
+    static const size_t COMPACT_STEP_BUDGET = 32; // Slots moved per mutating call
+
+    // Name index entry; the name is the row's folded arena view
+    struct NameKey {
+        string_view name;
+        int accountNumber;
+    };
+    struct NameOrder {
+        bool operator()(const NameKey& a, const NameKey& b) const {
+            int order = a.name.compare(b.name);
+            return order != 0 ? order < 0 : a.accountNumber < b.accountNumber;
+        }
+    };
+
+    StringArena strings;        // Names (interned) and password hashes of the rows
+    size_t deadStringBytes = 0; // Arena bytes of erased rows, reclaimed when a compaction pass ends
+    vector<AccountRow> slots;   // Cold rows
+    vector<Money> balances;     // Hot column, parallel to slots
+    vector<unsigned char> live; // 0 marks a tombstone
+    vector<HistoryLog> histories; // Parallel to slots
+    vector<uint64_t> versions;    // Parallel to slots
+    size_t liveCount = 0;
+    FlatIndex byNumber;
+    FlatIndex byPhone;          // Keyed by PackedPhone::key()
+    FlatIndex byCard;           // Accounts with a card; a legacy duplicate card keeps its first holder
+    NodePool nameNodes;         // Declared before byName, which allocates from it
+    set<NameKey, NameOrder, PoolAllocator<NameKey>> byName; // Numbers, not slots: they survive compaction
+
+    // Compaction cursors: live slots in [readPos, end) are moved down to writePos
+    bool compacting = false;
+    size_t readPos = 0;
+    size_t writePos = 0;
+
+    void moveSlot(size_t from, size_t to);
+    size_t firstSlotAfter(int afterNumber) const; // First slot numbered above, tombstones included
+    void maybeStartCompaction();
+    string_view internFolded(StringArena& arena, string_view name);
+    void repackStrings();
+};
+
+// Outcome of a Bank operation. New values also need a label in metrics.cpp.
+enum class TxResult {
+    Ok,
+    InvalidAmount,
+    AccountNotFound,
+    InsufficientFunds,
+    InvalidPhone,      // Not exactly 10 digits
+    DuplicatePhone,
+    WeakPassword,      // Needs an uppercase letter and a special character
+    AuthFailed,
+    TooManyAttempts,
+    VelocityLimit,     // Refused by a velocity rule; see VelocityRules
+    InvalidName,       // Longer than Bank::MAX_NAME_BYTES
+    InvalidPasswordHash // Longer than MAX_JOURNAL_STRING; openHashed only
+};
+
+const char* txResultMessage(TxResult result);
+
+// Where the next page of an admin query starts: just after the last row of
+// the previous page. A default cursor starts at the first row.
+struct PageCursor {
+    string name;           // Folded name of the last row (name queries only)
+    int accountNumber = 0; // 0 before the first page
+};
+
+struct AccountPage {
+    vector<Account> accounts;
+    bool hasMore = false;
+    PageCursor next; // Pass back to get the following page
+};
+
+// Whether a Bank call waits for its journal record to become durable
+enum class Commit {
+    Wait,
+    Defer
+};
+
+// One leg of a cross-shard transfer seen during journal replay
+struct TransferLeg {
+    uint64_t reference;
+    bool debit;
+    int account;
+    int counterparty;
+    Money amount;
+};
+
+// One leg of a batch posted with Bank::post: a credit when amount is
+// positive, a debit when negative. The legs of a batch sum to zero.
+struct Posting {
+    int account;
+    Money amount;
+};
+
+const size_t MAX_POSTING_LEGS = 10000; // Keeps a batch's journal record well under the payload limit
+
+// Headless banking engine: typed arguments in, TxResult out, no console I/O.
+// Thread-safe. structureLock is held exclusively while accounts are added,
+// removed or compacted (slots move) and shared by everything else. A balance
+// is read or written only under its account's stripe mutex; operations that
+// touch two accounts take both stripes in ascending order so they cannot
+// deadlock, and whole-book passes that change balances hold every stripe.
+// Reports read through a ReadView instead, so they never hold writers back.
+class Bank {
+public:
+    Bank();
+
+    // With withATM a card is issued; its PIN is drawn at random and handed
+    // out once through *atmPin, as only its verification value is kept
+    TxResult open(const string& name, const string& phone, const string& password, bool withATM, int& accountNumber,
+                  string* atmPin = nullptr);
+    // open() once the password is validated and hashed, for callers that
+    // keep the slow hash off their own hot thread
+    TxResult openHashed(const string& name, const string& phone, const string& passwordHash, bool withATM, int& accountNumber,
+                        Commit mode = Commit::Wait, string* atmPin = nullptr);
+    TxResult close(int accountNumber, Commit mode = Commit::Wait);
+    // Verifies outside every lock. A password verified recently for the
+    // account is answered from the session cache; otherwise the attempt is
+    // charged to the account's limiter before the slow hash runs.
+    TxResult authenticate(int accountNumber, const string& password) const;
+    void setPasswordCost(PasswordCost cost); // Applies to passwords hashed from now on
+
+    // ATM cards. The card index finds the account and the PIN is checked
+    // against its verification value outside the account's stripe; a wrong
+    // PIN is charged to a per-account limit (a few tries, then one an hour)
+    // that a right one clears. Unknown cards and wrong PINs both return
+    // AuthFailed. cardWithdraw() is withdraw() for the card's account in
+    // the same locks, journaled as an ordinary withdrawal.
+    TxResult authorizeCard(int cardNumber, const string& pin, int& accountNumber) const;
+    TxResult cardWithdraw(int cardNumber, const string& pin, Money amount, Money* newBalance = nullptr, Commit mode = Commit::Wait);
+    // Keys card numbers and PIN values; see CardKeys. Only on an empty bank.
+    void setCardSecret(const string& secret);
+    static const unsigned PIN_TRIES = 3;                               // Wrong PINs in a row before a card locks
+    static const int64_t PIN_RETRY_MICROS = int64_t(3600) * 1000000; // Then one more try per hour
+
+    // With Commit::Defer the call does not wait for its journal record; the
+    // caller owns durability and must syncJournal() before reporting success
+    TxResult deposit(int accountNumber, Money amount, Money* newBalance = nullptr, Commit mode = Commit::Wait);
+    TxResult withdraw(int accountNumber, Money amount, Money* newBalance = nullptr, Commit mode = Commit::Wait);
+    TxResult transfer(int fromAccountNumber, int toAccountNumber, Money amount, Commit mode = Commit::Wait);
+    // The two legs of a transfer whose accounts live in different Banks. The
+    // debit checks funds; the credit only needs the account. Both legs carry
+    // the caller's reference so recovery can pair them up.
+    TxResult debitLeg(int accountNumber, int counterparty, Money amount, uint64_t reference, Commit mode = Commit::Wait);
+    TxResult creditLeg(int accountNumber, int counterparty, Money amount, uint64_t reference, Commit mode = Commit::Wait);
+    // Apply a batch of postings (a split payment, a payroll run) as one
+    // transaction: every leg or none. Legs on the same account are netted,
+    // each account is looked up once, and the stripes of all of them are
+    // taken together for one journal record. A nonempty idempotency key makes
+    // a retry safe: if a batch with the key already applied, returns Ok with
+    // *duplicate set and changes nothing (the retry's legs are not compared).
+    // Keys are remembered for a bounded window; see IdempotencyKeys.
+    TxResult post(const string& idempotencyKey, const vector<Posting>& legs, Commit mode = Commit::Wait, bool* duplicate = nullptr);
+    TxResult balance(int accountNumber, Money& balance) const;
+    TxResult getAccount(int accountNumber, Account& account) const;
+
+    TxResult applyInterest(Rate rate, RoundingMode rounding, BulkRunSummary& summary);
+    TxResult applyServiceCharge(Money charge, BulkRunSummary& summary);
+
+    // Bulk jobs in chunks, driven by a JobRunner. startJob journals the job
+    // and cuts the account numbers that exist now into chunks. runJobChunk
+    // applies one chunk holding only its accounts' stripes and journals the
+    // changes it made as one record; a chunk already done, in this process or
+    // before a crash, is left alone, so no account is charged twice.
+    // Unknown jobs and chunks, and ending a job with chunks left, throw logic_error.
+    TxResult startJob(const JobSpec& spec, uint64_t& jobId);
+    BulkRunSummary runJobChunk(uint64_t jobId, size_t chunk); // What this call changed
+    BulkRunSummary endJob(uint64_t jobId);                    // What the whole job changed
+    bool jobProgress(uint64_t jobId, JobProgress& progress) const; // false if unknown or ended
+    vector<uint64_t> unfinishedJobs() const;
+
+    // Transaction history, oldest entry first. The newest entries of each
+    // account stay in memory up to the history limit; older ones are read
+    // back from the journal, so without one they are gone.
+    TxResult recentHistory(int accountNumber, size_t count, vector<HistoryEntry>& entries) const;
+    // Entries with from <= timestamp < to, in microseconds since the epoch
+    TxResult historyBetween(int accountNumber, int64_t from, int64_t to, vector<HistoryEntry>& entries) const;
+    void setHistoryLimit(size_t bytesPerAccount);
+    // Most memory the history of the whole book may take; past it accounts
+    // recycle their oldest entries sooner, which stay readable from the journal
+    void setHistoryCapacity(size_t bytes);
+    size_t historyBytes() const; // Pool memory held by in-memory history
+
+    // Insert a prebuilt account under the next account number without
+    // validation (bulk loads); returns that number. The password is stored
+    // as given: pass hashPassword() output, anything else is a legacy row.
+    int addAccount(const string& name, const string& phone, const string& passwordHash, Money balance);
+
+    // Rebuild the book into this (empty) bank: load the snapshot at
+    // snapshotPath if one exists, replay only the journal records written
+    // after it, then attach the journal. Returns the number of records replayed.
+    size_t recover(Journal& journal, const string& snapshotPath = "");
+    // Write a consistent snapshot of the book; the journal is synced first so
+    // the snapshot never gets ahead of what is durable. Refused (runtime_error)
+    // while a job is unfinished: its start would fall before the snapshot.
+    size_t saveSnapshot(const string& path) const;
+    // Once attached, every state change is appended while its locks are still
+    // held, and in Sync mode the call returns only once the record is durable.
+    // After a journal write or fsync fails, changes throw its error: the book
+    // in memory is then ahead of the disk and the process should stop.
+    void attachJournal(Journal* journal);
+    void syncJournal(); // Make every change so far durable
+    // Transfer legs replayed by recover(), handed over once and then dropped
+    void takeReplayedLegs(vector<TransferLeg>& legs);
+
+    // Velocity rules checked inline on withdrawals, transfers (and debit
+    // legs) and the debits of postings, holding the account's stripe; an
+    // outflow a rule refuses returns VelocityLimit and changes nothing. Swap
+    // them at any time; rules loaded before recover() rebuild the counters
+    // from the journal records replayed. Without rules the check is one load.
+    void setVelocityRules(VelocityRules rules);
+    void loadVelocityRules(const string& path); // Throws as VelocityRules::load
+    vector<pair<string, uint64_t>> velocityBlocks() const; // Refusals by rule of the current rules
+
+    // Number new accounts first, first + stride, ... so several Banks can
+    // share one account-number space. Only on an empty bank.
+    void setNumbering(int first, int stride);
+
+    bool phoneExists(const string& phone) const;
+    size_t accountCount() const;
+
+    // Paged admin lookups over the secondary indexes. Names match
+    // case-insensitively and come back in name order; balance queries come
+    // back in account-number order and each page is one point-in-time view.
+    AccountPage accountsByNamePrefix(const string& prefix, size_t pageSize, const PageCursor& after = PageCursor()) const;
+    AccountPage accountsWithBalanceOver(Money minimum, size_t pageSize, const PageCursor& after = PageCursor()) const;
+    Money totalBalance() const; // Sum over every account at one point in time
+
+    // Visit every account, in account-number order, as of one point in time.
+    // Transactions go on meanwhile; opening and closing accounts waits.
+    template <typename Fn>
+    void forEachAccount(Fn fn) const {
+        shared_lock<shared_mutex> structure(structureLock);
+        ReadView view(*this);
+        accounts.forEachSlot([&](size_t slot) { fn(accounts.get(slot, view.balance(slot))); });
+    }
+
+    static bool isValidPhone(const string& phone);
+    static bool isStrongPassword(const string& password);
+    static bool isValidName(const string& name);
+    static const size_t MAX_NAME_BYTES = 256;
+
+private:
+    static const size_t LOCK_STRIPES = 1024;
+    // A balance as it was before the first change made in `epoch`
+    struct BeforeImage {
+        size_t slot;
+        uint64_t epoch;
+        Money balance;
+    };
+    struct alignas(64) Stripe {
+        mutex lock;
+        vector<BeforeImage> beforeImages; // Of this stripe's accounts, oldest first; kept while a view may need them
+        VelocityTable velocity;           // Of this stripe's accounts
+        AttemptLimiter pinAttempts{PIN_TRIES, PIN_RETRY_MICROS}; // Of this stripe's accounts' cards
+    };
+    // Holds every stripe, in order, for whole-book passes
+    class AllStripes {
+    public:
+        explicit AllStripes(const Bank& bank);
+        ~AllStripes();
+    private:
+        const Bank& bank;
+    };
+    // Point-in-time view of every balance, multi-version style. Cutting one
+    // holds every stripe just long enough to take the next epoch; from then
+    // on a writer that changes a balance first keeps its before-image
+    // (preserve()), so the view reads the balance as of its cut while
+    // writers carry on. Hold a shared structureLock for the view's lifetime.
+    class ReadView {
+    public:
+        explicit ReadView(const Bank& bank);
+        ~ReadView();
+        ReadView(const ReadView&) = delete;
+        ReadView& operator=(const ReadView&) = delete;
+
+        Money balance(size_t slot) const;
+        uint64_t lsn() const { return cutLsn; }       // Last journal record the view includes
+        uint64_t offset() const { return cutOffset; } // Journal size up to that record
+
+    private:
+        const Bank& bank;
+        uint64_t epoch;
+        uint64_t cutLsn = 0;
+        uint64_t cutOffset = 0;
+    };
+    // Holds the stripes of the account numbers in [first, end), or the given
+    // stripes, in order
+    class RangeStripes {
+    public:
+        RangeStripes(const Bank& bank, int first, int end);
+        RangeStripes(const Bank& bank, const bitset<LOCK_STRIPES>& held);
+        ~RangeStripes();
+    private:
+        const Bank& bank;
+        bitset<LOCK_STRIPES> held;
+    };
+
+    AccountStore accounts;
+    int nextAccountNumber; // Monotonic, so numbers are never reused after a delete
+    int numberStride = 1;
+    mutable shared_mutex structureLock;
+    mutable array<Stripe, LOCK_STRIPES> stripes;
+    Journal* journal = nullptr;
+    HistoryPool history;
+    PasswordCost passwordCost;
+    mutable VerifiedCache sessions;
+    mutable AttemptLimiter attempts;
+    CardKeys cards;
+    vector<TransferLeg> replayedLegs;
+    IdempotencyKeys postedKeys; // Of applied post() batches, journaled and snapshotted
+    mutable mutex jobsLock; // Guards jobs and nextJobId
+    map<uint64_t, JobProgress> jobs; // Started and not ended
+    uint64_t nextJobId = 1;
+    mutable uint64_t writeEpoch = 1;       // Changed only holding every stripe
+    mutable atomic<unsigned> openViews{0};
+    mutable mutex viewsLock;
+    mutable multiset<uint64_t> viewEpochs; // Of the open views; guarded by viewsLock
+    atomic<const VelocityRules*> velocityRules{nullptr}; // Null when none are loaded
+    mutex rulesLock;                                     // Guards ruleSets
+    vector<unique_ptr<VelocityRules>> ruleSets; // Every set loaded, so a call still reading an old one is safe
+
+    size_t stripeOf(int accountNumber) const;
+    int generateNewAccountNumber();
+    uint64_t log(JournalRecord& record); // Append if journaling; returns the LSN or 0
+    TxResult applyLeg(JournalOp op, int accountNumber, int counterparty, Money amount, uint64_t reference, Commit mode);
+    // Take `amount` out of the account at `slot` as a withdrawal, setting
+    // *lsn. Caller holds the structure lock (shared) and the account's stripe.
+    TxResult withdrawSlot(size_t slot, int accountNumber, Money amount, Money* newBalance, uint64_t& lsn);
+    // Slot of the account holding the card (npos if none) and whether `pin`
+    // is its PIN. Caller holds the structure lock.
+    size_t cardSlot(int cardNumber, const string& pin, bool& pinMatches) const;
+    // Refuse an account whose PIN tries are spent, charge a wrong PIN or
+    // clear the tries after a right one. Caller holds the account's stripe.
+    TxResult settlePin(int accountNumber, bool pinMatches) const;
+    void commit(uint64_t lsn);           // Wait for durability, after locks are released
+    // Before a balance changes: keep what it was if an open view may need it.
+    // Caller holds the slot's stripe.
+    void preserve(size_t slot) {
+        if (openViews.load(memory_order_relaxed) != 0) preserveSlow(slot);
+    }
+    void preserveSlow(size_t slot);
+    void preserveAll(); // Before a whole-book pass; caller holds every stripe
+    // Check an outflow of the account against the velocity rules, or count
+    // one made at `timestamp` (microseconds). Caller holds the account's
+    // stripe, so the rules cannot change in between.
+    TxResult checkVelocity(int accountNumber, VelocityKind kind, Money amount) {
+        const VelocityRules* rules = velocityRules.load(memory_order_acquire);
+        return rules ? checkVelocitySlow(*rules, accountNumber, kind, amount) : TxResult::Ok;
+    }
+    void recordVelocity(int accountNumber, VelocityKind kind, Money amount, int64_t timestamp) {
+        const VelocityRules* rules = velocityRules.load(memory_order_acquire);
+        if (rules && (rules->windows() >> (VELOCITY_WINDOWS * velocityKindIndex(kind)) & 7) != 0) {
+            recordVelocitySlow(*rules, accountNumber, kind, amount, timestamp);
+        }
+    }
+    TxResult checkVelocitySlow(const VelocityRules& rules, int accountNumber, VelocityKind kind, Money amount);
+    void recordVelocitySlow(const VelocityRules& rules, int accountNumber, VelocityKind kind, Money amount, int64_t timestamp);
+    void applyRecord(const JournalRecord& record);
+    void replayJobRecord(const JournalRecord& record);
+    // Add the journaled change to the history of the account at `slot`; its balance is already updated
+    void remember(size_t slot, HistoryKind kind, int counterparty, const JournalRecord& record);
+    void rememberBulk(HistoryKind kind, const JournalRecord& record); // Every account a bulk pass changed
+    // Rebuild the entries of one account with LSN below `beforeLsn` from the journal
+    void journalHistory(int accountNumber, uint64_t beforeLsn, vector<HistoryEntry>& entries) const;
+};
+
 // Abstract class for Account Management
 class IAccountManager {
 public:
@@ -43,13 +566,14 @@ public:
     virtual void accessAccount() = 0;
     virtual void deleteAccount(int accountNumber) = 0;
     virtual void displayAllAccounts() const = 0;
-    virtual void applyInterest(double rate) = 0;
-    virtual void applyServiceCharge(double charge) = 0;
+    virtual BulkRunSummary applyInterest(Rate rate, RoundingMode rounding = RoundingMode::HalfEven) = 0;
+    virtual BulkRunSummary applyServiceCharge(Money charge) = 0;
     virtual void transferMoney(int senderAccountNumber) = 0;
     virtual ~IAccountManager() {} // Virtual destructor
 };
 
-// AccountManager class declaration
+// AccountManager: console front end over a Bank. Prompts for input, calls
+// the engine and turns failed TxResults into exceptions for the menus.
 class AccountManager : public IAccountManager {
 public:
     AccountManager();
@@ -57,21 +581,28 @@ public:
     bool phoneExists(const string&);
     void createAccount() override;
     void accessAccount() override;
+    void atmWithdraw();                 // Prompts for card, PIN and amount
     void deleteAccount(int accountNumber) override;
     void displayAllAccounts() const override;
-    void applyInterest(double rate) override;
-    void applyServiceCharge(double charge) override;
+    void searchAccountsByName() const;  // Prompts for a name prefix, shows results a page at a time
+    void listAccountsOver() const;      // Prompts for a minimum balance, same paging
+    void showMetrics() const;           // Engine call counts, failures and latency percentiles
+    void exportMetrics() const;         // Prompts for a path, writes the Prometheus text dump there
+    BulkRunSummary applyInterest(Rate rate, RoundingMode rounding = RoundingMode::HalfEven) override;
+    BulkRunSummary applyServiceCharge(Money charge) override;
+    // Interest and service charges run as chunked jobs, alongside other calls
+    BulkRunSummary runJob(const JobSpec& spec);
     void transferMoney(int senderAccountNumber) override; // Implemented as per previous code
 
-private:
-    static const int MAX_ACCOUNTS = 100;
-    Account accounts[MAX_ACCOUNTS];
-    int accountCount;
+    Bank& engine();
 
-    int generateNewAccountNumber();
-    bool isValidNumber(const string& str);
+private:
+    Bank bank;
 };
 
+// Read an amount from the console; throws invalid_argument on malformed input
+Money readAmount(istream& is);
+
 // Abstract class for Admin management
 class AbstractAdmin {
 public:
@@ -92,5 +623,5 @@ public:
 
 private:
     string username;
-    string password;
+    string passwordHash;
 };
\ No newline at end of file
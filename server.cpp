@@ -0,0 +1,451 @@
+#include "server.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+const size_t REPLY_BYTES = 4 + 4 + 1 + 8;
+const size_t OUTPUT_LIMIT = 1 << 20; // Pending reply bytes past which a connection is not read
+const size_t READ_CHUNK = 64 * 1024;
+const int MAX_EVENTS = 256;
+
+// Markers in epoll_event.data.ptr for the two descriptors that are not connections
+char listenerMark;
+char wakeMark;
+
+// Bounds-checked little-endian reads over one frame body
+class Reader {
+public:
+    Reader(const char* data, size_t length) : at(data), end(data + length) {}
+
+    uint8_t u8() { return static_cast<uint8_t>(take(1)); }
+    uint16_t u16() { return static_cast<uint16_t>(take(2)); }
+    uint32_t u32() { return static_cast<uint32_t>(take(4)); }
+    int32_t i32() { return static_cast<int32_t>(take(4)); }
+    int64_t i64() { return static_cast<int64_t>(take(8)); }
+    string str() {
+        size_t length = u16();
+        if (!ok || static_cast<size_t>(end - at) < length) {
+            ok = false;
+            return string();
+        }
+        string text(at, length);
+        at += length;
+        return text;
+    }
+    bool complete() const { return ok && at == end; } // Everything read, nothing left over
+
+private:
+    const char* at;
+    const char* end;
+    bool ok = true;
+
+    uint64_t take(size_t bytes) {
+        if (!ok || static_cast<size_t>(end - at) < bytes) {
+            ok = false;
+            return 0;
+        }
+        uint64_t value = 0;
+        for (size_t i = 0; i < bytes; ++i) value |= static_cast<uint64_t>(static_cast<unsigned char>(at[i])) << (8 * i);
+        at += bytes;
+        return value;
+    }
+};
+
+void put(vector<char>& out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+// `card` and `pin`, when given, follow the value (Open with a card)
+void reply(vector<char>& out, uint32_t tag, uint8_t status, int64_t value, int card = 0, const string& pin = string()) {
+    size_t tail = pin.empty() ? 0 : 4 + 2 + pin.size();
+    put(out, REPLY_BYTES - 4 + tail, 4);
+    put(out, tag, 4);
+    put(out, status, 1);
+    put(out, static_cast<uint64_t>(value), 8);
+    if (tail) {
+        put(out, static_cast<uint32_t>(card), 4);
+        put(out, pin.size(), 2);
+        out.insert(out.end(), pin.begin(), pin.end());
+    }
+}
+
+int listenOn(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw runtime_error("Cannot create server socket: " + string(strerror(errno)));
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        string reason = strerror(errno);
+        close(fd);
+        throw runtime_error("Cannot listen on port " + to_string(port) + ": " + reason);
+    }
+    return fd;
+}
+
+} // namespace
+
+struct BankServer::Connection {
+    int fd;
+    vector<char> in;
+    vector<char> out;
+    size_t outSent = 0;
+    uint32_t events = 0; // What epoll currently watches for
+    bool closing = false; // Peer is gone or sent garbage: flush what is left, then close
+    vector<int> loggedIn;
+
+    bool owns(int accountNumber) const {
+        return find(loggedIn.begin(), loggedIn.end(), accountNumber) != loggedIn.end();
+    }
+};
+
+BankServer::BankServer(Bank& bank, Journal* journal, uint16_t port, unsigned count) : bank(bank), journal(journal) {
+    for (unsigned k = 0; k < max(1u, count); ++k) {
+        unique_ptr<Loop> loop(new Loop());
+        loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+        loop->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        loops.push_back(move(loop));
+        Loop& added = *loops.back();
+        if (added.epoll < 0 || added.wake < 0) {
+            throw runtime_error("Cannot create event loop: " + string(strerror(errno)));
+        }
+        // The first listener settles the port when it was 0; the rest share it
+        added.listener = listenOn(boundPort ? boundPort : port);
+        if (!boundPort) {
+            sockaddr_in address;
+            socklen_t length = sizeof(address);
+            getsockname(added.listener, reinterpret_cast<sockaddr*>(&address), &length);
+            boundPort = ntohs(address.sin_port);
+        }
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = &listenerMark;
+        epoll_ctl(added.epoll, EPOLL_CTL_ADD, added.listener, &event);
+        event.data.ptr = &wakeMark;
+        epoll_ctl(added.epoll, EPOLL_CTL_ADD, added.wake, &event);
+    }
+}
+
+BankServer::~BankServer() {
+    stop();
+    for (auto& loop : loops) {
+        if (loop->worker.joinable()) loop->worker.join();
+        if (loop->listener >= 0) close(loop->listener);
+        if (loop->wake >= 0) close(loop->wake);
+        if (loop->epoll >= 0) close(loop->epoll);
+    }
+}
+
+uint16_t BankServer::port() const {
+    return boundPort;
+}
+
+void BankServer::run() {
+    for (size_t k = 1; k < loops.size(); ++k) {
+        Loop& loop = *loops[k];
+        loop.worker = thread([this, &loop] { serve(loop); });
+    }
+    serve(*loops[0]);
+    for (size_t k = 1; k < loops.size(); ++k) {
+        if (loops[k]->worker.joinable()) loops[k]->worker.join();
+    }
+}
+
+void BankServer::stop() {
+    stopping = true;
+    for (auto& loop : loops) {
+        uint64_t one = 1;
+        if (write(loop->wake, &one, sizeof(one)) < 0) {
+            // Already signalled: the counter is saturated, which is just as good
+        }
+    }
+}
+
+void BankServer::serve(Loop& loop) {
+    vector<Connection*> ready;
+    epoll_event events[MAX_EVENTS];
+    while (!stopping) {
+        int count = epoll_wait(loop.epoll, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error("epoll_wait failed: " + string(strerror(errno)));
+        }
+        bool changed = false;
+        ready.clear();
+        for (int i = 0; i < count; ++i) {
+            void* mark = events[i].data.ptr;
+            if (mark == &listenerMark) {
+                accept(loop);
+                continue;
+            }
+            if (mark == &wakeMark) {
+                continue;
+            }
+            Connection& connection = *static_cast<Connection*>(mark);
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                char chunk[READ_CHUNK];
+                while (!connection.closing) {
+                    ssize_t n = read(connection.fd, chunk, sizeof(chunk));
+                    if (n > 0) {
+                        connection.in.insert(connection.in.end(), chunk, chunk + n);
+                        if (static_cast<size_t>(n) < sizeof(chunk)) break;
+                    } else if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+                        break;
+                    } else {
+                        connection.closing = true; // EOF or a reset
+                    }
+                }
+                changed |= process(connection);
+            }
+            ready.push_back(&connection);
+        }
+        // One journal wait for everything applied this round, then the replies
+        if (changed) {
+            commit();
+        }
+        for (Connection* connection : ready) {
+            if (!flush(*connection) || (connection->closing && connection->out.empty())) {
+                drop(loop, *connection);
+            } else {
+                watch(loop, *connection);
+            }
+        }
+    }
+    for (auto& connection : loop.connections) {
+        if (connection) close(connection->fd);
+    }
+    loop.connections.clear();
+}
+
+void BankServer::accept(Loop& loop) {
+    for (;;) {
+        int fd = accept4(loop.listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return; // EAGAIN once the backlog is empty; anything else is retried on the next event
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if (loop.connections.size() <= static_cast<size_t>(fd)) {
+            loop.connections.resize(fd + 1);
+        }
+        loop.connections[fd].reset(new Connection());
+        Connection& connection = *loop.connections[fd];
+        connection.fd = fd;
+        connection.events = EPOLLIN;
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = &connection;
+        epoll_ctl(loop.epoll, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void BankServer::drop(Loop& loop, Connection& connection) {
+    int fd = connection.fd;
+    epoll_ctl(loop.epoll, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    loop.connections[fd].reset();
+}
+
+void BankServer::watch(Loop& loop, Connection& connection) {
+    size_t pending = connection.out.size() - connection.outSent;
+    uint32_t events = (pending < OUTPUT_LIMIT && !connection.closing ? uint32_t(EPOLLIN) : 0) | (pending ? uint32_t(EPOLLOUT) : 0);
+    if (events != connection.events) {
+        epoll_event event;
+        event.events = events;
+        event.data.ptr = &connection;
+        epoll_ctl(loop.epoll, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.events = events;
+    }
+}
+
+bool BankServer::flush(Connection& connection) {
+    while (connection.outSent < connection.out.size()) {
+        ssize_t n = send(connection.fd, connection.out.data() + connection.outSent, connection.out.size() - connection.outSent,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN; // The socket is full; EPOLLOUT resumes
+        }
+        connection.outSent += n;
+    }
+    connection.out.clear();
+    connection.outSent = 0;
+    return true;
+}
+
+bool BankServer::process(Connection& connection) {
+    bool changed = false;
+    size_t at = 0;
+    vector<char>& in = connection.in;
+    while (in.size() - at >= 4) {
+        uint32_t length = Reader(&in[at], 4).u32();
+        if (length == 0 || length > MAX_FRAME) {
+            // The stream cannot be resynchronised after a bad length
+            reply(connection.out, 0, static_cast<uint8_t>(WireError::Malformed), 0);
+            connection.closing = true;
+            at = in.size();
+            break;
+        }
+        if (in.size() - at - 4 < length) {
+            break;
+        }
+        changed |= handle(connection, &in[at + 4], length);
+        at += 4 + length;
+    }
+    in.erase(in.begin(), in.begin() + at);
+    return changed;
+}
+
+bool BankServer::handle(Connection& connection, const char* body, size_t length) {
+    Reader reader(body, length);
+    uint8_t op = reader.u8();
+    uint32_t tag = reader.u32();
+    int account = 0, counterparty = 0;
+    int64_t amount = 0;
+    uint8_t withATM = 0;
+    string name, phone, password;
+    vector<Posting> legs;
+    bool known = true;
+    switch (static_cast<WireOp>(op)) {
+        case WireOp::Login:
+            account = reader.i32();
+            password = reader.str();
+            break;
+        case WireOp::Open:
+            withATM = reader.u8();
+            name = reader.str();
+            phone = reader.str();
+            password = reader.str();
+            break;
+        case WireOp::Close:
+        case WireOp::Balance:
+            account = reader.i32();
+            break;
+        case WireOp::Deposit:
+        case WireOp::Withdraw:
+            account = reader.i32();
+            amount = reader.i64();
+            break;
+        case WireOp::Transfer:
+            account = reader.i32();
+            counterparty = reader.i32();
+            amount = reader.i64();
+            break;
+        case WireOp::CardWithdraw:
+            account = reader.i32(); // The card number
+            password = reader.str(); // The PIN
+            amount = reader.i64();
+            break;
+        case WireOp::Post: {
+            name = reader.str(); // The idempotency key
+            uint16_t count = reader.u16();
+            legs.reserve(count);
+            for (uint16_t i = 0; i < count; ++i) {
+                int legAccount = reader.i32();
+                legs.push_back(Posting{legAccount, Money::fromMinor(reader.i64())});
+            }
+            break;
+        }
+        default:
+            known = false;
+            break;
+    }
+    if (!known || !reader.complete()) {
+        reply(connection.out, tag, static_cast<uint8_t>(WireError::Malformed), 0);
+        return false;
+    }
+    bool needsLogin = op == uint8_t(WireOp::Close) || op == uint8_t(WireOp::Withdraw) || op == uint8_t(WireOp::Transfer) ||
+                      op == uint8_t(WireOp::Balance);
+    bool allowed = !needsLogin || connection.owns(account);
+    for (const Posting& leg : legs) {
+        allowed &= !(leg.amount < Money()) || connection.owns(leg.account);
+    }
+    if (!allowed) {
+        reply(connection.out, tag, static_cast<uint8_t>(WireError::NotLoggedIn), 0);
+        return false;
+    }
+
+    TxResult result = TxResult::Ok;
+    Money value;
+    int opened = 0;
+    int card = 0;
+    string pin;
+    bool changed = false;
+    switch (static_cast<WireOp>(op)) {
+        case WireOp::Login:
+            result = bank.authenticate(account, password);
+            if (result == TxResult::Ok && !connection.owns(account)) connection.loggedIn.push_back(account);
+            break;
+        case WireOp::Open:
+            result = bank.open(name, phone, password, withATM != 0, opened, &pin); // Waits for its own record
+            if (result == TxResult::Ok) {
+                connection.loggedIn.push_back(opened);
+                Account account;
+                if (withATM && bank.getAccount(opened, account) == TxResult::Ok) card = account.getAtmCardNumber();
+            }
+            value = Money::fromMinor(opened);
+            break;
+        case WireOp::Close:
+            result = bank.close(account, Commit::Defer);
+            if (result == TxResult::Ok) connection.loggedIn.erase(find(connection.loggedIn.begin(), connection.loggedIn.end(), account));
+            changed = true;
+            break;
+        case WireOp::Deposit:
+            result = bank.deposit(account, Money::fromMinor(amount), &value, Commit::Defer);
+            changed = true;
+            break;
+        case WireOp::Withdraw:
+            result = bank.withdraw(account, Money::fromMinor(amount), &value, Commit::Defer);
+            changed = true;
+            break;
+        case WireOp::Transfer:
+            result = bank.transfer(account, counterparty, Money::fromMinor(amount), Commit::Defer);
+            changed = true;
+            break;
+        case WireOp::Balance:
+            result = bank.balance(account, value);
+            break;
+        case WireOp::CardWithdraw:
+            result = bank.cardWithdraw(account, password, Money::fromMinor(amount), &value, Commit::Defer);
+            changed = true;
+            break;
+        case WireOp::Post: {
+            bool duplicate = false;
+            result = bank.post(name, legs, Commit::Defer, &duplicate);
+            value = Money::fromMinor(duplicate ? 1 : 0);
+            changed = true; // A duplicate still waits for the original's record
+            break;
+        }
+    }
+    if (result != TxResult::Ok) {
+        reply(connection.out, tag, static_cast<uint8_t>(result), 0);
+    } else {
+        reply(connection.out, tag, static_cast<uint8_t>(result), value.minorUnits(), card, pin);
+    }
+    return changed && result == TxResult::Ok;
+}
+
+void BankServer::commit() {
+    if (journal && journal->durability() == Journal::Durability::Sync) {
+        journal->sync();
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "project.h"
+
+using namespace std;
+
+// Wire protocol. Every message is a frame: a u32 length (of what follows,
+// at most MAX_FRAME bytes), then the body. Integers are little-endian;
+// strings are a u16 length and the bytes.
+//
+// Request body: u8 op, u32 tag (echoed back), then per op
+//   Login     i32 account, str password
+//   Open      u8 withATM, str name, str phone, str password
+//   Close     i32 account
+//   Deposit   i32 account, i64 amount (minor units)
+//   Withdraw  i32 account, i64 amount
+//   Transfer  i32 from, i32 to, i64 amount
+//   Balance   i32 account
+//   Post      str idempotency key, u16 count, count x (i32 account, i64 amount)
+//   CardWithdraw i32 card, str PIN, i64 amount
+// Reply body: u32 tag, u8 status, i64 value. The status is a TxResult or a
+// WireError. The value is the new balance (Deposit, Withdraw,
+// CardWithdraw), the balance (Balance), the new account number (Open) or,
+// for Post, 1 if the key had already applied and the batch was not run
+// again; else 0. A successful Open with withATM set goes on with i32 card
+// number, str PIN: the PIN is drawn at open and sent only this once.
+//
+// Close, Withdraw, Balance, the sender of a Transfer and every account a
+// Post debits need a successful Login (or Open) for that account earlier on
+// the same connection. CardWithdraw needs none: the card and PIN are its
+// credentials.
+enum class WireOp : uint8_t {
+    Login = 1,
+    Open,
+    Close,
+    Deposit,
+    Withdraw,
+    Transfer,
+    Balance,
+    Post,
+    CardWithdraw
+};
+
+enum class WireError : uint8_t {
+    Malformed = 0x80, // Bad length, unknown op or a body that does not parse
+    NotLoggedIn
+};
+
+// Serves a Bank over TCP on 127.0.0.1 with epoll event loops.
+//
+// Each loop owns a SO_REUSEPORT listener, so the kernel spreads connections
+// over the loops, and runs every request of its connections itself: the
+// engine calls are short and thread-safe. Requests are pipelined: every
+// complete frame read from a connection is applied in order (with
+// Commit::Defer), the replies queue up, and once a round of ready
+// connections is done the loop waits for the journal once and then writes
+// each connection's replies with one send(). A reply is therefore never
+// sent before its change is durable, and concurrent clients share fsyncs.
+//
+// Login and Open run the password hash on the loop thread; a connection
+// logs in once and repeated logins hit the session cache.
+class BankServer {
+public:
+    static const size_t MAX_FRAME = 4096;
+
+    // Listen on `port` (0 picks a free one). Throws runtime_error if the
+    // socket cannot be set up. With a journal in Sync mode, replies wait for it.
+    BankServer(Bank& bank, Journal* journal, uint16_t port = 0, unsigned loops = 1);
+    ~BankServer();
+
+    BankServer(const BankServer&) = delete;
+    BankServer& operator=(const BankServer&) = delete;
+
+    uint16_t port() const;
+    void run();  // Serve until stop(): loop 0 on the calling thread, the rest on their own
+    void stop(); // Safe from any thread, signal handlers excepted
+
+private:
+    struct Connection;
+    struct Loop {
+        int epoll = -1;
+        int listener = -1;
+        int wake = -1; // eventfd written by stop()
+        thread worker;
+        vector<unique_ptr<Connection>> connections; // Indexed by fd
+    };
+
+    Bank& bank;
+    Journal* journal;
+    uint16_t boundPort = 0;
+    vector<unique_ptr<Loop>> loops;
+    atomic<bool> stopping{false};
+
+    void serve(Loop& loop);
+    void accept(Loop& loop);
+    // Apply every complete frame buffered on the connection; returns true if
+    // any of them changed the book
+    bool process(Connection& connection);
+    bool handle(Connection& connection, const char* body, size_t length);
+    bool flush(Connection& connection); // false once the connection is broken
+    void watch(Loop& loop, Connection& connection); // Read unless replies back up; write while any are pending
+    void drop(Loop& loop, Connection& connection);
+    void commit();
+};
@@ -0,0 +1,315 @@
+#include "shards.h"
+#include <functional>
+#include <stdexcept>
+#include <unordered_set>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+const int FIRST_ACCOUNT_NUMBER = 1000;
+const int WAIT_SPINS = 64; // Polls before sleeping: a hop to an idle worker often finishes in that time
+const uint64_t REFERENCE_COUNTER_BITS = 48; // Low bits of a reference; the high bits name the debiting shard
+
+long futex(atomic<uint32_t>* word, int op, uint32_t value) {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value, nullptr, nullptr, 0);
+}
+
+// Cores this process may run on, so workers are pinned inside its cpuset
+vector<int> usableCpus() {
+    vector<int> cpus;
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+} // namespace
+
+void ShardedBank::Task::finish() {
+    done.store(1, memory_order_release);
+    futex(&done, FUTEX_WAKE_PRIVATE, 1);
+}
+
+void ShardedBank::Task::wait() {
+    for (int spin = 0; spin < WAIT_SPINS; ++spin) {
+        if (done.load(memory_order_acquire)) return;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    while (!done.load(memory_order_acquire)) {
+        futex(&done, FUTEX_WAIT_PRIVATE, 0);
+    }
+}
+
+ShardedBank::ShardedBank(unsigned count, bool pinWorkers) {
+    vector<int> cpus = usableCpus();
+    if (count == 0) {
+        count = max<unsigned>(1, static_cast<unsigned>(cpus.size()));
+    }
+    for (unsigned k = 0; k < count; ++k) {
+        shards.emplace_back(new Shard());
+        shards.back()->bank.setNumbering(FIRST_ACCOUNT_NUMBER + static_cast<int>(k), static_cast<int>(count));
+    }
+    for (unsigned k = 0; k < count; ++k) {
+        int cpu = pinWorkers && !cpus.empty() ? cpus[k % cpus.size()] : -1;
+        Shard& shard = *shards[k];
+        shard.worker = thread([this, &shard, cpu] { workerLoop(shard, cpu); });
+    }
+}
+
+ShardedBank::~ShardedBank() {
+    for (auto& shard : shards) {
+        {
+            lock_guard<mutex> guard(shard->lock);
+            shard->stopping = true;
+        }
+        shard->ready.notify_one();
+    }
+    for (auto& shard : shards) {
+        shard->worker.join();
+    }
+}
+
+void ShardedBank::workerLoop(Shard& shard, int cpu) {
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    vector<Task*> batch;
+    unique_lock<mutex> guard(shard.lock);
+    for (;;) {
+        shard.ready.wait(guard, [&shard] { return shard.stopping || !shard.queue.empty(); });
+        if (shard.queue.empty()) {
+            return;
+        }
+        // Take everything queued in one go; callers keep appending meanwhile
+        batch.swap(shard.queue);
+        guard.unlock();
+        for (Task* task : batch) {
+            try {
+                task->run(shard.bank);
+            } catch (...) {
+                task->error = current_exception();
+            }
+            task->finish(); // The caller may free the task from here on
+        }
+        batch.clear();
+        guard.lock();
+    }
+}
+
+void ShardedBank::submit(Shard& shard, Task& task) {
+    bool wake;
+    {
+        lock_guard<mutex> guard(shard.lock);
+        wake = shard.queue.empty();
+        shard.queue.push_back(&task);
+    }
+    // A non-empty queue means the worker is awake or about to look again
+    if (wake) shard.ready.notify_one();
+}
+
+template <typename Fn>
+TxResult ShardedBank::call(unsigned index, Fn fn) {
+    struct Call : Task {
+        Fn fn;
+        TxResult result = TxResult::Ok;
+        explicit Call(Fn fn) : fn(fn) {}
+        void run(Bank& bank) override { result = fn(bank); }
+    } task(fn);
+    submit(*shards[index], task);
+    task.wait();
+    if (task.error) {
+        rethrow_exception(task.error);
+    }
+    return task.result;
+}
+
+void ShardedBank::commit(Shard& shard) {
+    if (shard.journal && shard.journal->durability() == Journal::Durability::Sync) {
+        shard.journal->sync();
+    }
+}
+
+unsigned ShardedBank::shardCount() const {
+    return static_cast<unsigned>(shards.size());
+}
+
+unsigned ShardedBank::shardOf(int accountNumber) const {
+    if (accountNumber < FIRST_ACCOUNT_NUMBER) {
+        return shardCount();
+    }
+    return static_cast<unsigned>(accountNumber - FIRST_ACCOUNT_NUMBER) % shardCount();
+}
+
+unsigned ShardedBank::shardOfPhone(const string& phone) const {
+    return static_cast<unsigned>(hash<string>()(phone) % shards.size());
+}
+
+Bank& ShardedBank::shard(unsigned index) {
+    return shards.at(index)->bank;
+}
+
+size_t ShardedBank::recover(const string& directory, Journal::Durability durability) {
+    size_t replayed = 0;
+    vector<TransferLeg> legs, shardLegs;
+    for (unsigned k = 0; k < shardCount(); ++k) {
+        Shard& shard = *shards[k];
+        shard.journal.reset(new Journal(directory + "/shard-" + to_string(k) + ".journal", durability));
+        replayed += shard.bank.recover(*shard.journal);
+        shard.bank.takeReplayedLegs(shardLegs);
+        legs.insert(legs.end(), shardLegs.begin(), shardLegs.end());
+    }
+
+    unordered_set<uint64_t> credited;
+    for (const TransferLeg& leg : legs) {
+        if (!leg.debit) credited.insert(leg.reference);
+    }
+    for (const TransferLeg& leg : legs) {
+        if (!leg.debit) continue;
+        Shard& source = *shards[shardOf(leg.account)];
+        uint64_t counter = leg.reference & ((uint64_t(1) << REFERENCE_COUNTER_BITS) - 1);
+        if (source.nextReference <= counter) source.nextReference = counter + 1;
+        // The credit never reached disk, so the transfer was never acknowledged: undo the debit
+        if (!credited.count(leg.reference) &&
+            source.bank.creditLeg(leg.account, leg.counterparty, leg.amount, leg.reference) != TxResult::Ok) {
+            throw runtime_error("Cannot refund transfer " + to_string(leg.reference) + " to account " + to_string(leg.account));
+        }
+    }
+    return replayed;
+}
+
+TxResult ShardedBank::open(const string& name, const string& phone, const string& password, bool withATM, int& accountNumber) {
+    if (!Bank::isValidPhone(phone)) {
+        return TxResult::InvalidPhone;
+    }
+    if (!Bank::isStrongPassword(password)) {
+        return TxResult::WeakPassword;
+    }
+    // Hash on the caller's thread; a worker busy hashing would stall its whole shard
+    string passwordHash = hashPassword(password);
+    unsigned index = shardOfPhone(phone);
+    TxResult result = call(index, [&](Bank& bank) {
+        return bank.openHashed(name, phone, passwordHash, withATM, accountNumber, Commit::Defer);
+    });
+    if (result == TxResult::Ok) commit(*shards[index]);
+    return result;
+}
+
+int ShardedBank::addAccount(const string& name, const string& phone, const string& passwordHash, Money balance) {
+    return shards[shardOfPhone(phone)]->bank.addAccount(name, phone, passwordHash, balance);
+}
+
+TxResult ShardedBank::close(int accountNumber) {
+    unsigned index = shardOf(accountNumber);
+    if (index == shardCount()) {
+        return TxResult::AccountNotFound;
+    }
+    // No transfer out of this shard may be waiting to refund the account
+    unique_lock<shared_mutex> quiet(shards[index]->outgoing);
+    TxResult result = call(index, [&](Bank& bank) { return bank.close(accountNumber, Commit::Defer); });
+    if (result == TxResult::Ok) commit(*shards[index]);
+    return result;
+}
+
+TxResult ShardedBank::authenticate(int accountNumber, const string& password) const {
+    unsigned index = shardOf(accountNumber);
+    return index == shardCount() ? TxResult::AuthFailed : shards[index]->bank.authenticate(accountNumber, password);
+}
+
+TxResult ShardedBank::deposit(int accountNumber, Money amount, Money* newBalance) {
+    unsigned index = shardOf(accountNumber);
+    if (index == shardCount()) {
+        return TxResult::AccountNotFound;
+    }
+    TxResult result = call(index, [&](Bank& bank) { return bank.deposit(accountNumber, amount, newBalance, Commit::Defer); });
+    if (result == TxResult::Ok) commit(*shards[index]);
+    return result;
+}
+
+TxResult ShardedBank::withdraw(int accountNumber, Money amount, Money* newBalance) {
+    unsigned index = shardOf(accountNumber);
+    if (index == shardCount()) {
+        return TxResult::AccountNotFound;
+    }
+    TxResult result = call(index, [&](Bank& bank) { return bank.withdraw(accountNumber, amount, newBalance, Commit::Defer); });
+    if (result == TxResult::Ok) commit(*shards[index]);
+    return result;
+}
+
+TxResult ShardedBank::transfer(int fromAccountNumber, int toAccountNumber, Money amount) {
+    unsigned from = shardOf(fromAccountNumber);
+    unsigned to = shardOf(toAccountNumber);
+    if (from == shardCount() || to == shardCount()) {
+        return TxResult::AccountNotFound;
+    }
+    if (from == to) {
+        TxResult result = call(from, [&](Bank& bank) { return bank.transfer(fromAccountNumber, toAccountNumber, amount, Commit::Defer); });
+        if (result == TxResult::Ok) commit(*shards[from]);
+        return result;
+    }
+
+    Shard& source = *shards[from];
+    shared_lock<shared_mutex> inFlight(source.outgoing);
+    uint64_t reference = (uint64_t(from) << REFERENCE_COUNTER_BITS) | source.nextReference.fetch_add(1);
+    // Phase one: take the money out of the source account
+    TxResult result = call(from, [&](Bank& bank) {
+        return bank.debitLeg(fromAccountNumber, toAccountNumber, amount, reference, Commit::Defer);
+    });
+    if (result != TxResult::Ok) {
+        return result;
+    }
+    // Recovery refunds a debit without a credit, so the credit must never
+    // reach disk before its debit, whatever the durability mode
+    if (source.journal) source.journal->sync();
+
+    // Phase two: credit the destination, or put the money back
+    result = call(to, [&](Bank& bank) {
+        return bank.creditLeg(toAccountNumber, fromAccountNumber, amount, reference, Commit::Defer);
+    });
+    if (result == TxResult::Ok) {
+        commit(*shards[to]);
+        return result;
+    }
+    TxResult refund = call(from, [&](Bank& bank) {
+        return bank.creditLeg(fromAccountNumber, toAccountNumber, amount, reference, Commit::Defer);
+    });
+    if (refund != TxResult::Ok) {
+        throw logic_error("Refund of transfer " + to_string(reference) + " failed.");
+    }
+    commit(source);
+    return result;
+}
+
+TxResult ShardedBank::balance(int accountNumber, Money& balance) const {
+    unsigned index = shardOf(accountNumber);
+    return index == shardCount() ? TxResult::AccountNotFound : shards[index]->bank.balance(accountNumber, balance);
+}
+
+size_t ShardedBank::accountCount() const {
+    size_t count = 0;
+    for (const auto& shard : shards) count += shard->bank.accountCount();
+    return count;
+}
+
+Money ShardedBank::totalBalance() const {
+    // With no cross-shard transfer between its phases, every transfer is
+    // wholly inside one shard's own consistent total
+    vector<unique_lock<shared_mutex>> quiet;
+    for (const auto& shard : shards) quiet.emplace_back(shard->outgoing);
+    Money total;
+    for (const auto& shard : shards) total += shard->bank.totalBalance();
+    return total;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "project.h"
+
+using namespace std;
+
+// EXPERIMENT: the book partitioned by account number across N Banks
+// (shards), each owned by a worker thread pinned to one core and fed from
+// its own run queue. Nothing but bench/bench_shards uses it and it is not
+// part of bank_engine; the console and the server run on a single Bank. It
+// has shown no throughput gain over the striped Bank, which it trails by
+// an order of magnitude where every queue hop is a context switch.
+//
+// Shard k numbers its accounts 1000 + k, 1000 + k + N, ... so an account
+// number names its shard, and a new account goes to the shard picked by a
+// hash of its phone so the duplicate-phone check stays inside one shard.
+// Every change is queued to the owning shard and the caller waits for it;
+// the worker applies it with Commit::Defer and the caller then waits for the
+// shard's journal, so a worker never sits in an fsync and commits still
+// group. Reads (balance, authenticate) call the shard's Bank directly, which
+// is thread-safe on its own.
+//
+// A transfer inside one shard is a single Bank::transfer. Across shards it
+// runs in two phases: the source shard debits and that debit is made
+// durable, then the destination shard credits; if the credit is refused the
+// source shard refunds. Both legs carry one reference, and recovery refunds
+// any debit whose credit never reached disk. Such a transfer was never
+// acknowledged, so undoing it is always safe (presumed abort).
+class ShardedBank {
+public:
+    explicit ShardedBank(unsigned shards = 0, bool pinWorkers = true); // 0: one per usable core
+    ~ShardedBank();
+
+    ShardedBank(const ShardedBank&) = delete;
+    ShardedBank& operator=(const ShardedBank&) = delete;
+
+    // Replay and attach <directory>/shard-<k>.journal for every shard, then
+    // settle cross-shard transfers left half done. Only on an empty book.
+    // Returns the number of records replayed.
+    size_t recover(const string& directory, Journal::Durability durability = Journal::Durability::Sync);
+
+    TxResult open(const string& name, const string& phone, const string& password, bool withATM, int& accountNumber);
+    // Bulk load without validation, straight into the owning shard; see Bank::addAccount
+    int addAccount(const string& name, const string& phone, const string& passwordHash, Money balance);
+    TxResult close(int accountNumber);
+    TxResult authenticate(int accountNumber, const string& password) const;
+
+    TxResult deposit(int accountNumber, Money amount, Money* newBalance = nullptr);
+    TxResult withdraw(int accountNumber, Money amount, Money* newBalance = nullptr);
+    TxResult transfer(int fromAccountNumber, int toAccountNumber, Money amount);
+    TxResult balance(int accountNumber, Money& balance) const;
+
+    size_t accountCount() const;
+    // Consistent, but stops the world: it holds every shard's `outgoing`
+    // exclusively, so no cross-shard transfer starts until it returns. For
+    // audits, not a live path.
+    Money totalBalance() const;
+
+    unsigned shardCount() const;
+    unsigned shardOf(int accountNumber) const; // shardCount() for a number no shard issues
+    Bank& shard(unsigned index);
+
+private:
+    // A queued operation. The caller owns it (on its stack) and sleeps on
+    // `done` with a futex until the worker has run it.
+    struct Task {
+        atomic<uint32_t> done{0};
+        exception_ptr error;
+
+        virtual ~Task() {}
+        virtual void run(Bank& bank) = 0;
+        void finish();
+        void wait();
+    };
+
+    struct alignas(64) Shard {
+        Bank bank;
+        unique_ptr<Journal> journal;
+        mutex lock;
+        condition_variable ready;
+        vector<Task*> queue;
+        bool stopping = false;
+        thread worker;
+        // Shared by every cross-shard transfer out of this shard while it is
+        // in flight; exclusive for totals and for closing one of its accounts
+        mutable shared_mutex outgoing;
+        atomic<uint64_t> nextReference{1};
+    };
+
+    vector<unique_ptr<Shard>> shards;
+
+    template <typename Fn>
+    TxResult call(unsigned index, Fn fn);
+    void submit(Shard& shard, Task& task);
+    void workerLoop(Shard& shard, int cpu);
+    void commit(Shard& shard); // Wait, as Commit::Wait would, for what the shard applied so far
+    unsigned shardOfPhone(const string& phone) const;
+};
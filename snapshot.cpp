@@ -0,0 +1,198 @@
+#include "snapshot.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "journal.h"
+#include "project.h"
+
+using namespace std;
+
+namespace {
+
+uint32_t headerCrc(SnapshotHeader header) {
+    header.headerCrc = 0;
+    return crc32(&header, sizeof(header));
+}
+
+void writeAll(int fd, const void* data, size_t size, const string& path) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error("Cannot write snapshot " + path + ": " + strerror(errno));
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+}
+
+void checkHeapRange(const SnapshotHeader& header, uint64_t offset, uint16_t length) {
+    if (offset + length > header.heapBytes) {
+        throw runtime_error("Snapshot record points outside the string heap.");
+    }
+}
+
+} // namespace
+
+// SnapshotWriter class methods implementation
+void SnapshotWriter::add(const AccountRow& account, Money balance) {
+    if (heap.size() + account.name.size() + account.passwordHash.size() > SNAPSHOT_MAX_HEAP_BYTES) {
+        throw runtime_error("Snapshot string heap would exceed 1 TiB; the book is too large to snapshot.");
+    }
+    SnapshotRecord r;
+    memset(&r, 0, sizeof(r));
+    r.balance = balance.minorUnits();
+    r.accountNumber = account.accountNumber;
+    r.atmCardNumber = account.atmCardNumber;
+    r.atmPin = account.atmPin;
+    r.nameOffset = static_cast<uint32_t>(heap.size());
+    r.nameOffsetHigh = static_cast<uint8_t>(static_cast<uint64_t>(heap.size()) >> 32);
+    r.nameLength = static_cast<uint16_t>(min<size_t>(account.name.size(), UINT16_MAX));
+    heap.append(account.name.data(), r.nameLength);
+    r.passwordOffset = static_cast<uint32_t>(heap.size());
+    r.passwordOffsetHigh = static_cast<uint8_t>(static_cast<uint64_t>(heap.size()) >> 32);
+    r.passwordLength = static_cast<uint16_t>(min<size_t>(account.passwordHash.size(), UINT16_MAX));
+    heap.append(account.passwordHash.data(), r.passwordLength);
+    memcpy(r.phone, account.phone.digits, sizeof(r.phone));
+    r.hasATM = account.hasATM;
+    records.push_back(r);
+}
+
+void SnapshotWriter::write(const string& path, uint64_t journalLsn, uint64_t journalOffset, int nextAccountNumber) const {
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.recordBytes = sizeof(SnapshotRecord);
+    header.recordCount = records.size();
+    header.heapBytes = heap.size();
+    header.journalLsn = journalLsn;
+    header.journalOffset = journalOffset;
+    header.nextAccountNumber = nextAccountNumber;
+    header.headerCrc = headerCrc(header);
+
+    string temp = path + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw runtime_error("Cannot create snapshot " + temp + ": " + strerror(errno));
+    }
+    try {
+        writeAll(fd, &header, sizeof(header), temp);
+        writeAll(fd, records.data(), records.size() * sizeof(SnapshotRecord), temp);
+        writeAll(fd, heap.data(), heap.size(), temp);
+        uint64_t keyCount = keys.size();
+        writeAll(fd, &keyCount, sizeof(keyCount), temp);
+        writeAll(fd, keys.data(), keys.size() * sizeof(uint64_t), temp);
+        if (::fsync(fd) != 0) {
+            throw runtime_error("Cannot sync snapshot " + temp + ": " + strerror(errno));
+        }
+    } catch (...) {
+        ::close(fd);
+        ::unlink(temp.c_str());
+        throw;
+    }
+    ::close(fd);
+    // Readers see either the old snapshot or the complete new one
+    if (::rename(temp.c_str(), path.c_str()) != 0) {
+        throw runtime_error("Cannot publish snapshot " + path + ": " + strerror(errno));
+    }
+}
+
+void SnapshotWriter::setKeys(vector<uint64_t> keys) {
+    this->keys = move(keys);
+}
+
+size_t SnapshotWriter::size() const { return records.size(); }
+
+// SnapshotView class methods implementation
+SnapshotView::SnapshotView(const string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("Cannot open snapshot " + path + ": " + strerror(errno));
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        throw runtime_error("Snapshot " + path + " is truncated.");
+    }
+    length = static_cast<size_t>(st.st_size);
+    void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        throw runtime_error("Cannot map snapshot " + path + ": " + strerror(errno));
+    }
+    base = static_cast<const char*>(mapped);
+
+    const SnapshotHeader& h = header();
+    bool valid = memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) == 0 && (h.version >= 1 && h.version <= SNAPSHOT_VERSION) &&
+                 h.recordBytes == sizeof(SnapshotRecord) && h.headerCrc == headerCrc(h) &&
+                 h.recordCount <= length / sizeof(SnapshotRecord) && h.heapBytes <= length;
+    uint64_t body = valid ? sizeof(SnapshotHeader) + h.recordCount * sizeof(SnapshotRecord) + h.heapBytes : 0;
+    if (valid && h.version == 1) {
+        valid = length == body;
+    } else if (valid) {
+        uint64_t keyCount = 0;
+        valid = length >= body + sizeof(keyCount);
+        if (valid) {
+            memcpy(&keyCount, base + body, sizeof(keyCount));
+            valid = keyCount <= (length - body) / sizeof(uint64_t) && length == body + sizeof(keyCount) + keyCount * sizeof(uint64_t);
+            keys = base + body;
+        }
+    }
+    if (!valid) {
+        ::munmap(const_cast<char*>(base), length);
+        throw runtime_error("Snapshot " + path + " is not a valid version 1-" + to_string(SNAPSHOT_VERSION) + " snapshot.");
+    }
+    records = reinterpret_cast<const SnapshotRecord*>(base + sizeof(SnapshotHeader));
+    heap = base + sizeof(SnapshotHeader) + h.recordCount * sizeof(SnapshotRecord);
+    ::madvise(const_cast<char*>(base), length, MADV_SEQUENTIAL);
+}
+
+SnapshotView::~SnapshotView() {
+    ::munmap(const_cast<char*>(base), length);
+}
+
+const SnapshotHeader& SnapshotView::header() const {
+    return *reinterpret_cast<const SnapshotHeader*>(base);
+}
+
+size_t SnapshotView::size() const { return header().recordCount; }
+const SnapshotRecord& SnapshotView::record(size_t i) const { return records[i]; }
+
+string_view SnapshotView::name(const SnapshotRecord& record) const {
+    checkHeapRange(header(), record.nameStart(), record.nameLength);
+    return string_view(heap + record.nameStart(), record.nameLength);
+}
+
+string_view SnapshotView::phone(const SnapshotRecord& record) const {
+    return string_view(record.phone, sizeof(record.phone));
+}
+
+string_view SnapshotView::passwordHash(const SnapshotRecord& record) const {
+    checkHeapRange(header(), record.passwordStart(), record.passwordLength);
+    return string_view(heap + record.passwordStart(), record.passwordLength);
+}
+
+size_t SnapshotView::keyCount() const {
+    uint64_t count = 0;
+    if (keys) memcpy(&count, keys, sizeof(count));
+    return static_cast<size_t>(count);
+}
+
+uint64_t SnapshotView::key(size_t i) const {
+    uint64_t key;
+    memcpy(&key, keys + sizeof(uint64_t) * (i + 1), sizeof(key));
+    return key;
+}
+
+bool SnapshotView::exists(const string& path) {
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0;
+}
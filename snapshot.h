@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "money.h"
+
+using namespace std;
+
+struct AccountRow;
+
+// Versioned binary snapshot of the account book.
+//
+// Layout: a fixed header, then one fixed-width SnapshotRecord per account,
+// then a string heap holding names and password hashes, then (version 2) a
+// u64 count and that many u64 idempotency keys of applied batches. Every
+// field sits at a fixed offset, so a mapped file is used in place: there is
+// no per-record parsing, only pointer arithmetic.
+//
+// Heap offsets are 40 bits (version 3 keeps the high byte in what was
+// reserved), so the heap holds up to 1 TiB: some ten billion accounts at
+// about 100 bytes of name and scrypt hash each. SnapshotWriter refuses a
+// larger book. Versions 1 and 2 still load; their high bytes are zero.
+const char SNAPSHOT_MAGIC[8] = {'B', 'A', 'N', 'K', 'S', 'N', 'A', 'P'};
+const uint32_t SNAPSHOT_VERSION = 3;
+const uint64_t SNAPSHOT_MAX_HEAP_BYTES = uint64_t(1) << 40;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordBytes;      // sizeof(SnapshotRecord) when written
+    uint64_t recordCount;
+    uint64_t heapBytes;
+    uint64_t journalLsn;       // Last journal record reflected in the snapshot
+    uint64_t journalOffset;    // Journal file offset just past that record
+    int32_t nextAccountNumber;
+    uint32_t headerCrc;        // crc32 of the header with this field zeroed
+};
+
+struct SnapshotRecord {
+    int64_t balance;           // Minor units
+    int32_t accountNumber;
+    int32_t atmCardNumber;
+    int32_t atmPin;
+    uint32_t nameOffset;       // Into the string heap, low 32 bits
+    uint32_t passwordOffset;
+    uint16_t nameLength;
+    uint16_t passwordLength;
+    char phone[10];            // Always exactly 10 digits
+    uint8_t hasATM;
+    uint8_t nameOffsetHigh;    // Bits 32-39 of the offsets; zero before version 3
+    uint8_t passwordOffsetHigh;
+    uint8_t reserved[3];
+
+    uint64_t nameStart() const { return uint64_t(nameOffsetHigh) << 32 | nameOffset; }
+    uint64_t passwordStart() const { return uint64_t(passwordOffsetHigh) << 32 | passwordOffset; }
+};
+
+static_assert(sizeof(SnapshotHeader) == 56, "Snapshot header layout is part of the file format");
+static_assert(sizeof(SnapshotRecord) == 48, "Snapshot record layout is part of the file format");
+
+// Builds a snapshot in memory and writes it atomically (temp file, fsync, rename)
+class SnapshotWriter {
+public:
+    void add(const AccountRow& account, Money balance);
+    void setKeys(vector<uint64_t> keys);
+    void write(const string& path, uint64_t journalLsn, uint64_t journalOffset, int nextAccountNumber) const;
+    size_t size() const;
+
+private:
+    vector<SnapshotRecord> records;
+    string heap;
+    vector<uint64_t> keys;
+};
+
+// Read-only mmap of a snapshot file
+class SnapshotView {
+public:
+    explicit SnapshotView(const string& path); // Throws runtime_error if missing or malformed
+    ~SnapshotView();
+    SnapshotView(const SnapshotView&) = delete;
+    SnapshotView& operator=(const SnapshotView&) = delete;
+
+    const SnapshotHeader& header() const;
+    size_t size() const;
+    const SnapshotRecord& record(size_t i) const;
+    // Views into the mapping, valid while this view lives
+    string_view name(const SnapshotRecord& record) const;
+    string_view phone(const SnapshotRecord& record) const;
+    string_view passwordHash(const SnapshotRecord& record) const;
+    size_t keyCount() const;
+    uint64_t key(size_t i) const;
+
+    static bool exists(const string& path);
+
+private:
+    const char* base = nullptr;
+    size_t length = 0;
+    const SnapshotRecord* records = nullptr;
+    const char* heap = nullptr;
+    const char* keys = nullptr; // Count, then the keys; null in version 1
+};
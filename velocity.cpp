@@ -0,0 +1,203 @@
+#include "velocity.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "money.h"
+
+using namespace std;
+
+namespace {
+
+constexpr int64_t WINDOW_SECONDS[VELOCITY_WINDOWS] = {60, 3600, 86400};
+
+// Amount and count slots of each window
+constexpr uint8_t AMOUNT_SLOT[VELOCITY_WINDOWS] = {1, 2, 3};
+constexpr uint8_t COUNT_SLOT[VELOCITY_WINDOWS] = {4, 5, 6};
+
+// One window at a time with its width a constant, so rolling and the
+// estimates compile to multiplications instead of divisions
+template <size_t W>
+void windowValues(WindowCounter& counter, int64_t now, int64_t* values) {
+    counter.roll(now, WINDOW_SECONDS[W]);
+    values[AMOUNT_SLOT[W]] = counter.amountAt(now, WINDOW_SECONDS[W]);
+    values[COUNT_SLOT[W]] = static_cast<int64_t>(counter.countAt(now, WINDOW_SECONDS[W]));
+}
+
+template <size_t W>
+void countOutflow(WindowCounter& counter, int64_t amount, int64_t now) {
+    counter.roll(now, WINDOW_SECONDS[W]);
+    ++counter.count;
+    counter.amount += amount;
+}
+
+uint8_t parseKinds(const string& text) {
+    uint8_t kinds = 0;
+    stringstream in(text);
+    string kind;
+    while (getline(in, kind, ',')) {
+        if (kind == "withdraw") kinds |= VelocityWithdraw;
+        else if (kind == "transfer") kinds |= VelocityTransfer;
+        else if (kind == "post") kinds |= VelocityPost;
+        else if (kind == "any") kinds |= VelocityWithdraw | VelocityTransfer | VelocityPost;
+        else return 0;
+    }
+    return kinds;
+}
+
+} // namespace
+
+// VelocityTable class methods implementation
+VelocityCounters& VelocityTable::at(int accountNumber) {
+    size_t position = index.find(static_cast<uint64_t>(accountNumber));
+    if (position != FlatIndex::npos) {
+        return counters[position];
+    }
+    index.insert(static_cast<uint64_t>(accountNumber), counters.size());
+    counters.emplace_back();
+    owners.push_back(accountNumber);
+    return counters.back();
+}
+
+void VelocityTable::erase(int accountNumber) {
+    size_t position = index.find(static_cast<uint64_t>(accountNumber));
+    if (position == FlatIndex::npos) {
+        return;
+    }
+    // Move the last entry into the hole
+    index.erase(static_cast<uint64_t>(accountNumber));
+    if (position != counters.size() - 1) {
+        counters[position] = counters.back();
+        owners[position] = owners.back();
+        index.insert(static_cast<uint64_t>(owners[position]), position);
+    }
+    counters.pop_back();
+    owners.pop_back();
+}
+
+void VelocityTable::resetWindows(uint16_t windows) {
+    for (VelocityCounters& entry : counters) {
+        for (size_t k = 0; k < VELOCITY_KINDS; ++k) {
+            for (size_t w = 0; w < VELOCITY_WINDOWS; ++w) {
+                if (windows >> (VELOCITY_WINDOWS * k + w) & 1) entry.windows[k][w] = WindowCounter();
+            }
+        }
+    }
+}
+
+// VelocityRules class methods implementation
+VelocityRules VelocityRules::parse(istream& in) {
+    VelocityRules rules;
+    string line;
+    for (size_t number = 1; getline(in, line); ++number) {
+        line = line.substr(0, line.find('#'));
+        stringstream fields(line);
+        string name, kinds, window, measure, limit, extra;
+        if (!(fields >> name)) continue; // Blank or comment
+        auto fail = [&](const string& why) {
+            return invalid_argument("Velocity rules line " + to_string(number) + ": " + why);
+        };
+        if (!(fields >> kinds >> window >> measure >> limit) || (fields >> extra)) {
+            throw fail("expected <name> <applies to> <window> <measure> <limit>");
+        }
+        uint8_t kindMask = parseKinds(kinds);
+        if (kindMask == 0) {
+            throw fail("unknown outflow in \"" + kinds + "\"; use withdraw, transfer, post or any");
+        }
+        int windowIndex = window == "minute" ? 0 : window == "hour" ? 1 : window == "day" ? 2 : -1;
+        uint8_t slot;
+        int64_t value;
+        if (measure == "single") {
+            if (window != "-") throw fail("the single measure takes no window; write -");
+            slot = Single;
+        } else if (windowIndex < 0) {
+            throw fail("unknown window \"" + window + "\"; use minute, hour or day");
+        } else if (measure == "amount") {
+            slot = AMOUNT_SLOT[windowIndex];
+        } else if (measure == "count") {
+            slot = COUNT_SLOT[windowIndex];
+        } else {
+            throw fail("unknown measure \"" + measure + "\"; use amount, count or single");
+        }
+        try {
+            value = slot >= CountMinute ? static_cast<int64_t>(stoull(limit)) : Money::parse(limit).minorUnits();
+        } catch (const exception&) {
+            throw fail("bad limit \"" + limit + "\"");
+        }
+        if (value < 0) throw fail("limits cannot be negative");
+        if (rules.names.size() == UINT16_MAX) throw fail("too many rules");
+        rules.names.push_back(name);
+        rules.kinds.push_back(kindMask);
+        rules.slots.push_back(slot);
+        rules.limits.push_back(value);
+    }
+    rules.compile();
+    return rules;
+}
+
+VelocityRules VelocityRules::load(const string& path) {
+    ifstream in(path);
+    if (!in) {
+        throw runtime_error("Cannot open velocity rules " + path + ".");
+    }
+    return parse(in);
+}
+
+void VelocityRules::compile() {
+    for (vector<Compiled>& table : tables) table.clear();
+    windowsUsed = 0;
+    for (size_t rule = 0; rule < names.size(); ++rule) {
+        for (uint8_t kind = 1; kind < 8; ++kind) {
+            if (kinds[rule] & kind) tables[kind].push_back(Compiled{slots[rule], kinds[rule], static_cast<uint16_t>(rule), limits[rule]});
+        }
+        for (size_t w = 0; w < VELOCITY_WINDOWS; ++w) {
+            if (slots[rule] != AMOUNT_SLOT[w] && slots[rule] != COUNT_SLOT[w]) continue;
+            for (size_t k = 0; k < VELOCITY_KINDS; ++k) {
+                if (kinds[rule] >> k & 1) windowsUsed |= 1 << (VELOCITY_WINDOWS * k + w);
+            }
+        }
+    }
+    blocks.reset(new atomic<uint64_t>[names.size()]());
+}
+
+int VelocityRules::check(VelocityCounters& counters, VelocityKind kind, int64_t amount, int64_t now) const {
+    const vector<Compiled>& table = tables[kind];
+    if (table.empty()) {
+        return -1;
+    }
+    // Each kept window of each kind, rolled to `now`
+    int64_t byKind[VELOCITY_KINDS][SLOTS] = {};
+    for (size_t k = 0; k < VELOCITY_KINDS; ++k) {
+        unsigned kept = windowsUsed >> (VELOCITY_WINDOWS * k);
+        if (kept & 1) windowValues<0>(counters.windows[k][0], now, byKind[k]);
+        if (kept & 2) windowValues<1>(counters.windows[k][1], now, byKind[k]);
+        if (kept & 4) windowValues<2>(counters.windows[k][2], now, byKind[k]);
+    }
+    // Then the values over every mix of kinds, the outflow added: each mask
+    // is the mask without its lowest kind plus that kind
+    int64_t values[8][SLOTS] = {{amount, amount, amount, amount, 1, 1, 1}};
+    for (uint8_t mask = 1; mask < 8; ++mask) {
+        const int64_t* rest = values[mask & (mask - 1)];
+        const int64_t* lowest = byKind[mask & 1 ? 0 : mask & 2 ? 1 : 2];
+        for (size_t slot = 0; slot < SLOTS; ++slot) values[mask][slot] = rest[slot] + lowest[slot];
+    }
+    for (const Compiled& rule : table) {
+        if (values[rule.kinds][rule.slot] > rule.limit) {
+            blocks[rule.rule].fetch_add(1, memory_order_relaxed);
+            return rule.rule;
+        }
+    }
+    return -1;
+}
+
+void VelocityRules::record(VelocityCounters& counters, VelocityKind kind, int64_t amount, int64_t now) const {
+    size_t k = velocityKindIndex(kind);
+    unsigned kept = windowsUsed >> (VELOCITY_WINDOWS * k);
+    if (kept & 1) countOutflow<0>(counters.windows[k][0], amount, now);
+    if (kept & 2) countOutflow<1>(counters.windows[k][1], amount, now);
+    if (kept & 4) countOutflow<2>(counters.windows[k][2], amount, now);
+}
+
+uint64_t VelocityRules::blocked(size_t rule) const {
+    return blocks[rule].load(memory_order_relaxed);
+}
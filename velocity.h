@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+#include "arena.h"
+
+using namespace std;
+
+// Outflows the velocity rules can apply to; a rule names any mix of them
+enum VelocityKind : uint8_t {
+    VelocityWithdraw = 1,
+    VelocityTransfer = 2, // The debit leg of a cross-shard transfer included
+    VelocityPost = 4      // Each debit of a batch posting
+};
+const size_t VELOCITY_KINDS = 3;
+
+// Position of a kind among the VELOCITY_KINDS, for per-kind arrays
+inline size_t velocityKindIndex(VelocityKind kind) {
+    return kind == VelocityWithdraw ? 0 : kind == VelocityTransfer ? 1 : 2;
+}
+
+enum class VelocityWindow : uint8_t { Minute, Hour, Day };
+const size_t VELOCITY_WINDOWS = 3;
+
+// Outflows of one account over one window, as a sliding-window estimate
+// from two fixed windows: the current one counts in full and the previous
+// one in proportion to how much of it the sliding window still covers.
+// O(1) to update and to read, and 32 bytes whatever the traffic.
+struct WindowCounter {
+    uint32_t window = 0;       // Index of the current fixed window (time / width)
+    uint32_t count = 0;
+    uint32_t previousCount = 0;
+    int64_t amount = 0;        // Minor units
+    int64_t previousAmount = 0;
+
+    // Inline so a caller passing a constant width gets no divisions
+    void roll(int64_t now, int64_t width) { // Move to the fixed window holding `now`
+        uint32_t current = static_cast<uint32_t>(now / width);
+        if (current <= window) {
+            return; // Same window, or a clock that stepped back: count it in the current one
+        }
+        bool adjacent = current == window + 1;
+        previousCount = adjacent ? count : 0;
+        previousAmount = adjacent ? amount : 0;
+        count = 0;
+        amount = 0;
+        window = current;
+    }
+    // The previous window's share is rounded up, so the estimate never lets
+    // through what an exact count would refuse for want of a fraction
+    uint64_t countAt(int64_t now, int64_t width) const {
+        int64_t remaining = width - now % width; // Of the previous window, still inside the sliding one
+        return count + (static_cast<uint64_t>(previousCount) * remaining + width - 1) / width;
+    }
+    int64_t amountAt(int64_t now, int64_t width) const {
+        int64_t remaining = width - now % width;
+        // previousAmount * remaining / width, split so the product cannot overflow
+        return amount + previousAmount / width * remaining + (previousAmount % width * remaining + width - 1) / width;
+    }
+};
+
+// Kept per kind of outflow, so a rule sums only the kinds it applies to
+struct VelocityCounters {
+    WindowCounter windows[VELOCITY_KINDS][VELOCITY_WINDOWS]; // By velocityKindIndex, then VelocityWindow
+};
+
+// Velocity counters of the accounts of one lock stripe, by account number.
+// Only accounts that have had an outflow since rules were loaded have one.
+class VelocityTable {
+public:
+    VelocityCounters& at(int accountNumber); // Created empty on first use
+    void erase(int accountNumber);
+    void resetWindows(uint16_t windows); // Empty the given windows (as VelocityRules::windows()) of every entry
+    size_t size() const { return counters.size(); }
+
+private:
+    FlatIndex index; // Account number -> position in counters
+    vector<VelocityCounters> counters;
+    vector<int> owners; // Account number of each entry, for erase
+};
+
+// Velocity and limit rules, compiled for the transaction path.
+//
+// A rules file has one rule per line; '#' starts a comment:
+//   <name> <applies to> <window> <measure> <limit>
+// applies to: withdraw, transfer, post or any, comma-separated
+// window:     minute, hour or day; "-" with the single measure
+// measure:    amount (total outflow in the window, this one included),
+//             count (outflows in the window, this one included) or
+//             single (this outflow alone)
+// limit:      the most allowed; an amount like 2000.00 or a count
+// Example:
+//   daily_cash      withdraw           day     amount  2000.00
+//   burst           withdraw,transfer  minute  count   10
+//   large_transfer  transfer           -       single  50000
+//
+// Loading compiles the rules into one flat table per kind of outflow, each
+// entry a value slot and a limit, so a check computes the few windowed
+// values the rules use and compares them down the table with no parsing,
+// lookups or branching on rule types. Counters are kept per kind of outflow
+// and a rule's windowed values sum the kinds it applies to, so a withdraw
+// rule never counts transfers. Only the windows of kinds some rule reads
+// are kept up to date.
+class VelocityRules {
+public:
+    // Throw invalid_argument naming the line of a malformed rule
+    static VelocityRules parse(istream& in);
+    static VelocityRules load(const string& path); // Also throws runtime_error if unreadable
+
+    // Roll the account's counters to `now` (seconds) and return the index of
+    // the first rule the outflow would break, or -1 if every rule allows it
+    int check(VelocityCounters& counters, VelocityKind kind, int64_t amount, int64_t now) const;
+    // Count an outflow that went through (or, in replay, went through at `now`)
+    void record(VelocityCounters& counters, VelocityKind kind, int64_t amount, int64_t now) const;
+    // Kept up to date, bit VELOCITY_WINDOWS * velocityKindIndex + VelocityWindow
+    uint16_t windows() const { return windowsUsed; }
+
+    size_t size() const { return names.size(); }
+    const string& name(size_t rule) const { return names[rule]; }
+    uint64_t blocked(size_t rule) const; // Outflows the rule has refused
+
+private:
+    // Value slots a compiled rule compares: this outflow's amount, then the
+    // amount and count over each window
+    enum Slot : uint8_t { Single, AmountMinute, AmountHour, AmountDay, CountMinute, CountHour, CountDay, SLOTS };
+    struct Compiled {
+        uint8_t slot;
+        uint8_t kinds; // VelocityKind mask whose counters the slot sums
+        uint16_t rule; // Index into names
+        int64_t limit;
+    };
+
+    vector<string> names;
+    vector<uint8_t> kinds;                 // Per rule, as parsed
+    vector<uint8_t> slots;
+    vector<int64_t> limits;
+    vector<Compiled> tables[8];            // By VelocityKind mask of the outflow
+    uint16_t windowsUsed = 0;              // As windows()
+    unique_ptr<atomic<uint64_t>[]> blocks; // Per rule
+
+    void compile();
+};